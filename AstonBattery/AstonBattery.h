@@ -30,6 +30,10 @@ Abstract:
 #define RESHUB_USE_HELPER_ROUTINES
 #include <reshub.h>
 #include "spb.h"
+#include "Public.h"
+#include "model.h"
+#include "archive.h"
+#include "counterset.h"
 
 //--------------------------------------------------------------------- Literals
 
@@ -78,6 +82,144 @@ Abstract:
 #define DEVICE_NAME_SIZE 0x8
 #define CHEM_SIZE 0x4
 
+//
+// Standard command addresses of the BQ28Z610 gauge, see sluua65e.
+//
+
+#define BQ28Z610_REG_AT_RATE_TIME_TO_EMPTY  0x04
+#define BQ28Z610_REG_TEMPERATURE            0x06
+#define BQ28Z610_REG_VOLTAGE                0x08
+#define BQ28Z610_REG_BATTERY_STATUS         0x0A
+#define BQ28Z610_REG_CURRENT                0x0C
+#define BQ28Z610_REG_REMAINING_CAPACITY     0x10
+#define BQ28Z610_REG_FULL_CHARGE_CAPACITY   0x12
+#define BQ28Z610_REG_CYCLE_COUNT            0x2A
+#define BQ28Z610_REG_STATE_OF_HEALTH        0x2E
+#define BQ28Z610_REG_DESIGN_CAPACITY        0x3C
+#define BQ28Z610_REG_ALT_MANUFACTURER_ACCESS 0x3E
+#define BQ28Z610_REG_MAC_DATA               0x40
+
+//
+// ManufacturerAccess commands, written to 0x3E with the response read back
+// from MACData
+//
+
+#define BQ28Z610_MAC_CHEM_ID                0x0006
+#define BQ28Z610_MAC_SAFETY_ALERT           0x0050
+#define BQ28Z610_MAC_SAFETY_STATUS          0x0051
+#define BQ28Z610_MAC_PF_STATUS              0x0053
+#define BQ28Z610_MAC_OPERATION_STATUS       0x0054
+#define BQ28Z610_MAC_MANUFACTURER_INFO      0x0070
+#define BQ28Z610_MAC_DA_STATUS1             0x0071
+#define BQ28Z610_MAC_DA_STATUS2             0x0072
+#define BQ28Z610_MAC_IT_STATUS3             0x0075
+
+//
+// Cached dynamic data older than this is refreshed from the gauge before it
+// is handed to the class driver.
+//
+
+#define ASTON_BATTERY_SNAPSHOT_MAX_AGE_MS   1000
+
+//
+// Status queries are answered from a snapshot up to this old, with the
+// remaining capacity and voltage extrapolated to the time of the query.
+//
+
+#define ASTON_BATTERY_PREDICTION_MAX_AGE_MS 30000
+
+//
+// In fast-start mode queries issued before the deferred SPB open completes
+// wait this long for the target to become ready.
+//
+
+#define ASTON_BATTERY_SPB_READY_TIMEOUT_MS  2000
+
+//
+// Devices with a split pack carry one gauge per pack, each behind its own
+// I2C connection resource. GaugeSelect picks a single connection resource
+// for this device instance, ASTON_BATTERY_GAUGE_SELECT_ALL aggregates all
+// of them into one battery. ASTON_BATTERY_MAX_GAUGES is in Public.h.
+//
+
+#define ASTON_BATTERY_GAUGE_SELECT_ALL      0xFFFFFFFF
+
+//
+// The sampler refreshes the snapshot every SampleIntervalMs while in D0.
+// Samples further apart than ASTON_BATTERY_MAX_INTEGRATION_GAP_MS, see
+// model.h, are not integrated.
+//
+
+#define ASTON_BATTERY_DEFAULT_SAMPLE_INTERVAL_MS    5000
+#define ASTON_BATTERY_MIN_SAMPLE_INTERVAL_MS        250
+
+//
+// The sampler reads the DAStatus blocks once every this many samples.
+//
+
+#define ASTON_BATTERY_CELL_SAMPLE_DIVIDER   12
+
+//
+// The pack signature is checked once every this many samples.
+//
+
+#define ASTON_BATTERY_SIGNATURE_SAMPLE_DIVIDER  60
+#define BQ28Z610_MANUFACTURER_INFO_SIZE         32
+
+//
+// Health is checkpointed to the registry at most this often while it
+// changes, and once more on D0 exit.
+//
+
+#define ASTON_BATTERY_HEALTH_CHECKPOINT_INTERVAL_MS 3600000
+#define ASTON_BATTERY_HEALTH_CHECKPOINT_VERSION     1
+
+#define ASTON_BATTERY_POOL_TAG              'tBsA'
+
+//
+// BatteryStatus (0x0A) bits
+//
+
+#define BQ28Z610_BATTERY_STATUS_DSG         (1 << 6)
+
+//
+// BatteryStatus alarm bits: OCA, TCA, OTA, TDA, RCA and RTA, read with the
+// standard commands of every snapshot.
+//
+// The standard commands have no other status word, SafetyAlert,
+// SafetyStatus, PFStatus and OperationStatus are only reachable through
+// ManufacturerAccess blocks of three transfers each. They are part of every
+// snapshot refresh, so any edge is seen within one sample interval. A
+// snapshot thus takes 14 transfers per gauge, 2 for the standard commands
+// and 12 for the status words. See the SafetyPolls and SafetyBusTransfers
+// counters.
+//
+
+#define BQ28Z610_MAC_BLOCK_TRANSFERS        3
+
+#define BQ28Z610_BATTERY_STATUS_ALARM_MASK  0xDB00
+
+//
+// OperationStatus bits worth a status notification: SS, PF, XDSG and XCHG.
+// The other bits follow normal operation and are only traced.
+//
+
+#define BQ28Z610_OPERATION_STATUS_EVENT_MASK 0x00007800
+
+//
+// Data blocks registered by the driver, in the order of
+// AstonBatteryWmiGuidList. The blocks of the battery class driver follow.
+//
+
+#define ASTON_BATTERY_WMI_TELEMETRY_INDEX       0
+#define ASTON_BATTERY_WMI_HEALTH_INDEX          1
+#define ASTON_BATTERY_WMI_SPB_STATISTICS_INDEX  2
+#define ASTON_BATTERY_WMI_LOCK_STATISTICS_INDEX 3
+#define ASTON_BATTERY_WMI_GUID_COUNT            4
+#define ASTON_BATTERY_WMI_MOF_RESOURCE_NAME     L"MofResource"
+
+#define ASTON_BATTERY_COUNTER_INSTANCE_NAME_LENGTH  16
+
 #pragma pack(push, 1)
 //typedef struct _BQ27742_MANUF_INFO_TYPE
 //{
@@ -87,8 +229,76 @@ Abstract:
 //    BYTE BatteryDeviceName[DEVICE_NAME_SIZE];
 //    BYTE Chemistry[CHEM_SIZE];
 //} BQ27742_MANUF_INFO_TYPE, * PBQ27742_MANUF_INFO_TYPE;
+
+//
+// MAC DAStatus1 and DAStatus2 responses, little endian words
+//
+typedef struct _BQ28Z610_DA_STATUS1
+{
+    UINT16 CellVoltage[4];
+    UINT16 BatVoltage;
+    UINT16 PackVoltage;
+    INT16 CellCurrent[4];
+    INT16 CellPower[4];
+    INT16 Power;
+    INT16 AveragePower;
+} BQ28Z610_DA_STATUS1, * PBQ28Z610_DA_STATUS1;
+
+typedef struct _BQ28Z610_DA_STATUS2
+{
+    UINT16 InternalTemperature;
+    UINT16 Ts1Temperature;
+    UINT16 Ts2Temperature;
+    UINT16 Ts3Temperature;
+    UINT16 Ts4Temperature;
+    UINT16 CellTemperature;
+    UINT16 FetTemperature;
+} BQ28Z610_DA_STATUS2, * PBQ28Z610_DA_STATUS2;
 #pragma pack(pop)
 
+C_ASSERT(sizeof(BQ28Z610_STANDARD_BLOCK) ==
+    BQ28Z610_REG_FULL_CHARGE_CAPACITY + sizeof(UINT16) - BQ28Z610_REG_AT_RATE_TIME_TO_EMPTY);
+
+C_ASSERT(sizeof(BQ28Z610_DA_STATUS1) == 32);
+C_ASSERT(sizeof(BQ28Z610_DA_STATUS2) == 14);
+
+//
+// Spans traced as TraceLogging activities. A device control activity
+// covers the IRP from preprocessing until the class driver or the default
+// queue returns it, the others one call each.
+//
+typedef enum _ASTON_BATTERY_ACTIVITY_KIND
+{
+    AstonBatteryActivityDeviceControl,
+    AstonBatteryActivityQueryTag,
+    AstonBatteryActivityQueryInformation,
+    AstonBatteryActivityQueryStatus,
+    AstonBatteryActivitySetInformation,
+    AstonBatteryActivitySnapshotRefresh
+} ASTON_BATTERY_ACTIVITY_KIND;
+
+//
+// State of one activity, on the stack of the traced function. Previous is
+// the activity of the thread the span runs nested in.
+//
+typedef struct _ASTON_BATTERY_ACTIVITY
+{
+    ASTON_BATTERY_ACTIVITY_KIND Kind;
+    BOOLEAN Enabled;
+    GUID Id;
+    GUID Previous;
+    LARGE_INTEGER Start;
+} ASTON_BATTERY_ACTIVITY, * PASTON_BATTERY_ACTIVITY;
+
+//
+// Registry image of the health analytics, tied to the pack it was learnt on
+//
+typedef struct _ASTON_BATTERY_HEALTH_CHECKPOINT
+{
+    ULONG Version;
+    ASTON_BATTERY_PACK_SIGNATURE Signature;
+    ASTON_BATTERY_HEALTH Health;
+} ASTON_BATTERY_HEALTH_CHECKPOINT, * PASTON_BATTERY_HEALTH_CHECKPOINT;
 
 typedef struct {
     UNICODE_STRING                  RegistryPath;
@@ -106,25 +316,134 @@ typedef struct {
 
     PVOID                           ClassHandle;
     WDFWAITLOCK                     ClassInitLock;
+    LOCK_STATISTICS                 ClassInitLockStatistics;
     WMILIB_CONTEXT                  WmiLibContext;
 
     //
-    // Spb (I2C) related members used for the lifetime of the device
+    // Spb (I2C) related members used for the lifetime of the device, one
+    // context per gauge
+    //
+    SPB_CONTEXT I2CContext[ASTON_BATTERY_MAX_GAUGES];
+    ULONG                           GaugeCount;
+    ULONG                           GaugeSelect;
+
+    //
+    // When FastStart is set the SPB target is opened by the sampler work
+    // item after start completes, SpbReadyEvent is signalled once
+    // SpbInitStatus holds the outcome. SpbOpenLock makes the open happen
+    // once per start whoever gets there first
     //
-    SPB_CONTEXT I2CContext;
+    BOOLEAN                         FastStart;
+    WDFWAITLOCK                     SpbOpenLock;
+    BOOLEAN                         SpbReady;
+    NTSTATUS                        SpbInitStatus;
+    KEVENT                          SpbReadyEvent;
 
     //
-    // Battery state
+    // Battery state. InD0 is set between D0 entry and D0 exit under
+    // StateLock, raw register reads hold the lock across their transfers
+    // so that none is left on the bus once D0 exit has cleared it
     //
 
     WDFWAITLOCK                     StateLock;
+    LOCK_STATISTICS                 StateLockStatistics;
     ULONG                           BatteryTag;
+    BOOLEAN                         InD0;
+
+    //
+    // Telemetry snapshot, refreshed on demand and prefetched on D0 entry.
+    // SamplerBusy is set while a sampler run is in progress, the sampler
+    // state below it is only touched by that run. StatusNotifyPending holds
+    // a status notification for the sampler to deliver
+    //
+
+    WDFWAITLOCK                     SnapshotLock;
+    WDFWORKITEM                     SamplerWorkItem;
+    volatile LONG                   SamplerBusy;
+    volatile LONG                   StatusNotifyPending;
+    WDFTIMER                        SamplerTimer;
+    ULONG                           SampleIntervalMs;
+    ULONG                           CellSampleCountdown;
+    ULONG                           SignatureSampleCountdown;
+    BOOLEAN                         PackSignatureValid;
+    ASTON_BATTERY_PACK_SIGNATURE    PackSignature;
+
+    //
+    // Last health checkpoint read from or written to the registry
+    //
+
+    ASTON_BATTERY_HEALTH_CHECKPOINT HealthCheckpoint;
+    LARGE_INTEGER                   HealthCheckpointTime;
+
+    //
+    // Pending IOCTL_ASTON_BATTERY_WAIT_FOR_CHANGE requests, ChangeLock
+    // orders their evaluation against snapshot publication
+    //
+
+    WDFQUEUE                        ChangeQueue;
+    WDFWAITLOCK                     ChangeLock;
+
+    //
+    // Section user mode maps read only to follow the telemetry without
+    // system calls, rewritten under ChangeLock on every publication
+    //
+
+    HANDLE                          SharedSection;
+    PVOID                           SharedSectionObject;
+    PASTON_BATTERY_SHARED_TELEMETRY SharedTelemetry;
+
+    //
+    // Samples taken by the sampler, HistoryLock protects the ring and the
+    // archive
+    //
+
+    WDFWAITLOCK                     HistoryLock;
+    ASTON_BATTERY_HISTORY           History;
+    ASTON_BATTERY_ARCHIVE           Archive;
+    WDFMEMORY                       HistoryMemory;
+    WDFMEMORY                       ArchiveMemory;
+    LARGE_INTEGER                   HistoryCheckpointTime;
+
+    //
+    // Activity of the latest device control IRP passed to the class
+    // driver, related to the miniclass callbacks it leads to
+    //
+
+    KSPIN_LOCK                      ActivityLock;
+    GUID                            ClassActivity;
+
+    //
+    // Performance counters and the registration of this device as an
+    // instance of the counter set
+    //
+
+    ASTON_BATTERY_COUNTERS          Counters;
+    PPCW_REGISTRATION               CounterSet;
+    UNICODE_STRING                  CounterInstanceName;
+    WCHAR                           CounterInstanceNameBuffer[ASTON_BATTERY_COUNTER_INSTANCE_NAME_LENGTH];
+
+    ASTON_BATTERY_SNAPSHOT          Snapshot;
+    LARGE_INTEGER                   QpcFrequency;
+    LARGE_INTEGER                   D0EntryTime;
+    ULONG                           D0EntryToSnapshotUs;
 } SURFACE_BATTERY_FDO_DATA, *PSURFACE_BATTERY_FDO_DATA;
 
+//
+// Per handle state of the change notification: the wait parameters, what
+// was last reported and when
+//
+typedef struct {
+    ASTON_BATTERY_WAIT_FOR_CHANGE   Wait;
+    BOOLEAN                         BaselineValid;
+    ASTON_BATTERY_TELEMETRY         Baseline;
+    LARGE_INTEGER                   LastCompletion;
+} ASTON_BATTERY_FILE_CONTEXT, *PASTON_BATTERY_FILE_CONTEXT;
+
 //------------------------------------------------------ WDF Context Declaration
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(SURFACE_BATTERY_GLOBAL_DATA, GetGlobalData);
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(SURFACE_BATTERY_FDO_DATA, GetDeviceExtension);
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(ASTON_BATTERY_FILE_CONTEXT, GetFileContext);
 
 //----------------------------------------------------- Prototypes (miniclass.c)
 
@@ -134,9 +453,294 @@ AstonBatteryPrepareHardware(
     _In_ WDFDEVICE Device
 );
 
+_IRQL_requires_same_
+VOID
+AstonBatteryUpdateTag(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
 BCLASS_QUERY_TAG_CALLBACK AstonBatteryQueryTag;
 BCLASS_QUERY_INFORMATION_CALLBACK AstonBatteryQueryInformation;
 BCLASS_SET_INFORMATION_CALLBACK AstonBatterySetInformation;
 BCLASS_QUERY_STATUS_CALLBACK AstonBatteryQueryStatus;
 BCLASS_SET_STATUS_NOTIFY_CALLBACK AstonBatterySetStatusNotify;
-BCLASS_DISABLE_STATUS_NOTIFY_CALLBACK AstonBatteryDisableStatusNotify;
\ No newline at end of file
+BCLASS_DISABLE_STATUS_NOTIFY_CALLBACK AstonBatteryDisableStatusNotify;
+
+//----------------------------------------------------- Prototypes (telemetry.c)
+
+EVT_WDF_WORKITEM AstonBatteryEvtSamplerWorkItem;
+EVT_WDF_TIMER AstonBatteryEvtSamplerTimer;
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryInitializeSpbTarget(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryWaitForSpbTarget(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryReadGaugeWord(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _In_ UCHAR Address,
+    _Out_writes_(ASTON_BATTERY_MAX_GAUGES) UINT16* Values
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryRefreshSnapshot(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryReadMacBlock(
+    _In_ SPB_CONTEXT* SpbContext,
+    _In_ UINT16 Command,
+    _Out_writes_bytes_(Length) PVOID Data,
+    _In_ ULONG Length
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryRefreshCellTelemetry(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryReadSafetyStatus(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _Out_ PASTON_BATTERY_SAFETY_STATUS Safety
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryCheckPackSignature(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryNotifyStatusChange(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryDeliverStatusNotify(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryGetSnapshot(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _In_ ULONG MaxAgeMs,
+    _Out_ PASTON_BATTERY_SNAPSHOT Snapshot
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryGetPredictedSnapshot(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _Out_ PASTON_BATTERY_SNAPSHOT Snapshot
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryInvalidateSnapshot(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+//-------------------------------------------------------- Prototypes (health.c)
+
+VOID
+AstonBatteryUpdateHealth(
+    _Inout_ PASTON_BATTERY_SNAPSHOT Snapshot,
+    _In_ const BQ28Z610_STANDARD_BLOCK* Registers
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryRefreshHealth(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryLoadHealthCheckpoint(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryCheckpointHealth(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _In_ BOOLEAN Force
+);
+
+//--------------------------------------------------------- Prototypes (ioctl.c)
+
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL AstonBatteryEvtIoDeviceControl;
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryCreateIoQueue(
+    _In_ WDFDEVICE Device
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryPublishTelemetry(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryFillTelemetry(
+    _In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _Out_ PASTON_BATTERY_TELEMETRY Telemetry
+);
+
+//-------------------------------------------------------- Prototypes (shared.c)
+
+EVT_WDF_IO_IN_CALLER_CONTEXT AstonBatteryEvtIoInCallerContext;
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryCreateSharedTelemetry(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryDestroySharedTelemetry(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+VOID
+AstonBatteryWriteSharedTelemetry(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _In_ const ASTON_BATTERY_TELEMETRY* Telemetry
+);
+
+//------------------------------------------------------- Prototypes (history.c)
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryCreateHistory(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryAppendHistory(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryCopyHistory(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _Out_writes_bytes_to_(Length, *Written) PVOID Buffer,
+    _In_ size_t Length,
+    _Out_ size_t* Written
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryRestoreHistory(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryCheckpointHistory(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _In_ BOOLEAN Force
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryCopyArchive(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _In_ const ASTON_BATTERY_ARCHIVE_RANGE* Range,
+    _Out_writes_bytes_to_(Length, *Written) PVOID Buffer,
+    _In_ size_t Length,
+    _Out_ size_t* Written
+);
+
+//------------------------------------------------------ Prototypes (counters.c)
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryRegisterCounters(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryUnregisterCounters(
+    _Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
+);
+
+//------------------------------------------------------ Prototypes (activity.c)
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryStartActivity(
+    _In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _Out_ PASTON_BATTERY_ACTIVITY Activity,
+    _In_ ASTON_BATTERY_ACTIVITY_KIND Kind,
+    _In_ ULONG Detail
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryStopActivity(
+    _In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _In_ PASTON_BATTERY_ACTIVITY Activity,
+    _In_ NTSTATUS Status
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryTraceSnapshotLookup(
+    _In_ BOOLEAN Hit,
+    _In_ ULONGLONG AgeUs,
+    _In_ ULONG MaxAgeMs
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryTraceBatteryInformation(
+    _In_ const BATTERY_INFORMATION* Information
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+AstonBatteryTraceBatteryStatus(
+    _In_ const BATTERY_STATUS* BatteryStatus
+);
+
+//----------------------------------------------------------- Prototypes (wmi.c)
+
+extern WMIGUIDREGINFO AstonBatteryWmiGuidList[ASTON_BATTERY_WMI_GUID_COUNT];
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+AstonBatteryQueryCustomWmiDataBlock(
+    _In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+    _In_ PDEVICE_OBJECT DeviceObject,
+    _In_ PIRP Irp,
+    _In_ ULONG GuidIndex,
+    _Out_ PULONG InstanceLengthArray,
+    _In_ ULONG BufferAvail,
+    _Out_writes_bytes_opt_(BufferAvail) PUCHAR Buffer
+);
\ No newline at end of file
@@ -0,0 +1,153 @@
+/*++
+
+	Module Name:
+
+		lock.c
+
+	Abstract:
+
+		Wrappers around framework wait locks that count acquisitions and
+		record how long callers wait for and hold the lock, along with the
+		call site of the longest hold. An uncontended acquisition costs one
+		performance counter read more than a bare one.
+
+	Environment:
+
+		Kernel mode
+
+	Revision History:
+
+--*/
+
+#include "AstonBattery.h"
+
+static
+ULONG
+LockHistogramBucket(
+	IN LONG64 Ticks,
+	IN LONG64 Frequency
+)
+/*++
+
+  Routine Description:
+
+	Returns the histogram bucket of a duration, see LOCK_HISTOGRAM_BUCKETS.
+
+--*/
+{
+	ULONGLONG microseconds;
+	ULONG bit;
+
+	microseconds = (ULONGLONG)max(Ticks, 0) * 1000000 / (ULONGLONG)Frequency;
+	if (microseconds == 0)
+	{
+		return 0;
+	}
+
+	BitScanReverse64(&bit, microseconds);
+
+	return min(bit + 1, LOCK_HISTOGRAM_BUCKETS - 1);
+}
+
+VOID
+WaitLockAcquireAt(
+	IN WDFWAITLOCK Lock,
+	IN LOCK_STATISTICS* Statistics,
+	IN PCSTR Function,
+	IN ULONG Line
+)
+/*++
+
+  Routine Description:
+
+	This routine acquires a wait lock and accounts for the acquisition. The
+	lock is tried first, the performance counter is only read before the
+	acquisition when the caller has to wait.
+
+  Arguments:
+
+	Lock       - The lock to acquire
+	Statistics - The statistics of the lock
+	Function   - The function acquiring the lock
+	Line       - The line of the acquisition
+
+  Return Value:
+
+	None
+
+--*/
+{
+	LONGLONG timeout;
+	LARGE_INTEGER start;
+	LARGE_INTEGER now;
+	LARGE_INTEGER frequency;
+	LONG64 wait;
+
+	timeout = 0;
+	wait = 0;
+
+	if (WdfWaitLockAcquire(Lock, &timeout) == STATUS_SUCCESS)
+	{
+		now = KeQueryPerformanceCounter(&frequency);
+	}
+	else
+	{
+		start = KeQueryPerformanceCounter(NULL);
+		WdfWaitLockAcquire(Lock, NULL);
+		now = KeQueryPerformanceCounter(&frequency);
+
+		wait = now.QuadPart - start.QuadPart;
+		Statistics->Contentions += 1;
+		Statistics->WaitTicks += wait;
+		Statistics->MaxWaitTicks = max(Statistics->MaxWaitTicks, wait);
+	}
+
+	Statistics->Acquisitions += 1;
+	Statistics->WaitHistogram[LockHistogramBucket(wait, frequency.QuadPart)] += 1;
+
+	Statistics->HoldStart = now;
+	Statistics->HolderFunction = Function;
+	Statistics->HolderLine = Line;
+}
+
+VOID
+WaitLockRelease(
+	IN WDFWAITLOCK Lock,
+	IN LOCK_STATISTICS* Statistics
+)
+/*++
+
+  Routine Description:
+
+	This routine accounts for the time the lock was held and releases it.
+
+  Arguments:
+
+	Lock       - The lock to release
+	Statistics - The statistics of the lock
+
+  Return Value:
+
+	None
+
+--*/
+{
+	LARGE_INTEGER now;
+	LARGE_INTEGER frequency;
+	LONG64 hold;
+
+	now = KeQueryPerformanceCounter(&frequency);
+	hold = now.QuadPart - Statistics->HoldStart.QuadPart;
+
+	Statistics->HoldTicks += hold;
+	Statistics->HoldHistogram[LockHistogramBucket(hold, frequency.QuadPart)] += 1;
+
+	if (hold > Statistics->MaxHoldTicks)
+	{
+		Statistics->MaxHoldTicks = hold;
+		Statistics->MaxHoldFunction = Statistics->HolderFunction;
+		Statistics->MaxHoldLine = Statistics->HolderLine;
+	}
+
+	WdfWaitLockRelease(Lock);
+}
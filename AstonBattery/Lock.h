@@ -0,0 +1,76 @@
+/*++
+
+	Module Name:
+
+		lock.h
+
+	Abstract:
+
+		This module contains the definitions of the instrumented wait lock
+		helpers.
+
+	Environment:
+
+		Kernel Mode
+
+	Revision History:
+
+--*/
+
+#pragma once
+
+#include <wdm.h>
+#include <wdf.h>
+
+//
+// Wait and hold time histograms are in microseconds, bucket 0 holds those
+// under 1 us and bucket i those from 2^(i-1) us up to 2^i us, the last one
+// also holding everything slower.
+//
+
+#define LOCK_HISTOGRAM_BUCKETS 24
+
+//
+// Statistics of a wait lock taken through WaitLockAcquire. Every field is
+// written by the holder of the lock only, readers take a racy copy. Times
+// are in performance counter ticks.
+//
+
+typedef struct _LOCK_STATISTICS
+{
+	LONG64 Acquisitions;
+	LONG64 Contentions;
+	LONG64 WaitTicks;
+	LONG64 HoldTicks;
+	LONG64 MaxWaitTicks;
+	LONG64 MaxHoldTicks;
+	PCSTR MaxHoldFunction;
+	ULONG MaxHoldLine;
+	ULONG WaitHistogram[LOCK_HISTOGRAM_BUCKETS];
+	ULONG HoldHistogram[LOCK_HISTOGRAM_BUCKETS];
+
+	//
+	// Current holder
+	//
+
+	LARGE_INTEGER HoldStart;
+	PCSTR HolderFunction;
+	ULONG HolderLine;
+} LOCK_STATISTICS;
+
+#define WaitLockAcquire(Lock, Statistics) \
+	WaitLockAcquireAt((Lock), (Statistics), __FUNCTION__, __LINE__)
+
+VOID
+WaitLockAcquireAt(
+	IN WDFWAITLOCK Lock,
+	IN LOCK_STATISTICS* Statistics,
+	IN PCSTR Function,
+	IN ULONG Line
+);
+
+VOID
+WaitLockRelease(
+	IN WDFWAITLOCK Lock,
+	IN LOCK_STATISTICS* Statistics
+);
@@ -0,0 +1,577 @@
+/*++
+
+Module Name:
+
+    Public.h
+
+Abstract:
+
+    This module contains the definitions shared between the Aston battery
+    driver and user mode applications. User mode callers include windows.h
+    and winioctl.h before this header.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//---------------------------------------------------------------------- Pragmas
+
+#pragma once
+
+//------------------------------------------------------------------ Definitions
+
+//
+// Private device interface, separate from GUID_DEVICE_BATTERY which belongs
+// to the battery class driver.
+//
+// {9512419E-1343-48F1-A17E-04AEB0565907}
+//
+
+DEFINE_GUID(GUID_DEVINTERFACE_ASTON_BATTERY,
+    0x9512419e, 0x1343, 0x48f1, 0xa1, 0x7e, 0x04, 0xae, 0xb0, 0x56, 0x59, 0x07);
+
+//
+// WMI data blocks, described in AstonBattery.mof. Each is served from the
+// state of the driver in a single query, without bus transfers.
+//
+// AstonBattery_Telemetry       ASTON_BATTERY_TELEMETRY
+// AstonBattery_Health          ASTON_BATTERY_WMI_HEALTH
+// AstonBattery_SpbStatistics   ASTON_BATTERY_WMI_SPB_STATISTICS
+// AstonBattery_LockStatistics  ASTON_BATTERY_WMI_LOCK_STATISTICS
+//
+
+DEFINE_GUID(GUID_ASTON_BATTERY_WMI_TELEMETRY,
+    0xcf2e7acd, 0xe4a9, 0x4cdd, 0x9b, 0x7a, 0xea, 0x32, 0xf0, 0x59, 0x84, 0x74);
+
+DEFINE_GUID(GUID_ASTON_BATTERY_WMI_HEALTH,
+    0xbb56d01d, 0xab79, 0x4f83, 0x98, 0x1c, 0xa8, 0x52, 0xa5, 0xf9, 0x60, 0x14);
+
+DEFINE_GUID(GUID_ASTON_BATTERY_WMI_SPB_STATISTICS,
+    0xcfe37080, 0x8525, 0x4216, 0x9b, 0x9b, 0x6a, 0xac, 0x7c, 0xe9, 0x34, 0xd4);
+
+DEFINE_GUID(GUID_ASTON_BATTERY_WMI_LOCK_STATISTICS,
+    0x2fe58c97, 0xaaa7, 0x45da, 0xae, 0x5f, 0x33, 0x4a, 0x9d, 0x8b, 0x33, 0xcd);
+
+#define ASTON_BATTERY_MAX_GAUGES            2
+#define ASTON_BATTERY_CELLS_PER_GAUGE       2
+
+//
+// IOCTL_ASTON_BATTERY_QUERY_CELL_TELEMETRY
+//
+// Output: ASTON_BATTERY_CELL_TELEMETRY
+//
+
+#define IOCTL_ASTON_BATTERY_QUERY_CELL_TELEMETRY \
+    CTL_CODE(FILE_DEVICE_BATTERY, 0x800, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// IOCTL_ASTON_BATTERY_QUERY_TELEMETRY
+//
+// Output: ASTON_BATTERY_TELEMETRY, served from the cached snapshot
+//
+
+#define IOCTL_ASTON_BATTERY_QUERY_TELEMETRY \
+    CTL_CODE(FILE_DEVICE_BATTERY, 0x801, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// IOCTL_ASTON_BATTERY_READ_REGISTERS
+//
+// Input: ASTON_BATTERY_REGISTER_LIST
+// Output: ASTON_BATTERY_REGISTER_VALUES
+//
+// Reads a list of standard command words from one gauge. Runs of adjacent
+// words are read in a single bus transfer. The reads go to the bus rather
+// than the cached snapshot, so the handle needs write access as well, and
+// they fail with STATUS_DEVICE_NOT_READY while the device is not in D0.
+//
+
+#define IOCTL_ASTON_BATTERY_READ_REGISTERS \
+    CTL_CODE(FILE_DEVICE_BATTERY, 0x802, METHOD_BUFFERED, FILE_READ_ACCESS | FILE_WRITE_ACCESS)
+
+//
+// IOCTL_ASTON_BATTERY_WAIT_FOR_CHANGE
+//
+// Input: ASTON_BATTERY_WAIT_FOR_CHANGE
+// Output: ASTON_BATTERY_CHANGE
+//
+// Pends until the snapshot generation moves past the one passed in and,
+// when FieldMask is not zero, one of the selected fields has moved by more
+// than its delta since the last change reported on the same handle. The
+// parameters of the latest request apply to the whole handle, requests on
+// a handle complete at most once per MinIntervalMs.
+//
+
+#define IOCTL_ASTON_BATTERY_WAIT_FOR_CHANGE \
+    CTL_CODE(FILE_DEVICE_BATTERY, 0x803, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// IOCTL_ASTON_BATTERY_OPEN_SHARED_TELEMETRY
+//
+// Output: ASTON_BATTERY_SHARED_TELEMETRY_HANDLE
+//
+// Returns a handle, valid in the calling process, to a read only section
+// holding ASTON_BATTERY_SHARED_TELEMETRY. Map it with MapViewOfFile and
+// FILE_MAP_READ, then read it with AstonBatteryReadSharedTelemetry. The
+// section is republished after every snapshot update, reading it costs
+// neither a system call nor a bus transfer.
+//
+
+#define IOCTL_ASTON_BATTERY_OPEN_SHARED_TELEMETRY \
+    CTL_CODE(FILE_DEVICE_BATTERY, 0x804, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// IOCTL_ASTON_BATTERY_QUERY_HISTORY
+//
+// Output: ASTON_BATTERY_HISTORY_HEADER followed by the history columns
+//
+// Returns the samples kept by the driver, oldest first, as one column per
+// field at the offsets given in the header. If the buffer only holds the
+// header, the header is returned with STATUS_BUFFER_OVERFLOW and Size set
+// to the length needed.
+//
+
+#define IOCTL_ASTON_BATTERY_QUERY_HISTORY \
+    CTL_CODE(FILE_DEVICE_BATTERY, 0x805, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+//
+// IOCTL_ASTON_BATTERY_QUERY_ARCHIVE
+//
+// Input: ASTON_BATTERY_ARCHIVE_RANGE
+// Output: ASTON_BATTERY_HISTORY_HEADER followed by the history columns
+//
+// Same as IOCTL_ASTON_BATTERY_QUERY_HISTORY for the long term archive,
+// which keeps one sample out of six for days, limited to the samples taken
+// within the range. Timestamps of the archive have millisecond resolution.
+// The archive survives reboots, samples of earlier boots are placed before
+// the start of this one on the performance counter timeline and may have
+// negative timestamps. Samples come in the order they were taken; their
+// timestamps only increase as long as the wall clock was not set back
+// across a reboot.
+//
+
+#define IOCTL_ASTON_BATTERY_QUERY_ARCHIVE \
+    CTL_CODE(FILE_DEVICE_BATTERY, 0x806, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+//
+// IOCTL_ASTON_BATTERY_QUERY_SPB_LATENCY
+//
+// Input: optional ASTON_BATTERY_SPB_LATENCY_QUERY
+// Output: ASTON_BATTERY_SPB_LATENCY
+//
+// Returns the latency histograms of the I2C transfers of every gauge, one
+// row per register address and operation, counted since the device started
+// or the last reset. ASTON_BATTERY_SPB_LATENCY_RESET clears them once they
+// are copied.
+//
+
+#define IOCTL_ASTON_BATTERY_QUERY_SPB_LATENCY \
+    CTL_CODE(FILE_DEVICE_BATTERY, 0x807, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+#define ASTON_BATTERY_TELEMETRY_VERSION     1
+#define ASTON_BATTERY_SHARED_TELEMETRY_VERSION  1
+#define ASTON_BATTERY_HISTORY_VERSION       1
+#define ASTON_BATTERY_MAX_REGISTER_LIST     64
+#define ASTON_BATTERY_MAX_REGISTER_ADDRESS  0x7E
+#define ASTON_BATTERY_SPB_LATENCY_VERSION   1
+#define ASTON_BATTERY_SPB_LATENCY_BUCKETS   64
+#define ASTON_BATTERY_SPB_LATENCY_MAX_ROWS  48
+
+//
+// Cell level values decoded from DAStatus1 and DAStatus2 of one gauge.
+// Voltages are in mV, currents in mA (positive while charging) and
+// temperatures in 0.1 K, as reported by the gauge.
+//
+typedef struct _ASTON_BATTERY_GAUGE_CELLS
+{
+    USHORT CellVoltage[ASTON_BATTERY_CELLS_PER_GAUGE];
+    SHORT CellCurrent[ASTON_BATTERY_CELLS_PER_GAUGE];
+    USHORT BatVoltage;
+    USHORT PackVoltage;
+    USHORT CellImbalance;
+    USHORT InternalTemperature;
+    USHORT Ts1Temperature;
+    USHORT CellTemperature;
+    USHORT FetTemperature;
+} ASTON_BATTERY_GAUGE_CELLS, * PASTON_BATTERY_GAUGE_CELLS;
+
+//
+// Timestamp is in QueryPerformanceCounter ticks, zero until the first
+// cell sample has been taken.
+//
+typedef struct _ASTON_BATTERY_CELL_TELEMETRY
+{
+    ULONG Size;
+    ULONG GaugeCount;
+    LONGLONG Timestamp;
+    ASTON_BATTERY_GAUGE_CELLS Gauges[ASTON_BATTERY_MAX_GAUGES];
+} ASTON_BATTERY_CELL_TELEMETRY, * PASTON_BATTERY_CELL_TELEMETRY;
+
+//
+// Wear of the battery, updated on every sample and checkpointed to the
+// registry. Capacities are in mAh, StateOfHealth in percent and the fade in
+// hundredths of a percent of the first full charge capacity seen on the
+// pack. Qmax is the learnt chemical capacity of each cell.
+//
+typedef struct _ASTON_BATTERY_HEALTH
+{
+    ULONG StateOfHealth;
+    ULONG CycleCount;
+    ULONG DesignCapacity;
+    ULONG InitialFullChargeCapacity;
+    ULONG FullChargeCapacity;
+    ULONG FullChargeCapacityFade;
+    ULONG Qmax[ASTON_BATTERY_MAX_GAUGES][ASTON_BATTERY_CELLS_PER_GAUGE];
+    ULONG QmaxUpdates;
+    ULONG ResistanceMilliOhm;
+    ULONG ResistanceFitCount;
+} ASTON_BATTERY_HEALTH, * PASTON_BATTERY_HEALTH;
+
+//
+// Flags of ASTON_BATTERY_TELEMETRY
+//
+
+#define ASTON_BATTERY_TELEMETRY_SAMPLE_VALID    0x00000001
+#define ASTON_BATTERY_TELEMETRY_HEALTH_VALID    0x00000002
+
+//
+// Everything the driver knows about the battery, copied from its snapshot
+// in one call. Timestamps are in QueryPerformanceCounter ticks, SampleAgeMs
+// is the age of the dynamic values when the request was served. Units of
+// the register values are those of the gauge: mV, mA, mAh and 0.1 K.
+//
+typedef struct _ASTON_BATTERY_TELEMETRY
+{
+    ULONG Version;
+    ULONG Size;
+    ULONG Flags;
+    ULONG BatteryTag;
+    ULONG Generation;
+    LONGLONG QueryTimestamp;
+    LONGLONG SampleTimestamp;
+    ULONG SampleAgeMs;
+    ULONG SampleIntervalMs;
+    ULONG D0EntryToSnapshotUs;
+    ULONG GaugeCount;
+
+    //
+    // Merged standard commands
+    //
+
+    USHORT AtRateTimeToEmpty;
+    USHORT Temperature;
+    USHORT Voltage;
+    USHORT BatteryStatus;
+    SHORT Current;
+    SHORT MaxLoadCurrent;
+    USHORT RemainingCapacity;
+    USHORT FullChargeCapacity;
+
+    //
+    // Derived values. Energies are those of the merged registers, the
+    // battery class reports twice RemainingEnergy as the pack capacity.
+    //
+
+    LONG Rate;                      // mW, short term filter
+    LONG AverageRate;               // mW, long term filter
+    ULONG EstimatedTime;            // s to empty at AverageRate
+    ULONG RemainingEnergy;          // mWh at the mean discharge voltage
+    ULONG OpenCircuitVoltage;       // mV
+    ULONG ResistanceMilliOhm;       // mOhm
+    ULONGLONG ChargedEnergy;        // uJ integrated while charging
+    ULONGLONG DischargedEnergy;     // uJ integrated while discharging
+    ULONG PredictionSamples;
+    ULONG MaxCapacityErrorMah;      // mAh
+    ULONG MaxVoltageErrorMv;        // mV
+
+    //
+    // MAC status words
+    //
+
+    ULONG SafetyAlert;
+    ULONG SafetyStatus;
+    ULONG PFStatus;
+    ULONG OperationStatus;
+    LONGLONG SafetyTimestamp;
+
+    ASTON_BATTERY_HEALTH Health;
+    ASTON_BATTERY_CELL_TELEMETRY Cells;
+} ASTON_BATTERY_TELEMETRY, * PASTON_BATTERY_TELEMETRY;
+
+typedef struct _ASTON_BATTERY_REGISTER_LIST
+{
+    ULONG Gauge;
+    ULONG Count;
+    UCHAR Address[ASTON_BATTERY_MAX_REGISTER_LIST];
+} ASTON_BATTERY_REGISTER_LIST, * PASTON_BATTERY_REGISTER_LIST;
+
+typedef struct _ASTON_BATTERY_REGISTER_VALUES
+{
+    ULONG Count;
+    USHORT Value[ASTON_BATTERY_MAX_REGISTER_LIST];
+} ASTON_BATTERY_REGISTER_VALUES, * PASTON_BATTERY_REGISTER_VALUES;
+
+//
+// Fields of ASTON_BATTERY_WAIT_FOR_CHANGE::FieldMask and
+// ASTON_BATTERY_CHANGE::ChangedMask
+//
+
+#define ASTON_BATTERY_FIELD_VOLTAGE         0x00000001
+#define ASTON_BATTERY_FIELD_CURRENT         0x00000002
+#define ASTON_BATTERY_FIELD_CAPACITY        0x00000004
+#define ASTON_BATTERY_FIELD_TEMPERATURE     0x00000008
+#define ASTON_BATTERY_FIELD_STATUS          0x00000010
+#define ASTON_BATTERY_FIELD_SAFETY          0x00000020
+#define ASTON_BATTERY_FIELD_HEALTH          0x00000040
+#define ASTON_BATTERY_FIELD_TAG             0x00000080
+
+typedef struct _ASTON_BATTERY_WAIT_FOR_CHANGE
+{
+    ULONG Generation;
+    ULONG FieldMask;
+    ULONG MinIntervalMs;
+    ULONG VoltageDelta;
+    ULONG CurrentDelta;
+    ULONG CapacityDelta;
+    ULONG TemperatureDelta;
+} ASTON_BATTERY_WAIT_FOR_CHANGE, * PASTON_BATTERY_WAIT_FOR_CHANGE;
+
+typedef struct _ASTON_BATTERY_CHANGE
+{
+    ULONG ChangedMask;
+    ASTON_BATTERY_TELEMETRY Telemetry;
+} ASTON_BATTERY_CHANGE, * PASTON_BATTERY_CHANGE;
+
+typedef struct _ASTON_BATTERY_SHARED_TELEMETRY_HANDLE
+{
+    ULONGLONG Handle;
+    ULONG ViewSize;
+    ULONG Reserved;
+} ASTON_BATTERY_SHARED_TELEMETRY_HANDLE, * PASTON_BATTERY_SHARED_TELEMETRY_HANDLE;
+
+//
+// Layout of the shared section. Sequence is odd while the driver rewrites
+// Telemetry; a copy taken between two equal, even reads of Sequence is
+// consistent. QueryTimestamp and SampleAgeMs are those of the publication,
+// readers age the sample themselves against SampleTimestamp.
+//
+typedef struct _ASTON_BATTERY_SHARED_TELEMETRY
+{
+    ULONG Version;
+    ULONG Size;
+    volatile LONG Sequence;
+    ULONG Reserved;
+    ASTON_BATTERY_TELEMETRY Telemetry;
+} ASTON_BATTERY_SHARED_TELEMETRY, * PASTON_BATTERY_SHARED_TELEMETRY;
+
+//
+// Header of the history blob. Offsets are from the start of the header, each
+// column holds Count values. Timestamps are in QueryPerformanceCounter
+// ticks at QpcFrequency, the other units are those of
+// ASTON_BATTERY_TELEMETRY. TotalSamples counts every sample taken since the
+// device started, TotalSamples - Count of them have been overwritten.
+//
+typedef struct _ASTON_BATTERY_HISTORY_HEADER
+{
+    ULONG Version;
+    ULONG Size;
+    ULONG Capacity;
+    ULONG Count;
+    ULONGLONG TotalSamples;
+    LONGLONG QpcFrequency;
+    ULONG TimestampOffset;          // LONGLONG
+    ULONG RateOffset;               // LONG
+    ULONG SafetyStatusOffset;       // ULONG
+    ULONG VoltageOffset;            // USHORT
+    ULONG CurrentOffset;            // SHORT
+    ULONG TemperatureOffset;        // USHORT
+    ULONG RemainingCapacityOffset;  // USHORT
+    ULONG FullChargeCapacityOffset; // USHORT
+    ULONG BatteryStatusOffset;      // USHORT
+    ULONG Reserved;
+} ASTON_BATTERY_HISTORY_HEADER, * PASTON_BATTERY_HISTORY_HEADER;
+
+//
+// Inclusive range of QueryPerformanceCounter timestamps
+//
+typedef struct _ASTON_BATTERY_ARCHIVE_RANGE
+{
+    LONGLONG StartTimestamp;
+    LONGLONG EndTimestamp;
+} ASTON_BATTERY_ARCHIVE_RANGE, * PASTON_BATTERY_ARCHIVE_RANGE;
+
+//
+// Data of the AstonBattery_Health WMI block. Flags holds
+// ASTON_BATTERY_TELEMETRY_HEALTH_VALID, ChemId and ManufacturerInfoHash
+// identify the pack the analytics were learnt on.
+//
+typedef struct _ASTON_BATTERY_WMI_HEALTH
+{
+    ULONG Flags;
+    ULONG ChemId;
+    ULONG ManufacturerInfoHash;
+    ASTON_BATTERY_HEALTH Health;
+} ASTON_BATTERY_WMI_HEALTH, * PASTON_BATTERY_WMI_HEALTH;
+
+//
+// Data of the AstonBattery_SpbStatistics WMI block, counted since the
+// device started. Writes include the address writes that start reads.
+//
+typedef struct _ASTON_BATTERY_WMI_SPB_STATISTICS
+{
+    ULONG GaugeCount;
+    ULONG Reserved;
+    ULONGLONG Reads[ASTON_BATTERY_MAX_GAUGES];
+    ULONGLONG Writes[ASTON_BATTERY_MAX_GAUGES];
+    ULONGLONG Failures[ASTON_BATTERY_MAX_GAUGES];
+    ULONGLONG BytesRead[ASTON_BATTERY_MAX_GAUGES];
+    ULONGLONG BytesWritten[ASTON_BATTERY_MAX_GAUGES];
+} ASTON_BATTERY_WMI_SPB_STATISTICS, * PASTON_BATTERY_WMI_SPB_STATISTICS;
+
+//
+// Locks of the driver in ASTON_BATTERY_WMI_LOCK_STATISTICS, the SPB lock
+// comes once per gauge
+//
+#define ASTON_BATTERY_LOCK_STATE                0
+#define ASTON_BATTERY_LOCK_CLASS_INIT           1
+#define ASTON_BATTERY_LOCK_SPB                  2
+#define ASTON_BATTERY_LOCK_COUNT                (ASTON_BATTERY_LOCK_SPB + ASTON_BATTERY_MAX_GAUGES)
+#define ASTON_BATTERY_LOCK_HISTOGRAM_BUCKETS    24
+#define ASTON_BATTERY_LOCK_SITE_LENGTH          48
+
+//
+// Statistics of one lock since the device started. Times are in
+// microseconds. Histogram bucket 0 counts durations under 1 us, bucket i
+// those from 2^(i-1) us up to 2^i us and the last one everything slower.
+// Uncontended acquisitions land in bucket 0 of WaitHistogram.
+// MaxHoldFunction and MaxHoldLine give the call site that held the lock
+// the longest, the function name is zero terminated and may be truncated.
+//
+typedef struct _ASTON_BATTERY_LOCK_STATISTICS
+{
+    ULONGLONG Acquisitions;
+    ULONGLONG Contentions;
+    ULONGLONG WaitUs;
+    ULONGLONG HoldUs;
+    ULONG MaxWaitUs;
+    ULONG MaxHoldUs;
+    ULONG MaxHoldLine;
+    ULONG Reserved;
+    CHAR MaxHoldFunction[ASTON_BATTERY_LOCK_SITE_LENGTH];
+    ULONG WaitHistogram[ASTON_BATTERY_LOCK_HISTOGRAM_BUCKETS];
+    ULONG HoldHistogram[ASTON_BATTERY_LOCK_HISTOGRAM_BUCKETS];
+} ASTON_BATTERY_LOCK_STATISTICS, * PASTON_BATTERY_LOCK_STATISTICS;
+
+//
+// Data of the AstonBattery_LockStatistics WMI block, indexed by the
+// ASTON_BATTERY_LOCK values. LockCount covers the SPB locks of the gauges
+// present only.
+//
+typedef struct _ASTON_BATTERY_WMI_LOCK_STATISTICS
+{
+    ULONG LockCount;
+    ULONG Reserved;
+    ASTON_BATTERY_LOCK_STATISTICS Locks[ASTON_BATTERY_LOCK_COUNT];
+} ASTON_BATTERY_WMI_LOCK_STATISTICS, * PASTON_BATTERY_WMI_LOCK_STATISTICS;
+
+#define ASTON_BATTERY_SPB_LATENCY_RESET     0x00000001
+
+typedef struct _ASTON_BATTERY_SPB_LATENCY_QUERY
+{
+    ULONG Flags;
+} ASTON_BATTERY_SPB_LATENCY_QUERY, * PASTON_BATTERY_SPB_LATENCY_QUERY;
+
+//
+// Operation of a latency row. An address write is the register pointer
+// write that starts every read. A MAC block row is keyed by the MAC
+// command and times the command write and the response read together,
+// including any wait for the bus in between.
+//
+#define ASTON_BATTERY_SPB_OPERATION_ADDRESS_WRITE   0
+#define ASTON_BATTERY_SPB_OPERATION_READ            1
+#define ASTON_BATTERY_SPB_OPERATION_WRITE           2
+#define ASTON_BATTERY_SPB_OPERATION_MAC_BLOCK       3
+
+//
+// Durations are in microseconds. Count[i] holds the transfers that took at
+// least AstonBatterySpbLatencyBucketUs(i) and less than the bound of the
+// next bucket: four buckets per octave from 16 us, the last one open ended.
+//
+typedef struct _ASTON_BATTERY_SPB_LATENCY_ROW
+{
+    USHORT Address;
+    UCHAR Operation;
+    UCHAR Gauge;
+    ULONG MaxUs;
+    ULONGLONG TotalUs;
+    ULONG Count[ASTON_BATTERY_SPB_LATENCY_BUCKETS];
+} ASTON_BATTERY_SPB_LATENCY_ROW, * PASTON_BATTERY_SPB_LATENCY_ROW;
+
+//
+// Rows holds RowCount rows in use. Dropped counts the transfers of a gauge
+// that found all of its ASTON_BATTERY_SPB_LATENCY_MAX_ROWS rows taken.
+//
+typedef struct _ASTON_BATTERY_SPB_LATENCY
+{
+    ULONG Version;
+    ULONG Size;
+    ULONG RowCount;
+    ULONG Dropped;
+    ASTON_BATTERY_SPB_LATENCY_ROW Rows[ASTON_BATTERY_MAX_GAUGES * ASTON_BATTERY_SPB_LATENCY_MAX_ROWS];
+} ASTON_BATTERY_SPB_LATENCY, * PASTON_BATTERY_SPB_LATENCY;
+
+//
+// Lower bound in microseconds of a latency bucket.
+//
+FORCEINLINE
+ULONG
+AstonBatterySpbLatencyBucketUs(
+    _In_ ULONG Bucket
+)
+{
+    if (Bucket == 0)
+    {
+        return 0;
+    }
+
+    return (4 + (Bucket & 3)) << (Bucket / 4 + 2);
+}
+
+#ifndef _KERNEL_MODE
+
+//
+// Takes a consistent copy of the shared telemetry without locking. Returns
+// FALSE if the section has a layout this header does not know.
+//
+FORCEINLINE
+BOOLEAN
+AstonBatteryReadSharedTelemetry(
+    _In_ const volatile ASTON_BATTERY_SHARED_TELEMETRY* Shared,
+    _Out_ PASTON_BATTERY_TELEMETRY Telemetry
+)
+{
+    LONG Sequence;
+
+    if (Shared->Version != ASTON_BATTERY_SHARED_TELEMETRY_VERSION ||
+        Shared->Size < sizeof(ASTON_BATTERY_SHARED_TELEMETRY))
+    {
+        return FALSE;
+    }
+
+    for (;;)
+    {
+        Sequence = ReadAcquire(&Shared->Sequence);
+        if ((Sequence & 1) == 0)
+        {
+            CopyMemory(Telemetry, (const VOID*)&Shared->Telemetry, sizeof(*Telemetry));
+            MemoryBarrier();
+            if (ReadNoFence(&Shared->Sequence) == Sequence)
+            {
+                return TRUE;
+            }
+        }
+
+        YieldProcessor();
+    }
+}
+
+#endif
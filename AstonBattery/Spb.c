@@ -28,6 +28,113 @@
 
 #define I2C_VERBOSE_LOGGING 0
 
+static
+ULONG
+SpbLatencyBucket(
+	IN ULONGLONG Microseconds
+)
+/*++
+
+  Routine Description:
+
+	Returns the histogram bucket of a duration, see SPB_LATENCY.
+
+--*/
+{
+	ULONG octave;
+	ULONG bucket;
+
+	if (Microseconds < 16)
+	{
+		return 0;
+	}
+
+	BitScanReverse64(&octave, Microseconds);
+	bucket = (octave - 4) * 4 + (ULONG)((Microseconds >> (octave - 2)) & 3);
+
+	return min(bucket, SPB_LATENCY_BUCKETS - 1);
+}
+
+static
+VOID
+SpbDoRecordLatency(
+	IN SPB_CONTEXT* SpbContext,
+	IN SPB_OPERATION Operation,
+	IN USHORT Address,
+	IN LONGLONG Ticks,
+	IN LONGLONG Frequency
+)
+/*++
+
+  Routine Description:
+
+	Adds a transfer to the row of its register and operation, creating the
+	row on first use. Called with the SPB lock held. Transfers that would
+	need a row past SPB_LATENCY_MAX_ROWS are only counted as dropped. The
+	transfer is also traced under the activity of the thread, so that it
+	nests under the query it was made for. The event is verbose under the
+	bus keyword and costs one enablement check while no session asks for
+	it.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+	Operation  - The kind of transfer
+	Address    - The I2C register address, or the MAC command
+	Ticks      - The duration of the transfer in performance counter ticks
+	Frequency  - The frequency of the performance counter
+
+--*/
+{
+	SPB_LATENCY* latency;
+	SPB_LATENCY_ROW* row;
+	ULONGLONG microseconds;
+	ULONG i;
+
+	latency = &SpbContext->Latency;
+	row = NULL;
+	microseconds = (ULONGLONG)max(Ticks, 0) * 1000000 / (ULONGLONG)Frequency;
+
+	TraceLoggingWrite(
+		AstonBatteryTraceLoggingProvider,
+		"SpbTransfer",
+		TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+		TraceLoggingKeyword(ASTON_BATTERY_KEYWORD_BUS),
+		TraceLoggingUInt8((UINT8)Operation, "Operation"),
+		TraceLoggingHexUInt16(Address, "Address"),
+		TraceLoggingUInt64(microseconds, "DurationUs"));
+
+	for (i = 0; i < latency->RowCount; i++)
+	{
+		if (latency->Rows[i].Address == Address &&
+			latency->Rows[i].Operation == (UCHAR)Operation)
+		{
+			row = &latency->Rows[i];
+			break;
+		}
+	}
+
+	if (row == NULL)
+	{
+		if (latency->RowCount == SPB_LATENCY_MAX_ROWS)
+		{
+			latency->Dropped += 1;
+			return;
+		}
+
+		row = &latency->Rows[latency->RowCount];
+		latency->RowCount += 1;
+
+		RtlZeroMemory(row, sizeof(*row));
+		row->Address = Address;
+		row->Operation = (UCHAR)Operation;
+	}
+
+	row->Count[SpbLatencyBucket(microseconds)] += 1;
+	row->TotalUs += microseconds;
+	row->MaxUs = (ULONG)min(max(microseconds, row->MaxUs), MAXULONG);
+}
+
 NTSTATUS
 SpbDoWriteDataSynchronously(
 	IN SPB_CONTEXT* SpbContext,
@@ -59,6 +166,9 @@ SpbDoWriteDataSynchronously(
 	ULONG length;
 	WDFMEMORY memory;
 	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+	LARGE_INTEGER start;
+	LARGE_INTEGER end;
+	LARGE_INTEGER frequency;
 	NTSTATUS status;
 
 	//
@@ -123,6 +233,8 @@ SpbDoWriteDataSynchronously(
 	DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, "\n");
 #endif
 
+	start = KeQueryPerformanceCounter(NULL);
+
 	status = WdfIoTargetSendWriteSynchronously(
 		SpbContext->SpbIoTarget,
 		NULL,
@@ -131,8 +243,19 @@ SpbDoWriteDataSynchronously(
 		NULL,
 		NULL);
 
+	end = KeQueryPerformanceCounter(&frequency);
+
+	SpbDoRecordLatency(
+		SpbContext,
+		(Length == 0) ? SpbOperationAddressWrite : SpbOperationWrite,
+		Address,
+		end.QuadPart - start.QuadPart,
+		frequency.QuadPart);
+
+	InterlockedIncrement64(&SpbContext->Statistics.Writes);
 	if (!NT_SUCCESS(status))
 	{
+		InterlockedIncrement64(&SpbContext->Statistics.Failures);
 		Trace(
 			TRACE_LEVEL_ERROR,
 			SURFACE_BATTERY_ERROR,
@@ -141,6 +264,8 @@ SpbDoWriteDataSynchronously(
 		goto exit;
 	}
 
+	InterlockedAdd64(&SpbContext->Statistics.BytesWritten, length);
+
 exit:
 
 	if (NULL != memory)
@@ -181,7 +306,7 @@ SpbWriteDataSynchronously(
 {
 	NTSTATUS status;
 
-	WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+	WaitLockAcquire(SpbContext->SpbLock, &SpbContext->SpbLockStatistics);
 
 	status = SpbDoWriteDataSynchronously(
 		SpbContext,
@@ -189,13 +314,13 @@ SpbWriteDataSynchronously(
 		Data,
 		Length);
 
-	WdfWaitLockRelease(SpbContext->SpbLock);
+	WaitLockRelease(SpbContext->SpbLock, &SpbContext->SpbLockStatistics);
 
 	return status;
 }
 
 NTSTATUS
-SpbReadDataSynchronously(
+SpbDoReadDataSynchronously(
 	IN SPB_CONTEXT* SpbContext,
 	IN UCHAR Address,
 	_In_reads_bytes_(Length) PVOID Data,
@@ -206,7 +331,8 @@ SpbReadDataSynchronously(
   Routine Description:
 
 	This helper routine abstracts creating and sending an I/O
-	request (I2C Read) to the Spb I/O target.
+	request (I2C Read) to the Spb I/O target. Called with the
+	SPB lock held.
 
   Arguments:
 
@@ -224,11 +350,12 @@ SpbReadDataSynchronously(
 	PUCHAR buffer;
 	WDFMEMORY memory;
 	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+	LARGE_INTEGER start;
+	LARGE_INTEGER end;
+	LARGE_INTEGER frequency;
 	NTSTATUS status;
 	ULONG_PTR bytesRead;
 
-	WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
-
 	memory = NULL;
 	status = STATUS_INVALID_PARAMETER;
 	bytesRead = 0;
@@ -287,6 +414,7 @@ SpbReadDataSynchronously(
 			Length);
 	}
 
+	start = KeQueryPerformanceCounter(NULL);
 
 	status = WdfIoTargetSendReadSynchronously(
 		SpbContext->SpbIoTarget,
@@ -296,9 +424,21 @@ SpbReadDataSynchronously(
 		NULL,
 		&bytesRead);
 
+	end = KeQueryPerformanceCounter(&frequency);
+
+	SpbDoRecordLatency(
+		SpbContext,
+		SpbOperationRead,
+		Address,
+		end.QuadPart - start.QuadPart,
+		frequency.QuadPart);
+
+	InterlockedIncrement64(&SpbContext->Statistics.Reads);
+	InterlockedAdd64(&SpbContext->Statistics.BytesRead, (LONG64)bytesRead);
 	if (!NT_SUCCESS(status) ||
 		bytesRead != Length)
 	{
+		InterlockedIncrement64(&SpbContext->Statistics.Failures);
 		Trace(
 			TRACE_LEVEL_ERROR,
 			SURFACE_BATTERY_ERROR,
@@ -328,11 +468,204 @@ exit:
 		WdfObjectDelete(memory);
 	}
 
-	WdfWaitLockRelease(SpbContext->SpbLock);
+	return status;
+}
+
+NTSTATUS
+SpbReadDataSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR Address,
+	_In_reads_bytes_(Length) PVOID Data,
+	IN ULONG Length
+)
+/*++
+
+  Routine Description:
+
+	This routine abstracts creating and sending an I/O
+	request (I2C Read) to the Spb I/O target and utilizes
+	a helper routine to do work inside of locked code.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+	Address    - The I2C register address to read from
+	Data       - A buffer to receive the data at at the above address
+	Length     - The amount of data to be read from the above address
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
+	NTSTATUS status;
+
+	WaitLockAcquire(SpbContext->SpbLock, &SpbContext->SpbLockStatistics);
+
+	status = SpbDoReadDataSynchronously(
+		SpbContext,
+		Address,
+		Data,
+		Length);
+
+	WaitLockRelease(SpbContext->SpbLock, &SpbContext->SpbLockStatistics);
+
+	return status;
+}
+
+NTSTATUS
+SpbWriteReadDataSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR WriteAddress,
+	IN PVOID WriteData,
+	IN ULONG WriteLength,
+	IN UCHAR ReadAddress,
+	_In_reads_bytes_(ReadLength) PVOID ReadData,
+	IN ULONG ReadLength
+)
+/*++
+
+  Routine Description:
+
+	This routine writes a register and then reads another one
+	without releasing the SPB lock in between, for commands whose
+	response is read back from a different register, such as the
+	ManufacturerAccess commands. No other transfer on the target
+	can come between the command and its response.
+
+  Arguments:
+
+	SpbContext   - Pointer to the current device context
+	WriteAddress - The I2C register address to write to
+	WriteData    - The data to write at the above address
+	WriteLength  - The amount of data to write
+	ReadAddress  - The I2C register address to read from
+	ReadData     - A buffer to receive the data at that address
+	ReadLength   - The amount of data to be read
+
+  Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+--*/
+{
+	NTSTATUS status;
+
+	WaitLockAcquire(SpbContext->SpbLock, &SpbContext->SpbLockStatistics);
+
+	status = SpbDoWriteDataSynchronously(
+		SpbContext,
+		WriteAddress,
+		WriteData,
+		WriteLength);
+
+	if (!NT_SUCCESS(status))
+	{
+		goto exit;
+	}
+
+	status = SpbDoReadDataSynchronously(
+		SpbContext,
+		ReadAddress,
+		ReadData,
+		ReadLength);
+
+exit:
+	WaitLockRelease(SpbContext->SpbLock, &SpbContext->SpbLockStatistics);
 
 	return status;
 }
 
+VOID
+SpbRecordLatency(
+	IN SPB_CONTEXT* SpbContext,
+	IN SPB_OPERATION Operation,
+	IN USHORT Address,
+	IN LONGLONG Ticks,
+	IN LONGLONG Frequency
+)
+/*++
+
+  Routine Description:
+
+	This routine adds a transfer timed by the caller, such as a MAC block
+	spanning several transfers, to the latency histograms.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+	Operation  - The kind of transfer
+	Address    - The I2C register address, or the MAC command
+	Ticks      - The duration of the transfer in performance counter ticks
+	Frequency  - The frequency of the performance counter
+
+  Return Value:
+
+	None
+
+--*/
+{
+	WaitLockAcquire(SpbContext->SpbLock, &SpbContext->SpbLockStatistics);
+
+	SpbDoRecordLatency(
+		SpbContext,
+		Operation,
+		Address,
+		Ticks,
+		Frequency);
+
+	WaitLockRelease(SpbContext->SpbLock, &SpbContext->SpbLockStatistics);
+}
+
+ULONG
+SpbQueryLatency(
+	IN SPB_CONTEXT* SpbContext,
+	_Out_writes_(MaxRows) SPB_LATENCY_ROW* Rows,
+	IN ULONG MaxRows,
+	OUT PULONG Dropped,
+	IN BOOLEAN Reset
+)
+/*++
+
+  Routine Description:
+
+	This routine copies the latency histograms and optionally clears them,
+	in one hold of the SPB lock so that no transfer is lost in between.
+
+  Arguments:
+
+	SpbContext - Pointer to the current device context
+	Rows       - A buffer to receive the rows in use
+	MaxRows    - The number of rows the buffer holds
+	Dropped    - Receives the number of transfers that found no free row
+	Reset      - Clears the histograms after the copy
+
+  Return Value:
+
+	The number of rows copied
+
+--*/
+{
+	ULONG count;
+
+	WaitLockAcquire(SpbContext->SpbLock, &SpbContext->SpbLockStatistics);
+
+	count = min(SpbContext->Latency.RowCount, MaxRows);
+	RtlCopyMemory(Rows, SpbContext->Latency.Rows, count * sizeof(SPB_LATENCY_ROW));
+	*Dropped = SpbContext->Latency.Dropped;
+
+	if (Reset)
+	{
+		SpbContext->Latency.RowCount = 0;
+		SpbContext->Latency.Dropped = 0;
+	}
+
+	WaitLockRelease(SpbContext->SpbLock, &SpbContext->SpbLockStatistics);
+
+	return count;
+}
+
 VOID
 SpbTargetDeinitialize(
 	IN WDFDEVICE FxDevice,
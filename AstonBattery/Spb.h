@@ -22,11 +22,62 @@
 
 #include <wdm.h>
 #include <wdf.h>
+#include "lock.h"
 
 #define DEFAULT_SPB_BUFFER_SIZE 64
 
 #define SPB_POOL_TAG 'bpSB'
 
+//
+// Transfer counters, updated with interlocked operations so that they can
+// be read without waiting for the bus
+//
+
+typedef struct _SPB_STATISTICS
+{
+	volatile LONG64 Reads;
+	volatile LONG64 Writes;
+	volatile LONG64 Failures;
+	volatile LONG64 BytesRead;
+	volatile LONG64 BytesWritten;
+} SPB_STATISTICS;
+
+//
+// Latency histograms of the transfers, one row per register address and
+// operation, kept under the SPB lock. Durations are in microseconds, bucket
+// 0 holds those under 20 us, then every octave from 16 us is split in four
+// buckets, the last one also holding everything slower. The MAC block rows
+// are keyed by the MAC command and time the whole command write and read.
+//
+
+#define SPB_LATENCY_BUCKETS 64
+#define SPB_LATENCY_MAX_ROWS 48
+
+typedef enum _SPB_OPERATION
+{
+	SpbOperationAddressWrite,
+	SpbOperationRead,
+	SpbOperationWrite,
+	SpbOperationMacBlock
+} SPB_OPERATION;
+
+typedef struct _SPB_LATENCY_ROW
+{
+	USHORT Address;
+	UCHAR Operation;
+	UCHAR Reserved;
+	ULONG MaxUs;
+	ULONGLONG TotalUs;
+	ULONG Count[SPB_LATENCY_BUCKETS];
+} SPB_LATENCY_ROW;
+
+typedef struct _SPB_LATENCY
+{
+	ULONG RowCount;
+	ULONG Dropped;
+	SPB_LATENCY_ROW Rows[SPB_LATENCY_MAX_ROWS];
+} SPB_LATENCY;
+
 //
 // SPB (I2C) context
 //
@@ -38,6 +89,9 @@ typedef struct _SPB_CONTEXT
 	WDFMEMORY WriteMemory;
 	WDFMEMORY ReadMemory;
 	WDFWAITLOCK SpbLock;
+	LOCK_STATISTICS SpbLockStatistics;
+	SPB_STATISTICS Statistics;
+	SPB_LATENCY Latency;
 } SPB_CONTEXT;
 
 
@@ -49,6 +103,24 @@ SpbReadDataSynchronously(
 	IN ULONG Length
 );
 
+ULONG
+SpbQueryLatency(
+	IN SPB_CONTEXT* SpbContext,
+	_Out_writes_(MaxRows) SPB_LATENCY_ROW* Rows,
+	IN ULONG MaxRows,
+	OUT PULONG Dropped,
+	IN BOOLEAN Reset
+);
+
+VOID
+SpbRecordLatency(
+	IN SPB_CONTEXT* SpbContext,
+	IN SPB_OPERATION Operation,
+	IN USHORT Address,
+	IN LONGLONG Ticks,
+	IN LONGLONG Frequency
+);
+
 VOID
 SpbTargetDeinitialize(
 	IN WDFDEVICE FxDevice,
@@ -67,4 +139,15 @@ SpbWriteDataSynchronously(
 	IN UCHAR Address,
 	IN PVOID Data,
 	IN ULONG Length
+);
+
+NTSTATUS
+SpbWriteReadDataSynchronously(
+	IN SPB_CONTEXT* SpbContext,
+	IN UCHAR WriteAddress,
+	IN PVOID WriteData,
+	IN ULONG WriteLength,
+	IN UCHAR ReadAddress,
+	_In_reads_bytes_(ReadLength) PVOID ReadData,
+	IN ULONG ReadLength
 );
\ No newline at end of file
@@ -32,6 +32,31 @@ Environment:
         WPP_DEFINE_BIT(SURFACE_BATTERY_INFO)                                    \
         )                             
 
+//
+// Compile-time verbosity ceiling. A Trace call above it is wrapped in a
+// constant false condition by WPP_LEVEL_FLAGS_PRE, so the build contains
+// no code for it, neither the ETW nor the in-flight recorder path. Release
+// builds stop at TRACE_LEVEL_INFORMATION, the per-query traces are
+// TRACE_LEVEL_VERBOSE. Define ASTON_BATTERY_TRACE_LEVEL_MAX to override.
+//
+
+#ifndef ASTON_BATTERY_TRACE_LEVEL_MAX
+#if DBG
+#define ASTON_BATTERY_TRACE_LEVEL_MAX       TRACE_LEVEL_VERBOSE
+#else
+#define ASTON_BATTERY_TRACE_LEVEL_MAX       TRACE_LEVEL_INFORMATION
+#endif
+#endif
+
+#define ASTON_BATTERY_TRACE_LEVEL_ENABLED(lvl) \
+           ((lvl) <= ASTON_BATTERY_TRACE_LEVEL_MAX)
+
+#define WPP_LEVEL_FLAGS_PRE(lvl, flags) \
+           { if (ASTON_BATTERY_TRACE_LEVEL_ENABLED(lvl)) {
+
+#define WPP_LEVEL_FLAGS_POST(lvl, flags) \
+           ; } }
+
 #define WPP_FLAG_LEVEL_LOGGER(flag, level)                                  \
     WPP_LEVEL_LOGGER(flag)
 
@@ -60,4 +85,24 @@ Environment:
 // begin_wpp config
 // FUNC Trace(LEVEL, FLAGS, MSG, ...);
 // end_wpp
-//
\ No newline at end of file
+//
+
+//
+// TraceLogging provider of the activity events and of the binary events of
+// the query paths, see activity.c, of the bus transfers and of the safety
+// status edges. The GUID is the one ETW derives from the
+// name, so sessions can enable *Aston.Battery. These events are never
+// compiled out: a TraceLoggingWrite nobody listens to is one enablement
+// check, its fields are only evaluated for an enabled session.
+//
+// Provider GUID - b812b784-f106-5a8d-5c1f-ea9f794c46a1
+//
+
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+
+TRACELOGGING_DECLARE_PROVIDER(AstonBatteryTraceLoggingProvider);
+
+#define ASTON_BATTERY_KEYWORD_QUERY         0x0000000000000001
+#define ASTON_BATTERY_KEYWORD_BUS           0x0000000000000002
+#define ASTON_BATTERY_KEYWORD_SAFETY        0x0000000000000004
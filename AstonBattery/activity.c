@@ -0,0 +1,354 @@
+/*++
+
+Module Name:
+
+	activity.c
+
+Abstract:
+
+	This module traces the path of a battery query as TraceLogging
+	activities of the Aston.Battery provider. A span sets its activity as
+	the one of the thread while it runs, so the cache decision and the SPB
+	transfers it causes carry its activity ID and WPA can nest them under it.
+
+	The class driver answers battery IOCTLs from its own worker thread. The
+	miniclass callbacks are therefore related to the latest device control
+	IRP that entered the class driver, which is exact while the queries of
+	the battery do not overlap.
+
+	The battery information and status returned to the class driver are
+	traced here as binary events, in place of formatted WPP dumps.
+
+	Nothing but the enablement check runs while no session has the provider
+	enabled.
+
+	N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "AstonBattery.h"
+
+//------------------------------------------------------------------ Definitions
+
+//
+// Aston.Battery, b812b784-f106-5a8d-5c1f-ea9f794c46a1
+//
+
+TRACELOGGING_DEFINE_PROVIDER(AstonBatteryTraceLoggingProvider,
+	"Aston.Battery",
+	(0xb812b784, 0xf106, 0x5a8d, 0x5c, 0x1f, 0xea, 0x9f, 0x79, 0x4c, 0x46, 0xa1));
+
+#define AstonBatteryWriteStart(Name, Activity, Related, ...) \
+	TraceLoggingWriteActivity(AstonBatteryTraceLoggingProvider, \
+		Name, \
+		&(Activity)->Id, \
+		(Related), \
+		TraceLoggingOpcode(WINEVENT_OPCODE_START), \
+		TraceLoggingLevel(WINEVENT_LEVEL_INFO), \
+		TraceLoggingKeyword(ASTON_BATTERY_KEYWORD_QUERY), \
+		__VA_ARGS__)
+
+#define AstonBatteryWriteStop(Name, Activity, DurationUs, Status) \
+	TraceLoggingWriteActivity(AstonBatteryTraceLoggingProvider, \
+		Name, \
+		&(Activity)->Id, \
+		NULL, \
+		TraceLoggingOpcode(WINEVENT_OPCODE_STOP), \
+		TraceLoggingLevel(WINEVENT_LEVEL_INFO), \
+		TraceLoggingKeyword(ASTON_BATTERY_KEYWORD_QUERY), \
+		TraceLoggingUInt64((DurationUs), "DurationUs"), \
+		TraceLoggingNTStatus((Status), "Status"))
+
+//-------------------------------------------------------------------- Functions
+
+_Use_decl_annotations_
+VOID
+AstonBatteryStartActivity(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	PASTON_BATTERY_ACTIVITY Activity,
+	ASTON_BATTERY_ACTIVITY_KIND Kind,
+	ULONG Detail
+)
+
+/*++
+
+Routine Description:
+
+	Starts an activity and makes it the activity of the current thread until
+	it is stopped.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Activity - Supplies the state of the activity, kept by the caller until
+		it calls AstonBatteryStopActivity.
+
+	Kind - Supplies the traced span.
+
+	Detail - Supplies the IOCTL of a device control, the information level
+		of an information query or set, zero otherwise.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	GUID Related;
+	KIRQL Irql;
+
+	RtlZeroMemory(Activity, sizeof(*Activity));
+	Activity->Kind = Kind;
+	Activity->Enabled = TraceLoggingProviderEnabled(AstonBatteryTraceLoggingProvider,
+		WINEVENT_LEVEL_INFO,
+		ASTON_BATTERY_KEYWORD_QUERY);
+
+	if (!Activity->Enabled)
+	{
+		return;
+	}
+
+	(VOID)EtwActivityIdControl(EVENT_ACTIVITY_CTRL_CREATE_ID, &Activity->Id);
+	Activity->Previous = Activity->Id;
+	(VOID)EtwActivityIdControl(EVENT_ACTIVITY_CTRL_GET_SET_ID, &Activity->Previous);
+	Activity->Start = KeQueryPerformanceCounter(NULL);
+
+	Related = Activity->Previous;
+	switch (Kind)
+	{
+	case AstonBatteryActivityDeviceControl:
+		KeAcquireSpinLock(&DevExt->ActivityLock, &Irql);
+		DevExt->ClassActivity = Activity->Id;
+		KeReleaseSpinLock(&DevExt->ActivityLock, Irql);
+
+		AstonBatteryWriteStart("DeviceControl", Activity, &Related,
+			TraceLoggingHexUInt32(Detail, "IoControlCode"));
+
+		break;
+
+	case AstonBatteryActivityQueryTag:
+	case AstonBatteryActivityQueryInformation:
+	case AstonBatteryActivityQueryStatus:
+	case AstonBatteryActivitySetInformation:
+		KeAcquireSpinLock(&DevExt->ActivityLock, &Irql);
+		Related = DevExt->ClassActivity;
+		KeReleaseSpinLock(&DevExt->ActivityLock, Irql);
+
+		if (Kind == AstonBatteryActivityQueryTag)
+		{
+			AstonBatteryWriteStart("QueryTag", Activity, &Related,
+				TraceLoggingUInt32(Detail, "Reserved"));
+		}
+		else if (Kind == AstonBatteryActivityQueryInformation)
+		{
+			AstonBatteryWriteStart("QueryInformation", Activity, &Related,
+				TraceLoggingUInt32(Detail, "Level"));
+		}
+		else if (Kind == AstonBatteryActivityQueryStatus)
+		{
+			AstonBatteryWriteStart("QueryStatus", Activity, &Related,
+				TraceLoggingUInt32(Detail, "Reserved"));
+		}
+		else
+		{
+			AstonBatteryWriteStart("SetInformation", Activity, &Related,
+				TraceLoggingUInt32(Detail, "Level"));
+		}
+
+		break;
+
+	default:
+		AstonBatteryWriteStart("SnapshotRefresh", Activity, &Related,
+			TraceLoggingUInt32(Detail, "Reserved"));
+
+		break;
+	}
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryStopActivity(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	PASTON_BATTERY_ACTIVITY Activity,
+	NTSTATUS Status
+)
+
+/*++
+
+Routine Description:
+
+	Stops an activity with its duration and outcome and gives the thread
+	back the activity it had before.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Activity - Supplies the state set by AstonBatteryStartActivity.
+
+	Status - Supplies the outcome of the span.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	LARGE_INTEGER Now;
+	ULONGLONG DurationUs;
+
+	if (!Activity->Enabled)
+	{
+		return;
+	}
+
+	Now = KeQueryPerformanceCounter(NULL);
+	DurationUs = (ULONGLONG)(Now.QuadPart - Activity->Start.QuadPart) * 1000000 /
+		(ULONGLONG)DevExt->QpcFrequency.QuadPart;
+
+	switch (Activity->Kind)
+	{
+	case AstonBatteryActivityDeviceControl:
+		AstonBatteryWriteStop("DeviceControl", Activity, DurationUs, Status);
+		break;
+
+	case AstonBatteryActivityQueryTag:
+		AstonBatteryWriteStop("QueryTag", Activity, DurationUs, Status);
+		break;
+
+	case AstonBatteryActivityQueryInformation:
+		AstonBatteryWriteStop("QueryInformation", Activity, DurationUs, Status);
+		break;
+
+	case AstonBatteryActivityQueryStatus:
+		AstonBatteryWriteStop("QueryStatus", Activity, DurationUs, Status);
+		break;
+
+	case AstonBatteryActivitySetInformation:
+		AstonBatteryWriteStop("SetInformation", Activity, DurationUs, Status);
+		break;
+
+	default:
+		AstonBatteryWriteStop("SnapshotRefresh", Activity, DurationUs, Status);
+		break;
+	}
+
+	(VOID)EtwActivityIdControl(EVENT_ACTIVITY_CTRL_SET_ID, &Activity->Previous);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryTraceSnapshotLookup(
+	BOOLEAN Hit,
+	ULONGLONG AgeUs,
+	ULONG MaxAgeMs
+)
+
+/*++
+
+Routine Description:
+
+	Traces whether a snapshot lookup was answered from the cache, under the
+	activity of the thread.
+
+Arguments:
+
+	Hit - Supplies TRUE if the cached snapshot was recent enough.
+
+	AgeUs - Supplies the age of the cached snapshot, zero if none was valid.
+
+	MaxAgeMs - Supplies the maximum age the caller accepted.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	TraceLoggingWrite(AstonBatteryTraceLoggingProvider,
+		"SnapshotLookup",
+		TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+		TraceLoggingKeyword(ASTON_BATTERY_KEYWORD_QUERY),
+		TraceLoggingBoolean(Hit, "Hit"),
+		TraceLoggingUInt64(AgeUs, "AgeUs"),
+		TraceLoggingUInt32(MaxAgeMs, "MaxAgeMs"));
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryTraceBatteryInformation(
+	const BATTERY_INFORMATION* Information
+)
+
+/*++
+
+Routine Description:
+
+	Traces the battery information returned to the class driver as one
+	binary event, under the activity of the thread.
+
+Arguments:
+
+	Information - Supplies the returned battery information.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	TraceLoggingWrite(AstonBatteryTraceLoggingProvider,
+		"BatteryInformation",
+		TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+		TraceLoggingKeyword(ASTON_BATTERY_KEYWORD_QUERY),
+		TraceLoggingHexUInt32(Information->Capabilities, "Capabilities"),
+		TraceLoggingUInt8(Information->Technology, "Technology"),
+		TraceLoggingCharArray((const char*)Information->Chemistry, 4, "Chemistry"),
+		TraceLoggingUInt32(Information->DesignedCapacity, "DesignedCapacity"),
+		TraceLoggingUInt32(Information->FullChargedCapacity, "FullChargedCapacity"),
+		TraceLoggingUInt32(Information->DefaultAlert1, "DefaultAlert1"),
+		TraceLoggingUInt32(Information->DefaultAlert2, "DefaultAlert2"),
+		TraceLoggingUInt32(Information->CriticalBias, "CriticalBias"),
+		TraceLoggingUInt32(Information->CycleCount, "CycleCount"));
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryTraceBatteryStatus(
+	const BATTERY_STATUS* BatteryStatus
+)
+
+/*++
+
+Routine Description:
+
+	Traces the battery status returned to the class driver as one binary
+	event, under the activity of the thread.
+
+Arguments:
+
+	BatteryStatus - Supplies the returned battery status.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	TraceLoggingWrite(AstonBatteryTraceLoggingProvider,
+		"BatteryStatus",
+		TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+		TraceLoggingKeyword(ASTON_BATTERY_KEYWORD_QUERY),
+		TraceLoggingHexUInt32(BatteryStatus->PowerState, "PowerState"),
+		TraceLoggingUInt32(BatteryStatus->Capacity, "Capacity"),
+		TraceLoggingUInt32(BatteryStatus->Voltage, "Voltage"),
+		TraceLoggingInt32((LONG)BatteryStatus->Rate, "Rate"));
+}
@@ -0,0 +1,1006 @@
+/*++
+
+Module Name:
+
+	archive.c
+
+Abstract:
+
+	This module keeps the history of the battery: it stores samples in the
+	ring, encodes every few of them into the blocks of the long term
+	archive and decodes them back, and checkpoints both to the history file
+	and restores them from it. Every field of an archived sample is stored
+	as the zigzag varint of its difference to the previous sample, so a
+	slowly moving battery costs about one byte per field.
+
+	Everything here works on a ring, an archive and a file passed in by the
+	caller, without locks, allocations or direct I/O. Nothing read back
+	from the file is trusted: decoding stops at the used part of a block.
+
+	N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "archive.h"
+
+//------------------------------------------------------------------ Definitions
+
+C_ASSERT((sizeof(ASTON_BATTERY_HISTORY_HEADER) % sizeof(LONGLONG)) == 0);
+C_ASSERT((sizeof(ASTON_BATTERY_HISTORY_RECORD) % sizeof(LONGLONG)) == 0);
+
+const ASTON_BATTERY_HISTORY_COLUMN AstonBatteryHistoryColumns[ASTON_BATTERY_HISTORY_FIELDS] =
+{
+	{ FIELD_OFFSET(ASTON_BATTERY_HISTORY_HEADER, TimestampOffset), sizeof(LONGLONG) },
+	{ FIELD_OFFSET(ASTON_BATTERY_HISTORY_HEADER, RateOffset), sizeof(LONG) },
+	{ FIELD_OFFSET(ASTON_BATTERY_HISTORY_HEADER, SafetyStatusOffset), sizeof(ULONG) },
+	{ FIELD_OFFSET(ASTON_BATTERY_HISTORY_HEADER, VoltageOffset), sizeof(USHORT) },
+	{ FIELD_OFFSET(ASTON_BATTERY_HISTORY_HEADER, CurrentOffset), sizeof(SHORT) },
+	{ FIELD_OFFSET(ASTON_BATTERY_HISTORY_HEADER, TemperatureOffset), sizeof(USHORT) },
+	{ FIELD_OFFSET(ASTON_BATTERY_HISTORY_HEADER, RemainingCapacityOffset), sizeof(USHORT) },
+	{ FIELD_OFFSET(ASTON_BATTERY_HISTORY_HEADER, FullChargeCapacityOffset), sizeof(USHORT) },
+	{ FIELD_OFFSET(ASTON_BATTERY_HISTORY_HEADER, BatteryStatusOffset), sizeof(USHORT) },
+};
+
+//-------------------------------------------------------------------- Functions
+
+_Use_decl_annotations_
+VOID
+AstonBatteryLayoutHistory(
+	ULONG Entries,
+	PASTON_BATTERY_HISTORY_HEADER Header
+)
+
+/*++
+
+Routine Description:
+
+	Fills the header of a history blob holding the given number of samples,
+	with the columns following the header back to back.
+
+Arguments:
+
+	Entries - Supplies the number of samples.
+
+	Header - Receives the header.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	ULONG Column;
+	ULONG Offset;
+
+	RtlZeroMemory(Header, sizeof(*Header));
+	Header->Version = ASTON_BATTERY_HISTORY_VERSION;
+	Header->Capacity = ASTON_BATTERY_HISTORY_CAPACITY;
+	Header->Count = Entries;
+
+	Offset = sizeof(*Header);
+	for (Column = 0; Column < ASTON_BATTERY_HISTORY_FIELDS; Column++)
+	{
+		AstonBatteryHistoryColumnOffset(Header, Column) = Offset;
+		Offset += Entries * AstonBatteryHistoryColumns[Column].ElementSize;
+	}
+
+	Header->Size = Offset;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryInitializeHistory(
+	PASTON_BATTERY_HISTORY History,
+	PUCHAR Buffer
+)
+
+/*++
+
+Routine Description:
+
+	Sets up an empty ring over a buffer of the size the layout of a full
+	ring gives.
+
+Arguments:
+
+	History - Receives the ring.
+
+	Buffer - Supplies the buffer of the columns.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	RtlZeroMemory(History, sizeof(*History));
+	AstonBatteryLayoutHistory(ASTON_BATTERY_HISTORY_CAPACITY, &History->Layout);
+	RtlZeroMemory(Buffer, History->Layout.Size);
+
+	History->Timestamp = (PLONGLONG)(Buffer + History->Layout.TimestampOffset);
+	History->Rate = (PLONG)(Buffer + History->Layout.RateOffset);
+	History->SafetyStatus = (PULONG)(Buffer + History->Layout.SafetyStatusOffset);
+	History->Voltage = (PUSHORT)(Buffer + History->Layout.VoltageOffset);
+	History->Current = (PSHORT)(Buffer + History->Layout.CurrentOffset);
+	History->Temperature = (PUSHORT)(Buffer + History->Layout.TemperatureOffset);
+	History->RemainingCapacity = (PUSHORT)(Buffer + History->Layout.RemainingCapacityOffset);
+	History->FullChargeCapacity = (PUSHORT)(Buffer + History->Layout.FullChargeCapacityOffset);
+	History->BatteryStatus = (PUSHORT)(Buffer + History->Layout.BatteryStatusOffset);
+}
+
+static
+VOID
+AstonBatteryStoreHistoryRecord(
+	_Inout_ PASTON_BATTERY_HISTORY History,
+	_In_ ULONG Slot,
+	_In_ const ASTON_BATTERY_HISTORY_RECORD* Record
+)
+{
+	History->Timestamp[Slot] = Record->Timestamp;
+	History->Rate[Slot] = Record->Rate;
+	History->SafetyStatus[Slot] = Record->SafetyStatus;
+	History->Voltage[Slot] = Record->Voltage;
+	History->Current[Slot] = Record->Current;
+	History->Temperature[Slot] = Record->Temperature;
+	History->RemainingCapacity[Slot] = Record->RemainingCapacity;
+	History->FullChargeCapacity[Slot] = Record->FullChargeCapacity;
+	History->BatteryStatus[Slot] = Record->BatteryStatus;
+}
+
+static
+VOID
+AstonBatteryLoadHistoryRecord(
+	_In_ const ASTON_BATTERY_HISTORY* History,
+	_In_ ULONG Slot,
+	_Out_ PASTON_BATTERY_HISTORY_RECORD Record
+)
+{
+	Record->Timestamp = History->Timestamp[Slot];
+	Record->Rate = History->Rate[Slot];
+	Record->SafetyStatus = History->SafetyStatus[Slot];
+	Record->Voltage = History->Voltage[Slot];
+	Record->Current = History->Current[Slot];
+	Record->Temperature = History->Temperature[Slot];
+	Record->RemainingCapacity = History->RemainingCapacity[Slot];
+	Record->FullChargeCapacity = History->FullChargeCapacity[Slot];
+	Record->BatteryStatus = History->BatteryStatus[Slot];
+	Record->Reserved = 0;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryRecordHistory(
+	PASTON_BATTERY_HISTORY History,
+	PASTON_BATTERY_ARCHIVE Archive,
+	const ASTON_BATTERY_HISTORY_RECORD* Record,
+	LONGLONG QpcFrequency
+)
+
+/*++
+
+Routine Description:
+
+	Appends a sample to the ring, overwriting the oldest one once the ring
+	is full, and every ASTON_BATTERY_ARCHIVE_SAMPLE_DIVIDER samples to the
+	archive.
+
+Arguments:
+
+	History - Supplies the ring.
+
+	Archive - Supplies the archive.
+
+	Record - Supplies the sample.
+
+	QpcFrequency - Supplies the frequency of the timestamp of the sample.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	LONGLONG Values[ASTON_BATTERY_HISTORY_FIELDS];
+
+	AstonBatteryStoreHistoryRecord(History, History->Head, Record);
+	History->Head = (History->Head + 1) % ASTON_BATTERY_HISTORY_CAPACITY;
+	History->Count = min(History->Count + 1, ASTON_BATTERY_HISTORY_CAPACITY);
+	History->TotalSamples += 1;
+
+	if (Archive->SampleCountdown == 0)
+	{
+		Values[0] = AstonBatteryTicksToMs(Record->Timestamp, QpcFrequency);
+		Values[1] = Record->Rate;
+		Values[2] = Record->SafetyStatus;
+		Values[3] = Record->Voltage;
+		Values[4] = Record->Current;
+		Values[5] = Record->Temperature;
+		Values[6] = Record->RemainingCapacity;
+		Values[7] = Record->FullChargeCapacity;
+		Values[8] = Record->BatteryStatus;
+		AstonBatteryArchiveSample(Archive, Values);
+
+		Archive->SampleCountdown = ASTON_BATTERY_ARCHIVE_SAMPLE_DIVIDER;
+	}
+
+	Archive->SampleCountdown -= 1;
+}
+
+static
+ULONG
+AstonBatteryWriteVarint(
+	_Out_writes_(10) PUCHAR Destination,
+	_In_ ULONGLONG Value
+)
+{
+	ULONG Length;
+
+	Length = 0;
+	while (Value >= 0x80)
+	{
+		Destination[Length++] = (UCHAR)(Value | 0x80);
+		Value >>= 7;
+	}
+
+	Destination[Length++] = (UCHAR)Value;
+	return Length;
+}
+
+static
+BOOLEAN
+AstonBatteryReadVarint(
+	_In_reads_bytes_(Used) const UCHAR* Block,
+	_In_ ULONG Used,
+	_Inout_ PULONG Offset,
+	_Out_ PULONGLONG Value
+)
+
+/*++
+
+Routine Description:
+
+	Reads a varint of at most ten bytes that ends within the used part of a
+	block.
+
+--*/
+
+{
+	ULONG Shift;
+	UCHAR Byte;
+
+	*Value = 0;
+	Shift = 0;
+	do
+	{
+		if (*Offset >= Used)
+		{
+			return FALSE;
+		}
+
+		Byte = Block[(*Offset)++];
+		*Value |= (ULONGLONG)(Byte & 0x7F) << Shift;
+		Shift += 7;
+	} while ((Byte & 0x80) != 0 && Shift < 64);
+
+	return (Byte & 0x80) == 0;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryArchiveSample(
+	PASTON_BATTERY_ARCHIVE Archive,
+	const LONGLONG* Values
+)
+
+/*++
+
+Routine Description:
+
+	Encodes a sample at the end of the head block, moving on to the next
+	block when the sample might not fit. The caller serializes the calls on
+	an archive.
+
+--*/
+
+{
+	PASTON_BATTERY_ARCHIVE_BLOCK Entry;
+	PUCHAR Block;
+	LONGLONG Timestamp;
+	LONGLONG Interval;
+	ULONG Field;
+
+	Entry = &Archive->Index[Archive->Head];
+	if (Entry->Used + ASTON_BATTERY_ARCHIVE_MAX_SAMPLE_SIZE > ASTON_BATTERY_ARCHIVE_BLOCK_SIZE)
+	{
+		Archive->Head = (Archive->Head + 1) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+		Archive->BlockCount = min(Archive->BlockCount + 1, ASTON_BATTERY_ARCHIVE_BLOCKS);
+		Entry = &Archive->Index[Archive->Head];
+		RtlZeroMemory(Entry, sizeof(*Entry));
+	}
+
+	if (Entry->Count == 0)
+	{
+		RtlZeroMemory(Archive->Previous, sizeof(Archive->Previous));
+		Archive->PreviousInterval = 0;
+		Archive->BlockCount = max(Archive->BlockCount, 1);
+		Entry->FirstTimestamp = Values[0];
+		Entry->Bias = 0;
+		Entry->Sequence = Archive->NextSequence;
+		Archive->NextSequence += 1;
+		Archive->Persisted[Archive->Head] = 0;
+	}
+
+	Block = Archive->Blocks + (SIZE_T)Archive->Head * ASTON_BATTERY_ARCHIVE_BLOCK_SIZE;
+
+	//
+	// Samples are evenly spaced, so the interval rarely moves by more than
+	// the timer slack and the timestamp costs one or two bytes. The block
+	// keeps its own timeline, offset by Bias.
+	//
+
+	Timestamp = Values[0] - Entry->Bias;
+	Interval = Timestamp - Archive->Previous[0];
+	Entry->Used += AstonBatteryWriteVarint(Block + Entry->Used,
+		AstonBatteryZigzagEncode(Interval - Archive->PreviousInterval));
+
+	Archive->PreviousInterval = Interval;
+
+	for (Field = 1; Field < ASTON_BATTERY_HISTORY_FIELDS; Field++)
+	{
+		Entry->Used += AstonBatteryWriteVarint(Block + Entry->Used,
+			AstonBatteryZigzagEncode(Values[Field] - Archive->Previous[Field]));
+	}
+
+	RtlCopyMemory(Archive->Previous, Values, sizeof(Archive->Previous));
+	Archive->Previous[0] = Timestamp;
+	Entry->LastTimestamp = Values[0];
+	Entry->Count += 1;
+	Archive->TotalSamples += 1;
+}
+
+_Use_decl_annotations_
+BOOLEAN
+AstonBatteryDecodeSample(
+	const UCHAR* Block,
+	ULONG Used,
+	PULONG Offset,
+	PLONGLONG Values,
+	PLONGLONG Interval
+)
+
+/*++
+
+Routine Description:
+
+	Decodes the next sample of a block. Values and Interval hold the
+	previous sample and interval, zero at the start of the block. The
+	timestamp is on the timeline of the block, without its Bias.
+
+Arguments:
+
+	Block - Supplies the data of the block.
+
+	Used - Supplies the number of bytes of the block that hold samples.
+
+	Offset - Supplies the offset of the sample, receives the offset of the
+		next one.
+
+	Values - Supplies the previous sample, receives the decoded one.
+
+	Interval - Supplies the previous interval, receives the decoded one.
+
+Return Value:
+
+	FALSE if the sample does not end within Used.
+
+--*/
+
+{
+	ULONGLONG Encoded;
+	ULONG Field;
+
+	//
+	// AstonBatteryZigzagDecode evaluates its argument twice, each varint is
+	// read into Encoded first.
+	//
+
+	if (!AstonBatteryReadVarint(Block, Used, Offset, &Encoded))
+	{
+		return FALSE;
+	}
+
+	*Interval += AstonBatteryZigzagDecode(Encoded);
+	Values[0] += *Interval;
+
+	for (Field = 1; Field < ASTON_BATTERY_HISTORY_FIELDS; Field++)
+	{
+		if (!AstonBatteryReadVarint(Block, Used, Offset, &Encoded))
+		{
+			return FALSE;
+		}
+
+		Values[Field] += AstonBatteryZigzagDecode(Encoded);
+	}
+
+	return TRUE;
+}
+
+_Use_decl_annotations_
+BOOLEAN
+AstonBatteryReplayArchiveBlock(
+	const UCHAR* Block,
+	const ASTON_BATTERY_ARCHIVE_BLOCK* Entry,
+	PLONGLONG Values,
+	PLONGLONG Interval
+)
+
+/*++
+
+Routine Description:
+
+	Decodes every sample of a block to check it against its index entry:
+	the Count samples have to fill exactly the Used bytes, and the first and
+	last timestamps have to be the ones of the entry.
+
+Arguments:
+
+	Block - Supplies the data of the block.
+
+	Entry - Supplies the index entry of the block.
+
+	Values - Receives the last sample of the block, the encoder state to
+		append to it.
+
+	Interval - Receives the last interval of the block.
+
+Return Value:
+
+	TRUE if the block matches its entry.
+
+--*/
+
+{
+	ULONG Offset;
+	ULONG Sample;
+
+	RtlZeroMemory(Values, ASTON_BATTERY_HISTORY_FIELDS * sizeof(LONGLONG));
+	*Interval = 0;
+	Offset = 0;
+
+	if (Entry->Used > ASTON_BATTERY_ARCHIVE_BLOCK_SIZE)
+	{
+		return FALSE;
+	}
+
+	for (Sample = 0; Sample < Entry->Count; Sample++)
+	{
+		if (!AstonBatteryDecodeSample(Block, Entry->Used, &Offset, Values, Interval))
+		{
+			return FALSE;
+		}
+
+		if (Sample == 0 && Values[0] + Entry->Bias != Entry->FirstTimestamp)
+		{
+			return FALSE;
+		}
+	}
+
+	return Offset == Entry->Used &&
+		(Entry->Count == 0 || Values[0] + Entry->Bias == Entry->LastTimestamp);
+}
+
+static
+ULONG
+AstonBatteryHistoryFileChecksum(
+	_In_ const ASTON_BATTERY_HISTORY_FILE_HEADER* Header
+)
+
+/*++
+
+Routine Description:
+
+	FNV-1a over the header from Generation on.
+
+--*/
+
+{
+	const UCHAR* Bytes;
+	ULONG Hash;
+	ULONG i;
+
+	Bytes = (const UCHAR*)&Header->Generation;
+	Hash = 2166136261;
+	for (i = 0; i < sizeof(*Header) - FIELD_OFFSET(ASTON_BATTERY_HISTORY_FILE_HEADER, Generation); i++)
+	{
+		Hash = (Hash ^ Bytes[i]) * 16777619;
+	}
+
+	return Hash;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryCheckpointHistoryFile(
+	PASTON_BATTERY_HISTORY History,
+	PASTON_BATTERY_ARCHIVE Archive,
+	PASTON_BATTERY_HISTORY_FILE File
+)
+
+/*++
+
+Routine Description:
+
+	Appends to the history file the ring records and archive bytes added
+	since the previous checkpoint, then writes the header over its older
+	copy. Blocks started since then are written whole, with their sequence
+	number. Stops at the first write that fails; what was written is not
+	written again, the header is.
+
+Arguments:
+
+	History - Supplies the ring.
+
+	Archive - Supplies the archive.
+
+	File - Supplies the history file and the clocks, receives the bytes
+		written in Written.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	PASTON_BATTERY_HISTORY_FILE_HEADER Header;
+	PASTON_BATTERY_HISTORY_RECORD Records;
+	PASTON_BATTERY_ARCHIVE_BLOCK_IMAGE Image;
+	PASTON_BATTERY_ARCHIVE_BLOCK Entry;
+	LONGLONG Wall;
+	ULONG Persisted;
+	ULONG Offset;
+	ULONG Pending;
+	ULONG Slot;
+	ULONG Run;
+	ULONG Block;
+	ULONG i;
+	NTSTATUS Status;
+
+	File->Written = 0;
+	Wall = File->SystemTimeMs - File->TimestampMs;
+	Status = STATUS_SUCCESS;
+
+	//
+	// The new records follow each other in the ring, they go out in at most
+	// two runs around its end, as many records at a time as the buffer holds.
+	//
+
+	Records = (PASTON_BATTERY_HISTORY_RECORD)File->Buffer;
+	Pending = (ULONG)min(History->TotalSamples - History->PersistedSamples, (ULONGLONG)History->Count);
+	Slot = (History->Head + ASTON_BATTERY_HISTORY_CAPACITY - Pending) % ASTON_BATTERY_HISTORY_CAPACITY;
+	while (Pending != 0)
+	{
+		Run = min(Pending, ASTON_BATTERY_HISTORY_CAPACITY - Slot);
+		Run = min(Run, (ULONG)(ASTON_BATTERY_HISTORY_FILE_BUFFER_SIZE / sizeof(*Records)));
+		for (i = 0; i < Run; i++)
+		{
+			AstonBatteryLoadHistoryRecord(History, Slot + i, &Records[i]);
+			Records[i].Timestamp = AstonBatteryTicksToMs(Records[i].Timestamp, File->QpcFrequency) + Wall;
+		}
+
+		Status = File->Write(File->Context,
+			ASTON_BATTERY_HISTORY_FILE_RECORDS_OFFSET + Slot * sizeof(*Records),
+			Records,
+			Run * sizeof(*Records));
+
+		if (!NT_SUCCESS(Status))
+		{
+			goto Exit;
+		}
+
+		File->Written += Run * sizeof(*Records);
+		Slot = (Slot + Run) % ASTON_BATTERY_HISTORY_CAPACITY;
+		Pending -= Run;
+	}
+
+	History->PersistedSamples = History->TotalSamples;
+
+	Image = (PASTON_BATTERY_ARCHIVE_BLOCK_IMAGE)File->Buffer;
+	for (Block = 0; Block < ASTON_BATTERY_ARCHIVE_BLOCKS; Block++)
+	{
+		Entry = &Archive->Index[Block];
+		Persisted = Archive->Persisted[Block];
+		if (Persisted == Entry->Used)
+		{
+			continue;
+		}
+
+		Offset = ASTON_BATTERY_HISTORY_FILE_BLOCKS_OFFSET + Block * sizeof(*Image);
+		if (Persisted == 0)
+		{
+			Image->Sequence = Entry->Sequence;
+			RtlCopyMemory(Image->Data,
+				Archive->Blocks + (SIZE_T)Block * ASTON_BATTERY_ARCHIVE_BLOCK_SIZE,
+				Entry->Used);
+
+			Status = File->Write(File->Context,
+				Offset,
+				Image,
+				FIELD_OFFSET(ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE, Data) + Entry->Used);
+		}
+		else
+		{
+			Status = File->Write(File->Context,
+				Offset + FIELD_OFFSET(ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE, Data) + Persisted,
+				Archive->Blocks + (SIZE_T)Block * ASTON_BATTERY_ARCHIVE_BLOCK_SIZE + Persisted,
+				Entry->Used - Persisted);
+		}
+
+		if (!NT_SUCCESS(Status))
+		{
+			goto Exit;
+		}
+
+		File->Written += (Persisted == 0 ? FIELD_OFFSET(ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE, Data) : 0) +
+			Entry->Used - Persisted;
+
+		Archive->Persisted[Block] = Entry->Used;
+	}
+
+	if (File->Written == 0 && Archive->FileCurrent)
+	{
+		goto Exit;
+	}
+
+	//
+	// The header goes last so that it never describes data that has not been
+	// written, and over the older copy so that the newer one survives a
+	// write cut short.
+	//
+
+	Header = (PASTON_BATTERY_HISTORY_FILE_HEADER)File->Buffer;
+	RtlZeroMemory(Header, sizeof(*Header));
+	Header->Version = ASTON_BATTERY_HISTORY_FILE_VERSION;
+	Header->Generation = Archive->FileGeneration + 1;
+	Header->SystemTimeMs = File->SystemTimeMs;
+	Header->TimestampMs = File->TimestampMs;
+	Header->HistoryNewestMs = AstonBatteryTicksToMs(
+		History->Timestamp[(History->Head + ASTON_BATTERY_HISTORY_CAPACITY - 1) % ASTON_BATTERY_HISTORY_CAPACITY],
+		File->QpcFrequency) + Wall;
+	Header->HistoryHead = History->Head;
+	Header->HistoryCount = History->Count;
+	Header->HistoryTotalSamples = History->TotalSamples;
+	Header->ArchiveHead = Archive->Head;
+	Header->ArchiveBlockCount = Archive->BlockCount;
+	Header->ArchiveTotalSamples = Archive->TotalSamples;
+	Header->NextSequence = Archive->NextSequence;
+	RtlCopyMemory(Header->Index, Archive->Index, sizeof(Header->Index));
+	Header->Checksum = AstonBatteryHistoryFileChecksum(Header);
+
+	Archive->FileCurrent = FALSE;
+	Status = File->Write(File->Context,
+		(ULONG)(Header->Generation % 2) * ASTON_BATTERY_HISTORY_FILE_HEADER_SIZE,
+		Header,
+		sizeof(*Header));
+
+	if (!NT_SUCCESS(Status))
+	{
+		goto Exit;
+	}
+
+	File->Written += sizeof(*Header);
+	Archive->FileGeneration = Header->Generation;
+	Archive->FileCurrent = TRUE;
+
+Exit:
+	return Status;
+}
+
+static
+BOOLEAN
+AstonBatteryReadHistoryFileHeader(
+	_Inout_ PASTON_BATTERY_HISTORY_FILE File,
+	_In_ ULONG Copy,
+	_Out_ PASTON_BATTERY_HISTORY_FILE_HEADER Header
+)
+
+/*++
+
+Routine Description:
+
+	Reads one copy of the header and checks it is whole and within the
+	bounds of the ring and the archive.
+
+--*/
+
+{
+	NTSTATUS Status;
+
+	Status = File->Read(File->Context,
+		Copy * ASTON_BATTERY_HISTORY_FILE_HEADER_SIZE,
+		Header,
+		sizeof(*Header));
+
+	return NT_SUCCESS(Status) &&
+		Header->Version == ASTON_BATTERY_HISTORY_FILE_VERSION &&
+		Header->Checksum == AstonBatteryHistoryFileChecksum(Header) &&
+		Header->HistoryHead < ASTON_BATTERY_HISTORY_CAPACITY &&
+		Header->HistoryCount <= ASTON_BATTERY_HISTORY_CAPACITY &&
+		Header->HistoryCount <= Header->HistoryTotalSamples &&
+		Header->ArchiveHead < ASTON_BATTERY_ARCHIVE_BLOCKS &&
+		Header->ArchiveBlockCount <= ASTON_BATTERY_ARCHIVE_BLOCKS;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryRestoreHistoryFile(
+	PASTON_BATTERY_HISTORY History,
+	PASTON_BATTERY_ARCHIVE Archive,
+	PASTON_BATTERY_HISTORY_FILE File,
+	PULONG Dropped
+)
+
+/*++
+
+Routine Description:
+
+	Reads the ring and the archive back from the history file into an empty
+	ring and archive, and moves them to the timeline of File.
+
+	The ring keeps the records up to the newest one the header knows of,
+	in time order. Each
+	archive block is decoded within the bytes the index gives it, bytes
+	past them are ignored. A block that cannot be read, or does not match
+	its entry or its sequence number, is emptied.
+
+Arguments:
+
+	History - Supplies the empty ring.
+
+	Archive - Supplies the empty archive.
+
+	File - Supplies the history file and the clocks.
+
+	Dropped - Receives the number of archive blocks emptied.
+
+Return Value:
+
+	STATUS_NOT_FOUND if neither copy of the header is valid.
+
+--*/
+
+{
+	PASTON_BATTERY_HISTORY_FILE_HEADER Header;
+	PASTON_BATTERY_ARCHIVE_BLOCK_IMAGE Image;
+	PASTON_BATTERY_ARCHIVE_BLOCK Entry;
+	PASTON_BATTERY_HISTORY_RECORD Records;
+	LONGLONG Values[ASTON_BATTERY_HISTORY_FIELDS];
+	LONGLONG Interval;
+	LONGLONG Shift;
+	LONGLONG Wall;
+	LONGLONG Newest;
+	ULONG Oldest;
+	ULONG Count;
+	ULONG Block;
+	ULONG Slot;
+	ULONG Run;
+	ULONG i;
+	NTSTATUS Status;
+
+	*Dropped = 0;
+	Header = (PASTON_BATTERY_HISTORY_FILE_HEADER)File->Buffer;
+	Image = (PASTON_BATTERY_ARCHIVE_BLOCK_IMAGE)(File->Buffer + sizeof(*Header));
+
+	//
+	// The image buffer holds the other copy of the header while they are
+	// compared.
+	//
+
+	if (!AstonBatteryReadHistoryFileHeader(File, 0, Header))
+	{
+		Header->Version = 0;
+	}
+
+	if (AstonBatteryReadHistoryFileHeader(File, 1, (PASTON_BATTERY_HISTORY_FILE_HEADER)Image) &&
+		(Header->Version == 0 ||
+		 ((PASTON_BATTERY_HISTORY_FILE_HEADER)Image)->Generation > Header->Generation))
+	{
+		RtlCopyMemory(Header, Image, sizeof(*Header));
+	}
+
+	if (Header->Version == 0)
+	{
+		return STATUS_NOT_FOUND;
+	}
+
+	//
+	// The performance counter starts over on every boot, the wall clock
+	// carries the history over.
+	//
+
+	Wall = File->SystemTimeMs - File->TimestampMs;
+	Shift = (Header->SystemTimeMs - Header->TimestampMs) - Wall;
+
+	Records = (PASTON_BATTERY_HISTORY_RECORD)Image;
+	for (Slot = 0; Slot < ASTON_BATTERY_HISTORY_CAPACITY; Slot += Run)
+	{
+		Run = min(ASTON_BATTERY_HISTORY_CAPACITY - Slot, (ULONG)(sizeof(*Image) / sizeof(*Records)));
+		Status = File->Read(File->Context,
+			ASTON_BATTERY_HISTORY_FILE_RECORDS_OFFSET + Slot * sizeof(*Records),
+			Records,
+			Run * sizeof(*Records));
+
+		if (!NT_SUCCESS(Status))
+		{
+			Header->HistoryCount = 0;
+			break;
+		}
+
+		for (i = 0; i < Run; i++)
+		{
+			AstonBatteryStoreHistoryRecord(History, Slot + i, &Records[i]);
+		}
+	}
+
+	History->Head = Header->HistoryHead;
+	History->Count = Header->HistoryCount;
+	History->TotalSamples = Header->HistoryTotalSamples;
+
+	//
+	// Walk back from the newest record for as long as the records get older.
+	// A record written by a checkpoint that did not complete is newer than
+	// the newest one the header knows of and ends the walk.
+	//
+
+	Count = History->Count;
+	History->Count = 0;
+	Newest = Header->HistoryNewestMs;
+	Slot = History->Head;
+	while (History->Count < Count)
+	{
+		Slot = (Slot + ASTON_BATTERY_HISTORY_CAPACITY - 1) % ASTON_BATTERY_HISTORY_CAPACITY;
+		if (History->Count == 0 ? History->Timestamp[Slot] != Newest : History->Timestamp[Slot] >= Newest)
+		{
+			break;
+		}
+
+		Newest = History->Timestamp[Slot];
+		History->Timestamp[Slot] = AstonBatteryMsToTicks(Newest - Wall, File->QpcFrequency);
+		History->Count += 1;
+	}
+
+	History->PersistedSamples = History->TotalSamples;
+
+	RtlCopyMemory(Archive->Index, Header->Index, sizeof(Archive->Index));
+	for (i = 0; i < ASTON_BATTERY_ARCHIVE_BLOCKS; i++)
+	{
+		Archive->Index[i].FirstTimestamp += Shift;
+		Archive->Index[i].LastTimestamp += Shift;
+		Archive->Index[i].Bias += Shift;
+	}
+
+	Archive->Head = Header->ArchiveHead;
+	Archive->BlockCount = Header->ArchiveBlockCount;
+	Archive->TotalSamples = Header->ArchiveTotalSamples;
+	Archive->NextSequence = Header->NextSequence;
+
+	//
+	// Each block image is read as far as the index knows of it.
+	//
+
+	Oldest = (Archive->Head + ASTON_BATTERY_ARCHIVE_BLOCKS + 1 - Archive->BlockCount) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+	for (i = 0; i < Archive->BlockCount; i++)
+	{
+		Block = (Oldest + i) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+		Entry = &Archive->Index[Block];
+
+		Status = STATUS_NOT_FOUND;
+		if (Entry->Used <= ASTON_BATTERY_ARCHIVE_BLOCK_SIZE)
+		{
+			Status = File->Read(File->Context,
+				ASTON_BATTERY_HISTORY_FILE_BLOCKS_OFFSET + Block * sizeof(*Image),
+				Image,
+				FIELD_OFFSET(ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE, Data) + Entry->Used);
+		}
+
+		if (!NT_SUCCESS(Status) ||
+			Image->Sequence != Entry->Sequence ||
+			!AstonBatteryReplayArchiveBlock(Image->Data, Entry, Values, &Interval))
+		{
+			RtlZeroMemory(Entry, sizeof(*Entry));
+			RtlZeroMemory(Values, sizeof(Values));
+			Interval = 0;
+			*Dropped += 1;
+		}
+		else
+		{
+			RtlCopyMemory(Archive->Blocks + (SIZE_T)Block * ASTON_BATTERY_ARCHIVE_BLOCK_SIZE,
+				Image->Data,
+				Entry->Used);
+		}
+
+		Archive->Persisted[Block] = Entry->Used;
+
+		//
+		// New samples are appended to the head block, or start it over if it
+		// was emptied.
+		//
+
+		if (Block == Archive->Head)
+		{
+			RtlCopyMemory(Archive->Previous, Values, sizeof(Archive->Previous));
+			Archive->PreviousInterval = Interval;
+		}
+	}
+
+	Archive->FileGeneration = Header->Generation;
+	Archive->FileCurrent = FALSE;
+
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+LONGLONG
+AstonBatteryTicksToMs(
+	LONGLONG Ticks,
+	LONGLONG Frequency
+)
+
+/*++
+
+Routine Description:
+
+	Converts performance counter ticks to milliseconds. The whole seconds
+	are converted apart from the rest, so that no timestamp the counter can
+	hold overflows on the way.
+
+Arguments:
+
+	Ticks - Supplies the performance counter value.
+
+	Frequency - Supplies the performance counter frequency.
+
+Return Value:
+
+	The time in milliseconds, rounded toward zero.
+
+--*/
+
+{
+	return (Ticks / Frequency) * 1000 + (Ticks % Frequency) * 1000 / Frequency;
+}
+
+_Use_decl_annotations_
+LONGLONG
+AstonBatteryMsToTicks(
+	LONGLONG Milliseconds,
+	LONGLONG Frequency
+)
+
+/*++
+
+Routine Description:
+
+	Converts milliseconds to performance counter ticks, the whole seconds
+	apart from the rest as AstonBatteryTicksToMs does.
+
+Arguments:
+
+	Milliseconds - Supplies the time in milliseconds.
+
+	Frequency - Supplies the performance counter frequency.
+
+Return Value:
+
+	The performance counter value.
+
+--*/
+
+{
+	return (Milliseconds / 1000) * Frequency + (Milliseconds % 1000) * Frequency / 1000;
+}
@@ -0,0 +1,336 @@
+/*++
+
+Module Name:
+
+    archive.h
+
+Abstract:
+
+    This module contains the history of the battery: the ring of recent
+    samples, the long term archive with its delta encoded blocks and their
+    index, and the history file both are checkpointed to.
+
+    archive.c only depends on this header, Public.h and the basic types of
+    wdm.h, so that it can be built and measured outside of the driver. File
+    I/O goes through the routines of ASTON_BATTERY_HISTORY_FILE.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//---------------------------------------------------------------------- Pragmas
+
+#pragma once
+
+//--------------------------------------------------------------------- Includes
+
+#include <wdm.h>
+#include "Public.h"
+
+//------------------------------------------------------------------ Definitions
+
+//
+// Fields of a sample: timestamp, rate, safety status, voltage, current,
+// temperature, remaining and full charge capacity and battery status
+//
+
+#define ASTON_BATTERY_HISTORY_FIELDS        9
+
+//
+// Depth of the history ring, about 5.7 hours at the default sample interval
+//
+
+#define ASTON_BATTERY_HISTORY_CAPACITY      4096
+
+//
+// The archive keeps every 6th sample, delta encoded in 96 blocks of 4 KB.
+// At about 10 bytes per sample, as ArchiveBenchmark measures on simulated
+// days of use, that is 13 days at the default interval.
+//
+
+#define ASTON_BATTERY_ARCHIVE_SAMPLE_DIVIDER    6
+#define ASTON_BATTERY_ARCHIVE_BLOCK_SIZE        4096
+#define ASTON_BATTERY_ARCHIVE_BLOCKS            96
+#define ASTON_BATTERY_ARCHIVE_MAX_SAMPLE_SIZE   (ASTON_BATTERY_HISTORY_FIELDS * 10)
+
+#define AstonBatteryZigzagEncode(Value) \
+    (((ULONGLONG)(Value) << 1) ^ (ULONGLONG)((Value) >> 63))
+
+#define AstonBatteryZigzagDecode(Value) \
+    ((LONGLONG)((Value) >> 1) ^ -(LONGLONG)((Value) & 1))
+
+//
+// Columns of the history, widest first so that every column stays aligned
+//
+typedef struct _ASTON_BATTERY_HISTORY_COLUMN
+{
+    ULONG OffsetField;
+    ULONG ElementSize;
+} ASTON_BATTERY_HISTORY_COLUMN;
+
+extern const ASTON_BATTERY_HISTORY_COLUMN AstonBatteryHistoryColumns[ASTON_BATTERY_HISTORY_FIELDS];
+
+#define AstonBatteryHistoryColumnOffset(Header, Column) \
+    (*(PULONG)((PUCHAR)(Header) + AstonBatteryHistoryColumns[(Column)].OffsetField))
+
+//
+// History ring, one column per field so that scans over a field touch only
+// its own cache lines. The columns live in one nonpaged buffer laid out as
+// the blob returned by IOCTL_ASTON_BATTERY_QUERY_HISTORY. Head is the slot
+// the next sample goes to. PersistedSamples is the TotalSamples the history
+// file has the records of.
+//
+typedef struct _ASTON_BATTERY_HISTORY
+{
+    ASTON_BATTERY_HISTORY_HEADER Layout;
+    ULONG Head;
+    ULONG Count;
+    ULONGLONG TotalSamples;
+    ULONGLONG PersistedSamples;
+    PLONGLONG Timestamp;
+    PLONG Rate;
+    PULONG SafetyStatus;
+    PUSHORT Voltage;
+    PSHORT Current;
+    PUSHORT Temperature;
+    PUSHORT RemainingCapacity;
+    PUSHORT FullChargeCapacity;
+    PUSHORT BatteryStatus;
+} ASTON_BATTERY_HISTORY, * PASTON_BATTERY_HISTORY;
+
+//
+// One sample of the ring as a row, as the sampler takes it and as the
+// history file keeps it. Timestamp is in performance counter ticks, in the
+// file in milliseconds of the wall clock.
+//
+typedef struct _ASTON_BATTERY_HISTORY_RECORD
+{
+    LONGLONG Timestamp;
+    LONG Rate;
+    ULONG SafetyStatus;
+    USHORT Voltage;
+    SHORT Current;
+    USHORT Temperature;
+    USHORT RemainingCapacity;
+    USHORT FullChargeCapacity;
+    USHORT BatteryStatus;
+    ULONG Reserved;
+} ASTON_BATTERY_HISTORY_RECORD, * PASTON_BATTERY_HISTORY_RECORD;
+
+//
+// Index entry of an archive block. Timestamps are in milliseconds of the
+// performance counter. Bias is added to the timestamps decoded from the
+// block, it moves the blocks restored from an earlier boot to the current
+// timeline. Sequence numbers the blocks in the order they were started.
+//
+typedef struct _ASTON_BATTERY_ARCHIVE_BLOCK
+{
+    LONGLONG FirstTimestamp;
+    LONGLONG LastTimestamp;
+    LONGLONG Bias;
+    ULONGLONG Sequence;
+    ULONG Count;
+    ULONG Used;
+} ASTON_BATTERY_ARCHIVE_BLOCK, * PASTON_BATTERY_ARCHIVE_BLOCK;
+
+//
+// Long term archive. Every field of a sample is stored as the zigzag varint
+// of its difference to the previous sample, the timestamp as the
+// difference of its interval to the previous one. Blocks start from zero
+// and decode on their own; Head is the block being filled and the oldest
+// block is dropped when it wraps. Persisted is the part of each block the
+// history file holds, FileGeneration the generation of its last header.
+//
+typedef struct _ASTON_BATTERY_ARCHIVE
+{
+    PUCHAR Blocks;
+    ULONG Head;
+    ULONG BlockCount;
+    ULONG SampleCountdown;
+    ULONGLONG TotalSamples;
+    ULONGLONG NextSequence;
+    LONGLONG Previous[ASTON_BATTERY_HISTORY_FIELDS];
+    LONGLONG PreviousInterval;
+    ASTON_BATTERY_ARCHIVE_BLOCK Index[ASTON_BATTERY_ARCHIVE_BLOCKS];
+    ULONG Persisted[ASTON_BATTERY_ARCHIVE_BLOCKS];
+    ULONGLONG FileGeneration;
+    BOOLEAN FileCurrent;
+} ASTON_BATTERY_ARCHIVE, * PASTON_BATTERY_ARCHIVE;
+
+//
+// History file, in the data directory of the device. It holds two copies
+// of its header, then the ring as one record per slot, then one image per
+// archive block. A checkpoint appends the records and block bytes added
+// since the previous one, then writes the header over the older copy. The
+// copy with the highest Generation whose Checksum matches describes the
+// file, so a checkpoint cut short leaves the previous one usable: records
+// written past it are newer than its HistoryNewestMs and archive blocks
+// hold more bytes than its index says.
+//
+// SystemTimeMs and TimestampMs tie the timeline of the archive index to
+// the wall clock. The records carry wall clock milliseconds instead of
+// performance counter ticks, so that they stay valid across boots. Checksum
+// is the FNV-1a of the header from Generation on.
+//
+
+#define ASTON_BATTERY_HISTORY_FILE_VERSION      1
+#define ASTON_BATTERY_HISTORY_FILE_HEADER_SIZE  4096
+
+typedef struct _ASTON_BATTERY_HISTORY_FILE_HEADER
+{
+    ULONG Version;
+    ULONG Checksum;
+    ULONGLONG Generation;
+    LONGLONG SystemTimeMs;
+    LONGLONG TimestampMs;
+    LONGLONG HistoryNewestMs;
+    ULONG HistoryHead;
+    ULONG HistoryCount;
+    ULONGLONG HistoryTotalSamples;
+    ULONG ArchiveHead;
+    ULONG ArchiveBlockCount;
+    ULONGLONG ArchiveTotalSamples;
+    ULONGLONG NextSequence;
+    ASTON_BATTERY_ARCHIVE_BLOCK Index[ASTON_BATTERY_ARCHIVE_BLOCKS];
+} ASTON_BATTERY_HISTORY_FILE_HEADER, * PASTON_BATTERY_HISTORY_FILE_HEADER;
+
+typedef struct _ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE
+{
+    ULONGLONG Sequence;
+    UCHAR Data[ASTON_BATTERY_ARCHIVE_BLOCK_SIZE];
+} ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE, * PASTON_BATTERY_ARCHIVE_BLOCK_IMAGE;
+
+C_ASSERT(sizeof(ASTON_BATTERY_HISTORY_FILE_HEADER) <= ASTON_BATTERY_HISTORY_FILE_HEADER_SIZE);
+C_ASSERT(sizeof(ASTON_BATTERY_HISTORY_FILE_HEADER) <= sizeof(ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE));
+
+#define ASTON_BATTERY_HISTORY_FILE_RECORDS_OFFSET \
+    (2 * ASTON_BATTERY_HISTORY_FILE_HEADER_SIZE)
+
+#define ASTON_BATTERY_HISTORY_FILE_BLOCKS_OFFSET \
+    (ASTON_BATTERY_HISTORY_FILE_RECORDS_OFFSET + \
+     ASTON_BATTERY_HISTORY_CAPACITY * sizeof(ASTON_BATTERY_HISTORY_RECORD))
+
+#define ASTON_BATTERY_HISTORY_FILE_SIZE \
+    (ASTON_BATTERY_HISTORY_FILE_BLOCKS_OFFSET + \
+     ASTON_BATTERY_ARCHIVE_BLOCKS * sizeof(ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE))
+
+//
+// The driver checkpoints the ring and the archive to the history file at
+// most this often, and on D0 exit. At a 5 s sampling interval this comes
+// to at most 10 KB in 6 pages per checkpoint and about 940 KB a day, as
+// measured by HistoryFileTest.
+//
+
+#define ASTON_BATTERY_HISTORY_CHECKPOINT_INTERVAL_MS    900000
+
+//
+// Work buffer the caller provides for a checkpoint or a restore, room for
+// a header and a block image
+//
+
+#define ASTON_BATTERY_HISTORY_FILE_BUFFER_SIZE \
+    (sizeof(ASTON_BATTERY_HISTORY_FILE_HEADER) + sizeof(ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE))
+
+//
+// Reads or writes Length bytes at Offset of the history file. A read that
+// ends past the end of the file fails.
+//
+
+typedef
+NTSTATUS
+ASTON_BATTERY_HISTORY_FILE_IO(
+    _In_ PVOID Context,
+    _In_ ULONG Offset,
+    _Inout_updates_bytes_(Length) PVOID Buffer,
+    _In_ ULONG Length
+);
+
+typedef ASTON_BATTERY_HISTORY_FILE_IO* PASTON_BATTERY_HISTORY_FILE_IO;
+
+//
+// Open history file as seen by a checkpoint or a restore. The caller fills
+// in the clocks as of the call, Written receives the bytes written.
+//
+typedef struct _ASTON_BATTERY_HISTORY_FILE
+{
+    PVOID Context;
+    PASTON_BATTERY_HISTORY_FILE_IO Read;
+    PASTON_BATTERY_HISTORY_FILE_IO Write;
+    PUCHAR Buffer;
+    LONGLONG SystemTimeMs;
+    LONGLONG TimestampMs;
+    LONGLONG QpcFrequency;
+    ULONG Written;
+} ASTON_BATTERY_HISTORY_FILE, * PASTON_BATTERY_HISTORY_FILE;
+
+//------------------------------------------------------- Prototypes (archive.c)
+
+VOID
+AstonBatteryLayoutHistory(
+    _In_ ULONG Entries,
+    _Out_ PASTON_BATTERY_HISTORY_HEADER Header
+);
+
+VOID
+AstonBatteryInitializeHistory(
+    _Out_ PASTON_BATTERY_HISTORY History,
+    _Out_writes_bytes_(History->Layout.Size) PUCHAR Buffer
+);
+
+VOID
+AstonBatteryRecordHistory(
+    _Inout_ PASTON_BATTERY_HISTORY History,
+    _Inout_ PASTON_BATTERY_ARCHIVE Archive,
+    _In_ const ASTON_BATTERY_HISTORY_RECORD* Record,
+    _In_ LONGLONG QpcFrequency
+);
+
+VOID
+AstonBatteryArchiveSample(
+    _Inout_ PASTON_BATTERY_ARCHIVE Archive,
+    _In_reads_(ASTON_BATTERY_HISTORY_FIELDS) const LONGLONG* Values
+);
+
+BOOLEAN
+AstonBatteryDecodeSample(
+    _In_reads_bytes_(Used) const UCHAR* Block,
+    _In_ ULONG Used,
+    _Inout_ PULONG Offset,
+    _Inout_updates_(ASTON_BATTERY_HISTORY_FIELDS) PLONGLONG Values,
+    _Inout_ PLONGLONG Interval
+);
+
+BOOLEAN
+AstonBatteryReplayArchiveBlock(
+    _In_ const UCHAR* Block,
+    _In_ const ASTON_BATTERY_ARCHIVE_BLOCK* Entry,
+    _Out_writes_(ASTON_BATTERY_HISTORY_FIELDS) PLONGLONG Values,
+    _Out_ PLONGLONG Interval
+);
+
+NTSTATUS
+AstonBatteryCheckpointHistoryFile(
+    _Inout_ PASTON_BATTERY_HISTORY History,
+    _Inout_ PASTON_BATTERY_ARCHIVE Archive,
+    _Inout_ PASTON_BATTERY_HISTORY_FILE File
+);
+
+NTSTATUS
+AstonBatteryRestoreHistoryFile(
+    _Inout_ PASTON_BATTERY_HISTORY History,
+    _Inout_ PASTON_BATTERY_ARCHIVE Archive,
+    _Inout_ PASTON_BATTERY_HISTORY_FILE File,
+    _Out_ PULONG Dropped
+);
+
+LONGLONG
+AstonBatteryTicksToMs(
+    _In_ LONGLONG Ticks,
+    _In_ LONGLONG Frequency
+);
+
+LONGLONG
+AstonBatteryMsToTicks(
+    _In_ LONGLONG Milliseconds,
+    _In_ LONGLONG Frequency
+);
\ No newline at end of file
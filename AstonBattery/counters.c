@@ -0,0 +1,305 @@
+/*++
+
+Module Name:
+
+	counters.c
+
+Abstract:
+
+	This module publishes the behavior of the driver through the
+	"Aston Battery" performance counter set, described in AstonBattery.man.
+	The hot paths only add to counters in the device extension, with
+	interlocked operations or under a lock they already hold. Rates, ratios
+	and the totals are put together when a consumer collects the counter set.
+
+	N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "AstonBattery.h"
+#include "counters.tmh"
+
+//------------------------------------------------------------------- Prototypes
+
+PCW_CALLBACK AstonBatteryCounterCallback;
+
+//---------------------------------------------------------------------- Pragmas
+
+#pragma alloc_text(PAGE, AstonBatteryRegisterCounters)
+#pragma alloc_text(PAGE, AstonBatteryUnregisterCounters)
+#pragma alloc_text(PAGE, AstonBatteryCounterCallback)
+
+//------------------------------------------------------------------ Definitions
+
+DECLARE_CONST_UNICODE_STRING(CounterSetName, L"Aston Battery");
+
+#define AstonBatteryCounter(Id, Field) \
+	{ (Id), 0, FIELD_OFFSET(ASTON_BATTERY_COUNTER_VALUES, Field), RTL_FIELD_SIZE(ASTON_BATTERY_COUNTER_VALUES, Field) }
+
+//
+// Ids are those of AstonBattery.man
+//
+
+static const PCW_COUNTER_DESCRIPTOR CounterDescriptors[] =
+{
+	AstonBatteryCounter(1, InformationQueries[BatteryInformation]),
+	AstonBatteryCounter(2, InformationQueries[BatteryGranularityInformation]),
+	AstonBatteryCounter(3, InformationQueries[BatteryTemperature]),
+	AstonBatteryCounter(4, InformationQueries[BatteryEstimatedTime]),
+	AstonBatteryCounter(5, InformationQueries[BatteryDeviceName]),
+	AstonBatteryCounter(6, InformationQueries[BatteryManufactureDate]),
+	AstonBatteryCounter(7, InformationQueries[BatteryManufactureName]),
+	AstonBatteryCounter(8, InformationQueries[BatteryUniqueID]),
+	AstonBatteryCounter(9, InformationQueries[BatterySerialNumber]),
+	AstonBatteryCounter(10, InformationQueries[ASTON_BATTERY_COUNTED_QUERY_LEVELS]),
+	AstonBatteryCounter(11, StatusQueries),
+	AstonBatteryCounter(12, CacheHits),
+	AstonBatteryCounter(13, CacheLookups),
+	AstonBatteryCounter(14, BusTransfers),
+	AstonBatteryCounter(15, BusBytes),
+	AstonBatteryCounter(16, BusErrors),
+	AstonBatteryCounter(17, LockContentions),
+	AstonBatteryCounter(18, LockWaitTime),
+	AstonBatteryCounter(19, SnapshotAgeMs),
+	AstonBatteryCounter(20, SafetyPolls),
+	AstonBatteryCounter(21, SafetyBusTransfers),
+};
+
+//-------------------------------------------------------------------- Functions
+
+static
+VOID
+AstonBatteryCollectCounters(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+	_Out_ PASTON_BATTERY_COUNTER_VALUES Values
+)
+
+/*++
+
+Routine Description:
+
+	Takes the counter values of one device. The counters, the SPB
+	statistics of every gauge and the statistics of the state, class init
+	and SPB locks are read into a sample, AstonBatteryComputeCounterValues
+	puts the values together from it.
+
+--*/
+
+{
+	PASTON_BATTERY_COUNTERS Counters;
+	ASTON_BATTERY_COUNTER_SAMPLE Sample;
+	SPB_STATISTICS* Spb;
+	const LOCK_STATISTICS* Locks[ASTON_BATTERY_COUNTED_LOCKS];
+	ULONG i;
+
+	Counters = &DevExt->Counters;
+	RtlZeroMemory(&Sample, sizeof(Sample));
+
+	for (i = 0; i < RTL_NUMBER_OF(Sample.InformationQueries); i++)
+	{
+		Sample.InformationQueries[i] = ReadNoFence64(&Counters->InformationQueries[i]);
+	}
+
+	Sample.StatusQueries = ReadNoFence64(&Counters->StatusQueries);
+	Sample.SafetyPolls = ReadNoFence64(&Counters->SafetyPolls);
+	Sample.SafetyBusTransfers = ReadNoFence64(&Counters->SafetyBusTransfers);
+	Sample.CacheHits = ReadNoFence64(&Counters->CacheHits);
+	Sample.CacheMisses = ReadNoFence64(&Counters->CacheMisses);
+
+	Locks[0] = &DevExt->StateLockStatistics;
+	Locks[1] = &DevExt->ClassInitLockStatistics;
+	Sample.LockCount = 2;
+
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		Spb = &DevExt->I2CContext[i].Statistics;
+		Sample.Bus[i].Reads = ReadNoFence64(&Spb->Reads);
+		Sample.Bus[i].Writes = ReadNoFence64(&Spb->Writes);
+		Sample.Bus[i].Failures = ReadNoFence64(&Spb->Failures);
+		Sample.Bus[i].BytesRead = ReadNoFence64(&Spb->BytesRead);
+		Sample.Bus[i].BytesWritten = ReadNoFence64(&Spb->BytesWritten);
+		Locks[Sample.LockCount++] = &DevExt->I2CContext[i].SpbLockStatistics;
+	}
+
+	Sample.GaugeCount = DevExt->GaugeCount;
+
+	for (i = 0; i < Sample.LockCount; i++)
+	{
+		Sample.Locks[i].Contentions = ReadNoFence64(&Locks[i]->Contentions);
+		Sample.Locks[i].WaitTicks = ReadNoFence64(&Locks[i]->WaitTicks);
+	}
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	Sample.SnapshotValid = DevExt->Snapshot.Valid;
+	Sample.SnapshotTimestamp = DevExt->Snapshot.Timestamp.QuadPart;
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+
+	Sample.Now = KeQueryPerformanceCounter(NULL).QuadPart;
+	Sample.QpcFrequency = DevExt->QpcFrequency.QuadPart;
+
+	AstonBatteryComputeCounterValues(&Sample, Values);
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryCounterCallback(
+	PCW_CALLBACK_TYPE Type,
+	PPCW_CALLBACK_INFORMATION Info,
+	PVOID Context
+)
+
+/*++
+
+Routine Description:
+
+	Adds the instance of the device to an enumeration or a collection of
+	the counter set.
+
+Arguments:
+
+	Type - Supplies the kind of request.
+
+	Info - Supplies the buffer the instance is added to.
+
+	Context - Supplies the device extension of the battery.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	PSURFACE_BATTERY_FDO_DATA DevExt;
+	ASTON_BATTERY_COUNTER_VALUES Values;
+	PCW_DATA Data;
+
+	PAGED_CODE();
+
+	DevExt = (PSURFACE_BATTERY_FDO_DATA)Context;
+	Data.Data = &Values;
+	Data.Size = sizeof(Values);
+
+	switch (Type)
+	{
+	case PcwCallbackEnumerateInstances:
+		RtlZeroMemory(&Values, sizeof(Values));
+		return PcwAddInstance(Info->EnumerateInstances.Buffer,
+			&DevExt->CounterInstanceName,
+			DevExt->GaugeSelect,
+			1,
+			&Data);
+
+	case PcwCallbackCollectData:
+		AstonBatteryCollectCounters(DevExt, &Values);
+		return PcwAddInstance(Info->CollectData.Buffer,
+			&DevExt->CounterInstanceName,
+			DevExt->GaugeSelect,
+			1,
+			&Data);
+
+	default:
+		return STATUS_SUCCESS;
+	}
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryRegisterCounters(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Registers the device as an instance of the counter set, named after the
+	gauges it reports.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	PCW_REGISTRATION_INFORMATION Registration;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	RtlInitEmptyUnicodeString(&DevExt->CounterInstanceName,
+		DevExt->CounterInstanceNameBuffer,
+		sizeof(DevExt->CounterInstanceNameBuffer));
+
+	if (DevExt->GaugeSelect == ASTON_BATTERY_GAUGE_SELECT_ALL)
+	{
+		Status = RtlUnicodeStringPrintf(&DevExt->CounterInstanceName, L"All gauges");
+	}
+	else
+	{
+		Status = RtlUnicodeStringPrintf(&DevExt->CounterInstanceName, L"Gauge %u", DevExt->GaugeSelect);
+	}
+
+	if (!NT_SUCCESS(Status))
+	{
+		goto Exit;
+	}
+
+	RtlZeroMemory(&Registration, sizeof(Registration));
+	Registration.Version = PCW_CURRENT_VERSION;
+	Registration.Name = &CounterSetName;
+	Registration.CounterCount = RTL_NUMBER_OF(CounterDescriptors);
+	Registration.Counters = (PPCW_COUNTER_DESCRIPTOR)CounterDescriptors;
+	Registration.Callback = AstonBatteryCounterCallback;
+	Registration.CallbackContext = DevExt;
+
+	Status = PcwRegister(&DevExt->CounterSet, &Registration);
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "PcwRegister failed with Status = 0x%08lX\n", Status);
+		DevExt->CounterSet = NULL;
+	}
+
+Exit:
+	return Status;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryUnregisterCounters(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Removes the instance of the device from the counter set. No callback
+	runs once this returns.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PAGED_CODE();
+
+	if (DevExt->CounterSet != NULL)
+	{
+		PcwUnregister(DevExt->CounterSet);
+		DevExt->CounterSet = NULL;
+	}
+}
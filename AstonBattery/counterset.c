@@ -0,0 +1,135 @@
+/*++
+
+Module Name:
+
+	counterset.c
+
+Abstract:
+
+	This module puts together the values of the "Aston Battery" performance
+	counter set from the counters and statistics of a device: it sums the
+	bus and lock statistics, truncates the cache counters to the 32 bits of
+	the counter set and converts the lock wait and the snapshot age from
+	performance counter ticks.
+
+	N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "counterset.h"
+
+//-------------------------------------------------------------------- Functions
+
+_Use_decl_annotations_
+VOID
+AstonBatteryComputeCounterValues(
+	const ASTON_BATTERY_COUNTER_SAMPLE* Sample,
+	PASTON_BATTERY_COUNTER_VALUES Values
+)
+
+/*++
+
+Routine Description:
+
+	Computes the instance data of one device. The bus totals are summed
+	over the gauges, the lock totals over the locks, with the wait
+	converted to 100 ns units. The 32 bit cache counters wrap, consumers
+	only use their deltas. The snapshot age is left at 0 while there is no
+	valid snapshot.
+
+Arguments:
+
+	Sample - Supplies the counters and statistics read from the device.
+
+	Values - Receives the instance data.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	const ASTON_BATTERY_BUS_SAMPLE* Bus;
+	ULONGLONG WaitTicks;
+	ULONG i;
+
+	RtlZeroMemory(Values, sizeof(*Values));
+
+	for (i = 0; i < RTL_NUMBER_OF(Values->InformationQueries); i++)
+	{
+		Values->InformationQueries[i] = (ULONGLONG)Sample->InformationQueries[i];
+	}
+
+	Values->StatusQueries = (ULONGLONG)Sample->StatusQueries;
+	Values->SafetyPolls = (ULONGLONG)Sample->SafetyPolls;
+	Values->SafetyBusTransfers = (ULONGLONG)Sample->SafetyBusTransfers;
+	Values->CacheHits = (ULONG)Sample->CacheHits;
+	Values->CacheLookups = (ULONG)((ULONGLONG)Sample->CacheHits + (ULONGLONG)Sample->CacheMisses);
+
+	for (i = 0; i < Sample->GaugeCount && i < ASTON_BATTERY_MAX_GAUGES; i++)
+	{
+		Bus = &Sample->Bus[i];
+		Values->BusTransfers += (ULONGLONG)Bus->Reads + (ULONGLONG)Bus->Writes;
+		Values->BusBytes += (ULONGLONG)Bus->BytesRead + (ULONGLONG)Bus->BytesWritten;
+		Values->BusErrors += (ULONGLONG)Bus->Failures;
+	}
+
+	WaitTicks = 0;
+	for (i = 0; i < Sample->LockCount && i < ASTON_BATTERY_COUNTED_LOCKS; i++)
+	{
+		Values->LockContentions += (ULONGLONG)Sample->Locks[i].Contentions;
+		WaitTicks += (ULONGLONG)Sample->Locks[i].WaitTicks;
+	}
+
+	Values->LockWaitTime = AstonBatteryTicksToUnits(WaitTicks, (ULONGLONG)Sample->QpcFrequency, 10000000);
+
+	if (Sample->SnapshotValid && Sample->Now >= Sample->SnapshotTimestamp)
+	{
+		Values->SnapshotAgeMs = AstonBatteryTicksToUnits((ULONGLONG)(Sample->Now - Sample->SnapshotTimestamp),
+			(ULONGLONG)Sample->QpcFrequency,
+			1000);
+	}
+}
+
+_Use_decl_annotations_
+ULONGLONG
+AstonBatteryTicksToUnits(
+	ULONGLONG Ticks,
+	ULONGLONG Frequency,
+	ULONGLONG UnitsPerSecond
+)
+
+/*++
+
+Routine Description:
+
+	Converts performance counter ticks to units of 1 / UnitsPerSecond
+	seconds. The whole seconds are converted apart from the rest, so that
+	the product only overflows once the result itself no longer fits.
+
+Arguments:
+
+	Ticks - Supplies the number of ticks.
+
+	Frequency - Supplies the performance counter frequency.
+
+	UnitsPerSecond - Supplies the units in one second, at most 10^7.
+
+Return Value:
+
+	The duration in the requested units, rounded toward zero, or 0 when the
+	frequency is not known.
+
+--*/
+
+{
+	if (Frequency == 0)
+	{
+		return 0;
+	}
+
+	return (Ticks / Frequency) * UnitsPerSecond + (Ticks % Frequency) * UnitsPerSecond / Frequency;
+}
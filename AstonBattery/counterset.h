@@ -0,0 +1,136 @@
+/*++
+
+Module Name:
+
+    counterset.h
+
+Abstract:
+
+    This module contains the counters behind the "Aston Battery" performance
+    counter set and the routine putting their values together for a
+    collection.
+
+    counterset.c only depends on this header and the basic types of wdm.h,
+    so that it can be built and tested outside of the driver. counters.c
+    reads the statistics of the device into ASTON_BATTERY_COUNTER_SAMPLE
+    and hands the result to the counter set.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//---------------------------------------------------------------------- Pragmas
+
+#pragma once
+
+//--------------------------------------------------------------------- Includes
+
+#include <wdm.h>
+#include <batclass.h>
+#include "Public.h"
+
+//------------------------------------------------------------------ Definitions
+
+//
+// Information levels counted one by one in the performance counters, the
+// levels past them share one more slot
+//
+
+#define ASTON_BATTERY_COUNTED_QUERY_LEVELS  (BatterySerialNumber + 1)
+
+//
+// Locks summed in the lock counters: the state lock, the class init lock
+// and the SPB lock of every gauge
+//
+
+#define ASTON_BATTERY_COUNTED_LOCKS         (2 + ASTON_BATTERY_MAX_GAUGES)
+
+//
+// Counters behind the performance counter set, only ever added to with
+// interlocked operations. The lock counters come from the lock statistics.
+//
+typedef struct _ASTON_BATTERY_COUNTERS
+{
+    volatile LONG64 InformationQueries[ASTON_BATTERY_COUNTED_QUERY_LEVELS + 1];
+    volatile LONG64 StatusQueries;
+    volatile LONG64 CacheHits;
+    volatile LONG64 CacheMisses;
+    volatile LONG64 SafetyPolls;
+    volatile LONG64 SafetyBusTransfers;
+} ASTON_BATTERY_COUNTERS, * PASTON_BATTERY_COUNTERS;
+
+//
+// Totals of the SPB statistics of one gauge and of the statistics of one
+// lock, as read at the time of a collection
+//
+typedef struct _ASTON_BATTERY_BUS_SAMPLE
+{
+    LONG64 Reads;
+    LONG64 Writes;
+    LONG64 Failures;
+    LONG64 BytesRead;
+    LONG64 BytesWritten;
+} ASTON_BATTERY_BUS_SAMPLE, * PASTON_BATTERY_BUS_SAMPLE;
+
+typedef struct _ASTON_BATTERY_LOCK_SAMPLE
+{
+    LONG64 Contentions;
+    LONG64 WaitTicks;
+} ASTON_BATTERY_LOCK_SAMPLE, * PASTON_BATTERY_LOCK_SAMPLE;
+
+//
+// Everything a collection of the counter set is computed from. Ticks and
+// timestamps are performance counter values.
+//
+typedef struct _ASTON_BATTERY_COUNTER_SAMPLE
+{
+    LONG64 InformationQueries[ASTON_BATTERY_COUNTED_QUERY_LEVELS + 1];
+    LONG64 StatusQueries;
+    LONG64 CacheHits;
+    LONG64 CacheMisses;
+    LONG64 SafetyPolls;
+    LONG64 SafetyBusTransfers;
+    ULONG GaugeCount;
+    ASTON_BATTERY_BUS_SAMPLE Bus[ASTON_BATTERY_MAX_GAUGES];
+    ULONG LockCount;
+    ASTON_BATTERY_LOCK_SAMPLE Locks[ASTON_BATTERY_COUNTED_LOCKS];
+    BOOLEAN SnapshotValid;
+    LONGLONG SnapshotTimestamp;
+    LONGLONG Now;
+    LONGLONG QpcFrequency;
+} ASTON_BATTERY_COUNTER_SAMPLE, * PASTON_BATTERY_COUNTER_SAMPLE;
+
+//
+// Instance data of the performance counter set, laid out for the counter
+// descriptors in counters.c. LockWaitTime is in 100 ns units.
+//
+typedef struct _ASTON_BATTERY_COUNTER_VALUES
+{
+    ULONGLONG InformationQueries[ASTON_BATTERY_COUNTED_QUERY_LEVELS + 1];
+    ULONGLONG StatusQueries;
+    ULONG CacheHits;
+    ULONG CacheLookups;
+    ULONGLONG BusTransfers;
+    ULONGLONG BusBytes;
+    ULONGLONG BusErrors;
+    ULONGLONG LockContentions;
+    ULONGLONG LockWaitTime;
+    ULONGLONG SnapshotAgeMs;
+    ULONGLONG SafetyPolls;
+    ULONGLONG SafetyBusTransfers;
+} ASTON_BATTERY_COUNTER_VALUES, * PASTON_BATTERY_COUNTER_VALUES;
+
+//---------------------------------------------------- Prototypes (counterset.c)
+
+VOID
+AstonBatteryComputeCounterValues(
+    _In_ const ASTON_BATTERY_COUNTER_SAMPLE* Sample,
+    _Out_ PASTON_BATTERY_COUNTER_VALUES Values
+);
+
+ULONGLONG
+AstonBatteryTicksToUnits(
+    _In_ ULONGLONG Ticks,
+    _In_ ULONGLONG Frequency,
+    _In_ ULONGLONG UnitsPerSecond
+);
\ No newline at end of file
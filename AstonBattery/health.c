@@ -0,0 +1,341 @@
+/*++
+
+Module Name:
+
+	health.c
+
+Abstract:
+
+	This module tracks the wear of the battery: state of health, fade of the
+	full charge capacity, Qmax updates and internal resistance. The analytics
+	are updated in place from every snapshot and checkpointed to the device
+	hardware key so that they survive reboots.
+
+	N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "AstonBattery.h"
+#include "health.tmh"
+
+//---------------------------------------------------------------------- Pragmas
+
+#pragma alloc_text(PAGE, AstonBatteryRefreshHealth)
+#pragma alloc_text(PAGE, AstonBatteryLoadHealthCheckpoint)
+#pragma alloc_text(PAGE, AstonBatteryCheckpointHealth)
+
+//-------------------------------------------------------------------- Literals
+
+DECLARE_CONST_UNICODE_STRING(HealthCheckpointName, L"HealthCheckpoint");
+
+//-------------------------------------------------------------------- Functions
+
+_Use_decl_annotations_
+VOID
+AstonBatteryUpdateHealth(
+	PASTON_BATTERY_SNAPSHOT Snapshot,
+	const BQ28Z610_STANDARD_BLOCK* Registers
+)
+
+/*++
+
+Routine Description:
+
+	Folds a new sample into the health analytics. Called with SnapshotLock
+	held after the load model has taken the sample.
+
+Arguments:
+
+	Snapshot - Supplies the snapshot being updated.
+
+	Registers - Supplies the merged registers of the new sample.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PASTON_BATTERY_HEALTH Health;
+
+	Health = &Snapshot->Health;
+
+	if (Registers->FullChargeCapacity != 0)
+	{
+		if (Health->InitialFullChargeCapacity == 0)
+		{
+			Health->InitialFullChargeCapacity = Registers->FullChargeCapacity;
+		}
+
+		Health->FullChargeCapacity = Registers->FullChargeCapacity;
+		if (Health->FullChargeCapacity < Health->InitialFullChargeCapacity)
+		{
+			Health->FullChargeCapacityFade =
+				((Health->InitialFullChargeCapacity - Health->FullChargeCapacity) * 10000) /
+				Health->InitialFullChargeCapacity;
+		}
+		else
+		{
+			Health->FullChargeCapacityFade = 0;
+		}
+	}
+
+	Health->ResistanceMilliOhm = Snapshot->LoadModel.ResistanceMilliOhm;
+	Health->ResistanceFitCount = Snapshot->LoadModel.FitCount;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryRefreshHealth(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Reads StateOfHealth and the Qmax values of ITStatus3 from every gauge and
+	takes DesignCapacity and CycleCount from the pack signature just read.
+	The sampler calls this at the pack signature rate.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	UINT16 GaugeValues[ASTON_BATTERY_MAX_GAUGES];
+	UINT16 Qmax[ASTON_BATTERY_MAX_GAUGES][ASTON_BATTERY_CELLS_PER_GAUGE];
+	PASTON_BATTERY_HEALTH Health;
+	ULONG StateOfHealth;
+	ULONG i;
+	ULONG Cell;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	Status = AstonBatteryReadGaugeWord(DevExt, BQ28Z610_REG_STATE_OF_HEALTH, GaugeValues);
+	if (!NT_SUCCESS(Status))
+	{
+		goto Exit;
+	}
+
+	//
+	// The weakest pack sets the health of the battery.
+	//
+
+	StateOfHealth = MAXULONG;
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		StateOfHealth = min(StateOfHealth, GaugeValues[i]);
+
+		Status = AstonBatteryReadMacBlock(&DevExt->I2CContext[i],
+			BQ28Z610_MAC_IT_STATUS3,
+			Qmax[i],
+			sizeof(Qmax[i]));
+
+		if (!NT_SUCCESS(Status))
+		{
+			goto Exit;
+		}
+	}
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	Health = &DevExt->Snapshot.Health;
+	Health->StateOfHealth = StateOfHealth;
+	Health->DesignCapacity = DevExt->PackSignature.DesignCapacity;
+	Health->CycleCount = DevExt->PackSignature.CycleCount;
+
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		for (Cell = 0; Cell < ASTON_BATTERY_CELLS_PER_GAUGE; Cell++)
+		{
+			if (Health->Qmax[i][Cell] != Qmax[i][Cell])
+			{
+				if (DevExt->Snapshot.HealthValid)
+				{
+					Health->QmaxUpdates += 1;
+				}
+
+				Health->Qmax[i][Cell] = Qmax[i][Cell];
+			}
+		}
+	}
+
+	DevExt->Snapshot.HealthValid = TRUE;
+	DevExt->Snapshot.Generation += 1;
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+
+	AstonBatteryCheckpointHealth(DevExt, FALSE);
+
+Exit:
+	return Status;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryLoadHealthCheckpoint(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Reads the health checkpoint back from the device hardware key. It is
+	applied once the first pack signature shows it belongs to this pack.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	WDFKEY Key;
+	ULONG Length;
+	ULONG Type;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	RtlZeroMemory(&DevExt->HealthCheckpoint, sizeof(DevExt->HealthCheckpoint));
+
+	Status = WdfDeviceOpenRegistryKey(DevExt->Device,
+		PLUGPLAY_REGKEY_DEVICE,
+		KEY_READ,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&Key);
+
+	if (!NT_SUCCESS(Status))
+	{
+		return;
+	}
+
+	Status = WdfRegistryQueryValue(Key,
+		&HealthCheckpointName,
+		sizeof(DevExt->HealthCheckpoint),
+		&DevExt->HealthCheckpoint,
+		&Length,
+		&Type);
+
+	WdfRegistryClose(Key);
+
+	if (!NT_SUCCESS(Status) ||
+		Type != REG_BINARY ||
+		Length != sizeof(DevExt->HealthCheckpoint) ||
+		DevExt->HealthCheckpoint.Version != ASTON_BATTERY_HEALTH_CHECKPOINT_VERSION)
+	{
+		RtlZeroMemory(&DevExt->HealthCheckpoint, sizeof(DevExt->HealthCheckpoint));
+		return;
+	}
+
+	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_INFO,
+		"Health checkpoint: SOH %u%%, cycles %u, fade %u\n",
+		DevExt->HealthCheckpoint.Health.StateOfHealth,
+		DevExt->HealthCheckpoint.Health.CycleCount,
+		DevExt->HealthCheckpoint.Health.FullChargeCapacityFade);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryCheckpointHealth(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	BOOLEAN Force
+)
+
+/*++
+
+Routine Description:
+
+	Writes the health analytics to the device hardware key when they have
+	changed since the last checkpoint, at most once per
+	ASTON_BATTERY_HEALTH_CHECKPOINT_INTERVAL_MS unless Force is set.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Force - Supplies TRUE to skip the rate limit, used on D0 exit.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	ASTON_BATTERY_HEALTH_CHECKPOINT Checkpoint;
+	LARGE_INTEGER Now;
+	BOOLEAN HealthValid;
+	WDFKEY Key;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	Now = KeQueryPerformanceCounter(NULL);
+	if (!Force &&
+		DevExt->HealthCheckpointTime.QuadPart != 0 &&
+		(Now.QuadPart - DevExt->HealthCheckpointTime.QuadPart) / DevExt->QpcFrequency.QuadPart <
+			ASTON_BATTERY_HEALTH_CHECKPOINT_INTERVAL_MS / 1000)
+	{
+		return;
+	}
+
+	RtlZeroMemory(&Checkpoint, sizeof(Checkpoint));
+	Checkpoint.Version = ASTON_BATTERY_HEALTH_CHECKPOINT_VERSION;
+	Checkpoint.Signature = DevExt->PackSignature;
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	HealthValid = DevExt->Snapshot.HealthValid;
+	Checkpoint.Health = DevExt->Snapshot.Health;
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+
+	if (!HealthValid ||
+		!DevExt->PackSignatureValid ||
+		RtlEqualMemory(&Checkpoint, &DevExt->HealthCheckpoint, sizeof(Checkpoint)))
+	{
+		return;
+	}
+
+	Status = WdfDeviceOpenRegistryKey(DevExt->Device,
+		PLUGPLAY_REGKEY_DEVICE,
+		KEY_WRITE,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&Key);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "WdfDeviceOpenRegistryKey failed with Status = 0x%08lX\n", Status);
+		return;
+	}
+
+	Status = WdfRegistryAssignValue(Key,
+		&HealthCheckpointName,
+		REG_BINARY,
+		sizeof(Checkpoint),
+		&Checkpoint);
+
+	WdfRegistryClose(Key);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "WdfRegistryAssignValue failed with Status = 0x%08lX\n", Status);
+		return;
+	}
+
+	DevExt->HealthCheckpoint = Checkpoint;
+	DevExt->HealthCheckpointTime = Now;
+}
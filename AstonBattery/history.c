@@ -0,0 +1,860 @@
+/*++
+
+Module Name:
+
+	history.c
+
+Abstract:
+
+	This module keeps the recent history of the battery in a nonpaged ring
+	filled by the sampler, so that a sudden shutdown or drop can be looked
+	at after the fact without tracing having been enabled. The ring is
+	stored column by column and handed out in the same form. A delta
+	encoded archive of every few samples covers the last days. Both are
+	checkpointed to a file in the data directory of the device and read
+	back on the next boot; the encoding and the file format are in
+	archive.c.
+
+	N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "AstonBattery.h"
+#include "history.tmh"
+
+//---------------------------------------------------------------------- Pragmas
+
+#pragma alloc_text(PAGE, AstonBatteryCreateHistory)
+#pragma alloc_text(PAGE, AstonBatteryAppendHistory)
+#pragma alloc_text(PAGE, AstonBatteryCopyHistory)
+#pragma alloc_text(PAGE, AstonBatteryCopyArchive)
+#pragma alloc_text(PAGE, AstonBatteryRestoreHistory)
+#pragma alloc_text(PAGE, AstonBatteryCheckpointHistory)
+
+//-------------------------------------------------------------------- Literals
+
+DECLARE_CONST_UNICODE_STRING(HistoryFileName, L"History.bin");
+DECLARE_CONST_UNICODE_STRING(ArchiveIndexName, L"HistoryArchive");
+
+//-------------------------------------------------------------------- Functions
+
+static
+VOID
+AstonBatteryStoreHistoryValue(
+	_Out_ PUCHAR Column,
+	_In_ ULONG ElementSize,
+	_In_ ULONG Index,
+	_In_ LONGLONG Value
+)
+{
+	switch (ElementSize)
+	{
+	case sizeof(LONGLONG):
+		((PLONGLONG)Column)[Index] = Value;
+		break;
+
+	case sizeof(LONG):
+		((PLONG)Column)[Index] = (LONG)Value;
+		break;
+
+	default:
+		((PUSHORT)Column)[Index] = (USHORT)Value;
+		break;
+	}
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryCreateHistory(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Allocates the history ring, the archive and their lock. All belong to
+	the device.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	PASTON_BATTERY_HISTORY History;
+	PASTON_BATTERY_ARCHIVE Archive;
+	WDF_OBJECT_ATTRIBUTES Attributes;
+	PUCHAR Buffer;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	History = &DevExt->History;
+	Archive = &DevExt->Archive;
+	RtlZeroMemory(Archive, sizeof(*Archive));
+	AstonBatteryLayoutHistory(ASTON_BATTERY_HISTORY_CAPACITY, &History->Layout);
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&Attributes);
+	Attributes.ParentObject = DevExt->Device;
+	Status = WdfWaitLockCreate(&Attributes, &DevExt->HistoryLock);
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "WdfWaitLockCreate failed with Status = 0x%08lX\n", Status);
+		goto Exit;
+	}
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&Attributes);
+	Attributes.ParentObject = DevExt->Device;
+	Status = WdfMemoryCreate(&Attributes,
+		NonPagedPoolNx,
+		ASTON_BATTERY_POOL_TAG,
+		History->Layout.Size,
+		&DevExt->HistoryMemory,
+		(PVOID*)&Buffer);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "WdfMemoryCreate failed with Status = 0x%08lX\n", Status);
+		goto Exit;
+	}
+
+	AstonBatteryInitializeHistory(History, Buffer);
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&Attributes);
+	Attributes.ParentObject = DevExt->Device;
+	Status = WdfMemoryCreate(&Attributes,
+		NonPagedPoolNx,
+		ASTON_BATTERY_POOL_TAG,
+		ASTON_BATTERY_ARCHIVE_BLOCK_SIZE * ASTON_BATTERY_ARCHIVE_BLOCKS,
+		&DevExt->ArchiveMemory,
+		(PVOID*)&Archive->Blocks);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "WdfMemoryCreate failed with Status = 0x%08lX\n", Status);
+		goto Exit;
+	}
+
+Exit:
+	return Status;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryAppendHistory(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Appends the current snapshot to the history ring, overwriting the oldest
+	sample once the ring is full, and every few samples to the archive.
+	Called by the sampler after every successful refresh.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	ASTON_BATTERY_HISTORY_RECORD Record;
+
+	PAGED_CODE();
+
+	if (DevExt->HistoryMemory == NULL || DevExt->ArchiveMemory == NULL)
+	{
+		return;
+	}
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	if (!DevExt->Snapshot.Valid)
+	{
+		WdfWaitLockRelease(DevExt->SnapshotLock);
+		return;
+	}
+
+	Record.Timestamp = DevExt->Snapshot.Timestamp.QuadPart;
+	Record.Rate = AstonBatteryFilterValue(DevExt->Snapshot.RateFilter.PowerShort);
+	Record.SafetyStatus = DevExt->Snapshot.Safety.SafetyStatus;
+	Record.Voltage = DevExt->Snapshot.Registers.Voltage;
+	Record.Current = DevExt->Snapshot.Registers.Current;
+	Record.Temperature = DevExt->Snapshot.Registers.Temperature;
+	Record.RemainingCapacity = DevExt->Snapshot.Registers.RemainingCapacity;
+	Record.FullChargeCapacity = DevExt->Snapshot.Registers.FullChargeCapacity;
+	Record.BatteryStatus = DevExt->Snapshot.Registers.BatteryStatus;
+	Record.Reserved = 0;
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+
+	WdfWaitLockAcquire(DevExt->HistoryLock, NULL);
+	AstonBatteryRecordHistory(&DevExt->History,
+		&DevExt->Archive,
+		&Record,
+		DevExt->QpcFrequency.QuadPart);
+
+	WdfWaitLockRelease(DevExt->HistoryLock);
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryCopyHistory(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	PVOID Buffer,
+	size_t Length,
+	size_t* Written
+)
+
+/*++
+
+Routine Description:
+
+	Copies the history ring to a caller buffer, oldest sample first, as the
+	header followed by one column per field.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Buffer - Supplies the buffer to fill.
+
+	Length - Supplies the length of the buffer.
+
+	Written - Receives the number of bytes written.
+
+Return Value:
+
+	STATUS_BUFFER_OVERFLOW if only the header fits.
+
+--*/
+
+{
+	PASTON_BATTERY_HISTORY History;
+	ASTON_BATTERY_HISTORY_HEADER Header;
+	PUCHAR Ring;
+	PUCHAR Destination;
+	ULONG ElementSize;
+	ULONG Column;
+	ULONG First;
+	ULONG Run;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	History = &DevExt->History;
+	*Written = 0;
+
+	if (Length < sizeof(Header))
+	{
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	if (DevExt->HistoryMemory == NULL)
+	{
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	Ring = WdfMemoryGetBuffer(DevExt->HistoryMemory, NULL);
+
+	WdfWaitLockAcquire(DevExt->HistoryLock, NULL);
+	AstonBatteryLayoutHistory(History->Count, &Header);
+	Header.TotalSamples = History->TotalSamples;
+	Header.QpcFrequency = DevExt->QpcFrequency.QuadPart;
+
+	if (Length < Header.Size)
+	{
+		RtlCopyMemory(Buffer, &Header, sizeof(Header));
+		*Written = sizeof(Header);
+		Status = STATUS_BUFFER_OVERFLOW;
+		goto Exit;
+	}
+
+	RtlCopyMemory(Buffer, &Header, sizeof(Header));
+
+	//
+	// The oldest sample sits at Head once the ring has wrapped, each column
+	// is copied in at most two runs.
+	//
+
+	First = (History->Head + ASTON_BATTERY_HISTORY_CAPACITY - History->Count) % ASTON_BATTERY_HISTORY_CAPACITY;
+	Run = min(History->Count, ASTON_BATTERY_HISTORY_CAPACITY - First);
+
+	for (Column = 0; Column < ARRAYSIZE(AstonBatteryHistoryColumns); Column++)
+	{
+		ElementSize = AstonBatteryHistoryColumns[Column].ElementSize;
+		Destination = (PUCHAR)Buffer + AstonBatteryHistoryColumnOffset(&Header, Column);
+
+		RtlCopyMemory(Destination,
+			Ring + AstonBatteryHistoryColumnOffset(&History->Layout, Column) + First * ElementSize,
+			Run * ElementSize);
+
+		RtlCopyMemory(Destination + Run * ElementSize,
+			Ring + AstonBatteryHistoryColumnOffset(&History->Layout, Column),
+			(History->Count - Run) * ElementSize);
+	}
+
+	*Written = Header.Size;
+	Status = STATUS_SUCCESS;
+
+Exit:
+	WdfWaitLockRelease(DevExt->HistoryLock);
+	return Status;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryCopyArchive(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	const ASTON_BATTERY_ARCHIVE_RANGE* Range,
+	PVOID Buffer,
+	size_t Length,
+	size_t* Written
+)
+
+/*++
+
+Routine Description:
+
+	Decodes the archived samples taken within a range into a caller buffer,
+	in the format of AstonBatteryCopyHistory. The block index limits the
+	decoding to the blocks that overlap the range. Samples are copied in
+	the order they were archived, which is only time order as long as the
+	wall clock did not move back across a reboot.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Range - Supplies the range of performance counter timestamps.
+
+	Buffer - Supplies the buffer to fill.
+
+	Length - Supplies the length of the buffer.
+
+	Written - Receives the number of bytes written.
+
+Return Value:
+
+	STATUS_BUFFER_OVERFLOW if only the header fits. Size is then an upper
+	bound of the length needed.
+
+--*/
+
+{
+	PASTON_BATTERY_ARCHIVE Archive;
+	PASTON_BATTERY_ARCHIVE_BLOCK Entry;
+	ASTON_BATTERY_HISTORY_HEADER Header;
+	ASTON_BATTERY_HISTORY_HEADER Final;
+	LONGLONG Values[ASTON_BATTERY_HISTORY_FIELDS];
+	LONGLONG Timestamp;
+	LONGLONG Interval;
+	LONGLONG Start;
+	LONGLONG End;
+	ULONG Oldest;
+	ULONG Block;
+	ULONG Bound;
+	ULONG Held;
+	ULONG Count;
+	ULONG Sample;
+	ULONG Offset;
+	ULONG Column;
+	ULONG i;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	Archive = &DevExt->Archive;
+	*Written = 0;
+
+	if (Length < sizeof(Header))
+	{
+		return STATUS_BUFFER_TOO_SMALL;
+	}
+
+	if (DevExt->ArchiveMemory == NULL)
+	{
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	Start = AstonBatteryTicksToMs(Range->StartTimestamp, DevExt->QpcFrequency.QuadPart);
+	End = AstonBatteryTicksToMs(Range->EndTimestamp, DevExt->QpcFrequency.QuadPart);
+
+	WdfWaitLockAcquire(DevExt->HistoryLock, NULL);
+
+	//
+	// The blocks of one boot follow each other in time, but the blocks of
+	// earlier boots sit where the wall clock placed them and overlap this
+	// boot if the clock was set back in between. Every block of the index
+	// is checked against the range instead of searching it; there are few
+	// of them and only the ones that overlap the range are decoded.
+	//
+
+	Oldest = (Archive->Head + ASTON_BATTERY_ARCHIVE_BLOCKS + 1 - Archive->BlockCount) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+	Bound = 0;
+	Held = 0;
+	for (i = 0; i < Archive->BlockCount; i++)
+	{
+		Entry = &Archive->Index[(Oldest + i) % ASTON_BATTERY_ARCHIVE_BLOCKS];
+		Held += Entry->Count;
+		if (Entry->LastTimestamp >= Start && Entry->FirstTimestamp <= End)
+		{
+			Bound += Entry->Count;
+		}
+	}
+
+	AstonBatteryLayoutHistory(Bound, &Header);
+	Header.Capacity = Held;
+	Header.TotalSamples = Archive->TotalSamples;
+	Header.QpcFrequency = DevExt->QpcFrequency.QuadPart;
+
+	if (Length < Header.Size)
+	{
+		RtlCopyMemory(Buffer, &Header, sizeof(Header));
+		*Written = sizeof(Header);
+		Status = STATUS_BUFFER_OVERFLOW;
+		goto Exit;
+	}
+
+	Count = 0;
+	for (i = 0; i < Archive->BlockCount; i++)
+	{
+		Block = (Oldest + i) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+		Entry = &Archive->Index[Block];
+		if (Entry->LastTimestamp < Start || Entry->FirstTimestamp > End)
+		{
+			continue;
+		}
+
+		RtlZeroMemory(Values, sizeof(Values));
+		Interval = 0;
+		Offset = 0;
+
+		for (Sample = 0; Sample < Entry->Count; Sample++)
+		{
+			if (!AstonBatteryDecodeSample(Archive->Blocks + (SIZE_T)Block * ASTON_BATTERY_ARCHIVE_BLOCK_SIZE,
+				Entry->Used,
+				&Offset,
+				Values,
+				&Interval))
+			{
+				break;
+			}
+
+			Timestamp = Values[0] + Entry->Bias;
+			if (Timestamp < Start || Timestamp > End)
+			{
+				continue;
+			}
+
+			for (Column = 0; Column < ARRAYSIZE(AstonBatteryHistoryColumns); Column++)
+			{
+				AstonBatteryStoreHistoryValue((PUCHAR)Buffer + AstonBatteryHistoryColumnOffset(&Header, Column),
+					AstonBatteryHistoryColumns[Column].ElementSize,
+					Count,
+					(Column == 0) ? AstonBatteryMsToTicks(Timestamp, DevExt->QpcFrequency.QuadPart) : Values[Column]);
+			}
+
+			Count += 1;
+		}
+	}
+
+	//
+	// The columns were spaced for every sample of the blocks, close the gaps
+	// left by the samples outside of the range.
+	//
+
+	AstonBatteryLayoutHistory(Count, &Final);
+	Final.Capacity = Header.Capacity;
+	Final.TotalSamples = Header.TotalSamples;
+	Final.QpcFrequency = Header.QpcFrequency;
+
+	for (Column = 1; Column < ARRAYSIZE(AstonBatteryHistoryColumns); Column++)
+	{
+		RtlMoveMemory((PUCHAR)Buffer + AstonBatteryHistoryColumnOffset(&Final, Column),
+			(PUCHAR)Buffer + AstonBatteryHistoryColumnOffset(&Header, Column),
+			Count * AstonBatteryHistoryColumns[Column].ElementSize);
+	}
+
+	RtlCopyMemory(Buffer, &Final, sizeof(Final));
+	*Written = Final.Size;
+	Status = STATUS_SUCCESS;
+
+Exit:
+	WdfWaitLockRelease(DevExt->HistoryLock);
+	return Status;
+}
+
+static
+NTSTATUS
+AstonBatteryReadHistoryFile(
+	_In_ PVOID Context,
+	_In_ ULONG Offset,
+	_Out_writes_bytes_(Length) PVOID Buffer,
+	_In_ ULONG Length
+)
+{
+	IO_STATUS_BLOCK IoStatus;
+	LARGE_INTEGER Position;
+	NTSTATUS Status;
+
+	Position.QuadPart = Offset;
+	Status = ZwReadFile((HANDLE)Context, NULL, NULL, NULL, &IoStatus, Buffer, Length, &Position, NULL);
+	if (NT_SUCCESS(Status) && IoStatus.Information != Length)
+	{
+		Status = STATUS_END_OF_FILE;
+	}
+
+	return Status;
+}
+
+static
+NTSTATUS
+AstonBatteryWriteHistoryFile(
+	_In_ PVOID Context,
+	_In_ ULONG Offset,
+	_In_reads_bytes_(Length) PVOID Buffer,
+	_In_ ULONG Length
+)
+{
+	IO_STATUS_BLOCK IoStatus;
+	LARGE_INTEGER Position;
+
+	Position.QuadPart = Offset;
+	return ZwWriteFile((HANDLE)Context, NULL, NULL, NULL, &IoStatus, Buffer, Length, &Position, NULL);
+}
+
+static
+NTSTATUS
+AstonBatteryOpenHistoryFile(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+	_In_ BOOLEAN Create,
+	_Out_ PASTON_BATTERY_HISTORY_FILE File,
+	_Out_ WDFMEMORY* Memory
+)
+
+/*++
+
+Routine Description:
+
+	Opens the history file in the data directory of the device, allocates
+	the work buffer and reads the clocks.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Create - Supplies TRUE to create the file if it does not exist.
+
+	File - Receives the open file, to be closed with ZwClose on its Context.
+
+	Memory - Receives the work buffer, to be deleted by the caller.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	OBJECT_ATTRIBUTES Attributes;
+	IO_STATUS_BLOCK IoStatus;
+	LARGE_INTEGER SystemTime;
+	LARGE_INTEGER Now;
+	HANDLE Directory;
+	HANDLE Handle;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	RtlZeroMemory(File, sizeof(*File));
+	*Memory = NULL;
+
+	Status = WdfMemoryCreate(WDF_NO_OBJECT_ATTRIBUTES,
+		PagedPool,
+		ASTON_BATTERY_POOL_TAG,
+		ASTON_BATTERY_HISTORY_FILE_BUFFER_SIZE,
+		Memory,
+		(PVOID*)&File->Buffer);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "WdfMemoryCreate failed with Status = 0x%08lX\n", Status);
+		goto Exit;
+	}
+
+	Status = IoGetDeviceDirectory(WdfDeviceWdmGetPhysicalDevice(DevExt->Device),
+		DeviceDirectoryData,
+		0,
+		NULL,
+		&Directory);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "IoGetDeviceDirectory failed with Status = 0x%08lX\n", Status);
+		goto Exit;
+	}
+
+	InitializeObjectAttributes(&Attributes,
+		(PUNICODE_STRING)&HistoryFileName,
+		OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE,
+		Directory,
+		NULL);
+
+	Status = ZwCreateFile(&Handle,
+		(Create ? FILE_GENERIC_WRITE : 0) | FILE_GENERIC_READ,
+		&Attributes,
+		&IoStatus,
+		NULL,
+		FILE_ATTRIBUTE_NORMAL,
+		0,
+		Create ? FILE_OPEN_IF : FILE_OPEN,
+		FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE,
+		NULL,
+		0);
+
+	ZwClose(Directory);
+
+	if (!NT_SUCCESS(Status))
+	{
+		if (Status != STATUS_OBJECT_NAME_NOT_FOUND)
+		{
+			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "ZwCreateFile failed with Status = 0x%08lX\n", Status);
+		}
+
+		goto Exit;
+	}
+
+	KeQuerySystemTime(&SystemTime);
+	Now = KeQueryPerformanceCounter(NULL);
+
+	File->Context = Handle;
+	File->Read = AstonBatteryReadHistoryFile;
+	File->Write = AstonBatteryWriteHistoryFile;
+	File->SystemTimeMs = SystemTime.QuadPart / 10000;
+	File->TimestampMs = AstonBatteryTicksToMs(Now.QuadPart, DevExt->QpcFrequency.QuadPart);
+	File->QpcFrequency = DevExt->QpcFrequency.QuadPart;
+
+Exit:
+	if (!NT_SUCCESS(Status) && *Memory != NULL)
+	{
+		WdfObjectDelete(*Memory);
+		*Memory = NULL;
+	}
+
+	return Status;
+}
+
+static
+VOID
+AstonBatteryRemoveRegistryArchive(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Removes the archive that earlier versions of the driver kept in the
+	device hardware key.
+
+--*/
+
+{
+	DECLARE_UNICODE_STRING_SIZE(BlockName, 32);
+	WDFKEY Key;
+	ULONG Block;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	Status = WdfDeviceOpenRegistryKey(DevExt->Device,
+		PLUGPLAY_REGKEY_DEVICE,
+		KEY_WRITE,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&Key);
+
+	if (!NT_SUCCESS(Status))
+	{
+		return;
+	}
+
+	if (NT_SUCCESS(WdfRegistryRemoveValue(Key, &ArchiveIndexName)))
+	{
+		for (Block = 0; Block < ASTON_BATTERY_ARCHIVE_BLOCKS; Block++)
+		{
+			if (NT_SUCCESS(RtlUnicodeStringPrintf(&BlockName, L"HistoryArchive%02u", Block)))
+			{
+				WdfRegistryRemoveValue(Key, &BlockName);
+			}
+		}
+	}
+
+	WdfRegistryClose(Key);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryRestoreHistory(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Reads the ring and the archive back from the history file and moves
+	them to the timeline of this boot, see AstonBatteryRestoreHistoryFile.
+	Does nothing once either holds samples, so that a stop and start of
+	the device keeps what it has.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	ASTON_BATTERY_HISTORY_FILE File;
+	WDFMEMORY Memory;
+	ULONG Dropped;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	if (DevExt->HistoryMemory == NULL ||
+		DevExt->ArchiveMemory == NULL ||
+		DevExt->History.TotalSamples != 0 ||
+		DevExt->Archive.TotalSamples != 0)
+	{
+		return;
+	}
+
+	AstonBatteryRemoveRegistryArchive(DevExt);
+
+	Status = AstonBatteryOpenHistoryFile(DevExt, FALSE, &File, &Memory);
+	if (!NT_SUCCESS(Status))
+	{
+		return;
+	}
+
+	WdfWaitLockAcquire(DevExt->HistoryLock, NULL);
+	Status = AstonBatteryRestoreHistoryFile(&DevExt->History, &DevExt->Archive, &File, &Dropped);
+	if (NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_INFO,
+			"Restored %u history samples and %u archive blocks, dropped %u\n",
+			DevExt->History.Count,
+			DevExt->Archive.BlockCount,
+			Dropped);
+	}
+
+	WdfWaitLockRelease(DevExt->HistoryLock);
+
+	ZwClose(File.Context);
+	WdfObjectDelete(Memory);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryCheckpointHistory(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	BOOLEAN Force
+)
+
+/*++
+
+Routine Description:
+
+	Appends the ring records and archive bytes added since the last
+	checkpoint to the history file, then writes its header, see
+	AstonBatteryCheckpointHistoryFile. Runs at most once per
+	ASTON_BATTERY_HISTORY_CHECKPOINT_INTERVAL_MS unless Force is set.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Force - Supplies TRUE to skip the rate limit, used on D0 exit.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	ASTON_BATTERY_HISTORY_FILE File;
+	WDFMEMORY Memory;
+	LARGE_INTEGER Now;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	if (DevExt->HistoryMemory == NULL || DevExt->ArchiveMemory == NULL)
+	{
+		return;
+	}
+
+	Now = KeQueryPerformanceCounter(NULL);
+	if (!Force)
+	{
+		//
+		// The first interval starts with the first sample.
+		//
+
+		if (DevExt->HistoryCheckpointTime.QuadPart == 0)
+		{
+			DevExt->HistoryCheckpointTime = Now;
+			return;
+		}
+
+		if ((Now.QuadPart - DevExt->HistoryCheckpointTime.QuadPart) / DevExt->QpcFrequency.QuadPart <
+			ASTON_BATTERY_HISTORY_CHECKPOINT_INTERVAL_MS / 1000)
+		{
+			return;
+		}
+	}
+
+	DevExt->HistoryCheckpointTime = Now;
+
+	Status = AstonBatteryOpenHistoryFile(DevExt, TRUE, &File, &Memory);
+	if (!NT_SUCCESS(Status))
+	{
+		return;
+	}
+
+	WdfWaitLockAcquire(DevExt->HistoryLock, NULL);
+	Status = AstonBatteryCheckpointHistoryFile(&DevExt->History, &DevExt->Archive, &File);
+	WdfWaitLockRelease(DevExt->HistoryLock);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "ZwWriteFile failed with Status = 0x%08lX\n", Status);
+	}
+	else
+	{
+		Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_INFO,
+			"History checkpoint wrote %u bytes\n",
+			File.Written);
+	}
+
+	ZwClose(File.Context);
+	WdfObjectDelete(Memory);
+}
@@ -0,0 +1,893 @@
+/*++
+
+Module Name:
+
+	ioctl.c
+
+Abstract:
+
+	This module serves the private device interface of the battery. The
+	battery class driver sees every IRP_MJ_DEVICE_CONTROL first, the ones it
+	does not own fall through to the default queue created here. Change
+	notification requests are parked on a manual queue until a snapshot
+	update satisfies them.
+
+	N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include <initguid.h>
+#include "AstonBattery.h"
+#include "ioctl.tmh"
+
+//---------------------------------------------------------------------- Pragmas
+
+#pragma alloc_text(PAGE, AstonBatteryCreateIoQueue)
+#pragma alloc_text(PAGE, AstonBatteryEvtIoDeviceControl)
+#pragma alloc_text(PAGE, AstonBatteryPublishTelemetry)
+#pragma alloc_text(PAGE, AstonBatteryFillTelemetry)
+
+//------------------------------------------------------------------ Definitions
+
+C_ASSERT(sizeof(SPB_LATENCY_ROW) == sizeof(ASTON_BATTERY_SPB_LATENCY_ROW));
+C_ASSERT(SPB_LATENCY_BUCKETS == ASTON_BATTERY_SPB_LATENCY_BUCKETS);
+C_ASSERT(SPB_LATENCY_MAX_ROWS == ASTON_BATTERY_SPB_LATENCY_MAX_ROWS);
+C_ASSERT(SpbOperationMacBlock == ASTON_BATTERY_SPB_OPERATION_MAC_BLOCK);
+
+//-------------------------------------------------------------------- Functions
+
+_Use_decl_annotations_
+VOID
+AstonBatteryFillTelemetry(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	PASTON_BATTERY_TELEMETRY Telemetry
+)
+
+/*++
+
+Routine Description:
+
+	Fills the bulk telemetry structure from a copy of the snapshot. The gauge
+	is not read, SampleAgeMs tells the caller how old the values are.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Telemetry - Supplies a pointer to return the telemetry.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+	LARGE_INTEGER Now;
+
+	PAGED_CODE();
+
+	Now = KeQueryPerformanceCounter(NULL);
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	Snapshot = DevExt->Snapshot;
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+
+	RtlZeroMemory(Telemetry, sizeof(*Telemetry));
+	Telemetry->Version = ASTON_BATTERY_TELEMETRY_VERSION;
+	Telemetry->Size = sizeof(*Telemetry);
+	Telemetry->BatteryTag = DevExt->BatteryTag;
+	Telemetry->Generation = Snapshot.Generation;
+	Telemetry->QueryTimestamp = Now.QuadPart;
+	Telemetry->SampleIntervalMs = DevExt->SampleIntervalMs;
+	Telemetry->D0EntryToSnapshotUs = DevExt->D0EntryToSnapshotUs;
+
+	if (Snapshot.Valid)
+	{
+		Telemetry->Flags |= ASTON_BATTERY_TELEMETRY_SAMPLE_VALID;
+		Telemetry->SampleTimestamp = Snapshot.Timestamp.QuadPart;
+		Telemetry->SampleAgeMs = (ULONG)min((Now.QuadPart - Snapshot.Timestamp.QuadPart) * 1000 /
+			DevExt->QpcFrequency.QuadPart, MAXULONG);
+	}
+
+	Telemetry->GaugeCount = Snapshot.GaugeCount;
+	Telemetry->AtRateTimeToEmpty = Snapshot.Registers.AtRateTimeToEmpty;
+	Telemetry->Temperature = Snapshot.Registers.Temperature;
+	Telemetry->Voltage = Snapshot.Registers.Voltage;
+	Telemetry->BatteryStatus = Snapshot.Registers.BatteryStatus;
+	Telemetry->Current = Snapshot.Registers.Current;
+	Telemetry->MaxLoadCurrent = Snapshot.Registers.MaxLoadCurrent;
+	Telemetry->RemainingCapacity = Snapshot.Registers.RemainingCapacity;
+	Telemetry->FullChargeCapacity = Snapshot.Registers.FullChargeCapacity;
+
+	Telemetry->Rate = AstonBatteryFilterValue(Snapshot.RateFilter.PowerShort);
+	Telemetry->AverageRate = AstonBatteryFilterValue(Snapshot.RateFilter.PowerLong);
+	Telemetry->EstimatedTime = AstonBatteryEstimateTime(&Snapshot, 0);
+	Telemetry->RemainingEnergy = Snapshot.Energy.RemainingEnergyMwh;
+	Telemetry->OpenCircuitVoltage = Snapshot.LoadModel.OpenCircuitVoltage;
+	Telemetry->ResistanceMilliOhm = Snapshot.LoadModel.ResistanceMilliOhm;
+	Telemetry->ChargedEnergy = Snapshot.Energy.ChargedUj;
+	Telemetry->DischargedEnergy = Snapshot.Energy.DischargedUj;
+	Telemetry->PredictionSamples = Snapshot.Predictor.Samples;
+	Telemetry->MaxCapacityErrorMah = Snapshot.Predictor.MaxCapacityErrorMah;
+	Telemetry->MaxVoltageErrorMv = Snapshot.Predictor.MaxVoltageErrorMv;
+
+	Telemetry->SafetyAlert = Snapshot.Safety.SafetyAlert;
+	Telemetry->SafetyStatus = Snapshot.Safety.SafetyStatus;
+	Telemetry->PFStatus = Snapshot.Safety.PFStatus;
+	Telemetry->OperationStatus = Snapshot.Safety.OperationStatus;
+	Telemetry->SafetyTimestamp = Snapshot.Safety.Timestamp;
+
+	if (Snapshot.HealthValid)
+	{
+		Telemetry->Flags |= ASTON_BATTERY_TELEMETRY_HEALTH_VALID;
+	}
+
+	Telemetry->Health = Snapshot.Health;
+	Telemetry->Cells = Snapshot.Cells;
+	Telemetry->Cells.Size = sizeof(Telemetry->Cells);
+}
+
+static
+NTSTATUS
+AstonBatteryReadRegisterList(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+	_In_ const ASTON_BATTERY_REGISTER_LIST* List,
+	_Out_ PASTON_BATTERY_REGISTER_VALUES Values
+)
+
+/*++
+
+Routine Description:
+
+	Reads the requested standard command words from one gauge. Adjacent
+	words are coalesced so that each run costs a single transfer. The
+	queue is not power managed, so the reads are refused outside D0
+	rather than put on the bus of a powered down device.
+
+--*/
+
+{
+	UINT16 Block[DEFAULT_SPB_BUFFER_SIZE / sizeof(UINT16)];
+	ULONG First;
+	ULONG Last;
+	ULONG i;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	if (List->Gauge >= DevExt->GaugeCount || List->Count > ASTON_BATTERY_MAX_REGISTER_LIST)
+	{
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	for (i = 0; i < List->Count; i++)
+	{
+		if ((List->Address[i] & 1) != 0 || List->Address[i] > ASTON_BATTERY_MAX_REGISTER_ADDRESS)
+		{
+			return STATUS_INVALID_PARAMETER;
+		}
+	}
+
+	Status = AstonBatteryWaitForSpbTarget(DevExt);
+	if (!NT_SUCCESS(Status))
+	{
+		return Status;
+	}
+
+	WaitLockAcquire(DevExt->StateLock, &DevExt->StateLockStatistics);
+	if (!DevExt->InD0)
+	{
+		Status = STATUS_DEVICE_NOT_READY;
+		goto Exit;
+	}
+
+	RtlZeroMemory(Values, sizeof(*Values));
+
+	for (First = 0; First < List->Count; First = Last + 1)
+	{
+		Last = First;
+		while (Last + 1 < List->Count &&
+			List->Address[Last + 1] == List->Address[Last] + sizeof(UINT16) &&
+			Last + 1 - First < ARRAYSIZE(Block))
+		{
+			Last += 1;
+		}
+
+		Status = SpbReadDataSynchronously(&DevExt->I2CContext[List->Gauge],
+			List->Address[First],
+			Block,
+			(Last - First + 1) * sizeof(UINT16));
+
+		if (!NT_SUCCESS(Status))
+		{
+			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed at 0x%02x with Status = 0x%08lX\n", List->Address[First], Status);
+			goto Exit;
+		}
+
+		for (i = First; i <= Last; i++)
+		{
+			Values->Value[i] = Block[i - First];
+		}
+	}
+
+	Values->Count = List->Count;
+	Status = STATUS_SUCCESS;
+
+Exit:
+	WaitLockRelease(DevExt->StateLock, &DevExt->StateLockStatistics);
+	return Status;
+}
+
+static
+VOID
+AstonBatteryCopySpbLatency(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+	_Out_ PASTON_BATTERY_SPB_LATENCY Latency,
+	_In_ BOOLEAN Reset
+)
+
+/*++
+
+Routine Description:
+
+	Copies the latency rows of every gauge, which share the layout of the
+	SPB rows apart from the gauge number. Gauges whose target has not been
+	opened have no rows.
+
+--*/
+
+{
+	ULONG Count;
+	ULONG Dropped;
+	ULONG i;
+	ULONG j;
+
+	PAGED_CODE();
+
+	RtlZeroMemory(Latency, sizeof(*Latency));
+	Latency->Version = ASTON_BATTERY_SPB_LATENCY_VERSION;
+	Latency->Size = sizeof(*Latency);
+
+	if (!DevExt->SpbReady || !NT_SUCCESS(DevExt->SpbInitStatus))
+	{
+		return;
+	}
+
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		Count = SpbQueryLatency(&DevExt->I2CContext[i],
+			(SPB_LATENCY_ROW*)&Latency->Rows[Latency->RowCount],
+			ASTON_BATTERY_SPB_LATENCY_MAX_ROWS,
+			&Dropped,
+			Reset);
+
+		for (j = 0; j < Count; j++)
+		{
+			Latency->Rows[Latency->RowCount + j].Gauge = (UCHAR)i;
+		}
+
+		Latency->RowCount += Count;
+		Latency->Dropped += Dropped;
+	}
+}
+
+static
+ULONG
+AstonBatteryDistance(
+	_In_ LONG Value,
+	_In_ LONG Baseline
+)
+{
+	return (ULONG)(Value >= Baseline ? Value - Baseline : Baseline - Value);
+}
+
+static
+BOOLEAN
+AstonBatteryEvaluateChange(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+	_In_ PASTON_BATTERY_FILE_CONTEXT FileContext,
+	_In_ const ASTON_BATTERY_TELEMETRY* Telemetry,
+	_Out_ PULONG ChangedMask
+)
+
+/*++
+
+Routine Description:
+
+	Decides whether a change worth reporting to the handle has happened,
+	based on the wait parameters and the baseline of the handle.
+
+--*/
+
+{
+	const ASTON_BATTERY_WAIT_FOR_CHANGE* Wait;
+	const ASTON_BATTERY_TELEMETRY* Baseline;
+	ULONG Changed;
+
+	Wait = &FileContext->Wait;
+	*ChangedMask = 0;
+
+	if (Telemetry->Generation == Wait->Generation)
+	{
+		return FALSE;
+	}
+
+	if (FileContext->LastCompletion.QuadPart != 0 &&
+		(Telemetry->QueryTimestamp - FileContext->LastCompletion.QuadPart) * 1000 <
+			(LONGLONG)Wait->MinIntervalMs * DevExt->QpcFrequency.QuadPart)
+	{
+		return FALSE;
+	}
+
+	if (!FileContext->BaselineValid)
+	{
+		*ChangedMask = (Wait->FieldMask != 0) ? Wait->FieldMask : MAXULONG;
+		return TRUE;
+	}
+
+	Baseline = &FileContext->Baseline;
+	Changed = 0;
+
+	if (AstonBatteryDistance(Telemetry->Voltage, Baseline->Voltage) > Wait->VoltageDelta)
+	{
+		Changed |= ASTON_BATTERY_FIELD_VOLTAGE;
+	}
+
+	if (AstonBatteryDistance(Telemetry->Current, Baseline->Current) > Wait->CurrentDelta)
+	{
+		Changed |= ASTON_BATTERY_FIELD_CURRENT;
+	}
+
+	if (AstonBatteryDistance(Telemetry->RemainingCapacity, Baseline->RemainingCapacity) > Wait->CapacityDelta)
+	{
+		Changed |= ASTON_BATTERY_FIELD_CAPACITY;
+	}
+
+	if (AstonBatteryDistance(Telemetry->Temperature, Baseline->Temperature) > Wait->TemperatureDelta)
+	{
+		Changed |= ASTON_BATTERY_FIELD_TEMPERATURE;
+	}
+
+	if (Telemetry->BatteryStatus != Baseline->BatteryStatus)
+	{
+		Changed |= ASTON_BATTERY_FIELD_STATUS;
+	}
+
+	if (Telemetry->SafetyAlert != Baseline->SafetyAlert ||
+		Telemetry->SafetyStatus != Baseline->SafetyStatus ||
+		Telemetry->PFStatus != Baseline->PFStatus ||
+		Telemetry->OperationStatus != Baseline->OperationStatus)
+	{
+		Changed |= ASTON_BATTERY_FIELD_SAFETY;
+	}
+
+	if (Telemetry->Health.StateOfHealth != Baseline->Health.StateOfHealth ||
+		Telemetry->Health.CycleCount != Baseline->Health.CycleCount ||
+		Telemetry->Health.FullChargeCapacity != Baseline->Health.FullChargeCapacity)
+	{
+		Changed |= ASTON_BATTERY_FIELD_HEALTH;
+	}
+
+	if (Telemetry->BatteryTag != Baseline->BatteryTag)
+	{
+		Changed |= ASTON_BATTERY_FIELD_TAG;
+	}
+
+	if (Wait->FieldMask == 0)
+	{
+		*ChangedMask = Changed;
+		return TRUE;
+	}
+
+	*ChangedMask = Changed & Wait->FieldMask;
+	return (*ChangedMask != 0);
+}
+
+static
+VOID
+AstonBatteryCompleteChange(
+	_In_ WDFREQUEST Request,
+	_In_ PASTON_BATTERY_FILE_CONTEXT FileContext,
+	_In_ const ASTON_BATTERY_TELEMETRY* Telemetry,
+	_In_ ULONG ChangedMask
+)
+
+/*++
+
+Routine Description:
+
+	Completes a change request and makes its telemetry the new baseline of
+	the handle.
+
+--*/
+
+{
+	PASTON_BATTERY_CHANGE Change;
+	NTSTATUS Status;
+
+	Status = WdfRequestRetrieveOutputBuffer(Request,
+		sizeof(*Change),
+		(PVOID*)&Change,
+		NULL);
+
+	if (!NT_SUCCESS(Status))
+	{
+		WdfRequestComplete(Request, Status);
+		return;
+	}
+
+	Change->ChangedMask = ChangedMask;
+	Change->Telemetry = *Telemetry;
+
+	FileContext->Baseline = *Telemetry;
+	FileContext->BaselineValid = TRUE;
+	FileContext->LastCompletion.QuadPart = Telemetry->QueryTimestamp;
+
+	WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, sizeof(*Change));
+}
+
+static
+VOID
+AstonBatteryWaitForChange(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+	_In_ WDFREQUEST Request
+)
+
+/*++
+
+Routine Description:
+
+	Completes a change request right away if the handle has something to
+	report, otherwise parks it on the change queue until a snapshot update
+	satisfies it or it is cancelled.
+
+--*/
+
+{
+	PASTON_BATTERY_WAIT_FOR_CHANGE Wait;
+	PASTON_BATTERY_FILE_CONTEXT FileContext;
+	ASTON_BATTERY_TELEMETRY Telemetry;
+	PVOID Output;
+	ULONG ChangedMask;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	Status = WdfRequestRetrieveInputBuffer(Request,
+		sizeof(*Wait),
+		(PVOID*)&Wait,
+		NULL);
+
+	if (NT_SUCCESS(Status))
+	{
+		Status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(ASTON_BATTERY_CHANGE),
+			&Output,
+			NULL);
+	}
+
+	if (NT_SUCCESS(Status) && WdfRequestGetFileObject(Request) == NULL)
+	{
+		Status = STATUS_INVALID_DEVICE_REQUEST;
+	}
+
+	if (!NT_SUCCESS(Status))
+	{
+		WdfRequestComplete(Request, Status);
+		return;
+	}
+
+	FileContext = GetFileContext(WdfRequestGetFileObject(Request));
+
+	WdfWaitLockAcquire(DevExt->ChangeLock, NULL);
+	FileContext->Wait = *Wait;
+
+	AstonBatteryFillTelemetry(DevExt, &Telemetry);
+	if (AstonBatteryEvaluateChange(DevExt, FileContext, &Telemetry, &ChangedMask))
+	{
+		AstonBatteryCompleteChange(Request, FileContext, &Telemetry, ChangedMask);
+	}
+	else
+	{
+		Status = WdfRequestForwardToIoQueue(Request, DevExt->ChangeQueue);
+		if (!NT_SUCCESS(Status))
+		{
+			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "WdfRequestForwardToIoQueue failed with Status = 0x%08lX\n", Status);
+			WdfRequestComplete(Request, Status);
+		}
+	}
+
+	WdfWaitLockRelease(DevExt->ChangeLock);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryPublishTelemetry(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Publishes the current snapshot: rewrites the shared section and
+	completes the parked change requests it satisfies. Called after every
+	snapshot update.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	ASTON_BATTERY_TELEMETRY Telemetry;
+	PASTON_BATTERY_FILE_CONTEXT FileContext;
+	WDFREQUEST Previous;
+	WDFREQUEST Found;
+	WDFREQUEST Request;
+	ULONG ChangedMask;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	if (DevExt->ChangeQueue == NULL)
+	{
+		return;
+	}
+
+	WdfWaitLockAcquire(DevExt->ChangeLock, NULL);
+	AstonBatteryFillTelemetry(DevExt, &Telemetry);
+	AstonBatteryWriteSharedTelemetry(DevExt, &Telemetry);
+
+	Previous = NULL;
+	for (;;)
+	{
+		Status = WdfIoQueueFindRequest(DevExt->ChangeQueue, Previous, NULL, NULL, &Found);
+		if (Previous != NULL)
+		{
+			WdfObjectDereference(Previous);
+			Previous = NULL;
+		}
+
+		if (Status == STATUS_NOT_FOUND)
+		{
+			//
+			// The previous request was cancelled, start over.
+			//
+
+			continue;
+		}
+
+		if (!NT_SUCCESS(Status))
+		{
+			break;
+		}
+
+		FileContext = GetFileContext(WdfRequestGetFileObject(Found));
+		if (!AstonBatteryEvaluateChange(DevExt, FileContext, &Telemetry, &ChangedMask))
+		{
+			Previous = Found;
+			continue;
+		}
+
+		Status = WdfIoQueueRetrieveFoundRequest(DevExt->ChangeQueue, Found, &Request);
+		WdfObjectDereference(Found);
+		if (NT_SUCCESS(Status))
+		{
+			AstonBatteryCompleteChange(Request, FileContext, &Telemetry, ChangedMask);
+		}
+	}
+
+	WdfWaitLockRelease(DevExt->ChangeLock);
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryCreateIoQueue(
+	WDFDEVICE Device
+)
+
+/*++
+
+Routine Description:
+
+	Publishes the private device interface and creates the default queue
+	behind it. The queue is not power managed, requests are answered from
+	the cached telemetry and never wake the device.
+
+Arguments:
+
+	Device - Supplies a handle to a framework device object.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	PSURFACE_BATTERY_FDO_DATA DevExt;
+	WDF_OBJECT_ATTRIBUTES LockAttributes;
+	WDF_IO_QUEUE_CONFIG QueueConfig;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	DevExt = GetDeviceExtension(Device);
+
+	Status = WdfDeviceCreateDeviceInterface(Device,
+		&GUID_DEVINTERFACE_ASTON_BATTERY,
+		NULL);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "WdfDeviceCreateDeviceInterface failed with Status = 0x%08lX\n", Status);
+		goto Exit;
+	}
+
+	WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&QueueConfig, WdfIoQueueDispatchParallel);
+	QueueConfig.PowerManaged = WdfFalse;
+	QueueConfig.EvtIoDeviceControl = AstonBatteryEvtIoDeviceControl;
+
+	Status = WdfIoQueueCreate(Device,
+		&QueueConfig,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		WDF_NO_HANDLE);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "WdfIoQueueCreate failed with Status = 0x%08lX\n", Status);
+		goto Exit;
+	}
+
+	//
+	// Change requests wait on a manual queue, which also takes care of
+	// cancelling them.
+	//
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&LockAttributes);
+	LockAttributes.ParentObject = Device;
+	Status = WdfWaitLockCreate(&LockAttributes, &DevExt->ChangeLock);
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "WdfWaitLockCreate failed with Status = 0x%08lX\n", Status);
+		goto Exit;
+	}
+
+	WDF_IO_QUEUE_CONFIG_INIT(&QueueConfig, WdfIoQueueDispatchManual);
+	QueueConfig.PowerManaged = WdfFalse;
+
+	Status = WdfIoQueueCreate(Device,
+		&QueueConfig,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&DevExt->ChangeQueue);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "WdfIoQueueCreate failed with Status = 0x%08lX\n", Status);
+		goto Exit;
+	}
+
+Exit:
+	return Status;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryEvtIoDeviceControl(
+	WDFQUEUE Queue,
+	WDFREQUEST Request,
+	size_t OutputBufferLength,
+	size_t InputBufferLength,
+	ULONG IoControlCode
+)
+
+/*++
+
+Routine Description:
+
+	Handles the private IOCTLs of the battery.
+
+Arguments:
+
+	Queue - Supplies the default queue of the device.
+
+	Request - Supplies the request to complete.
+
+	OutputBufferLength - Supplies the length of the output buffer.
+
+	InputBufferLength - Supplies the length of the input buffer.
+
+	IoControlCode - Supplies the IOCTL.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PSURFACE_BATTERY_FDO_DATA DevExt;
+	PASTON_BATTERY_CELL_TELEMETRY Cells;
+	PASTON_BATTERY_TELEMETRY Telemetry;
+	PASTON_BATTERY_REGISTER_LIST List;
+	PASTON_BATTERY_REGISTER_VALUES Values;
+	ASTON_BATTERY_REGISTER_LIST ListCopy;
+	PASTON_BATTERY_ARCHIVE_RANGE Range;
+	PASTON_BATTERY_SPB_LATENCY_QUERY LatencyQuery;
+	PASTON_BATTERY_SPB_LATENCY Latency;
+	ULONG LatencyFlags;
+	PVOID History;
+	size_t HistoryLength;
+	size_t Information;
+	NTSTATUS Status;
+
+	UNREFERENCED_PARAMETER(OutputBufferLength);
+
+	PAGED_CODE();
+
+	DevExt = GetDeviceExtension(WdfIoQueueGetDevice(Queue));
+	Information = 0;
+
+	switch (IoControlCode)
+	{
+	case IOCTL_ASTON_BATTERY_QUERY_CELL_TELEMETRY:
+		Status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(*Cells),
+			(PVOID*)&Cells,
+			NULL);
+
+		if (!NT_SUCCESS(Status))
+		{
+			break;
+		}
+
+		WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+		*Cells = DevExt->Snapshot.Cells;
+		WdfWaitLockRelease(DevExt->SnapshotLock);
+
+		Cells->Size = sizeof(*Cells);
+		Information = sizeof(*Cells);
+		break;
+
+	case IOCTL_ASTON_BATTERY_QUERY_TELEMETRY:
+		Status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(*Telemetry),
+			(PVOID*)&Telemetry,
+			NULL);
+
+		if (!NT_SUCCESS(Status))
+		{
+			break;
+		}
+
+		AstonBatteryFillTelemetry(DevExt, Telemetry);
+		Information = sizeof(*Telemetry);
+		break;
+
+	case IOCTL_ASTON_BATTERY_READ_REGISTERS:
+		Status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(*List),
+			(PVOID*)&List,
+			NULL);
+
+		if (!NT_SUCCESS(Status))
+		{
+			break;
+		}
+
+		Status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(*Values),
+			(PVOID*)&Values,
+			NULL);
+
+		if (!NT_SUCCESS(Status))
+		{
+			break;
+		}
+
+		//
+		// METHOD_BUFFERED shares one system buffer between input and output.
+		//
+
+		ListCopy = *List;
+		Status = AstonBatteryReadRegisterList(DevExt, &ListCopy, Values);
+		if (NT_SUCCESS(Status))
+		{
+			Information = sizeof(*Values);
+		}
+
+		break;
+
+	case IOCTL_ASTON_BATTERY_QUERY_HISTORY:
+		Status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(ASTON_BATTERY_HISTORY_HEADER),
+			&History,
+			&HistoryLength);
+
+		if (!NT_SUCCESS(Status))
+		{
+			break;
+		}
+
+		Status = AstonBatteryCopyHistory(DevExt, History, HistoryLength, &Information);
+		break;
+
+	case IOCTL_ASTON_BATTERY_QUERY_ARCHIVE:
+		Status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(*Range),
+			(PVOID*)&Range,
+			NULL);
+
+		if (!NT_SUCCESS(Status))
+		{
+			break;
+		}
+
+		Status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(ASTON_BATTERY_HISTORY_HEADER),
+			&History,
+			&HistoryLength);
+
+		if (!NT_SUCCESS(Status))
+		{
+			break;
+		}
+
+		Status = AstonBatteryCopyArchive(DevExt, Range, History, HistoryLength, &Information);
+		break;
+
+	case IOCTL_ASTON_BATTERY_QUERY_SPB_LATENCY:
+		LatencyFlags = 0;
+		if (InputBufferLength != 0)
+		{
+			Status = WdfRequestRetrieveInputBuffer(Request,
+				sizeof(*LatencyQuery),
+				(PVOID*)&LatencyQuery,
+				NULL);
+
+			if (!NT_SUCCESS(Status))
+			{
+				break;
+			}
+
+			LatencyFlags = LatencyQuery->Flags;
+		}
+
+		Status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(*Latency),
+			(PVOID*)&Latency,
+			NULL);
+
+		if (!NT_SUCCESS(Status))
+		{
+			break;
+		}
+
+		AstonBatteryCopySpbLatency(DevExt,
+			Latency,
+			(LatencyFlags & ASTON_BATTERY_SPB_LATENCY_RESET) != 0);
+
+		Information = sizeof(*Latency);
+		break;
+
+	case IOCTL_ASTON_BATTERY_WAIT_FOR_CHANGE:
+		AstonBatteryWaitForChange(DevExt, Request);
+		return;
+
+	default:
+		Status = STATUS_INVALID_DEVICE_REQUEST;
+		break;
+	}
+
+	WdfRequestCompleteWithInformation(Request, Status, Information);
+}
@@ -27,12 +27,7 @@ Abstract:
 //------------------------------------------------------------------- Prototypes
 
 #define AstonBatteryConvertMAHToMWH(Value) ((Value) * 9)
-
-_IRQL_requires_same_
-VOID
-AstonBatteryUpdateTag(
-	_Inout_ PSURFACE_BATTERY_FDO_DATA DevExt
-);
+#define AstonBatteryScalePackEnergy(Value) ((Value) * 2)
 
 BCLASS_QUERY_TAG_CALLBACK AstonBatteryQueryTag;
 BCLASS_QUERY_INFORMATION_CALLBACK AstonBatteryQueryInformation;
@@ -81,15 +76,15 @@ Return Value:
 	NTSTATUS Status = STATUS_SUCCESS;
 
 	PAGED_CODE();
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 
 	DevExt = GetDeviceExtension(Device);
 
-	WdfWaitLockAcquire(DevExt->StateLock, NULL);
+	WaitLockAcquire(DevExt->StateLock, &DevExt->StateLockStatistics);
 	AstonBatteryUpdateTag(DevExt);
-	WdfWaitLockRelease(DevExt->StateLock);
+	WaitLockRelease(DevExt->StateLock, &DevExt->StateLockStatistics);
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE,
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE,
 		"Leaving %!FUNC!: Status = 0x%08lX\n",
 		Status);
 	return;
@@ -123,10 +118,7 @@ Return Value:
 
 	PAGED_CODE();
 
-	DevExt->BatteryTag += 1;
-	if (DevExt->BatteryTag == BATTERY_TAG_INVALID) {
-		DevExt->BatteryTag += 1;
-	}
+	DevExt->BatteryTag = AstonBatteryNextTag(DevExt->BatteryTag);
 
 	return;
 }
@@ -157,16 +149,18 @@ Return Value:
 --*/
 
 {
+	ASTON_BATTERY_ACTIVITY Activity;
 	PSURFACE_BATTERY_FDO_DATA DevExt;
 	NTSTATUS Status;
 
 	PAGED_CODE();
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 
 	DevExt = (PSURFACE_BATTERY_FDO_DATA)Context;
-	WdfWaitLockAcquire(DevExt->StateLock, NULL);
+	AstonBatteryStartActivity(DevExt, &Activity, AstonBatteryActivityQueryTag, 0);
+	WaitLockAcquire(DevExt->StateLock, &DevExt->StateLockStatistics);
 	*BatteryTag = DevExt->BatteryTag;
-	WdfWaitLockRelease(DevExt->StateLock);
+	WaitLockRelease(DevExt->StateLock, &DevExt->StateLockStatistics);
 	if (*BatteryTag == BATTERY_TAG_INVALID) {
 		Status = STATUS_NO_SUCH_DEVICE;
 	}
@@ -174,7 +168,8 @@ Return Value:
 		Status = STATUS_SUCCESS;
 	}
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE,
+	AstonBatteryStopActivity(DevExt, &Activity, Status);
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE,
 		"Leaving %!FUNC!: Status = 0x%08lX\n",
 		Status);
 	return Status;
@@ -186,8 +181,11 @@ AstonBatteryQueryBatteryInformation(
 	PBATTERY_INFORMATION BatteryInformationResult
 )
 {
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+	UINT16 GaugeValues[ASTON_BATTERY_MAX_GAUGES];
+	ULONG i;
 	NTSTATUS Status;
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 
 	BatteryInformationResult->Capabilities =
 		BATTERY_SYSTEM_BATTERY |
@@ -200,68 +198,80 @@ AstonBatteryQueryBatteryInformation(
 
 	BYTE LION[4] = { 'L','I','O','N' };
 	RtlCopyMemory(BatteryInformationResult->Chemistry, LION, 4);
-	Status = SpbReadDataSynchronously(&DevExt->I2CContext, 0x3C, &BatteryInformationResult->DesignedCapacity, 2);
+
+	Status = AstonBatteryGetSnapshot(DevExt, ASTON_BATTERY_SNAPSHOT_MAX_AGE_MS, &Snapshot);
 	if (!NT_SUCCESS(Status))
 	{
-		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed with Status = 0x%08lX\n", Status);
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "AstonBatteryGetSnapshot failed with Status = 0x%08lX\n", Status);
 		goto Exit;
 	}
 
-	BatteryInformationResult->DesignedCapacity = AstonBatteryConvertMAHToMWH(BatteryInformationResult->DesignedCapacity * 2);
+	//
+	// Design capacity and cycle count come with the health analytics once
+	// the sampler has read them, until then they are read from the gauges.
+	//
 
-	Status = SpbReadDataSynchronously(&DevExt->I2CContext, 0x12, &BatteryInformationResult->FullChargedCapacity, 2);
-	if (!NT_SUCCESS(Status))
+	if (Snapshot.HealthValid)
 	{
-		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed with Status = 0x%08lX\n", Status);
-		goto Exit;
+		BatteryInformationResult->DesignedCapacity = AstonBatteryConvertMAHToMWH(Snapshot.Health.DesignCapacity * 2);
 	}
+	else
+	{
+		Status = AstonBatteryReadGaugeWord(DevExt, BQ28Z610_REG_DESIGN_CAPACITY, GaugeValues);
+		if (!NT_SUCCESS(Status))
+		{
+			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "AstonBatteryReadGaugeWord failed with Status = 0x%08lX\n", Status);
+			goto Exit;
+		}
 
-	BatteryInformationResult->FullChargedCapacity = AstonBatteryConvertMAHToMWH(BatteryInformationResult->FullChargedCapacity * 2);
+		BatteryInformationResult->DesignedCapacity = 0;
+		for (i = 0; i < ASTON_BATTERY_MAX_GAUGES; i++)
+		{
+			BatteryInformationResult->DesignedCapacity += AstonBatteryConvertMAHToMWH(GaugeValues[i] * 2);
+		}
+	}
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "FullChargedCapacity 0x13: %x", BatteryInformationResult->FullChargedCapacity);
+	//
+	// The full charge capacity is converted at the mean discharge voltage of
+	// the energy integrator, like the remaining capacity reported with the
+	// status, so that the two stay comparable.
+	//
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "FullChargedCapacity BeforeTransfer 0x12: %x", BatteryInformationResult->FullChargedCapacity);
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "FullChargedCapacity AfterTransfer: %x", BatteryInformationResult->FullChargedCapacity);
+	BatteryInformationResult->FullChargedCapacity = AstonBatteryScalePackEnergy(
+		AstonBatteryCapacityToEnergy(&Snapshot, Snapshot.Registers.FullChargeCapacity));
 
 	BatteryInformationResult->DefaultAlert1 = BatteryInformationResult->FullChargedCapacity * 7 / 100; // 7% of total capacity for error
 	BatteryInformationResult->DefaultAlert2 = BatteryInformationResult->FullChargedCapacity * 9 / 100; // 9% of total capacity for warning
 	BatteryInformationResult->CriticalBias = 0;
 
-	Status = SpbReadDataSynchronously(&DevExt->I2CContext, 0x2A, &BatteryInformationResult->CycleCount, 2);
-	if (!NT_SUCCESS(Status))
+	//
+	// The most worn pack determines the cycle count of the battery.
+	//
+
+	if (Snapshot.HealthValid)
 	{
-		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed with Status = 0x%08lX\n", Status);
-		goto Exit;
+		BatteryInformationResult->CycleCount = Snapshot.Health.CycleCount;
 	}
+	else
+	{
+		Status = AstonBatteryReadGaugeWord(DevExt, BQ28Z610_REG_CYCLE_COUNT, GaugeValues);
+		if (!NT_SUCCESS(Status))
+		{
+			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "AstonBatteryReadGaugeWord failed with Status = 0x%08lX\n", Status);
+			goto Exit;
+		}
 
-	Trace(
-		TRACE_LEVEL_INFORMATION,
-		SURFACE_BATTERY_TRACE,
-		"BATTERY_INFORMATION: \n"
-		"Capabilities: %d \n"
-		"Technology: %d \n"
-		"Chemistry: %c%c%c%c \n"
-		"DesignedCapacity: %d \n"
-		"FullChargedCapacity: %d \n"
-		"DefaultAlert1: %d \n"
-		"DefaultAlert2: %d \n"
-		"CriticalBias: %d \n"
-		"CycleCount: %d\n",
-		BatteryInformationResult->Capabilities,
-		BatteryInformationResult->Technology,
-		BatteryInformationResult->Chemistry[0],
-		BatteryInformationResult->Chemistry[1],
-		BatteryInformationResult->Chemistry[2],
-		BatteryInformationResult->Chemistry[3],
-		BatteryInformationResult->DesignedCapacity,
-		BatteryInformationResult->FullChargedCapacity,
-		BatteryInformationResult->DefaultAlert1,
-		BatteryInformationResult->DefaultAlert2,
-		BatteryInformationResult->CriticalBias,
-		BatteryInformationResult->CycleCount);
+		BatteryInformationResult->CycleCount = 0;
+		for (i = 0; i < ASTON_BATTERY_MAX_GAUGES; i++)
+		{
+			BatteryInformationResult->CycleCount = max(BatteryInformationResult->CycleCount, GaugeValues[i]);
+		}
+	}
+
+	AstonBatteryTraceBatteryInformation(BatteryInformationResult);
 
 Exit:
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE,
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE,
 		"Leaving %!FUNC!: Status = 0x%08lX\n",
 		Status);
 	return Status;
@@ -274,68 +284,34 @@ AstonBatteryQueryBatteryEstimatedTime(
 	PULONG ResultValue
 )
 {
+	ASTON_BATTERY_SNAPSHOT Snapshot;
 	NTSTATUS Status = STATUS_SUCCESS;
-	UCHAR Flags = 0;
-	UINT16 ETA = 0;
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 
-	if (AtRate == 0)
-	{
-		Status = SpbReadDataSynchronously(&DevExt->I2CContext, 0x0A, &Flags, 2);
-		if (!NT_SUCCESS(Status))
-		{
-			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed with Status = 0x%08lX\n", Status);
-			goto Exit;
-		}
+	//
+	// Every rate, hypothetical or not, is answered from the cached snapshot
+	// and the fitted load model; the gauge AtRate register is never written.
+	//
 
-		if (Flags & (1 << 0) || Flags & (1 << 1))
-		{
-			Status = SpbReadDataSynchronously(&DevExt->I2CContext, 0x04, &ETA, 2);
-			if (!NT_SUCCESS(Status))
-			{
-				Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed with Status = 0x%08lX\n", Status);
-				goto Exit;
-			}
-
-			if (ETA == 0xFFFF)
-			{
-
-			}
-			else
-			{
-				*ResultValue = ETA * 60;
-
-				Trace(
-					TRACE_LEVEL_INFORMATION,
-					SURFACE_BATTERY_TRACE,
-					"BatteryEstimatedTime: %d seconds\n",
-					*ResultValue);
-			}
-		}
-		else
-		{
-			*ResultValue = BATTERY_UNKNOWN_TIME;
-
-			Trace(
-				TRACE_LEVEL_INFORMATION,
-				SURFACE_BATTERY_TRACE,
-				"BatteryEstimatedTime: BATTERY_UNKNOWN_TIME\n");
-		}
-	}
-	else
+	Status = AstonBatteryGetSnapshot(DevExt, ASTON_BATTERY_SNAPSHOT_MAX_AGE_MS, &Snapshot);
+	if (!NT_SUCCESS(Status))
 	{
-		*ResultValue = BATTERY_UNKNOWN_TIME;
-
-		Trace(
-			TRACE_LEVEL_INFORMATION,
-			SURFACE_BATTERY_TRACE,
-			"BatteryEstimatedTime: BATTERY_UNKNOWN_TIME for AtRate = %d\n",
-			AtRate);
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "AstonBatteryGetSnapshot failed with Status = 0x%08lX\n", Status);
+		goto Exit;
 	}
 
+	*ResultValue = AstonBatteryEstimateTime(&Snapshot, AtRate);
+
+	Trace(
+		TRACE_LEVEL_VERBOSE,
+		SURFACE_BATTERY_TRACE,
+		"BatteryEstimatedTime: %u seconds for AtRate = %d\n",
+		*ResultValue,
+		AtRate);
+
 Exit:
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE,
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE,
 		"Leaving %!FUNC!: Status = 0x%08lX\n",
 		Status);
 	return Status;
@@ -388,25 +364,28 @@ Return Value:
 --*/
 
 {
+	ASTON_BATTERY_ACTIVITY Activity;
 	PSURFACE_BATTERY_FDO_DATA DevExt;
 	ULONG ResultValue;
 	PVOID ReturnBuffer;
 	size_t ReturnBufferLength;
 	NTSTATUS Status;
-	ULONG Percentage = 8000;
 
 	BATTERY_REPORTING_SCALE ReportingScale = { 0 };
 	BATTERY_INFORMATION BatteryInformationResult = { 0 };
 	WCHAR StringResult[MAX_BATTERY_STRING_SIZE] = { 0 };
 	BATTERY_MANUFACTURE_DATE ManufactureDate = { 0 };
+	ASTON_BATTERY_SNAPSHOT Snapshot;
 
 	ULONG Temperature = 0;
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 	PAGED_CODE();
 
 	DevExt = (PSURFACE_BATTERY_FDO_DATA)Context;
-	WdfWaitLockAcquire(DevExt->StateLock, NULL);
+	InterlockedIncrement64(&DevExt->Counters.InformationQueries[min((ULONG)Level, ASTON_BATTERY_COUNTED_QUERY_LEVELS)]);
+	AstonBatteryStartActivity(DevExt, &Activity, AstonBatteryActivityQueryInformation, (ULONG)Level);
+	WaitLockAcquire(DevExt->StateLock, &DevExt->StateLockStatistics);
 	if (BatteryTag != DevExt->BatteryTag) {
 		Status = STATUS_NO_SUCH_DEVICE;
 		goto QueryInformationEnd;
@@ -414,7 +393,7 @@ Return Value:
 
 	ReturnBuffer = NULL;
 	ReturnBufferLength = 0;
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_INFO, "Query for information level 0x%x\n", Level);
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_INFO, "Query for information level 0x%x\n", Level);
 	Status = STATUS_INVALID_DEVICE_REQUEST;
 	switch (Level) {
 	case BatteryInformation:
@@ -460,7 +439,7 @@ Return Value:
 			2333);
 
 		Trace(
-			TRACE_LEVEL_INFORMATION,
+			TRACE_LEVEL_VERBOSE,
 			SURFACE_BATTERY_TRACE,
 			"BatteryUniqueID: %S\n",
 			StringResult);
@@ -491,7 +470,7 @@ Return Value:
 		);
 
 		Trace(
-			TRACE_LEVEL_INFORMATION,
+			TRACE_LEVEL_VERBOSE,
 			SURFACE_BATTERY_TRACE,
 			"BatteryManufactureName: %S\n",
 			StringResult);
@@ -521,7 +500,7 @@ Return Value:
 		);
 
 		Trace(
-			TRACE_LEVEL_INFORMATION,
+			TRACE_LEVEL_VERBOSE,
 			SURFACE_BATTERY_TRACE,
 			"BatteryDeviceName: %S\n",
 			StringResult);
@@ -544,7 +523,7 @@ Return Value:
 		swprintf_s(StringResult, sizeof(StringResult) / sizeof(WCHAR), L"%u", (UINT32)2333);
 
 		Trace(
-			TRACE_LEVEL_INFORMATION,
+			TRACE_LEVEL_VERBOSE,
 			SURFACE_BATTERY_TRACE,
 			"BatterySerialNumber: %S\n",
 			StringResult);
@@ -574,18 +553,18 @@ Return Value:
 		break;
 
 	case BatteryGranularityInformation:
-		Status = SpbReadDataSynchronously(&DevExt->I2CContext, 0x10, &Percentage, 2);
+		Status = AstonBatteryGetPredictedSnapshot(DevExt, &Snapshot);
 		if (!NT_SUCCESS(Status))
 		{
-			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed with Status = 0x%08lX\n", Status);
+			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "AstonBatteryGetPredictedSnapshot failed with Status = 0x%08lX\n", Status);
 			goto Exit;
 		}
 
-		ReportingScale.Capacity = AstonBatteryConvertMAHToMWH(Percentage * 2);
+		ReportingScale.Capacity = AstonBatteryScalePackEnergy(Snapshot.Energy.RemainingEnergyMwh);
 		ReportingScale.Granularity = 1;
 
 		Trace(
-			TRACE_LEVEL_INFORMATION,
+			TRACE_LEVEL_VERBOSE,
 			SURFACE_BATTERY_TRACE,
 			"BATTERY_REPORTING_SCALE: Capacity: %d, Granularity: %d\n",
 			ReportingScale.Capacity,
@@ -597,15 +576,17 @@ Return Value:
 		break;
 
 	case BatteryTemperature:
-		Status = SpbReadDataSynchronously(&DevExt->I2CContext, 0x06, &Temperature, 2);
+		Status = AstonBatteryGetSnapshot(DevExt, ASTON_BATTERY_SNAPSHOT_MAX_AGE_MS, &Snapshot);
 		if (!NT_SUCCESS(Status))
 		{
-			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed with Status = 0x%08lX\n", Status);
+			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "AstonBatteryGetSnapshot failed with Status = 0x%08lX\n", Status);
 			goto Exit;
 		}
 
+		Temperature = Snapshot.Registers.Temperature;
+
 		Trace(
-			TRACE_LEVEL_INFORMATION,
+			TRACE_LEVEL_VERBOSE,
 			SURFACE_BATTERY_TRACE,
 			"BatteryTemperature: %d\n",
 			Temperature);
@@ -642,8 +623,9 @@ Exit:
 	}
 
 QueryInformationEnd:
-	WdfWaitLockRelease(DevExt->StateLock);
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE,
+	WaitLockRelease(DevExt->StateLock, &DevExt->StateLockStatistics);
+	AstonBatteryStopActivity(DevExt, &Activity, Status);
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE,
 		"Leaving %!FUNC!: Status = 0x%08lX\n",
 		Status);
 	return Status;
@@ -686,71 +668,65 @@ Return Value:
 --*/
 
 {
+	ASTON_BATTERY_ACTIVITY Activity;
 	PSURFACE_BATTERY_FDO_DATA DevExt;
+	ASTON_BATTERY_SNAPSHOT Snapshot;
 	NTSTATUS Status;
 
-	ULONG VBATT = 8000;
-	ULONG Percentage = 24750 * 2;
-
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 	PAGED_CODE();
 
 	DevExt = (PSURFACE_BATTERY_FDO_DATA)Context;
-	WdfWaitLockAcquire(DevExt->StateLock, NULL);
+	InterlockedIncrement64(&DevExt->Counters.StatusQueries);
+	AstonBatteryStartActivity(DevExt, &Activity, AstonBatteryActivityQueryStatus, 0);
+	WaitLockAcquire(DevExt->StateLock, &DevExt->StateLockStatistics);
 	if (BatteryTag != DevExt->BatteryTag) {
 		Status = STATUS_NO_SUCH_DEVICE;
 		goto QueryStatusEnd;
 	}
 
-	Trace(
-		TRACE_LEVEL_INFORMATION,
-		SURFACE_BATTERY_TRACE,
-		"BATTERY_DISCHARGING\n");
-
-	Status = SpbReadDataSynchronously(&DevExt->I2CContext, 0x0C, &BatteryStatus->Rate, 2);
+	Status = AstonBatteryGetPredictedSnapshot(DevExt, &Snapshot);
 	if (!NT_SUCCESS(Status))
 	{
-		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed with Status = 0x%08lX\n", Status);
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "AstonBatteryGetPredictedSnapshot failed with Status = 0x%08lX\n", Status);
 		goto QueryStatusEnd;
 	}
 
-	BatteryStatus->PowerState = BATTERY_DISCHARGING;
+	//
+	// Rate is the short term filtered power in mW, negative while
+	// discharging, so that it does not jump with every load transient.
+	//
 
-	Status = SpbReadDataSynchronously(&DevExt->I2CContext, 0x08, &VBATT, 2);
-	if (!NT_SUCCESS(Status))
+	BatteryStatus->Rate = AstonBatteryFilterValue(Snapshot.RateFilter.PowerShort);
+	if (BatteryStatus->Rate > 0)
 	{
-		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed with Status = 0x%08lX\n", Status);
-		goto QueryStatusEnd;
+		BatteryStatus->PowerState = BATTERY_POWER_ON_LINE | BATTERY_CHARGING;
 	}
-
-	Status = SpbReadDataSynchronously(&DevExt->I2CContext, 0x10, &Percentage, 2);
-	if (!NT_SUCCESS(Status))
+	else if ((Snapshot.Registers.BatteryStatus & BQ28Z610_BATTERY_STATUS_DSG) == 0)
 	{
-		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed with Status = 0x%08lX\n", Status);
-		goto QueryStatusEnd;
+		BatteryStatus->PowerState = BATTERY_POWER_ON_LINE;
+	}
+	else
+	{
+		BatteryStatus->PowerState = BATTERY_DISCHARGING;
 	}
 
-	BatteryStatus->Capacity = AstonBatteryConvertMAHToMWH(Percentage * 2);
-	BatteryStatus->Voltage = VBATT;
+	//
+	// Capacity is the remaining energy of the integrator, extrapolated to
+	// the present along with the remaining charge.
+	//
 
-	Trace(
-		TRACE_LEVEL_INFORMATION,
-		SURFACE_BATTERY_TRACE,
-		"BATTERY_STATUS: \n"
-		"PowerState: %d \n"
-		"Capacity: %d \n"
-		"Voltage: %d \n"
-		"Rate: %d\n",
-		BatteryStatus->PowerState,
-		BatteryStatus->Capacity,
-		BatteryStatus->Voltage,
-		BatteryStatus->Rate);
+	BatteryStatus->Capacity = AstonBatteryScalePackEnergy(Snapshot.Energy.RemainingEnergyMwh);
+	BatteryStatus->Voltage = Snapshot.Registers.Voltage;
+
+	AstonBatteryTraceBatteryStatus(BatteryStatus);
 
 	Status = STATUS_SUCCESS;
 
 QueryStatusEnd:
-	WdfWaitLockRelease(DevExt->StateLock);
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE,
+	WaitLockRelease(DevExt->StateLock, &DevExt->StateLockStatistics);
+	AstonBatteryStopActivity(DevExt, &Activity, Status);
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE,
 		"Leaving %!FUNC!: Status = 0x%08lX\n",
 		Status);
 	return Status;
@@ -795,11 +771,11 @@ Return Value:
 
 	UNREFERENCED_PARAMETER(BatteryNotify);
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 	PAGED_CODE();
 
 	DevExt = (PSURFACE_BATTERY_FDO_DATA)Context;
-	WdfWaitLockAcquire(DevExt->StateLock, NULL);
+	WaitLockAcquire(DevExt->StateLock, &DevExt->StateLockStatistics);
 	if (BatteryTag != DevExt->BatteryTag) {
 		Status = STATUS_NO_SUCH_DEVICE;
 		goto SetStatusNotifyEnd;
@@ -808,8 +784,8 @@ Return Value:
 	Status = STATUS_NOT_SUPPORTED;
 
 SetStatusNotifyEnd:
-	WdfWaitLockRelease(DevExt->StateLock);
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE,
+	WaitLockRelease(DevExt->StateLock, &DevExt->StateLockStatistics);
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE,
 		"Leaving %!FUNC!: Status = 0x%08lX\n",
 		Status);
 	return Status;
@@ -845,11 +821,11 @@ Return Value:
 
 	UNREFERENCED_PARAMETER(Context);
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 	PAGED_CODE();
 
 	Status = STATUS_NOT_SUPPORTED;
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE,
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE,
 		"Leaving %!FUNC!: Status = 0x%08lX\n",
 		Status);
 	return Status;
@@ -891,14 +867,16 @@ Return Value:
 	PULONG CriticalBias;
 	PBATTERY_CHARGER_ID ChargerId;
 	PBATTERY_CHARGER_STATUS ChargerStatus;
+	ASTON_BATTERY_ACTIVITY Activity;
 	PSURFACE_BATTERY_FDO_DATA DevExt;
 	NTSTATUS Status;
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 	PAGED_CODE();
 
 	DevExt = (PSURFACE_BATTERY_FDO_DATA)Context;
-	WdfWaitLockAcquire(DevExt->StateLock, NULL);
+	AstonBatteryStartActivity(DevExt, &Activity, AstonBatteryActivitySetInformation, (ULONG)Level);
+	WaitLockAcquire(DevExt->StateLock, &DevExt->StateLockStatistics);
 	if (BatteryTag != DevExt->BatteryTag) {
 		Status = STATUS_NO_SUCH_DEVICE;
 		goto SetInformationEnd;
@@ -970,8 +948,9 @@ Return Value:
 	}
 
 SetInformationEnd:
-	WdfWaitLockRelease(DevExt->StateLock);
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE,
+	WaitLockRelease(DevExt->StateLock, &DevExt->StateLockStatistics);
+	AstonBatteryStopActivity(DevExt, &Activity, Status);
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE,
 		"Leaving %!FUNC!: Status = 0x%08lX\n",
 		Status);
 	return Status;
@@ -0,0 +1,809 @@
+/*++
+
+Module Name:
+
+	model.c
+
+Abstract:
+
+	This module derives the battery reported to the class driver from the
+	registers of the gauges: it merges parallel packs, fits the load model,
+	integrates energy, filters the rates, predicts the registers between
+	samples, estimates the remaining time and tells a swapped pack from the
+	one it learnt on.
+
+	Everything here works on a snapshot passed in by the caller, without
+	locks, allocations or bus I/O.
+
+	N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "model.h"
+
+//-------------------------------------------------------------------- Functions
+
+_Use_decl_annotations_
+VOID
+AstonBatteryMergeGaugeRegisters(
+	const BQ28Z610_STANDARD_BLOCK* Gauges,
+	ULONG GaugeCount,
+	PBQ28Z610_STANDARD_BLOCK Merged
+)
+
+/*++
+
+Routine Description:
+
+	Combines the registers of packs wired in parallel into the registers of
+	one equivalent battery: capacities and currents add up, voltage is the
+	mean, temperature the hottest pack and status bits are or'ed together.
+	Time to empty is recomputed from the combined capacity and current.
+
+--*/
+
+{
+	LONG Current;
+	LONG MaxLoadCurrent;
+	ULONG RemainingCapacity;
+	ULONG FullChargeCapacity;
+	ULONG Voltage;
+	ULONG i;
+
+	if (GaugeCount == 1)
+	{
+		*Merged = Gauges[0];
+		return;
+	}
+
+	RtlZeroMemory(Merged, sizeof(*Merged));
+	Current = 0;
+	MaxLoadCurrent = 0;
+	RemainingCapacity = 0;
+	FullChargeCapacity = 0;
+	Voltage = 0;
+
+	for (i = 0; i < GaugeCount; i++)
+	{
+		Current += Gauges[i].Current;
+		MaxLoadCurrent += Gauges[i].MaxLoadCurrent;
+		RemainingCapacity += Gauges[i].RemainingCapacity;
+		FullChargeCapacity += Gauges[i].FullChargeCapacity;
+		Voltage += Gauges[i].Voltage;
+		Merged->Temperature = max(Merged->Temperature, Gauges[i].Temperature);
+		Merged->BatteryStatus |= Gauges[i].BatteryStatus;
+	}
+
+	Merged->Current = (INT16)max(min(Current, MAXSHORT), MINSHORT);
+	Merged->MaxLoadCurrent = (INT16)max(min(MaxLoadCurrent, MAXSHORT), MINSHORT);
+	Merged->RemainingCapacity = (UINT16)min(RemainingCapacity, MAXUSHORT);
+	Merged->FullChargeCapacity = (UINT16)min(FullChargeCapacity, MAXUSHORT);
+	Merged->Voltage = (UINT16)(Voltage / GaugeCount);
+
+	//
+	// AtRateTimeToEmpty is in minutes and 0xFFFF when not discharging.
+	//
+
+	if (Current < 0)
+	{
+		Merged->AtRateTimeToEmpty =
+			(UINT16)min((RemainingCapacity * 60) / (ULONG)(-Current), 0xFFFE);
+	}
+	else
+	{
+		Merged->AtRateTimeToEmpty = 0xFFFF;
+	}
+}
+
+static
+ULONG
+AstonBatteryIntegerSqrt(
+	ULONGLONG Value
+)
+{
+	ULONGLONG Root;
+	ULONGLONG Bit;
+
+	Root = 0;
+	Bit = 1ULL << 62;
+	while (Bit > Value)
+	{
+		Bit >>= 2;
+	}
+
+	while (Bit != 0)
+	{
+		if (Value >= Root + Bit)
+		{
+			Value -= Root + Bit;
+			Root = (Root >> 1) + Bit;
+		}
+		else
+		{
+			Root >>= 1;
+		}
+
+		Bit >>= 2;
+	}
+
+	return (ULONG)Root;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryUpdateLoadModel(
+	PASTON_BATTERY_SNAPSHOT Snapshot,
+	const BQ28Z610_STANDARD_BLOCK* Registers,
+	ULONGLONG ElapsedUs
+)
+
+/*++
+
+Routine Description:
+
+	Refines the series resistance of the load model from the voltage step
+	seen across a load step between two consecutive snapshots, then derives
+	the open circuit voltage from the newest sample.
+
+--*/
+
+{
+	PASTON_BATTERY_LOAD_MODEL Model;
+	LONG DeltaCurrent;
+	LONG DeltaVoltage;
+	LONG Resistance;
+
+	Model = &Snapshot->LoadModel;
+	if (Model->ResistanceMilliOhm == 0)
+	{
+		Model->ResistanceMilliOhm = ASTON_BATTERY_DEFAULT_RESISTANCE_MOHM;
+	}
+
+	if (Snapshot->Valid && ElapsedUs <= (ULONGLONG)ASTON_BATTERY_LOAD_STEP_MAX_AGE_MS * 1000)
+	{
+		DeltaCurrent = (LONG)Registers->Current - Snapshot->Registers.Current;
+		DeltaVoltage = (LONG)Registers->Voltage - Snapshot->Registers.Voltage;
+
+		//
+		// V = Voc + I * R with I positive while charging, so a load step
+		// and its voltage step carry the same sign.
+		//
+
+		if (DeltaCurrent >= ASTON_BATTERY_LOAD_STEP_MA || DeltaCurrent <= -ASTON_BATTERY_LOAD_STEP_MA)
+		{
+			Resistance = (DeltaVoltage * 1000) / DeltaCurrent;
+			if (Resistance >= ASTON_BATTERY_MIN_RESISTANCE_MOHM &&
+				Resistance <= ASTON_BATTERY_MAX_RESISTANCE_MOHM)
+			{
+				Model->ResistanceMilliOhm = (ULONG)((LONG)Model->ResistanceMilliOhm +
+					(Resistance - (LONG)Model->ResistanceMilliOhm) / 8);
+
+				Model->FitCount += 1;
+			}
+		}
+	}
+
+	Model->OpenCircuitVoltage = (ULONG)max((LONG)Registers->Voltage -
+		((LONG)Registers->Current * (LONG)Model->ResistanceMilliOhm) / 1000, 0);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryIntegrateEnergy(
+	PASTON_BATTERY_SNAPSHOT Snapshot,
+	const BQ28Z610_STANDARD_BLOCK* Registers,
+	ULONGLONG ElapsedUs
+)
+
+/*++
+
+Routine Description:
+
+	Accumulates the energy exchanged with the pack since the previous
+	sample, using the trapezoid rule over V * I at both ends of the
+	interval, and derives the remaining energy from the mean voltage
+	observed over the integrated discharge.
+
+--*/
+
+{
+	PASTON_BATTERY_ENERGY Energy;
+	LONGLONG PowerUw;
+	LONGLONG CurrentUa;
+	LONGLONG EnergyUj;
+	ULONGLONG MeanVoltage;
+
+	Energy = &Snapshot->Energy;
+	Energy->IntervalUj = 0;
+	Energy->IntervalUs = 0;
+
+	if (Snapshot->Valid &&
+		ElapsedUs != 0 &&
+		ElapsedUs <= (ULONGLONG)ASTON_BATTERY_MAX_INTEGRATION_GAP_MS * 1000)
+	{
+		//
+		// mV * mA is uW, uW * us / 10^6 is uJ.
+		//
+
+		PowerUw = ((LONGLONG)Snapshot->Registers.Voltage * Snapshot->Registers.Current +
+			(LONGLONG)Registers->Voltage * Registers->Current) / 2;
+
+		CurrentUa = ((LONGLONG)Snapshot->Registers.Current + Registers->Current) * 1000 / 2;
+		EnergyUj = (PowerUw * (LONGLONG)ElapsedUs) / 1000000;
+
+		if (EnergyUj >= 0)
+		{
+			Energy->ChargedUj += (ULONGLONG)EnergyUj;
+		}
+		else
+		{
+			Energy->DischargedUj += (ULONGLONG)(-EnergyUj);
+			Energy->DischargedUc += (ULONGLONG)((-CurrentUa * (LONGLONG)ElapsedUs) / 1000000);
+		}
+
+		Energy->IntervalUj = EnergyUj;
+		Energy->IntervalUs = ElapsedUs;
+	}
+
+	//
+	// uJ / uC is V, scaled to mV. Until some discharge has been integrated
+	// the terminal voltage stands in for the mean.
+	//
+
+	if (Energy->DischargedUc != 0)
+	{
+		MeanVoltage = (Energy->DischargedUj * 1000) / Energy->DischargedUc;
+	}
+	else
+	{
+		MeanVoltage = Registers->Voltage;
+	}
+
+	Energy->MeanVoltage = (ULONG)min(MeanVoltage, MAXULONG);
+	Energy->RemainingEnergyMwh = (ULONG)(((ULONGLONG)Registers->RemainingCapacity * Energy->MeanVoltage) / 1000);
+}
+
+_Use_decl_annotations_
+ULONG
+AstonBatteryCapacityToEnergy(
+	const ASTON_BATTERY_SNAPSHOT* Snapshot,
+	ULONG Capacity
+)
+
+/*++
+
+Routine Description:
+
+	Converts a charge into the energy it holds at the mean discharge
+	voltage of the integrator, so that capacities reported in mWh follow
+	the same curve as the integrated remaining energy.
+
+Arguments:
+
+	Snapshot - Supplies the snapshot holding the integrated energy.
+
+	Capacity - Supplies the charge in mAh.
+
+Return Value:
+
+	The energy in mWh, before any pack scaling.
+
+--*/
+
+{
+	ULONG MeanVoltage;
+
+	MeanVoltage = Snapshot->Energy.MeanVoltage;
+	if (MeanVoltage == 0)
+	{
+		MeanVoltage = Snapshot->Registers.Voltage;
+	}
+
+	return (ULONG)min(((ULONGLONG)Capacity * MeanVoltage) / 1000, MAXULONG);
+}
+
+static
+LONGLONG
+AstonBatteryFilterStep(
+	LONGLONG State,
+	LONG Sample,
+	ULONGLONG ElapsedUs,
+	ULONG TauMs
+)
+{
+	LONGLONG Target;
+	ULONGLONG ElapsedMs;
+
+	Target = (LONGLONG)Sample * (1LL << ASTON_BATTERY_RATE_FILTER_SHIFT);
+	ElapsedMs = ElapsedUs / 1000;
+
+	return State + ((Target - State) * (LONGLONG)ElapsedMs) / (LONGLONG)(TauMs + ElapsedMs);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryUpdateRateFilter(
+	PASTON_BATTERY_SNAPSHOT Snapshot,
+	const BQ28Z610_STANDARD_BLOCK* Registers,
+	ULONGLONG ElapsedUs
+)
+
+/*++
+
+Routine Description:
+
+	Feeds the newest current and power sample into the short and long rate
+	filters. The filters restart from the sample after a gap in sampling.
+
+	The Current register is a one second average, a single read stands for
+	the whole interval since the previous sample. RemainingCapacity counts
+	the charge that went through the pack, so its change bounds the mean
+	current over the interval within one mAh per gauge either way. The
+	reading is kept when it lies within those bounds and moved to the
+	nearest one otherwise. With a long interval the bounds are tight and a
+	read that lands in a burst or a lull no longer stands for minutes of
+	load, with a short one they are loose and the reading is used as is.
+
+--*/
+
+{
+	PASTON_BATTERY_RATE_FILTER Filter;
+	LONGLONG Charge;
+	LONGLONG Quantum;
+	LONGLONG Low;
+	LONGLONG High;
+	LONG Current;
+	LONG Power;
+
+	Filter = &Snapshot->RateFilter;
+	Current = Registers->Current;
+
+	if (!Filter->Primed ||
+		!Snapshot->Valid ||
+		ElapsedUs > (ULONGLONG)ASTON_BATTERY_MAX_INTEGRATION_GAP_MS * 1000)
+	{
+		Power = ((LONG)Registers->Voltage * Current) / 1000;
+		Filter->CurrentShort = (LONGLONG)Current * (1LL << ASTON_BATTERY_RATE_FILTER_SHIFT);
+		Filter->CurrentLong = Filter->CurrentShort;
+		Filter->PowerShort = (LONGLONG)Power * (1LL << ASTON_BATTERY_RATE_FILTER_SHIFT);
+		Filter->PowerLong = Filter->PowerShort;
+		Filter->Primed = TRUE;
+		return;
+	}
+
+	//
+	// A change of FullChargeCapacity rescales RemainingCapacity, its change
+	// over such an interval is not charge.
+	//
+
+	if (ElapsedUs != 0 &&
+		Registers->FullChargeCapacity == Snapshot->Registers.FullChargeCapacity)
+	{
+		//
+		// mAh * 3.6 * 10^9 / us is mA.
+		//
+
+		Charge = (LONGLONG)Registers->RemainingCapacity - Snapshot->Registers.RemainingCapacity;
+		Quantum = max(Snapshot->GaugeCount, 1);
+		Low = ((Charge - Quantum) * 3600000000LL) / (LONGLONG)ElapsedUs;
+		High = ((Charge + Quantum) * 3600000000LL) / (LONGLONG)ElapsedUs;
+		Current = (LONG)max(min(max(min((LONGLONG)Current, High), Low), MAXSHORT), MINSHORT);
+	}
+
+	Power = ((LONG)Registers->Voltage * Current) / 1000;
+
+	Filter->CurrentShort = AstonBatteryFilterStep(Filter->CurrentShort, Current, ElapsedUs, ASTON_BATTERY_RATE_TAU_SHORT_MS);
+	Filter->CurrentLong = AstonBatteryFilterStep(Filter->CurrentLong, Current, ElapsedUs, ASTON_BATTERY_RATE_TAU_LONG_MS);
+	Filter->PowerShort = AstonBatteryFilterStep(Filter->PowerShort, Power, ElapsedUs, ASTON_BATTERY_RATE_TAU_SHORT_MS);
+	Filter->PowerLong = AstonBatteryFilterStep(Filter->PowerLong, Power, ElapsedUs, ASTON_BATTERY_RATE_TAU_LONG_MS);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryPredict(
+	const ASTON_BATTERY_SNAPSHOT* Snapshot,
+	ULONGLONG AgeUs,
+	PLONG Capacity,
+	PLONG Voltage
+)
+
+/*++
+
+Routine Description:
+
+	Extrapolates the remaining capacity and voltage of a snapshot AgeUs
+	after it was taken, from the short term filtered current.
+
+--*/
+
+{
+	LONGLONG DeltaCapacity;
+
+	*Capacity = Snapshot->Registers.RemainingCapacity;
+	*Voltage = Snapshot->Registers.Voltage;
+
+	if (!Snapshot->RateFilter.Primed || AgeUs == 0)
+	{
+		return;
+	}
+
+	//
+	// mA * us / 3.6 * 10^9 is mAh.
+	//
+
+	DeltaCapacity = ((LONGLONG)AstonBatteryFilterValue(Snapshot->RateFilter.CurrentShort) *
+		(LONGLONG)AgeUs) / 3600000000LL;
+
+	*Capacity = (LONG)max(min((LONGLONG)*Capacity + DeltaCapacity,
+		(LONGLONG)Snapshot->Registers.FullChargeCapacity), 0);
+
+	*Voltage += (LONG)(((LONGLONG)(*Capacity - (LONG)Snapshot->Registers.RemainingCapacity) *
+		Snapshot->Predictor.VoltageSlopeUvPerMah) / 1000);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryUpdatePredictor(
+	PASTON_BATTERY_SNAPSHOT Snapshot,
+	const BQ28Z610_STANDARD_BLOCK* Registers,
+	ULONGLONG ElapsedUs
+)
+
+/*++
+
+Routine Description:
+
+	Scores the prediction made from the previous snapshot against the newest
+	sample and refines the slope of the open circuit voltage over capacity.
+	Must run before the load model and rate filters take the new sample.
+
+--*/
+
+{
+	PASTON_BATTERY_PREDICTOR Predictor;
+	LONG Capacity;
+	LONG Voltage;
+	LONG CapacityError;
+	LONG VoltageError;
+	ULONG AbsCapacityError;
+	ULONG AbsVoltageError;
+	LONG DeltaCapacity;
+	LONG DeltaVoltage;
+	LONG OpenCircuitVoltage;
+	LONG Slope;
+
+	Predictor = &Snapshot->Predictor;
+
+	if (!Snapshot->Valid ||
+		ElapsedUs > (ULONGLONG)ASTON_BATTERY_MAX_INTEGRATION_GAP_MS * 1000)
+	{
+		return;
+	}
+
+	AstonBatteryPredict(Snapshot, ElapsedUs, &Capacity, &Voltage);
+
+	CapacityError = Capacity - (LONG)Registers->RemainingCapacity;
+	VoltageError = Voltage - (LONG)Registers->Voltage;
+
+	Predictor->Samples += 1;
+	Predictor->LastCapacityErrorMah = CapacityError;
+	Predictor->LastVoltageErrorMv = VoltageError;
+	AbsCapacityError = (ULONG)(CapacityError < 0 ? -CapacityError : CapacityError);
+	AbsVoltageError = (ULONG)(VoltageError < 0 ? -VoltageError : VoltageError);
+	Predictor->SumCapacityErrorMah += AbsCapacityError;
+	Predictor->SumVoltageErrorMv += AbsVoltageError;
+	Predictor->MaxCapacityErrorMah = max(Predictor->MaxCapacityErrorMah, AbsCapacityError);
+	Predictor->MaxVoltageErrorMv = max(Predictor->MaxVoltageErrorMv, AbsVoltageError);
+
+	//
+	// Compare open circuit voltages so that load steps between the samples
+	// do not show up as a change of slope.
+	//
+
+	DeltaCapacity = (LONG)Registers->RemainingCapacity - (LONG)Snapshot->Registers.RemainingCapacity;
+	if (DeltaCapacity == 0)
+	{
+		return;
+	}
+
+	OpenCircuitVoltage = (LONG)Registers->Voltage -
+		((LONG)Registers->Current * (LONG)Snapshot->LoadModel.ResistanceMilliOhm) / 1000;
+
+	DeltaVoltage = OpenCircuitVoltage - (LONG)Snapshot->LoadModel.OpenCircuitVoltage;
+	Slope = (DeltaVoltage * 1000) / DeltaCapacity;
+
+	if (Slope >= 0)
+	{
+		Predictor->VoltageSlopeUvPerMah += (Slope - Predictor->VoltageSlopeUvPerMah) / 8;
+	}
+}
+
+_Use_decl_annotations_
+ULONG
+AstonBatteryEstimateTime(
+	const ASTON_BATTERY_SNAPSHOT* Snapshot,
+	LONG AtRate
+)
+
+/*++
+
+Routine Description:
+
+	Estimates, in seconds, how long the battery lasts at a given power draw
+	or how long it takes to fill at a given charge power. The estimate only
+	uses the snapshot, so it is cheap enough to be asked for many rates.
+
+	The current drawn for a power P follows from the load model,
+	P = I * (Voc - I * R), so heavier loads lose more to the series
+	resistance and run out sooner than a plain capacity / power estimate.
+
+Arguments:
+
+	Snapshot - Supplies a valid snapshot.
+
+	AtRate - Supplies the rate in mW, negative for discharge. Zero estimates
+		the time to empty at the long term filtered current.
+
+Return Value:
+
+	Estimated time in seconds or BATTERY_UNKNOWN_TIME.
+
+--*/
+
+{
+	const ASTON_BATTERY_LOAD_MODEL* Model;
+	ULONGLONG Discriminant;
+	ULONGLONG Power;
+	ULONG Resistance;
+	ULONG Voltage;
+	ULONG Current;
+	ULONG Capacity;
+
+	Model = &Snapshot->LoadModel;
+
+	if (AtRate == 0)
+	{
+		if (!Snapshot->RateFilter.Primed ||
+			AstonBatteryFilterValue(Snapshot->RateFilter.CurrentLong) >= 0)
+		{
+			return BATTERY_UNKNOWN_TIME;
+		}
+
+		Current = (ULONG)(-AstonBatteryFilterValue(Snapshot->RateFilter.CurrentLong));
+		return (ULONG)min(((ULONGLONG)Snapshot->Registers.RemainingCapacity * 3600) / Current,
+			BATTERY_UNKNOWN_TIME - 1);
+	}
+
+	Voltage = Model->OpenCircuitVoltage != 0 ? Model->OpenCircuitVoltage : Snapshot->Registers.Voltage;
+	Resistance = Model->ResistanceMilliOhm;
+	if (Voltage == 0)
+	{
+		return BATTERY_UNKNOWN_TIME;
+	}
+
+	if (AtRate > 0)
+	{
+		//
+		// Charging: the terminal voltage sits above Voc, I = P / (Voc + I * R)
+		// is approximated by one fixed point step from the open circuit
+		// voltage, which is well within the gauge resolution.
+		//
+
+		Power = (ULONGLONG)AtRate * 1000;
+		Current = (ULONG)(Power / Voltage);
+		Current = (ULONG)(Power / (Voltage + (Current * Resistance) / 1000));
+		if (Current == 0)
+		{
+			return BATTERY_UNKNOWN_TIME;
+		}
+
+		Capacity = Snapshot->Registers.FullChargeCapacity > Snapshot->Registers.RemainingCapacity ?
+			Snapshot->Registers.FullChargeCapacity - Snapshot->Registers.RemainingCapacity : 0;
+
+		return (ULONG)min(((ULONGLONG)Capacity * 3600) / Current, BATTERY_UNKNOWN_TIME - 1);
+	}
+
+	//
+	// Discharging: solve R * I^2 - Voc * I + P = 0 for the smaller root,
+	// with I in mA, Voc in mV, R in mOhm and P in mW. In these units the
+	// equation reads R * I^2 - 1000 * Voc * I + 10^6 * P = 0, so the
+	// discriminant is Voc^2 - 4 * R * P with P left in mW and the root
+	// is scaled by 1000 in the final division.
+	//
+
+	Power = (ULONGLONG)(-(LONGLONG)AtRate);
+	if (Resistance == 0)
+	{
+		Current = (ULONG)((Power * 1000) / Voltage);
+	}
+	else
+	{
+		Discriminant = (ULONGLONG)Voltage * Voltage;
+		if (Discriminant <= 4 * (ULONGLONG)Resistance * Power)
+		{
+			//
+			// The pack cannot deliver this much power at all.
+			//
+
+			return 0;
+		}
+
+		Discriminant -= 4 * (ULONGLONG)Resistance * Power;
+		Current = (ULONG)(((ULONGLONG)(Voltage - AstonBatteryIntegerSqrt(Discriminant)) * 1000) /
+			(2 * (ULONGLONG)Resistance));
+	}
+
+	if (Current == 0)
+	{
+		return BATTERY_UNKNOWN_TIME;
+	}
+
+	return (ULONG)min(((ULONGLONG)Snapshot->Registers.RemainingCapacity * 3600) / Current,
+		BATTERY_UNKNOWN_TIME - 1);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryAdvanceSnapshot(
+	PASTON_BATTERY_SNAPSHOT Snapshot,
+	const BQ28Z610_STANDARD_BLOCK* Registers,
+	ULONGLONG ElapsedUs
+)
+
+/*++
+
+Routine Description:
+
+	Runs the models over a new sample in the order they depend on each
+	other: the predictor is scored before anything takes the sample, the
+	load model is fitted before the energy and rates are derived from it.
+	The caller stores the sample in the snapshot afterwards.
+
+Arguments:
+
+	Snapshot - Supplies the snapshot holding the previous sample.
+
+	Registers - Supplies the merged registers of the new sample.
+
+	ElapsedUs - Supplies the time since the previous sample.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	AstonBatteryUpdatePredictor(Snapshot, Registers, ElapsedUs);
+	AstonBatteryUpdateLoadModel(Snapshot, Registers, ElapsedUs);
+	AstonBatteryIntegrateEnergy(Snapshot, Registers, ElapsedUs);
+	AstonBatteryUpdateRateFilter(Snapshot, Registers, ElapsedUs);
+}
+
+_Use_decl_annotations_
+BOOLEAN
+AstonBatteryIsSamePack(
+	const ASTON_BATTERY_PACK_SIGNATURE* Recorded,
+	const ASTON_BATTERY_PACK_SIGNATURE* Signature
+)
+
+/*++
+
+Routine Description:
+
+	Decides whether a signature read now belongs to the packs a recorded
+	one was read from. The cycle count only moves forward.
+
+Arguments:
+
+	Recorded - Supplies the signature read earlier.
+
+	Signature - Supplies the signature read now.
+
+Return Value:
+
+	TRUE if the packs are the same.
+
+--*/
+
+{
+	return Signature->ManufacturerInfoHash == Recorded->ManufacturerInfoHash &&
+		Signature->ChemId == Recorded->ChemId &&
+		Signature->DesignCapacity == Recorded->DesignCapacity &&
+		Signature->CycleCount >= Recorded->CycleCount;
+}
+
+_Use_decl_annotations_
+ULONG
+AstonBatteryNextTag(
+	ULONG BatteryTag
+)
+
+/*++
+
+Routine Description:
+
+	Returns the battery tag that follows the given one, never
+	BATTERY_TAG_INVALID.
+
+Arguments:
+
+	BatteryTag - Supplies the current battery tag.
+
+Return Value:
+
+	The next battery tag.
+
+--*/
+
+{
+	BatteryTag += 1;
+	if (BatteryTag == BATTERY_TAG_INVALID)
+	{
+		BatteryTag += 1;
+	}
+
+	return BatteryTag;
+}
+
+_Use_decl_annotations_
+BOOLEAN
+AstonBatteryRecordPackSignature(
+	PASTON_BATTERY_PACK_SIGNATURE Recorded,
+	PBOOLEAN RecordedValid,
+	const ASTON_BATTERY_PACK_SIGNATURE* Signature,
+	PULONG BatteryTag,
+	PASTON_BATTERY_SNAPSHOT Snapshot
+)
+
+/*++
+
+Routine Description:
+
+	Records the signature read from the packs. When it shows the packs were
+	swapped, a new battery tag is issued and the snapshot is cleared, since
+	everything in it was read from or learnt on the old packs. Only the
+	generation survives, moved forward.
+
+Arguments:
+
+	Recorded - Supplies the recorded signature, replaced by Signature.
+
+	RecordedValid - Supplies whether Recorded holds a signature, set on
+		return.
+
+	Signature - Supplies the signature read now.
+
+	BatteryTag - Supplies the battery tag, moved on if the packs changed.
+
+	Snapshot - Supplies the snapshot, cleared if the packs changed.
+
+Return Value:
+
+	TRUE if the packs changed, in which case the caller notifies the class
+	driver so that it queries the static information again.
+
+--*/
+
+{
+	BOOLEAN Changed;
+	ULONG Generation;
+
+	Changed = *RecordedValid && !AstonBatteryIsSamePack(Recorded, Signature);
+
+	*Recorded = *Signature;
+	*RecordedValid = TRUE;
+
+	if (Changed)
+	{
+		*BatteryTag = AstonBatteryNextTag(*BatteryTag);
+
+		Generation = Snapshot->Generation;
+		RtlZeroMemory(Snapshot, sizeof(*Snapshot));
+		Snapshot->Generation = Generation + 1;
+	}
+
+	return Changed;
+}
@@ -0,0 +1,269 @@
+/*++
+
+Module Name:
+
+    model.h
+
+Abstract:
+
+    This module contains the snapshot of the gauge registers and the models
+    derived from it: the merge of parallel packs, the load model, the energy
+    integrator, the rate filters, the predictor and the time estimator.
+
+    model.c only depends on this header, Public.h and the basic types of
+    wdm.h, so that it can be built and tested outside of the driver.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//---------------------------------------------------------------------- Pragmas
+
+#pragma once
+
+//--------------------------------------------------------------------- Includes
+
+#include <wdm.h>
+#include <batclass.h>
+#include "Public.h"
+
+//------------------------------------------------------------------ Definitions
+
+//
+// Load model used by the time estimators: the pack is modelled as an open
+// circuit voltage behind a series resistance, fitted from voltage steps
+// across load steps of at least ASTON_BATTERY_LOAD_STEP_MA.
+//
+
+#define ASTON_BATTERY_DEFAULT_RESISTANCE_MOHM   100
+#define ASTON_BATTERY_MIN_RESISTANCE_MOHM       5
+#define ASTON_BATTERY_MAX_RESISTANCE_MOHM       1000
+#define ASTON_BATTERY_LOAD_STEP_MA              200
+#define ASTON_BATTERY_LOAD_STEP_MAX_AGE_MS      10000
+
+//
+// Samples further apart than this are not integrated, the energy over such
+// a gap is unknown.
+//
+
+#define ASTON_BATTERY_MAX_INTEGRATION_GAP_MS        60000
+
+//
+// Time constants of the rate filters. The short filter feeds the rate
+// reported to the class driver, the long one the time estimators.
+//
+
+#define ASTON_BATTERY_RATE_TAU_SHORT_MS     30000
+#define ASTON_BATTERY_RATE_TAU_LONG_MS      300000
+#define ASTON_BATTERY_RATE_FILTER_SHIFT     16
+
+#pragma pack(push, 1)
+//
+// Standard commands 0x04 - 0x13 are laid out back to back, the gauge
+// auto-increments the command pointer so they are read in one transfer.
+//
+typedef struct _BQ28Z610_STANDARD_BLOCK
+{
+    UINT16 AtRateTimeToEmpty;
+    UINT16 Temperature;
+    UINT16 Voltage;
+    UINT16 BatteryStatus;
+    INT16 Current;
+    INT16 MaxLoadCurrent;
+    UINT16 RemainingCapacity;
+    UINT16 FullChargeCapacity;
+} BQ28Z610_STANDARD_BLOCK, * PBQ28Z610_STANDARD_BLOCK;
+#pragma pack(pop)
+
+typedef struct _ASTON_BATTERY_LOAD_MODEL
+{
+    ULONG ResistanceMilliOhm;
+    ULONG OpenCircuitVoltage;
+    ULONG FitCount;
+} ASTON_BATTERY_LOAD_MODEL, * PASTON_BATTERY_LOAD_MODEL;
+
+//
+// Energy integrated from V * I between consecutive samples, in uJ. The
+// discharge charge is kept alongside so that the mean discharge voltage
+// (mV), and from it the remaining energy (mWh), follow the pack's actual
+// curve. Both are in the units of the merged registers, before any pack
+// scaling.
+//
+typedef struct _ASTON_BATTERY_ENERGY
+{
+    ULONGLONG ChargedUj;
+    ULONGLONG DischargedUj;
+    ULONGLONG DischargedUc;
+    LONGLONG IntervalUj;
+    ULONGLONG IntervalUs;
+    ULONG MeanVoltage;
+    ULONG RemainingEnergyMwh;
+} ASTON_BATTERY_ENERGY, * PASTON_BATTERY_ENERGY;
+
+//
+// Exponential moving averages of current (mA) and power (mW), kept in
+// fixed point with ASTON_BATTERY_RATE_FILTER_SHIFT fraction bits. The
+// weight of each sample follows its age, dt / (tau + dt), so the filters
+// behave the same whatever the sampling interval.
+//
+typedef struct _ASTON_BATTERY_RATE_FILTER
+{
+    BOOLEAN Primed;
+    LONGLONG CurrentShort;
+    LONGLONG CurrentLong;
+    LONGLONG PowerShort;
+    LONGLONG PowerLong;
+} ASTON_BATTERY_RATE_FILTER, * PASTON_BATTERY_RATE_FILTER;
+
+#define AstonBatteryFilterValue(Value) \
+    ((LONG)((Value) / (1LL << ASTON_BATTERY_RATE_FILTER_SHIFT)))
+
+//
+// Extrapolation of RemainingCapacity and Voltage between two samples. The
+// voltage follows the capacity along the learnt slope of the open circuit
+// voltage. Each real sample is compared against the prediction made for
+// it from the previous one.
+//
+typedef struct _ASTON_BATTERY_PREDICTOR
+{
+    LONG VoltageSlopeUvPerMah;
+    ULONG Samples;
+    LONG LastCapacityErrorMah;
+    LONG LastVoltageErrorMv;
+    ULONG MaxCapacityErrorMah;
+    ULONG MaxVoltageErrorMv;
+    ULONGLONG SumCapacityErrorMah;
+    ULONGLONG SumVoltageErrorMv;
+} ASTON_BATTERY_PREDICTOR, * PASTON_BATTERY_PREDICTOR;
+
+//
+// MAC status words, ORed across all gauges
+//
+typedef struct _ASTON_BATTERY_SAFETY_STATUS
+{
+    ULONG SafetyAlert;
+    ULONG SafetyStatus;
+    ULONG PFStatus;
+    ULONG OperationStatus;
+    LONGLONG Timestamp;
+} ASTON_BATTERY_SAFETY_STATUS, * PASTON_BATTERY_SAFETY_STATUS;
+
+//
+// Identity of the packs behind the gauges. A change of any field, or a
+// cycle count going backwards, means a pack was swapped or a gauge reset.
+//
+typedef struct _ASTON_BATTERY_PACK_SIGNATURE
+{
+    ULONG ManufacturerInfoHash;
+    ULONG ChemId;
+    ULONG DesignCapacity;
+    ULONG CycleCount;
+} ASTON_BATTERY_PACK_SIGNATURE, * PASTON_BATTERY_PACK_SIGNATURE;
+
+//
+// Last set of dynamic values read from the gauges. Registers holds the
+// values merged across all gauges, which is what the battery is reported
+// as. Timestamp is in KeQueryPerformanceCounter ticks. Generation advances
+// whenever any part of the snapshot is published.
+//
+typedef struct _ASTON_BATTERY_SNAPSHOT
+{
+    BOOLEAN Valid;
+    ULONG Generation;
+    LARGE_INTEGER Timestamp;
+    BQ28Z610_STANDARD_BLOCK Registers;
+    ULONG GaugeCount;
+    BQ28Z610_STANDARD_BLOCK GaugeRegisters[ASTON_BATTERY_MAX_GAUGES];
+    ASTON_BATTERY_LOAD_MODEL LoadModel;
+    ASTON_BATTERY_ENERGY Energy;
+    ASTON_BATTERY_RATE_FILTER RateFilter;
+    ASTON_BATTERY_PREDICTOR Predictor;
+    ASTON_BATTERY_CELL_TELEMETRY Cells;
+    ASTON_BATTERY_SAFETY_STATUS Safety;
+    BOOLEAN HealthValid;
+    ASTON_BATTERY_HEALTH Health;
+} ASTON_BATTERY_SNAPSHOT, * PASTON_BATTERY_SNAPSHOT;
+
+//--------------------------------------------------------- Prototypes (model.c)
+
+VOID
+AstonBatteryMergeGaugeRegisters(
+    _In_reads_(GaugeCount) const BQ28Z610_STANDARD_BLOCK* Gauges,
+    _In_ ULONG GaugeCount,
+    _Out_ PBQ28Z610_STANDARD_BLOCK Merged
+);
+
+VOID
+AstonBatteryUpdatePredictor(
+    _Inout_ PASTON_BATTERY_SNAPSHOT Snapshot,
+    _In_ const BQ28Z610_STANDARD_BLOCK* Registers,
+    _In_ ULONGLONG ElapsedUs
+);
+
+VOID
+AstonBatteryUpdateLoadModel(
+    _Inout_ PASTON_BATTERY_SNAPSHOT Snapshot,
+    _In_ const BQ28Z610_STANDARD_BLOCK* Registers,
+    _In_ ULONGLONG ElapsedUs
+);
+
+VOID
+AstonBatteryIntegrateEnergy(
+    _Inout_ PASTON_BATTERY_SNAPSHOT Snapshot,
+    _In_ const BQ28Z610_STANDARD_BLOCK* Registers,
+    _In_ ULONGLONG ElapsedUs
+);
+
+ULONG
+AstonBatteryCapacityToEnergy(
+    _In_ const ASTON_BATTERY_SNAPSHOT* Snapshot,
+    _In_ ULONG Capacity
+);
+
+VOID
+AstonBatteryUpdateRateFilter(
+    _Inout_ PASTON_BATTERY_SNAPSHOT Snapshot,
+    _In_ const BQ28Z610_STANDARD_BLOCK* Registers,
+    _In_ ULONGLONG ElapsedUs
+);
+
+VOID
+AstonBatteryPredict(
+    _In_ const ASTON_BATTERY_SNAPSHOT* Snapshot,
+    _In_ ULONGLONG AgeUs,
+    _Out_ PLONG Capacity,
+    _Out_ PLONG Voltage
+);
+
+VOID
+AstonBatteryAdvanceSnapshot(
+    _Inout_ PASTON_BATTERY_SNAPSHOT Snapshot,
+    _In_ const BQ28Z610_STANDARD_BLOCK* Registers,
+    _In_ ULONGLONG ElapsedUs
+);
+
+ULONG
+AstonBatteryEstimateTime(
+    _In_ const ASTON_BATTERY_SNAPSHOT* Snapshot,
+    _In_ LONG AtRate
+);
+
+BOOLEAN
+AstonBatteryIsSamePack(
+    _In_ const ASTON_BATTERY_PACK_SIGNATURE* Recorded,
+    _In_ const ASTON_BATTERY_PACK_SIGNATURE* Signature
+);
+
+ULONG
+AstonBatteryNextTag(
+    _In_ ULONG BatteryTag
+);
+
+BOOLEAN
+AstonBatteryRecordPackSignature(
+    _Inout_ PASTON_BATTERY_PACK_SIGNATURE Recorded,
+    _Inout_ PBOOLEAN RecordedValid,
+    _In_ const ASTON_BATTERY_PACK_SIGNATURE* Signature,
+    _Inout_ PULONG BatteryTag,
+    _Inout_ PASTON_BATTERY_SNAPSHOT Snapshot
+);
\ No newline at end of file
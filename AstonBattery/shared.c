@@ -0,0 +1,308 @@
+/*++
+
+Module Name:
+
+	shared.c
+
+Abstract:
+
+	This module publishes the telemetry in a section that user mode maps
+	read only. Profiling tools poll it at high rates without a system call
+	per read: the driver brackets every rewrite with a sequence counter and
+	readers retry the copies that overlap a rewrite.
+
+	N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include <ntifs.h>
+#include "AstonBattery.h"
+#include "shared.tmh"
+
+//---------------------------------------------------------------------- Pragmas
+
+#pragma alloc_text(PAGE, AstonBatteryCreateSharedTelemetry)
+#pragma alloc_text(PAGE, AstonBatteryDestroySharedTelemetry)
+#pragma alloc_text(PAGE, AstonBatteryEvtIoInCallerContext)
+
+//------------------------------------------------------------------ Definitions
+
+#define ASTON_BATTERY_SHARED_TELEMETRY_VIEW_SIZE    PAGE_SIZE
+
+C_ASSERT(sizeof(ASTON_BATTERY_SHARED_TELEMETRY) <= ASTON_BATTERY_SHARED_TELEMETRY_VIEW_SIZE);
+
+//-------------------------------------------------------------------- Functions
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryCreateSharedTelemetry(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Creates the pagefile backed section holding the shared telemetry and
+	maps it in system space. The section lives as long as the device, views
+	mapped by user mode keep it alive past that.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	OBJECT_ATTRIBUTES ObjectAttributes;
+	LARGE_INTEGER MaximumSize;
+	SIZE_T ViewSize;
+	PVOID View;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	InitializeObjectAttributes(&ObjectAttributes,
+		NULL,
+		OBJ_KERNEL_HANDLE,
+		NULL,
+		NULL);
+
+	MaximumSize.QuadPart = ASTON_BATTERY_SHARED_TELEMETRY_VIEW_SIZE;
+	Status = ZwCreateSection(&DevExt->SharedSection,
+		SECTION_ALL_ACCESS,
+		&ObjectAttributes,
+		&MaximumSize,
+		PAGE_READWRITE,
+		SEC_COMMIT,
+		NULL);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "ZwCreateSection failed with Status = 0x%08lX\n", Status);
+		DevExt->SharedSection = NULL;
+		goto Exit;
+	}
+
+	Status = ObReferenceObjectByHandle(DevExt->SharedSection,
+		SECTION_ALL_ACCESS,
+		*MmSectionObjectType,
+		KernelMode,
+		&DevExt->SharedSectionObject,
+		NULL);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "ObReferenceObjectByHandle failed with Status = 0x%08lX\n", Status);
+		DevExt->SharedSectionObject = NULL;
+		goto Exit;
+	}
+
+	View = NULL;
+	ViewSize = ASTON_BATTERY_SHARED_TELEMETRY_VIEW_SIZE;
+	Status = MmMapViewInSystemSpace(DevExt->SharedSectionObject, &View, &ViewSize);
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "MmMapViewInSystemSpace failed with Status = 0x%08lX\n", Status);
+		goto Exit;
+	}
+
+	DevExt->SharedTelemetry = (PASTON_BATTERY_SHARED_TELEMETRY)View;
+	RtlZeroMemory(DevExt->SharedTelemetry, sizeof(*DevExt->SharedTelemetry));
+	DevExt->SharedTelemetry->Size = sizeof(*DevExt->SharedTelemetry);
+	DevExt->SharedTelemetry->Version = ASTON_BATTERY_SHARED_TELEMETRY_VERSION;
+
+Exit:
+	if (!NT_SUCCESS(Status))
+	{
+		AstonBatteryDestroySharedTelemetry(DevExt);
+	}
+
+	return Status;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryDestroySharedTelemetry(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Releases the system view and the references of the driver on the
+	shared section.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PAGED_CODE();
+
+	if (DevExt->SharedTelemetry != NULL)
+	{
+		MmUnmapViewInSystemSpace(DevExt->SharedTelemetry);
+		DevExt->SharedTelemetry = NULL;
+	}
+
+	if (DevExt->SharedSectionObject != NULL)
+	{
+		ObDereferenceObject(DevExt->SharedSectionObject);
+		DevExt->SharedSectionObject = NULL;
+	}
+
+	if (DevExt->SharedSection != NULL)
+	{
+		ZwClose(DevExt->SharedSection);
+		DevExt->SharedSection = NULL;
+	}
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryWriteSharedTelemetry(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	const ASTON_BATTERY_TELEMETRY* Telemetry
+)
+
+/*++
+
+Routine Description:
+
+	Rewrites the shared telemetry. The sequence is odd for the duration of
+	the copy, the interlocked increments order the copy between them.
+	Writers are serialized by ChangeLock.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Telemetry - Supplies the telemetry to publish.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PASTON_BATTERY_SHARED_TELEMETRY Shared;
+
+	Shared = DevExt->SharedTelemetry;
+	if (Shared == NULL)
+	{
+		return;
+	}
+
+	InterlockedIncrement(&Shared->Sequence);
+	RtlCopyMemory(&Shared->Telemetry, Telemetry, sizeof(Shared->Telemetry));
+	InterlockedIncrement(&Shared->Sequence);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryEvtIoInCallerContext(
+	WDFDEVICE Device,
+	WDFREQUEST Request
+)
+
+/*++
+
+Routine Description:
+
+	Opens the shared section in the process that sent
+	IOCTL_ASTON_BATTERY_OPEN_SHARED_TELEMETRY, which is only possible in the
+	context of the caller. The handle only grants SECTION_MAP_READ so the
+	caller can not map the section writable. Every other request goes to
+	the queues.
+
+Arguments:
+
+	Device - Supplies a handle to a framework device object.
+
+	Request - Supplies the request being dispatched.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PSURFACE_BATTERY_FDO_DATA DevExt;
+	PASTON_BATTERY_SHARED_TELEMETRY_HANDLE Output;
+	WDF_REQUEST_PARAMETERS Parameters;
+	HANDLE Handle;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	WDF_REQUEST_PARAMETERS_INIT(&Parameters);
+	WdfRequestGetParameters(Request, &Parameters);
+
+	if (Parameters.Type != WdfRequestTypeDeviceIoControl ||
+		Parameters.Parameters.DeviceIoControl.IoControlCode != IOCTL_ASTON_BATTERY_OPEN_SHARED_TELEMETRY)
+	{
+		Status = WdfDeviceEnqueueRequest(Device, Request);
+		if (!NT_SUCCESS(Status))
+		{
+			WdfRequestComplete(Request, Status);
+		}
+
+		return;
+	}
+
+	DevExt = GetDeviceExtension(Device);
+
+	if (WdfRequestGetRequestorMode(Request) != UserMode || DevExt->SharedSectionObject == NULL)
+	{
+		WdfRequestComplete(Request, STATUS_INVALID_DEVICE_REQUEST);
+		return;
+	}
+
+	Status = WdfRequestRetrieveOutputBuffer(Request,
+		sizeof(*Output),
+		(PVOID*)&Output,
+		NULL);
+
+	if (!NT_SUCCESS(Status))
+	{
+		WdfRequestComplete(Request, Status);
+		return;
+	}
+
+	Status = ObOpenObjectByPointer(DevExt->SharedSectionObject,
+		0,
+		NULL,
+		SECTION_MAP_READ | SECTION_QUERY,
+		*MmSectionObjectType,
+		UserMode,
+		&Handle);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "ObOpenObjectByPointer failed with Status = 0x%08lX\n", Status);
+		WdfRequestComplete(Request, Status);
+		return;
+	}
+
+	Output->Handle = (ULONGLONG)(ULONG_PTR)Handle;
+	Output->ViewSize = ASTON_BATTERY_SHARED_TELEMETRY_VIEW_SIZE;
+	Output->Reserved = 0;
+
+	WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, sizeof(*Output));
+}
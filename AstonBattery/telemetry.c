@@ -0,0 +1,1279 @@
+/*++
+
+Module Name:
+
+	telemetry.c
+
+Abstract:
+
+	This module keeps a snapshot of the dynamic gauge registers so that the
+	battery class callbacks can be served from memory instead of paying the
+	I2C round trips on every query.
+
+	N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "AstonBattery.h"
+#include "Spb.h"
+#include "telemetry.tmh"
+
+//---------------------------------------------------------------------- Pragmas
+
+#pragma alloc_text(PAGE, AstonBatteryEvtSamplerWorkItem)
+#pragma alloc_text(PAGE, AstonBatteryInitializeSpbTarget)
+#pragma alloc_text(PAGE, AstonBatteryWaitForSpbTarget)
+#pragma alloc_text(PAGE, AstonBatteryReadGaugeWord)
+#pragma alloc_text(PAGE, AstonBatteryRefreshSnapshot)
+#pragma alloc_text(PAGE, AstonBatteryReadMacBlock)
+#pragma alloc_text(PAGE, AstonBatteryRefreshCellTelemetry)
+#pragma alloc_text(PAGE, AstonBatteryReadSafetyStatus)
+#pragma alloc_text(PAGE, AstonBatteryCheckPackSignature)
+#pragma alloc_text(PAGE, AstonBatteryNotifyStatusChange)
+#pragma alloc_text(PAGE, AstonBatteryDeliverStatusNotify)
+#pragma alloc_text(PAGE, AstonBatteryGetSnapshot)
+#pragma alloc_text(PAGE, AstonBatteryGetPredictedSnapshot)
+#pragma alloc_text(PAGE, AstonBatteryInvalidateSnapshot)
+
+//-------------------------------------------------------------------- Functions
+
+static
+ULONGLONG
+AstonBatteryQpcToUs(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+	_In_ LONGLONG Ticks
+)
+{
+	if (Ticks <= 0 || DevExt->QpcFrequency.QuadPart == 0)
+	{
+		return 0;
+	}
+
+	return ((ULONGLONG)Ticks * 1000000) / (ULONGLONG)DevExt->QpcFrequency.QuadPart;
+}
+
+static
+BOOLEAN
+AstonBatteryTraceSafetyEdges(
+	_In_ const ASTON_BATTERY_SAFETY_STATUS* Previous,
+	_In_ const ASTON_BATTERY_SAFETY_STATUS* Current
+)
+
+/*++
+
+Routine Description:
+
+	Compares the status words of a snapshot against those of the previous
+	one. Bits that went from clear to set are traced as a SafetyStatusRaised
+	event, bits that went from set to clear as a SafetyStatusCleared event,
+	each with the masks of the changed bits and the words as fields.
+
+Return Value:
+
+	TRUE if a raised bit indicates a protection or failure and the battery
+	class driver is to be notified.
+
+--*/
+
+{
+	ULONG Words[4];
+	ULONG Rising[4];
+	ULONG Falling[4];
+	ULONG Word;
+
+	Words[0] = Current->SafetyAlert;
+	Words[1] = Current->SafetyStatus;
+	Words[2] = Current->PFStatus;
+	Words[3] = Current->OperationStatus;
+	Rising[0] = Current->SafetyAlert & ~Previous->SafetyAlert;
+	Rising[1] = Current->SafetyStatus & ~Previous->SafetyStatus;
+	Rising[2] = Current->PFStatus & ~Previous->PFStatus;
+	Rising[3] = Current->OperationStatus & ~Previous->OperationStatus;
+	Falling[0] = Previous->SafetyAlert & ~Current->SafetyAlert;
+	Falling[1] = Previous->SafetyStatus & ~Current->SafetyStatus;
+	Falling[2] = Previous->PFStatus & ~Current->PFStatus;
+	Falling[3] = Previous->OperationStatus & ~Current->OperationStatus;
+
+	if ((Rising[0] | Rising[1] | Rising[2] | Rising[3]) != 0)
+	{
+		TraceLoggingWrite(AstonBatteryTraceLoggingProvider,
+			"SafetyStatusRaised",
+			TraceLoggingLevel(WINEVENT_LEVEL_WARNING),
+			TraceLoggingKeyword(ASTON_BATTERY_KEYWORD_SAFETY),
+			TraceLoggingHexUInt32(Rising[0], "SafetyAlertRaised"),
+			TraceLoggingHexUInt32(Rising[1], "SafetyStatusRaised"),
+			TraceLoggingHexUInt32(Rising[2], "PFStatusRaised"),
+			TraceLoggingHexUInt32(Rising[3], "OperationStatusRaised"),
+			TraceLoggingHexUInt32(Words[0], "SafetyAlert"),
+			TraceLoggingHexUInt32(Words[1], "SafetyStatus"),
+			TraceLoggingHexUInt32(Words[2], "PFStatus"),
+			TraceLoggingHexUInt32(Words[3], "OperationStatus"));
+	}
+
+	if ((Falling[0] | Falling[1] | Falling[2] | Falling[3]) != 0)
+	{
+		TraceLoggingWrite(AstonBatteryTraceLoggingProvider,
+			"SafetyStatusCleared",
+			TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+			TraceLoggingKeyword(ASTON_BATTERY_KEYWORD_SAFETY),
+			TraceLoggingHexUInt32(Falling[0], "SafetyAlertCleared"),
+			TraceLoggingHexUInt32(Falling[1], "SafetyStatusCleared"),
+			TraceLoggingHexUInt32(Falling[2], "PFStatusCleared"),
+			TraceLoggingHexUInt32(Falling[3], "OperationStatusCleared"),
+			TraceLoggingHexUInt32(Words[0], "SafetyAlert"),
+			TraceLoggingHexUInt32(Words[1], "SafetyStatus"),
+			TraceLoggingHexUInt32(Words[2], "PFStatus"),
+			TraceLoggingHexUInt32(Words[3], "OperationStatus"));
+	}
+
+	for (Word = 0; Word < 3; Word++)
+	{
+		if (Rising[Word] != 0)
+		{
+			return TRUE;
+		}
+	}
+
+	return (Rising[3] & BQ28Z610_OPERATION_STATUS_EVENT_MASK) != 0;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryInitializeSpbTarget(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Opens the SPB targets recorded at prepare hardware time and publishes the
+	outcome to anyone waiting in AstonBatteryWaitForSpbTarget. The targets
+	are opened once per start, later calls return the recorded outcome. In
+	fast-start mode the start has already completed, so a failed open marks
+	the device failed and lets PnP restart it.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	BOOLEAN Opened;
+	ULONG i;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	Opened = FALSE;
+	WdfWaitLockAcquire(DevExt->SpbOpenLock, NULL);
+	if (DevExt->SpbReady)
+	{
+		Status = DevExt->SpbInitStatus;
+		goto Exit;
+	}
+
+	Opened = TRUE;
+	Status = STATUS_SUCCESS;
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		Status = SpbTargetInitialize(DevExt->Device, &DevExt->I2CContext[i]);
+		if (!NT_SUCCESS(Status))
+		{
+			Trace(
+				TRACE_LEVEL_ERROR,
+				SURFACE_BATTERY_ERROR,
+				"Error in Spb initialization of gauge %u - %!STATUS!",
+				i,
+				Status);
+
+			break;
+		}
+	}
+
+	DevExt->SpbInitStatus = Status;
+	DevExt->SpbReady = TRUE;
+	KeSetEvent(&DevExt->SpbReadyEvent, IO_NO_INCREMENT, FALSE);
+
+Exit:
+	WdfWaitLockRelease(DevExt->SpbOpenLock);
+
+	if (Opened && DevExt->FastStart && !NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_ERROR,
+			"Deferred SPB open failed with Status = 0x%08lX, restarting the device\n",
+			Status);
+
+		WdfDeviceSetFailed(DevExt->Device, WdfDeviceFailedAttemptRestart);
+	}
+
+	return Status;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryWaitForSpbTarget(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Waits for a deferred SPB open to complete. Returns immediately once the
+	target is ready, which is always the case outside of fast-start mode.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	STATUS_DEVICE_NOT_READY if the target did not open in time, otherwise
+	the status of the open.
+
+--*/
+
+{
+	LARGE_INTEGER Timeout;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	if (DevExt->SpbReady)
+	{
+		return DevExt->SpbInitStatus;
+	}
+
+	Timeout.QuadPart = RELATIVE(MILLISECONDS(ASTON_BATTERY_SPB_READY_TIMEOUT_MS));
+	Status = KeWaitForSingleObject(&DevExt->SpbReadyEvent,
+		Executive,
+		KernelMode,
+		FALSE,
+		&Timeout);
+
+	if (Status == STATUS_TIMEOUT)
+	{
+		Trace(TRACE_LEVEL_WARNING, SURFACE_BATTERY_WARN,
+			"Timed out waiting for deferred Spb open\n");
+
+		return STATUS_DEVICE_NOT_READY;
+	}
+
+	return DevExt->SpbInitStatus;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryReadGaugeWord(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	UCHAR Address,
+	UINT16* Values
+)
+
+/*++
+
+Routine Description:
+
+	Reads one 16 bit standard command from every gauge of the battery.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Address - Supplies the standard command to read.
+
+	Values - Supplies an array receiving one value per gauge, entries past
+		GaugeCount are zeroed.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	ULONG i;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	RtlZeroMemory(Values, sizeof(UINT16) * ASTON_BATTERY_MAX_GAUGES);
+
+	Status = AstonBatteryWaitForSpbTarget(DevExt);
+	if (!NT_SUCCESS(Status))
+	{
+		return Status;
+	}
+
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		Status = SpbReadDataSynchronously(&DevExt->I2CContext[i], Address, &Values[i], sizeof(UINT16));
+		if (!NT_SUCCESS(Status))
+		{
+			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed on gauge %u with Status = 0x%08lX\n", i, Status);
+			break;
+		}
+	}
+
+	return Status;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryRefreshSnapshot(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Reads the dynamic standard commands and the MAC status words from every
+	gauge and publishes them together with their merged view as the
+	current snapshot. Rising edges of the BatteryStatus alarm bits and of
+	the status words are traced and ask for a status notification, so
+	every edge is seen within one sample.
+
+	The bus transfer is done without holding SnapshotLock so that readers of
+	the cached data are never blocked behind I2C I/O.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	BQ28Z610_STANDARD_BLOCK GaugeRegisters[ASTON_BATTERY_MAX_GAUGES] = { 0 };
+	BQ28Z610_STANDARD_BLOCK Registers;
+	LARGE_INTEGER Timestamp;
+	ULONG i;
+	ULONGLONG ElapsedUs;
+	ULONGLONG ResumeLatencyUs;
+	ULONG PredictedSamples;
+	UINT16 PreviousAlarms;
+	UINT16 RisingAlarms;
+	ASTON_BATTERY_SAFETY_STATUS Safety;
+	ASTON_BATTERY_SAFETY_STATUS PreviousSafety;
+	BOOLEAN Notify;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	Status = AstonBatteryWaitForSpbTarget(DevExt);
+	if (!NT_SUCCESS(Status))
+	{
+		goto Exit;
+	}
+
+	//
+	// Each gauge sits behind its own target and lock, so a slow gauge only
+	// delays its own transfer.
+	//
+
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		Status = SpbReadDataSynchronously(&DevExt->I2CContext[i],
+			BQ28Z610_REG_AT_RATE_TIME_TO_EMPTY,
+			&GaugeRegisters[i],
+			sizeof(GaugeRegisters[i]));
+
+		if (!NT_SUCCESS(Status))
+		{
+			Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbReadDataSynchronously failed on gauge %u with Status = 0x%08lX\n", i, Status);
+			goto Exit;
+		}
+	}
+
+	AstonBatteryMergeGaugeRegisters(GaugeRegisters, DevExt->GaugeCount, &Registers);
+
+	Status = AstonBatteryReadSafetyStatus(DevExt, &Safety);
+	if (!NT_SUCCESS(Status))
+	{
+		goto Exit;
+	}
+
+	Timestamp = KeQueryPerformanceCounter(NULL);
+	Safety.Timestamp = Timestamp.QuadPart;
+	ResumeLatencyUs = 0;
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	ElapsedUs = AstonBatteryQpcToUs(DevExt, Timestamp.QuadPart - DevExt->Snapshot.Timestamp.QuadPart);
+
+	PreviousAlarms = 0;
+	if (DevExt->Snapshot.Valid)
+	{
+		PreviousAlarms = DevExt->Snapshot.Registers.BatteryStatus & BQ28Z610_BATTERY_STATUS_ALARM_MASK;
+	}
+
+	RisingAlarms = Registers.BatteryStatus & BQ28Z610_BATTERY_STATUS_ALARM_MASK & ~PreviousAlarms;
+	PreviousSafety = DevExt->Snapshot.Safety;
+
+	PredictedSamples = DevExt->Snapshot.Predictor.Samples;
+	AstonBatteryAdvanceSnapshot(&DevExt->Snapshot, &Registers, ElapsedUs);
+	AstonBatteryUpdateHealth(&DevExt->Snapshot, &Registers);
+	if (DevExt->Snapshot.Predictor.Samples != PredictedSamples)
+	{
+		Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_INFO,
+			"Prediction error after %I64u us: %d mAh, %d mV\n",
+			ElapsedUs,
+			DevExt->Snapshot.Predictor.LastCapacityErrorMah,
+			DevExt->Snapshot.Predictor.LastVoltageErrorMv);
+	}
+
+	DevExt->Snapshot.Registers = Registers;
+	DevExt->Snapshot.GaugeCount = DevExt->GaugeCount;
+	RtlCopyMemory(DevExt->Snapshot.GaugeRegisters, GaugeRegisters, sizeof(GaugeRegisters));
+	DevExt->Snapshot.Safety = Safety;
+	DevExt->Snapshot.Timestamp = Timestamp;
+	DevExt->Snapshot.Valid = TRUE;
+	DevExt->Snapshot.Generation += 1;
+
+	//
+	// The first snapshot published after D0 entry closes the resume window.
+	//
+
+	if (DevExt->D0EntryTime.QuadPart != 0)
+	{
+		ResumeLatencyUs = AstonBatteryQpcToUs(DevExt,
+			Timestamp.QuadPart - DevExt->D0EntryTime.QuadPart);
+
+		DevExt->D0EntryToSnapshotUs = (ULONG)min(ResumeLatencyUs, MAXULONG);
+		DevExt->D0EntryTime.QuadPart = 0;
+	}
+
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+
+	if (ResumeLatencyUs != 0)
+	{
+		Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_INFO,
+			"First snapshot valid %I64u us after D0 entry\n",
+			ResumeLatencyUs);
+	}
+
+	Notify = AstonBatteryTraceSafetyEdges(&PreviousSafety, &Safety);
+	if (RisingAlarms != 0)
+	{
+		Trace(TRACE_LEVEL_WARNING, SURFACE_BATTERY_WARN,
+			"BatteryStatus alarm raised: 0x%04x (BatteryStatus = 0x%04x)\n",
+			RisingAlarms,
+			Registers.BatteryStatus);
+
+		Notify = TRUE;
+	}
+
+	if (Notify)
+	{
+		AstonBatteryNotifyStatusChange(DevExt);
+	}
+
+Exit:
+	return Status;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryReadMacBlock(
+	SPB_CONTEXT* SpbContext,
+	UINT16 Command,
+	PVOID Data,
+	ULONG Length
+)
+
+/*++
+
+Routine Description:
+
+	Issues a ManufacturerAccess command through AltManufacturerAccess and
+	reads its response back from MACData, holding the SPB lock across both
+	so that no other command can replace the response. A completed block is added to the
+	latency histograms of the gauge under its command.
+
+Arguments:
+
+	SpbContext - Supplies the SPB context of the gauge.
+
+	Command - Supplies the ManufacturerAccess command.
+
+	Data - Supplies a buffer to receive the response.
+
+	Length - Supplies the length of the response.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	UINT16 CommandLe;
+	LARGE_INTEGER Start;
+	LARGE_INTEGER End;
+	LARGE_INTEGER Frequency;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	Start = KeQueryPerformanceCounter(NULL);
+	CommandLe = Command;
+	Status = SpbWriteReadDataSynchronously(SpbContext,
+		BQ28Z610_REG_ALT_MANUFACTURER_ACCESS,
+		&CommandLe,
+		sizeof(CommandLe),
+		BQ28Z610_REG_MAC_DATA,
+		Data,
+		Length);
+
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_ERROR, SURFACE_BATTERY_TRACE, "SpbWriteReadDataSynchronously failed for MAC 0x%04x with Status = 0x%08lX\n", Command, Status);
+		return Status;
+	}
+
+	End = KeQueryPerformanceCounter(&Frequency);
+	SpbRecordLatency(SpbContext,
+		SpbOperationMacBlock,
+		Command,
+		End.QuadPart - Start.QuadPart,
+		Frequency.QuadPart);
+
+	return Status;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryRefreshCellTelemetry(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Reads DAStatus1 and DAStatus2 from every gauge and decodes them into the
+	cell telemetry of the snapshot in one pass. The sampler calls this once
+	every ASTON_BATTERY_CELL_SAMPLE_DIVIDER samples so that the per-cell view
+	costs a fixed, small share of the bus time.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	BQ28Z610_DA_STATUS1 Status1[ASTON_BATTERY_MAX_GAUGES];
+	BQ28Z610_DA_STATUS2 Status2[ASTON_BATTERY_MAX_GAUGES];
+	ASTON_BATTERY_CELL_TELEMETRY Cells;
+	PASTON_BATTERY_GAUGE_CELLS Gauge;
+	ULONG i;
+	ULONG Cell;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	Status = AstonBatteryWaitForSpbTarget(DevExt);
+	if (!NT_SUCCESS(Status))
+	{
+		goto Exit;
+	}
+
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		Status = AstonBatteryReadMacBlock(&DevExt->I2CContext[i],
+			BQ28Z610_MAC_DA_STATUS1,
+			&Status1[i],
+			sizeof(Status1[i]));
+
+		if (!NT_SUCCESS(Status))
+		{
+			goto Exit;
+		}
+
+		Status = AstonBatteryReadMacBlock(&DevExt->I2CContext[i],
+			BQ28Z610_MAC_DA_STATUS2,
+			&Status2[i],
+			sizeof(Status2[i]));
+
+		if (!NT_SUCCESS(Status))
+		{
+			goto Exit;
+		}
+	}
+
+	RtlZeroMemory(&Cells, sizeof(Cells));
+	Cells.Size = sizeof(Cells);
+	Cells.GaugeCount = DevExt->GaugeCount;
+	Cells.Timestamp = KeQueryPerformanceCounter(NULL).QuadPart;
+
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		Gauge = &Cells.Gauges[i];
+		for (Cell = 0; Cell < ASTON_BATTERY_CELLS_PER_GAUGE; Cell++)
+		{
+			Gauge->CellVoltage[Cell] = Status1[i].CellVoltage[Cell];
+			Gauge->CellCurrent[Cell] = Status1[i].CellCurrent[Cell];
+		}
+
+		Gauge->BatVoltage = Status1[i].BatVoltage;
+		Gauge->PackVoltage = Status1[i].PackVoltage;
+		Gauge->CellImbalance = (USHORT)(max(Gauge->CellVoltage[0], Gauge->CellVoltage[1]) -
+			min(Gauge->CellVoltage[0], Gauge->CellVoltage[1]));
+
+		Gauge->InternalTemperature = Status2[i].InternalTemperature;
+		Gauge->Ts1Temperature = Status2[i].Ts1Temperature;
+		Gauge->CellTemperature = Status2[i].CellTemperature;
+		Gauge->FetTemperature = Status2[i].FetTemperature;
+
+		Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_INFO,
+			"Gauge %u cells: %u mV, %u mV, imbalance %u mV, FET %u dK\n",
+			i,
+			Gauge->CellVoltage[0],
+			Gauge->CellVoltage[1],
+			Gauge->CellImbalance,
+			Gauge->FetTemperature);
+	}
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	DevExt->Snapshot.Cells = Cells;
+	DevExt->Snapshot.Generation += 1;
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+
+Exit:
+	return Status;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryReadSafetyStatus(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	PASTON_BATTERY_SAFETY_STATUS Safety
+)
+
+/*++
+
+Routine Description:
+
+	Reads SafetyAlert, SafetyStatus, PFStatus and OperationStatus from every
+	gauge, ORed across the gauges. Part of every snapshot refresh.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Safety - Receives the status words, without a timestamp.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	static const UINT16 Commands[] = {
+		BQ28Z610_MAC_SAFETY_ALERT,
+		BQ28Z610_MAC_SAFETY_STATUS,
+		BQ28Z610_MAC_PF_STATUS,
+		BQ28Z610_MAC_OPERATION_STATUS
+	};
+
+	ULONG Words[ARRAYSIZE(Commands)] = { 0 };
+	ULONG Value;
+	ULONG i;
+	ULONG Word;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	RtlZeroMemory(Safety, sizeof(*Safety));
+	InterlockedIncrement64(&DevExt->Counters.SafetyPolls);
+	Status = STATUS_SUCCESS;
+
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		for (Word = 0; Word < ARRAYSIZE(Commands); Word++)
+		{
+			InterlockedAdd64(&DevExt->Counters.SafetyBusTransfers, BQ28Z610_MAC_BLOCK_TRANSFERS);
+			Status = AstonBatteryReadMacBlock(&DevExt->I2CContext[i],
+				Commands[Word],
+				&Value,
+				sizeof(Value));
+
+			if (!NT_SUCCESS(Status))
+			{
+				goto Exit;
+			}
+
+			Words[Word] |= Value;
+		}
+	}
+
+	Safety->SafetyAlert = Words[0];
+	Safety->SafetyStatus = Words[1];
+	Safety->PFStatus = Words[2];
+	Safety->OperationStatus = Words[3];
+
+Exit:
+	return Status;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryCheckPackSignature(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Reads the identity of the packs and compares it with the one recorded
+	for the current battery tag. When it differs a new tag is issued, all
+	learnt and cached telemetry is dropped and the battery class driver is
+	notified so that it queries the static information again.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	UCHAR ManufacturerInfo[BQ28Z610_MANUFACTURER_INFO_SIZE];
+	UINT16 GaugeValues[ASTON_BATTERY_MAX_GAUGES];
+	ASTON_BATTERY_PACK_SIGNATURE Signature;
+	UINT16 ChemId;
+	ULONG Hash;
+	ULONG i;
+	ULONG j;
+	BOOLEAN Changed;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	RtlZeroMemory(&Signature, sizeof(Signature));
+
+	//
+	// FNV-1a over the ManufacturerInfo blocks of all gauges.
+	//
+
+	Hash = 2166136261;
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		Status = AstonBatteryReadMacBlock(&DevExt->I2CContext[i],
+			BQ28Z610_MAC_MANUFACTURER_INFO,
+			ManufacturerInfo,
+			sizeof(ManufacturerInfo));
+
+		if (!NT_SUCCESS(Status))
+		{
+			goto Exit;
+		}
+
+		for (j = 0; j < sizeof(ManufacturerInfo); j++)
+		{
+			Hash = (Hash ^ ManufacturerInfo[j]) * 16777619;
+		}
+
+		Status = AstonBatteryReadMacBlock(&DevExt->I2CContext[i],
+			BQ28Z610_MAC_CHEM_ID,
+			&ChemId,
+			sizeof(ChemId));
+
+		if (!NT_SUCCESS(Status))
+		{
+			goto Exit;
+		}
+
+		Signature.ChemId = (Signature.ChemId << 16) | ChemId;
+	}
+
+	Signature.ManufacturerInfoHash = Hash;
+
+	Status = AstonBatteryReadGaugeWord(DevExt, BQ28Z610_REG_DESIGN_CAPACITY, GaugeValues);
+	if (!NT_SUCCESS(Status))
+	{
+		goto Exit;
+	}
+
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		Signature.DesignCapacity += GaugeValues[i];
+	}
+
+	Status = AstonBatteryReadGaugeWord(DevExt, BQ28Z610_REG_CYCLE_COUNT, GaugeValues);
+	if (!NT_SUCCESS(Status))
+	{
+		goto Exit;
+	}
+
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		Signature.CycleCount = max(Signature.CycleCount, GaugeValues[i]);
+	}
+
+	//
+	// The first signature read decides whether the health checkpoint in the
+	// registry was learnt on this pack.
+	//
+
+	if (!DevExt->PackSignatureValid &&
+		DevExt->HealthCheckpoint.Version == ASTON_BATTERY_HEALTH_CHECKPOINT_VERSION &&
+		AstonBatteryIsSamePack(&DevExt->HealthCheckpoint.Signature, &Signature))
+	{
+		WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+		if (!DevExt->Snapshot.HealthValid)
+		{
+			DevExt->Snapshot.Health = DevExt->HealthCheckpoint.Health;
+			DevExt->Snapshot.HealthValid = TRUE;
+			DevExt->Snapshot.Generation += 1;
+		}
+
+		WdfWaitLockRelease(DevExt->SnapshotLock);
+	}
+
+	//
+	// The tag and the snapshot change together, so that no query pairs the
+	// new tag with values read from the old pack.
+	//
+
+	WaitLockAcquire(DevExt->StateLock, &DevExt->StateLockStatistics);
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	Changed = AstonBatteryRecordPackSignature(&DevExt->PackSignature,
+		&DevExt->PackSignatureValid,
+		&Signature,
+		&DevExt->BatteryTag,
+		&DevExt->Snapshot);
+
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+	WaitLockRelease(DevExt->StateLock, &DevExt->StateLockStatistics);
+
+	if (!Changed)
+	{
+		goto Exit;
+	}
+
+	Trace(TRACE_LEVEL_WARNING, SURFACE_BATTERY_WARN,
+		"Pack changed: info 0x%08x, chem 0x%x, design %u mAh, cycles %u\n",
+		Signature.ManufacturerInfoHash,
+		Signature.ChemId,
+		Signature.DesignCapacity,
+		Signature.CycleCount);
+
+	AstonBatteryNotifyStatusChange(DevExt);
+
+Exit:
+	return Status;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryNotifyStatusChange(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Asks for the battery class driver to be told to query the battery
+	status again. The snapshot is also refreshed from inside the miniclass
+	callbacks, where calling back into the class driver would re-enter it
+	and could wait on ClassInitLock while BatteryClassUnload holds it for
+	those very callbacks. The request is only latched here, the sampler
+	delivers it at the end of its run through
+	AstonBatteryDeliverStatusNotify.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PAGED_CODE();
+
+	InterlockedExchange(&DevExt->StatusNotifyPending, TRUE);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryDeliverStatusNotify(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Calls BatteryClassStatusNotify for a request latched by
+	AstonBatteryNotifyStatusChange. Only called from the sampler work item,
+	outside of any battery class callback. The sampler is stopped on D0
+	exit, before BatteryClassUnload runs under ClassInitLock.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PAGED_CODE();
+
+	if (InterlockedExchange(&DevExt->StatusNotifyPending, FALSE) == FALSE)
+	{
+		return;
+	}
+
+	WaitLockAcquire(DevExt->ClassInitLock, &DevExt->ClassInitLockStatistics);
+	if (DevExt->ClassHandle != NULL)
+	{
+		BatteryClassStatusNotify(DevExt->ClassHandle);
+	}
+
+	WaitLockRelease(DevExt->ClassInitLock, &DevExt->ClassInitLockStatistics);
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryGetSnapshot(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	ULONG MaxAgeMs,
+	PASTON_BATTERY_SNAPSHOT Snapshot
+)
+
+/*++
+
+Routine Description:
+
+	Returns a copy of the current snapshot, refreshing it from the gauge first
+	if it is invalid or older than MaxAgeMs.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	MaxAgeMs - Supplies the maximum acceptable age of the cached data.
+
+	Snapshot - Supplies a pointer to receive the snapshot.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	ASTON_BATTERY_ACTIVITY Activity;
+	LARGE_INTEGER Now;
+	ULONGLONG AgeUs;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	Now = KeQueryPerformanceCounter(NULL);
+	AgeUs = 0;
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	*Snapshot = DevExt->Snapshot;
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+
+	if (Snapshot->Valid)
+	{
+		AgeUs = AstonBatteryQpcToUs(DevExt, Now.QuadPart - Snapshot->Timestamp.QuadPart);
+		if (AgeUs <= (ULONGLONG)MaxAgeMs * 1000)
+		{
+			InterlockedIncrement64(&DevExt->Counters.CacheHits);
+			AstonBatteryTraceSnapshotLookup(TRUE, AgeUs, MaxAgeMs);
+			return STATUS_SUCCESS;
+		}
+	}
+
+	InterlockedIncrement64(&DevExt->Counters.CacheMisses);
+	AstonBatteryTraceSnapshotLookup(FALSE, AgeUs, MaxAgeMs);
+
+	AstonBatteryStartActivity(DevExt, &Activity, AstonBatteryActivitySnapshotRefresh, 0);
+	Status = AstonBatteryRefreshSnapshot(DevExt);
+	AstonBatteryStopActivity(DevExt, &Activity, Status);
+	if (!NT_SUCCESS(Status))
+	{
+		Snapshot->Valid = FALSE;
+		return Status;
+	}
+
+	AstonBatteryPublishTelemetry(DevExt);
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	*Snapshot = DevExt->Snapshot;
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryGetPredictedSnapshot(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	PASTON_BATTERY_SNAPSHOT Snapshot
+)
+
+/*++
+
+Routine Description:
+
+	Returns a copy of the current snapshot with the remaining capacity,
+	voltage and remaining energy extrapolated to the present. The gauge is
+	only read when the snapshot is older than
+	ASTON_BATTERY_PREDICTION_MAX_AGE_MS.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	Snapshot - Supplies a pointer to receive the snapshot.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	LARGE_INTEGER Now;
+	LONG Capacity;
+	LONG Voltage;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	Status = AstonBatteryGetSnapshot(DevExt, ASTON_BATTERY_PREDICTION_MAX_AGE_MS, Snapshot);
+	if (!NT_SUCCESS(Status))
+	{
+		return Status;
+	}
+
+	Now = KeQueryPerformanceCounter(NULL);
+	AstonBatteryPredict(Snapshot,
+		AstonBatteryQpcToUs(DevExt, Now.QuadPart - Snapshot->Timestamp.QuadPart),
+		&Capacity,
+		&Voltage);
+
+	Snapshot->Registers.RemainingCapacity = (UINT16)Capacity;
+	Snapshot->Registers.Voltage = (UINT16)max(Voltage, 0);
+	Snapshot->Energy.RemainingEnergyMwh = AstonBatteryCapacityToEnergy(Snapshot, (ULONG)Capacity);
+
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryInvalidateSnapshot(
+	PSURFACE_BATTERY_FDO_DATA DevExt
+)
+
+/*++
+
+Routine Description:
+
+	Marks the cached dynamic data as stale, the next query reads through to
+	the gauge unless a prefetch has completed in the meantime.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PAGED_CODE();
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	DevExt->Snapshot.Valid = FALSE;
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryEvtSamplerWorkItem(
+	WDFWORKITEM WorkItem
+)
+
+/*++
+
+Routine Description:
+
+	Work item used to refresh the snapshot off the PnP/power path, queued on
+	D0 entry so that the queries following a resume hit a fresh cache, and
+	every SampleIntervalMs by the sampler timer after that. In
+	fast-start mode it is also queued from prepare hardware and performs
+	the deferred SPB open before priming the snapshot.
+
+Arguments:
+
+	WorkItem - Supplies the work item, parented to the device.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PSURFACE_BATTERY_FDO_DATA DevExt;
+	ULONG CellCountdown;
+	ULONG SignatureCountdown;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	DevExt = GetDeviceExtension(WdfWorkItemGetParentObject(WorkItem));
+
+	//
+	// WDF allows the work item to be queued again as soon as its callback
+	// starts, so a run that takes longer than a period would otherwise
+	// overlap the next one. The later run is dropped, the timer queues
+	// another one a period after.
+	//
+
+	if (InterlockedCompareExchange(&DevExt->SamplerBusy, 1, 0) != 0)
+	{
+		Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE,
+			"Sampler run skipped, the previous one is still in progress\n");
+
+		return;
+	}
+
+	Status = AstonBatteryInitializeSpbTarget(DevExt);
+	if (!NT_SUCCESS(Status))
+	{
+		goto Exit;
+	}
+
+	Status = AstonBatteryRefreshSnapshot(DevExt);
+	if (!NT_SUCCESS(Status))
+	{
+		Trace(TRACE_LEVEL_WARNING, SURFACE_BATTERY_WARN,
+			"Snapshot prefetch failed with Status = 0x%08lX\n",
+			Status);
+
+		goto Exit;
+	}
+
+	//
+	// D0 entry may reset the countdowns at any time, they are read once per
+	// run.
+	//
+
+	CellCountdown = DevExt->CellSampleCountdown;
+	SignatureCountdown = DevExt->SignatureSampleCountdown;
+
+	if (SignatureCountdown == 0)
+	{
+		Status = AstonBatteryCheckPackSignature(DevExt);
+		if (NT_SUCCESS(Status))
+		{
+			Status = AstonBatteryRefreshHealth(DevExt);
+		}
+
+		if (!NT_SUCCESS(Status))
+		{
+			Trace(TRACE_LEVEL_WARNING, SURFACE_BATTERY_WARN,
+				"Pack signature or health refresh failed with Status = 0x%08lX\n",
+				Status);
+		}
+
+		SignatureCountdown = ASTON_BATTERY_SIGNATURE_SAMPLE_DIVIDER;
+	}
+
+	DevExt->SignatureSampleCountdown = SignatureCountdown - 1;
+
+	//
+	// The cell blocks ride along with every Nth sample, starting with the
+	// first one after D0 entry.
+	//
+
+	if (CellCountdown == 0)
+	{
+		Status = AstonBatteryRefreshCellTelemetry(DevExt);
+		if (!NT_SUCCESS(Status))
+		{
+			Trace(TRACE_LEVEL_WARNING, SURFACE_BATTERY_WARN,
+				"Cell telemetry refresh failed with Status = 0x%08lX\n",
+				Status);
+		}
+
+		CellCountdown = ASTON_BATTERY_CELL_SAMPLE_DIVIDER;
+	}
+
+	DevExt->CellSampleCountdown = CellCountdown - 1;
+
+	AstonBatteryAppendHistory(DevExt);
+	AstonBatteryCheckpointHistory(DevExt, FALSE);
+	AstonBatteryPublishTelemetry(DevExt);
+
+Exit:
+	AstonBatteryDeliverStatusNotify(DevExt);
+	InterlockedExchange(&DevExt->SamplerBusy, 0);
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryEvtSamplerTimer(
+	WDFTIMER Timer
+)
+
+/*++
+
+Routine Description:
+
+	Periodic timer driving the sampler while the device is in D0. Runs at
+	DISPATCH_LEVEL, the bus I/O is left to the sampler work item.
+
+Arguments:
+
+	Timer - Supplies the timer, parented to the device.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PSURFACE_BATTERY_FDO_DATA DevExt;
+
+	DevExt = GetDeviceExtension(WdfTimerGetParentObject(Timer));
+	WdfWorkItemEnqueue(DevExt->SamplerWorkItem);
+}
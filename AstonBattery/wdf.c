@@ -28,6 +28,9 @@ EVT_WDF_DEVICE_SELF_MANAGED_IO_INIT  AstonBatterySelfManagedIoInit;
 EVT_WDF_DEVICE_SELF_MANAGED_IO_CLEANUP  AstonBatterySelfManagedIoCleanup;
 EVT_WDF_DEVICE_QUERY_STOP AstonBatteryQueryStop;
 EVT_WDF_DEVICE_PREPARE_HARDWARE AstonBatteryDevicePrepareHardware;
+EVT_WDF_DEVICE_D0_ENTRY AstonBatteryDeviceD0Entry;
+EVT_WDF_DEVICE_D0_EXIT AstonBatteryDeviceD0Exit;
+EVT_WDF_DEVICE_CONTEXT_CLEANUP AstonBatteryEvtDeviceCleanup;
 EVT_WDFDEVICE_WDM_IRP_PREPROCESS AstonBatteryWdmIrpPreprocessDeviceControl;
 EVT_WDFDEVICE_WDM_IRP_PREPROCESS AstonBatteryWdmIrpPreprocessSystemControl;
 WMI_QUERY_REGINFO_CALLBACK AstonBatteryQueryWmiRegInfo;
@@ -43,6 +46,9 @@ EVT_WDF_OBJECT_CONTEXT_CLEANUP AstonBatteryEvtDriverContextCleanup;
 #pragma alloc_text(PAGE, AstonBatteryQueryStop)
 #pragma alloc_text(PAGE, AstonBatteryDriverDeviceAdd)
 #pragma alloc_text(PAGE, AstonBatteryDevicePrepareHardware)
+#pragma alloc_text(PAGE, AstonBatteryDeviceD0Entry)
+#pragma alloc_text(PAGE, AstonBatteryDeviceD0Exit)
+#pragma alloc_text(PAGE, AstonBatteryEvtDeviceCleanup)
 #pragma alloc_text(PAGE, AstonBatteryWdmIrpPreprocessDeviceControl)
 #pragma alloc_text(PAGE, AstonBatteryWdmIrpPreprocessSystemControl)
 #pragma alloc_text(PAGE, AstonBatteryQueryWmiRegInfo)
@@ -92,6 +98,11 @@ Return Value:
 	//
 	WPP_INIT_TRACING(DriverObject, RegistryPath);
 
+	//
+	// A failure only leaves the TraceLogging activities disabled.
+	//
+	(VOID)TraceLoggingRegister(AstonBatteryTraceLoggingProvider);
+
 	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 
 	WDF_DRIVER_CONFIG_INIT(&DriverConfig, AstonBatteryDriverDeviceAdd);
@@ -132,6 +143,7 @@ Return Value:
 			"WdfDriverCreate() Failed. Status 0x%x\n",
 			Status);
 
+		TraceLoggingUnregister(AstonBatteryTraceLoggingProvider);
 		goto DriverEntryEnd;
 	}
 
@@ -181,6 +193,17 @@ Return Value:
 	WDFDEVICE DeviceHandle;
 	WDF_OBJECT_ATTRIBUTES LockAttributes;
 	WDF_PNPPOWER_EVENT_CALLBACKS PnpPowerCallbacks;
+	WDF_OBJECT_ATTRIBUTES WorkItemAttributes;
+	WDF_WORKITEM_CONFIG WorkItemConfig;
+	WDF_OBJECT_ATTRIBUTES TimerAttributes;
+	WDF_TIMER_CONFIG TimerConfig;
+	WDF_FILEOBJECT_CONFIG FileObjectConfig;
+	WDF_OBJECT_ATTRIBUTES FileObjectAttributes;
+	WDFKEY ConfigKey;
+	DECLARE_CONST_UNICODE_STRING(FastStartName, L"FastStart");
+	DECLARE_CONST_UNICODE_STRING(GaugeSelectName, L"GaugeSelect");
+	DECLARE_CONST_UNICODE_STRING(SampleIntervalName, L"SampleIntervalMs");
+	ULONG FastStart = 0;
 	NTSTATUS Status;
 
 	UNREFERENCED_PARAMETER(Driver);
@@ -195,11 +218,29 @@ Return Value:
 
 	WDF_PNPPOWER_EVENT_CALLBACKS_INIT(&PnpPowerCallbacks);
 	PnpPowerCallbacks.EvtDevicePrepareHardware = AstonBatteryDevicePrepareHardware;
+	PnpPowerCallbacks.EvtDeviceD0Entry = AstonBatteryDeviceD0Entry;
+	PnpPowerCallbacks.EvtDeviceD0Exit = AstonBatteryDeviceD0Exit;
 	PnpPowerCallbacks.EvtDeviceSelfManagedIoInit = AstonBatterySelfManagedIoInit;
 	PnpPowerCallbacks.EvtDeviceSelfManagedIoCleanup = AstonBatterySelfManagedIoCleanup;
 	PnpPowerCallbacks.EvtDeviceQueryStop = AstonBatteryQueryStop;
 	WdfDeviceInitSetPnpPowerEventCallbacks(DeviceInit, &PnpPowerCallbacks);
 
+	//
+	// Every handle on the private interface carries its own change
+	// notification state.
+	//
+
+	WDF_FILEOBJECT_CONFIG_INIT(&FileObjectConfig, NULL, NULL, NULL);
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&FileObjectAttributes, ASTON_BATTERY_FILE_CONTEXT);
+	WdfDeviceInitSetFileObjectConfig(DeviceInit, &FileObjectConfig, &FileObjectAttributes);
+
+	//
+	// The shared telemetry handle has to be opened in the context of the
+	// requesting process.
+	//
+
+	WdfDeviceInitSetIoInCallerContextCallback(DeviceInit, AstonBatteryEvtIoInCallerContext);
+
 	//
 	// Register WDM preprocess callbacks for IRP_MJ_DEVICE_CONTROL and
 	// IRP_MJ_SYSTEM_CONTROL. The battery class driver needs to handle these IO
@@ -244,6 +285,7 @@ Return Value:
 
 	WDF_OBJECT_ATTRIBUTES_INIT(&DeviceAttributes);
 	WDF_OBJECT_ATTRIBUTES_SET_CONTEXT_TYPE(&DeviceAttributes, SURFACE_BATTERY_FDO_DATA);
+	DeviceAttributes.EvtCleanupCallback = AstonBatteryEvtDeviceCleanup;
 
 	//
 	// Create a framework device object.  This call will in turn create
@@ -291,6 +333,141 @@ Return Value:
 		goto DriverDeviceAddEnd;
 	}
 
+	WDF_OBJECT_ATTRIBUTES_INIT(&LockAttributes);
+	LockAttributes.ParentObject = DeviceHandle;
+	Status = WdfWaitLockCreate(&LockAttributes,
+		&DevExt->SnapshotLock);
+
+	if (!NT_SUCCESS(Status)) {
+		Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_ERROR,
+			"WdfWaitLockCreate(SnapshotLock) Failed. Status 0x%x\n",
+			Status);
+
+		goto DriverDeviceAddEnd;
+	}
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&LockAttributes);
+	LockAttributes.ParentObject = DeviceHandle;
+	Status = WdfWaitLockCreate(&LockAttributes,
+		&DevExt->SpbOpenLock);
+
+	if (!NT_SUCCESS(Status)) {
+		Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_ERROR,
+			"WdfWaitLockCreate(SpbOpenLock) Failed. Status 0x%x\n",
+			Status);
+
+		goto DriverDeviceAddEnd;
+	}
+
+	KeQueryPerformanceCounter(&DevExt->QpcFrequency);
+	KeInitializeEvent(&DevExt->SpbReadyEvent, NotificationEvent, FALSE);
+	KeInitializeSpinLock(&DevExt->ActivityLock);
+	AstonBatteryLoadHealthCheckpoint(DevExt);
+
+	//
+	// FastStart defers opening the SPB target until after start completes.
+	// It is opt-in, a missing value leaves the synchronous behavior in place. GaugeSelect
+	// picks one gauge for this instance, by default all are aggregated.
+	// SampleIntervalMs sets the period of the background sampler.
+	//
+
+	DevExt->GaugeSelect = ASTON_BATTERY_GAUGE_SELECT_ALL;
+	DevExt->SampleIntervalMs = ASTON_BATTERY_DEFAULT_SAMPLE_INTERVAL_MS;
+
+	Status = WdfDeviceOpenRegistryKey(DeviceHandle,
+		PLUGPLAY_REGKEY_DEVICE,
+		KEY_READ,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&ConfigKey);
+
+	if (NT_SUCCESS(Status)) {
+		if (NT_SUCCESS(WdfRegistryQueryULong(ConfigKey, &FastStartName, &FastStart))) {
+			DevExt->FastStart = (FastStart != 0);
+		}
+
+		(VOID)WdfRegistryQueryULong(ConfigKey, &GaugeSelectName, &DevExt->GaugeSelect);
+		(VOID)WdfRegistryQueryULong(ConfigKey, &SampleIntervalName, &DevExt->SampleIntervalMs);
+
+		WdfRegistryClose(ConfigKey);
+	}
+
+	DevExt->SampleIntervalMs = max(DevExt->SampleIntervalMs, ASTON_BATTERY_MIN_SAMPLE_INTERVAL_MS);
+
+	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_INFO,
+		"FastStart = %d, GaugeSelect = 0x%x, SampleIntervalMs = %u\n",
+		DevExt->FastStart,
+		DevExt->GaugeSelect,
+		DevExt->SampleIntervalMs);
+
+	WDF_WORKITEM_CONFIG_INIT(&WorkItemConfig, AstonBatteryEvtSamplerWorkItem);
+	WDF_OBJECT_ATTRIBUTES_INIT(&WorkItemAttributes);
+	WorkItemAttributes.ParentObject = DeviceHandle;
+	Status = WdfWorkItemCreate(&WorkItemConfig,
+		&WorkItemAttributes,
+		&DevExt->SamplerWorkItem);
+
+	if (!NT_SUCCESS(Status)) {
+		Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_ERROR,
+			"WdfWorkItemCreate(SamplerWorkItem) Failed. Status 0x%x\n",
+			Status);
+
+		goto DriverDeviceAddEnd;
+	}
+
+	//
+	// The sampler timer only queues the work item, it is allowed to slip by
+	// a tenth of its period so that it can be coalesced with other timers.
+	//
+
+	WDF_TIMER_CONFIG_INIT_PERIODIC(&TimerConfig,
+		AstonBatteryEvtSamplerTimer,
+		DevExt->SampleIntervalMs);
+
+	TimerConfig.TolerableDelay = DevExt->SampleIntervalMs / 10;
+	TimerConfig.AutomaticSerialization = FALSE;
+	WDF_OBJECT_ATTRIBUTES_INIT(&TimerAttributes);
+	TimerAttributes.ParentObject = DeviceHandle;
+	TimerAttributes.ExecutionLevel = WdfExecutionLevelDispatch;
+	Status = WdfTimerCreate(&TimerConfig,
+		&TimerAttributes,
+		&DevExt->SamplerTimer);
+
+	if (!NT_SUCCESS(Status)) {
+		Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_ERROR,
+			"WdfTimerCreate(SamplerTimer) Failed. Status 0x%x\n",
+			Status);
+
+		goto DriverDeviceAddEnd;
+	}
+
+	Status = AstonBatteryCreateIoQueue(DeviceHandle);
+	if (!NT_SUCCESS(Status)) {
+		goto DriverDeviceAddEnd;
+	}
+
+	Status = AstonBatteryCreateSharedTelemetry(DevExt);
+	if (!NT_SUCCESS(Status)) {
+		goto DriverDeviceAddEnd;
+	}
+
+	Status = AstonBatteryCreateHistory(DevExt);
+	if (!NT_SUCCESS(Status)) {
+		goto DriverDeviceAddEnd;
+	}
+
+	//
+	// Failure to register the performance counters is nonfatal.
+	//
+
+	Status = AstonBatteryRegisterCounters(DevExt);
+	if (!NT_SUCCESS(Status)) {
+		Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_WARN,
+			"AstonBatteryRegisterCounters() Failed. Status 0x%x\n",
+			Status);
+
+		Status = STATUS_SUCCESS;
+	}
+
 DriverDeviceAddEnd:
 	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", Status);
 	return Status;
@@ -349,11 +526,11 @@ Return Value:
 	BattInit.Pdo = WdfDeviceWdmGetPhysicalDevice(Device);
 	BattInit.DeviceName = NULL;
 	BattInit.Fdo = WdfDeviceWdmGetDeviceObject(Device);
-	WdfWaitLockAcquire(DevExt->ClassInitLock, NULL);
+	WaitLockAcquire(DevExt->ClassInitLock, &DevExt->ClassInitLockStatistics);
 	Status = BatteryClassInitializeDevice((PBATTERY_MINIPORT_INFO)&BattInit,
 		&DevExt->ClassHandle);
 
-	WdfWaitLockRelease(DevExt->ClassInitLock);
+	WaitLockRelease(DevExt->ClassInitLock, &DevExt->ClassInitLockStatistics);
 	if (!NT_SUCCESS(Status)) {
 		goto DevicePrepareHardwareEnd;
 	}
@@ -364,8 +541,8 @@ Return Value:
 	// WMI requests.
 	//
 
-	DevExt->WmiLibContext.GuidCount = 0;
-	DevExt->WmiLibContext.GuidList = NULL;
+	DevExt->WmiLibContext.GuidCount = ASTON_BATTERY_WMI_GUID_COUNT;
+	DevExt->WmiLibContext.GuidList = AstonBatteryWmiGuidList;
 	DevExt->WmiLibContext.QueryWmiRegInfo = AstonBatteryQueryWmiRegInfo;
 	DevExt->WmiLibContext.QueryWmiDataBlock = AstonBatteryQueryWmiDataBlock;
 	DevExt->WmiLibContext.SetWmiDataBlock = NULL;
@@ -435,13 +612,13 @@ Return Value:
 	}
 
 	DevExt = GetDeviceExtension(Device);
-	WdfWaitLockAcquire(DevExt->ClassInitLock, NULL);
+	WaitLockAcquire(DevExt->ClassInitLock, &DevExt->ClassInitLockStatistics);
 	if (DevExt->ClassHandle != NULL) {
 		Status = BatteryClassUnload(DevExt->ClassHandle);
 		DevExt->ClassHandle = NULL;
 	}
 
-	WdfWaitLockRelease(DevExt->ClassInitLock);
+	WaitLockRelease(DevExt->ClassInitLock, &DevExt->ClassInitLockStatistics);
 	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", Status);
 	return;
 }
@@ -533,6 +710,8 @@ Return Value:
 	NTSTATUS status = STATUS_INSUFFICIENT_RESOURCES;
 	PCM_PARTIAL_RESOURCE_DESCRIPTOR res, resRaw;
 	ULONG resourceCount;
+	ULONG gaugeIndex;
+	SPB_CONTEXT* spbContext;
 	ULONG i;
 
 	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
@@ -541,6 +720,8 @@ Return Value:
 	PSURFACE_BATTERY_FDO_DATA devContext = GetDeviceExtension(Device);
 
 	devContext->Device = Device;
+	devContext->GaugeCount = 0;
+	gaugeIndex = 0;
 
 	//
 	// Get the resouce hub connection ID for our I2C driver
@@ -556,15 +737,34 @@ Return Value:
 			res->u.Connection.Class == CM_RESOURCE_CONNECTION_CLASS_SERIAL &&
 			res->u.Connection.Type == CM_RESOURCE_CONNECTION_TYPE_SERIAL_I2C)
 		{
-			devContext->I2CContext.I2cResHubId.LowPart =
-				res->u.Connection.IdLowPart;
-			devContext->I2CContext.I2cResHubId.HighPart =
-				res->u.Connection.IdHighPart;
-
-			status = STATUS_SUCCESS;
+			//
+			// Every I2C connection is one gauge, in resource order. When a
+			// single gauge is selected the others are left to the device
+			// instances they belong to.
+			//
+			if ((devContext->GaugeSelect == ASTON_BATTERY_GAUGE_SELECT_ALL ||
+				 devContext->GaugeSelect == gaugeIndex) &&
+				devContext->GaugeCount < ASTON_BATTERY_MAX_GAUGES)
+			{
+				spbContext = &devContext->I2CContext[devContext->GaugeCount];
+				spbContext->I2cResHubId.LowPart =
+					res->u.Connection.IdLowPart;
+				spbContext->I2cResHubId.HighPart =
+					res->u.Connection.IdHighPart;
+
+				devContext->GaugeCount += 1;
+				status = STATUS_SUCCESS;
+			}
+
+			gaugeIndex += 1;
 		}
 	}
 
+	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_INFO,
+		"Using %u of %u gauges\n",
+		devContext->GaugeCount,
+		gaugeIndex);
+
 	if (!NT_SUCCESS(status))
 	{
 		Trace(
@@ -576,20 +776,33 @@ Return Value:
 		goto exit;
 	}
 
-	//
-	// Initialize Spb so the driver can issue reads/writes
-	//
-	status = SpbTargetInitialize(Device, &devContext->I2CContext);
+	WdfWaitLockAcquire(devContext->SpbOpenLock, NULL);
+	devContext->SpbReady = FALSE;
+	KeClearEvent(&devContext->SpbReadyEvent);
+	WdfWaitLockRelease(devContext->SpbOpenLock);
 
-	if (!NT_SUCCESS(status))
+	devContext->PackSignatureValid = FALSE;
+	AstonBatteryRestoreHistory(devContext);
+
+	if (devContext->FastStart)
 	{
-		Trace(
-			TRACE_LEVEL_ERROR,
-			SURFACE_BATTERY_ERROR,
-			"Error in Spb initialization - %!STATUS!",
-			status);
+		//
+		// Complete start right away, the sampler work item opens the target
+		// and primes the snapshot. Early queries wait on SpbReadyEvent.
+		//
+		WdfWorkItemEnqueue(devContext->SamplerWorkItem);
+	}
+	else
+	{
+		//
+		// Initialize Spb so the driver can issue reads/writes
+		//
+		status = AstonBatteryInitializeSpbTarget(devContext);
 
-		goto exit;
+		if (!NT_SUCCESS(status))
+		{
+			goto exit;
+		}
 	}
 
 	AstonBatteryPrepareHardware(Device);
@@ -599,6 +812,152 @@ exit:
 	return status;
 }
 
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryDeviceD0Entry(
+	WDFDEVICE Device,
+	WDF_POWER_DEVICE_STATE PreviousState
+)
+
+/*++
+
+Routine Description:
+
+	EvtDeviceD0Entry is called when the device enters the working state, both
+	on start and on resume. A snapshot prefetch is queued so that the burst of
+	queries following a resume is served from memory; the time until the
+	first valid snapshot is recorded in D0EntryToSnapshotUs. The periodic
+	sampler runs, and raw register reads are accepted, from here until D0
+	exit.
+
+Arguments:
+
+	Device - Supplies a handle to a framework device object.
+
+	PreviousState - Supplies the device power state the device is leaving.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+
+	PSURFACE_BATTERY_FDO_DATA DevExt;
+
+	UNREFERENCED_PARAMETER(PreviousState);
+
+	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	PAGED_CODE();
+
+	DevExt = GetDeviceExtension(Device);
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	DevExt->D0EntryTime = KeQueryPerformanceCounter(NULL);
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+
+	DevExt->CellSampleCountdown = 0;
+	DevExt->SignatureSampleCountdown = 0;
+
+	WaitLockAcquire(DevExt->StateLock, &DevExt->StateLockStatistics);
+	DevExt->InD0 = TRUE;
+	WaitLockRelease(DevExt->StateLock, &DevExt->StateLockStatistics);
+
+	WdfWorkItemEnqueue(DevExt->SamplerWorkItem);
+	WdfTimerStart(DevExt->SamplerTimer, WDF_REL_TIMEOUT_IN_MS(DevExt->SampleIntervalMs));
+
+	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", STATUS_SUCCESS);
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryDeviceD0Exit(
+	WDFDEVICE Device,
+	WDF_POWER_DEVICE_STATE TargetState
+)
+
+/*++
+
+Routine Description:
+
+	EvtDeviceD0Exit is called when the device leaves the working state. Raw
+	register reads are refused from here on, once any in flight has left
+	the bus. The sampler is stopped, any prefetch still in flight is flushed
+	and the dynamic data is invalidated, since the pack keeps changing while
+	the system sleeps.
+
+Arguments:
+
+	Device - Supplies a handle to a framework device object.
+
+	TargetState - Supplies the device power state the device is entering.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+
+	PSURFACE_BATTERY_FDO_DATA DevExt;
+
+	UNREFERENCED_PARAMETER(TargetState);
+
+	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	PAGED_CODE();
+
+	DevExt = GetDeviceExtension(Device);
+
+	WaitLockAcquire(DevExt->StateLock, &DevExt->StateLockStatistics);
+	DevExt->InD0 = FALSE;
+	WaitLockRelease(DevExt->StateLock, &DevExt->StateLockStatistics);
+
+	WdfTimerStop(DevExt->SamplerTimer, TRUE);
+	WdfWorkItemFlush(DevExt->SamplerWorkItem);
+	AstonBatteryCheckpointHealth(DevExt, TRUE);
+	AstonBatteryCheckpointHistory(DevExt, TRUE);
+	AstonBatteryInvalidateSnapshot(DevExt);
+	AstonBatteryPublishTelemetry(DevExt);
+
+	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", STATUS_SUCCESS);
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+VOID
+AstonBatteryEvtDeviceCleanup(
+	WDFOBJECT Object
+)
+
+/*++
+
+Routine Description:
+
+	Releases the resources of the device that the framework does not own.
+
+Arguments:
+
+	Object - Supplies a handle to the framework device object.
+
+Return Value:
+
+	None
+
+--*/
+
+{
+	PSURFACE_BATTERY_FDO_DATA DevExt;
+
+	PAGED_CODE();
+
+	DevExt = GetDeviceExtension((WDFDEVICE)Object);
+	AstonBatteryUnregisterCounters(DevExt);
+	AstonBatteryDestroySharedTelemetry(DevExt);
+}
+
 _Use_decl_annotations_
 NTSTATUS
 AstonBatteryWdmIrpPreprocessDeviceControl(
@@ -633,11 +992,12 @@ Return Value:
 
 {
 
+	ASTON_BATTERY_ACTIVITY Activity;
 	PSURFACE_BATTERY_FDO_DATA DevExt;
 	NTSTATUS Status;
 
 	PAGED_CODE();
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 
 	ASSERTMSG("Must be called at IRQL = PASSIVE_LEVEL",
 		(KeGetCurrentIrql() == PASSIVE_LEVEL));
@@ -645,13 +1005,23 @@ Return Value:
 	DevExt = GetDeviceExtension(Device);
 	Status = STATUS_NOT_SUPPORTED;
 
+	//
+	// The activity spans the class driver and the private IOCTLs, the
+	// miniclass callbacks the class driver runs for this IRP relate to it.
+	//
+
+	AstonBatteryStartActivity(DevExt,
+		&Activity,
+		AstonBatteryActivityDeviceControl,
+		IoGetCurrentIrpStackLocation(Irp)->Parameters.DeviceIoControl.IoControlCode);
+
 	//
 	// Suppress 28118:Irq Exceeds Caller, see Routine Description for
 	// explaination.
 	//
 
 #pragma warning(suppress: 28118)
-	WdfWaitLockAcquire(DevExt->ClassInitLock, NULL);
+	WaitLockAcquire(DevExt->ClassInitLock, &DevExt->ClassInitLockStatistics);
 
 	//
 	// N.B. An attempt to queue the IRP with the port driver should happen
@@ -671,13 +1041,14 @@ Return Value:
 		Status = BatteryClassIoctl(DevExt->ClassHandle, Irp);
 	}
 
-	WdfWaitLockRelease(DevExt->ClassInitLock);
+	WaitLockRelease(DevExt->ClassInitLock, &DevExt->ClassInitLockStatistics);
 	if (Status == STATUS_NOT_SUPPORTED) {
 		IoSkipCurrentIrpStackLocation(Irp);
 		Status = WdfDeviceWdmDispatchPreprocessedIrp(Device, Irp);
 	}
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", Status);
+	AstonBatteryStopActivity(DevExt, &Activity, Status);
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", Status);
 	return Status;
 }
 
@@ -720,7 +1091,7 @@ Return Value:
 	SYSCTL_IRP_DISPOSITION Disposition;
 	NTSTATUS Status;
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 	PAGED_CODE();
 
 	ASSERTMSG("Must be called at IRQL = PASSIVE_LEVEL", (KeGetCurrentIrql() == PASSIVE_LEVEL));
@@ -738,7 +1109,7 @@ Return Value:
 	//
 
 #pragma warning(suppress: 28118)
-	WdfWaitLockAcquire(DevExt->ClassInitLock, NULL);
+	WaitLockAcquire(DevExt->ClassInitLock, &DevExt->ClassInitLockStatistics);
 	if (DevExt->ClassHandle != NULL) {
 		DeviceObject = WdfDeviceWdmGetDeviceObject(Device);
 		Status = BatteryClassSystemControl(DevExt->ClassHandle,
@@ -748,7 +1119,7 @@ Return Value:
 			&Disposition);
 	}
 
-	WdfWaitLockRelease(DevExt->ClassInitLock);
+	WaitLockRelease(DevExt->ClassInitLock, &DevExt->ClassInitLockStatistics);
 	switch (Disposition) {
 	case IrpProcessed:
 		break;
@@ -765,7 +1136,7 @@ Return Value:
 		break;
 	}
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", Status);
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", Status);
 	return Status;
 }
 
@@ -829,10 +1200,9 @@ Return Value:
 	PSURFACE_BATTERY_GLOBAL_DATA GlobalData;
 	NTSTATUS Status;
 
-	UNREFERENCED_PARAMETER(MofResourceName);
 	UNREFERENCED_PARAMETER(InstanceName);
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 	PAGED_CODE();
 
 	Device = WdfWdmDeviceGetWdfDeviceHandle(DeviceObject);
@@ -840,8 +1210,9 @@ Return Value:
 	*RegFlags = WMIREG_FLAG_INSTANCE_PDO;
 	*RegistryPath = &GlobalData->RegistryPath;
 	*Pdo = WdfDeviceWdmGetPhysicalDevice(Device);
+	RtlInitUnicodeString(MofResourceName, ASTON_BATTERY_WMI_MOF_RESOURCE_NAME);
 	Status = STATUS_SUCCESS;
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", Status);
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", Status);
 	return Status;
 }
 
@@ -908,7 +1279,7 @@ Return Value:
 	UNREFERENCED_PARAMETER(InstanceIndex);
 	UNREFERENCED_PARAMETER(InstanceCount);
 
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Entering %!FUNC!\n");
 	PAGED_CODE();
 
 	ASSERT((InstanceIndex == 0) && (InstanceCount == 1));
@@ -921,6 +1292,23 @@ Return Value:
 	Device = WdfWdmDeviceGetWdfDeviceHandle(DeviceObject);
 	DevExt = GetDeviceExtension(Device);
 
+	//
+	// The blocks of the driver come first in the list, the class driver
+	// answers the rest.
+	//
+
+	if (GuidIndex < ASTON_BATTERY_WMI_GUID_COUNT) {
+		Status = AstonBatteryQueryCustomWmiDataBlock(DevExt,
+			DeviceObject,
+			Irp,
+			GuidIndex,
+			InstanceLengthArray,
+			BufferAvail,
+			Buffer);
+
+		goto AstonBatteryQueryWmiDataBlockEnd;
+	}
+
 	//
 	// The class driver guarantees that all outstanding IO requests will be
 	// completed before it finishes unregistering. As a result, the class
@@ -945,7 +1333,7 @@ Return Value:
 	}
 
 AstonBatteryQueryWmiDataBlockEnd:
-	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", Status);
+	Trace(TRACE_LEVEL_VERBOSE, SURFACE_BATTERY_TRACE, "Leaving %!FUNC!: Status = 0x%08lX\n", Status);
 	return Status;
 }
 
@@ -975,6 +1363,8 @@ Return Value:
 
 	Trace(TRACE_LEVEL_INFORMATION, SURFACE_BATTERY_INFO, "%!FUNC! Entry");
 
+	TraceLoggingUnregister(AstonBatteryTraceLoggingProvider);
+
 	//
 	// Stop WPP Tracing
 	//
@@ -0,0 +1,296 @@
+/*++
+
+Module Name:
+
+	wmi.c
+
+Abstract:
+
+	This module serves the WMI data blocks of the driver, described in
+	AstonBattery.mof. Each block returns in one query what would otherwise
+	take a round of battery class queries, from the cached snapshot, the
+	counters and the lock statistics of the driver, without bus transfers.
+	The blocks are registered ahead of those of the battery class driver.
+
+	N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "AstonBattery.h"
+#include "wmi.tmh"
+
+//---------------------------------------------------------------------- Pragmas
+
+#pragma alloc_text(PAGE, AstonBatteryQueryCustomWmiDataBlock)
+
+//------------------------------------------------------------------ Definitions
+
+WMIGUIDREGINFO AstonBatteryWmiGuidList[ASTON_BATTERY_WMI_GUID_COUNT] =
+{
+	{ &GUID_ASTON_BATTERY_WMI_TELEMETRY, 1, 0 },
+	{ &GUID_ASTON_BATTERY_WMI_HEALTH, 1, 0 },
+	{ &GUID_ASTON_BATTERY_WMI_SPB_STATISTICS, 1, 0 },
+	{ &GUID_ASTON_BATTERY_WMI_LOCK_STATISTICS, 1, 0 },
+};
+
+C_ASSERT(LOCK_HISTOGRAM_BUCKETS == ASTON_BATTERY_LOCK_HISTOGRAM_BUCKETS);
+
+//-------------------------------------------------------------------- Functions
+
+static
+VOID
+AstonBatteryFillWmiHealth(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+	_Out_ PASTON_BATTERY_WMI_HEALTH Health
+)
+
+{
+	PAGED_CODE();
+
+	RtlZeroMemory(Health, sizeof(*Health));
+
+	WdfWaitLockAcquire(DevExt->SnapshotLock, NULL);
+	if (DevExt->Snapshot.HealthValid)
+	{
+		Health->Flags |= ASTON_BATTERY_TELEMETRY_HEALTH_VALID;
+	}
+
+	Health->Health = DevExt->Snapshot.Health;
+	WdfWaitLockRelease(DevExt->SnapshotLock);
+
+	if (DevExt->PackSignatureValid)
+	{
+		Health->ChemId = DevExt->PackSignature.ChemId;
+		Health->ManufacturerInfoHash = DevExt->PackSignature.ManufacturerInfoHash;
+	}
+}
+
+static
+VOID
+AstonBatteryFillWmiSpbStatistics(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+	_Out_ PASTON_BATTERY_WMI_SPB_STATISTICS Statistics
+)
+
+/*++
+
+Routine Description:
+
+	Copies the transfer counters of every gauge. They are read without the
+	SPB lock, a transfer in flight may be counted in some of them only.
+
+--*/
+
+{
+	SPB_STATISTICS* Counters;
+	ULONG i;
+
+	PAGED_CODE();
+
+	RtlZeroMemory(Statistics, sizeof(*Statistics));
+	Statistics->GaugeCount = DevExt->GaugeCount;
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		Counters = &DevExt->I2CContext[i].Statistics;
+		Statistics->Reads[i] = (ULONGLONG)ReadNoFence64(&Counters->Reads);
+		Statistics->Writes[i] = (ULONGLONG)ReadNoFence64(&Counters->Writes);
+		Statistics->Failures[i] = (ULONGLONG)ReadNoFence64(&Counters->Failures);
+		Statistics->BytesRead[i] = (ULONGLONG)ReadNoFence64(&Counters->BytesRead);
+		Statistics->BytesWritten[i] = (ULONGLONG)ReadNoFence64(&Counters->BytesWritten);
+	}
+}
+
+static
+VOID
+AstonBatteryCopyLockStatistics(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+	_In_ const LOCK_STATISTICS* Lock,
+	_Out_ PASTON_BATTERY_LOCK_STATISTICS Statistics
+)
+
+/*++
+
+Routine Description:
+
+	Copies the statistics of one lock with the times converted to
+	microseconds. The lock is not taken, a holder updating them at the same
+	time may leave some of the fields one acquisition behind.
+
+--*/
+
+{
+	LONGLONG Frequency;
+	PCSTR Function;
+	ULONG i;
+
+	PAGED_CODE();
+
+	Frequency = DevExt->QpcFrequency.QuadPart;
+
+	Statistics->Acquisitions = (ULONGLONG)ReadNoFence64(&Lock->Acquisitions);
+	Statistics->Contentions = (ULONGLONG)ReadNoFence64(&Lock->Contentions);
+	Statistics->WaitUs = (ULONGLONG)ReadNoFence64(&Lock->WaitTicks) * 1000000 / Frequency;
+	Statistics->HoldUs = (ULONGLONG)ReadNoFence64(&Lock->HoldTicks) * 1000000 / Frequency;
+	Statistics->MaxWaitUs = (ULONG)min((ULONGLONG)ReadNoFence64(&Lock->MaxWaitTicks) * 1000000 / Frequency, MAXULONG);
+	Statistics->MaxHoldUs = (ULONG)min((ULONGLONG)ReadNoFence64(&Lock->MaxHoldTicks) * 1000000 / Frequency, MAXULONG);
+	Statistics->MaxHoldLine = Lock->MaxHoldLine;
+
+	Function = Lock->MaxHoldFunction;
+	if (Function != NULL)
+	{
+		(VOID)RtlStringCbCopyA(Statistics->MaxHoldFunction, sizeof(Statistics->MaxHoldFunction), Function);
+	}
+
+	for (i = 0; i < LOCK_HISTOGRAM_BUCKETS; i++)
+	{
+		Statistics->WaitHistogram[i] = Lock->WaitHistogram[i];
+		Statistics->HoldHistogram[i] = Lock->HoldHistogram[i];
+	}
+}
+
+static
+VOID
+AstonBatteryFillWmiLockStatistics(
+	_In_ PSURFACE_BATTERY_FDO_DATA DevExt,
+	_Out_ PASTON_BATTERY_WMI_LOCK_STATISTICS Statistics
+)
+
+{
+	ULONG i;
+
+	PAGED_CODE();
+
+	RtlZeroMemory(Statistics, sizeof(*Statistics));
+	Statistics->LockCount = ASTON_BATTERY_LOCK_SPB + DevExt->GaugeCount;
+
+	AstonBatteryCopyLockStatistics(DevExt,
+		&DevExt->StateLockStatistics,
+		&Statistics->Locks[ASTON_BATTERY_LOCK_STATE]);
+
+	AstonBatteryCopyLockStatistics(DevExt,
+		&DevExt->ClassInitLockStatistics,
+		&Statistics->Locks[ASTON_BATTERY_LOCK_CLASS_INIT]);
+
+	for (i = 0; i < DevExt->GaugeCount; i++)
+	{
+		AstonBatteryCopyLockStatistics(DevExt,
+			&DevExt->I2CContext[i].SpbLockStatistics,
+			&Statistics->Locks[ASTON_BATTERY_LOCK_SPB + i]);
+	}
+}
+
+_Use_decl_annotations_
+NTSTATUS
+AstonBatteryQueryCustomWmiDataBlock(
+	PSURFACE_BATTERY_FDO_DATA DevExt,
+	PDEVICE_OBJECT DeviceObject,
+	PIRP Irp,
+	ULONG GuidIndex,
+	PULONG InstanceLengthArray,
+	ULONG BufferAvail,
+	PUCHAR Buffer
+)
+
+/*++
+
+Routine Description:
+
+	Fills and completes a query for one of the data blocks of the driver.
+	A buffer too small for the block completes the request with the size
+	needed.
+
+Arguments:
+
+	DevExt - Supplies the device extension of the battery.
+
+	DeviceObject - Supplies the device whose data block is being queried.
+
+	Irp - Supplies the Irp that makes this request.
+
+	GuidIndex - Supplies the index of the block in AstonBatteryWmiGuidList.
+
+	InstanceLengthArray - Supplies a pointer to return the length of the
+		single instance of the block.
+
+	BufferAvail - Supplies the maximum size available to write the data
+		block.
+
+	Buffer - Supplies a pointer to a buffer to return the data block.
+
+Return Value:
+
+	NTSTATUS
+
+--*/
+
+{
+	ULONG Size;
+	NTSTATUS Status;
+
+	PAGED_CODE();
+
+	switch (GuidIndex)
+	{
+	case ASTON_BATTERY_WMI_TELEMETRY_INDEX:
+		Size = sizeof(ASTON_BATTERY_TELEMETRY);
+		break;
+
+	case ASTON_BATTERY_WMI_HEALTH_INDEX:
+		Size = sizeof(ASTON_BATTERY_WMI_HEALTH);
+		break;
+
+	case ASTON_BATTERY_WMI_SPB_STATISTICS_INDEX:
+		Size = sizeof(ASTON_BATTERY_WMI_SPB_STATISTICS);
+		break;
+
+	case ASTON_BATTERY_WMI_LOCK_STATISTICS_INDEX:
+		Size = sizeof(ASTON_BATTERY_WMI_LOCK_STATISTICS);
+		break;
+
+	default:
+		return WmiCompleteRequest(DeviceObject,
+			Irp,
+			STATUS_WMI_GUID_NOT_FOUND,
+			0,
+			IO_NO_INCREMENT);
+	}
+
+	if (BufferAvail < Size)
+	{
+		return WmiCompleteRequest(DeviceObject,
+			Irp,
+			STATUS_BUFFER_TOO_SMALL,
+			Size,
+			IO_NO_INCREMENT);
+	}
+
+	switch (GuidIndex)
+	{
+	case ASTON_BATTERY_WMI_TELEMETRY_INDEX:
+		AstonBatteryFillTelemetry(DevExt, (PASTON_BATTERY_TELEMETRY)Buffer);
+		break;
+
+	case ASTON_BATTERY_WMI_HEALTH_INDEX:
+		AstonBatteryFillWmiHealth(DevExt, (PASTON_BATTERY_WMI_HEALTH)Buffer);
+		break;
+
+	case ASTON_BATTERY_WMI_SPB_STATISTICS_INDEX:
+		AstonBatteryFillWmiSpbStatistics(DevExt, (PASTON_BATTERY_WMI_SPB_STATISTICS)Buffer);
+		break;
+
+	default:
+		AstonBatteryFillWmiLockStatistics(DevExt, (PASTON_BATTERY_WMI_LOCK_STATISTICS)Buffer);
+		break;
+	}
+
+	*InstanceLengthArray = Size;
+	Status = WmiCompleteRequest(DeviceObject,
+		Irp,
+		STATUS_SUCCESS,
+		Size,
+		IO_NO_INCREMENT);
+
+	return Status;
+}
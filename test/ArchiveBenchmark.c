@@ -0,0 +1,256 @@
+/*++
+
+Module Name:
+
+    ArchiveBenchmark.c
+
+Abstract:
+
+    Measures the long term archive on two weeks of simulated use, charge
+    and discharge cycles of two packs in parallel, at sampling intervals of
+    1 s, 5 s and 15 s. Every archived sample is decoded back and compared
+    with what was encoded.
+
+    Reported per interval: the bytes per archived sample against the 28
+    bytes of the history columns, the days the 96 blocks hold once they
+    have wrapped, and the cost of encoding and decoding one sample on the
+    build host.
+
+    The conversions between performance counter ticks and the millisecond
+    timestamps of the archive are checked at the ends of the counter range.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include <stdlib.h>
+#include <time.h>
+#include "GaugeSimulator.h"
+#include "archive.h"
+#include "Test.h"
+
+//------------------------------------------------------------------ Definitions
+
+#define TRACE_DAYS          14
+#define TRACE_SECONDS       (TRACE_DAYS * 86400)
+#define RAW_SAMPLE_SIZE     (sizeof(LONGLONG) + sizeof(LONG) + sizeof(ULONG) + 6 * sizeof(USHORT))
+
+typedef struct _BENCHMARK_RESULT
+{
+    ULONG Samples;
+    ULONG Held;
+    ULONG Used;
+    double Days;
+    double EncodeNs;
+    double DecodeNs;
+    ULONG Mismatches;
+} BENCHMARK_RESULT;
+
+//-------------------------------------------------------------------- Functions
+
+static
+double
+NowNs(
+	VOID
+)
+{
+	struct timespec Now;
+
+	timespec_get(&Now, TIME_UTC);
+	return Now.tv_sec * 1e9 + Now.tv_nsec;
+}
+
+static
+ULONG
+GenerateTrace(
+	ULONG IntervalS,
+	LONGLONG (*Samples)[ASTON_BATTERY_HISTORY_FIELDS]
+)
+
+/*++
+
+Routine Description:
+
+	Runs the day cycle and keeps the fields of every archived sample the
+	way AstonBatteryAppendHistory takes them from the snapshot.
+
+--*/
+
+{
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+	SIM_GAUGE Gauges[2];
+	SIM_CYCLE Cycle;
+	LONGLONG* Values;
+	ULONG Countdown;
+	ULONG Count;
+	ULONG t;
+
+	RtlZeroMemory(&Snapshot, sizeof(Snapshot));
+	SimInitializeGauge(&Gauges[0], 4000, 0.9, 110);
+	SimInitializeGauge(&Gauges[1], 4000, 0.9, 120);
+	SimInitializeCycle(&Cycle, 41);
+	Countdown = 0;
+	Count = 0;
+
+	for (t = 0; t < TRACE_SECONDS; t++)
+	{
+		SimAdvanceCycle(&Cycle, Gauges, 2);
+		if (t % IntervalS != 0)
+		{
+			continue;
+		}
+
+		SimSample(&Snapshot, Gauges, 2, t == 0 ? 0 : (ULONGLONG)IntervalS * 1000000);
+
+		if (Countdown == 0)
+		{
+			Values = Samples[Count++];
+			Values[0] = AstonBatteryTicksToMs(Snapshot.Timestamp.QuadPart, 1000000);
+			Values[1] = AstonBatteryFilterValue(Snapshot.RateFilter.PowerShort);
+			Values[2] = Snapshot.Safety.SafetyStatus;
+			Values[3] = Snapshot.Registers.Voltage;
+			Values[4] = Snapshot.Registers.Current;
+			Values[5] = Snapshot.Registers.Temperature;
+			Values[6] = Snapshot.Registers.RemainingCapacity;
+			Values[7] = Snapshot.Registers.FullChargeCapacity;
+			Values[8] = Snapshot.Registers.BatteryStatus;
+
+			Countdown = ASTON_BATTERY_ARCHIVE_SAMPLE_DIVIDER;
+		}
+
+		Countdown -= 1;
+	}
+
+	return Count;
+}
+
+static
+VOID
+Benchmark(
+	ULONG IntervalS,
+	BENCHMARK_RESULT* Result
+)
+{
+	static LONGLONG Samples[TRACE_SECONDS / ASTON_BATTERY_ARCHIVE_SAMPLE_DIVIDER + 1][ASTON_BATTERY_HISTORY_FIELDS];
+	ASTON_BATTERY_ARCHIVE Archive;
+	PASTON_BATTERY_ARCHIVE_BLOCK Entry;
+	ULONG BlockStart[ASTON_BATTERY_ARCHIVE_BLOCKS];
+	LONGLONG Values[ASTON_BATTERY_HISTORY_FIELDS];
+	LONGLONG Interval;
+	LONGLONG First;
+	LONGLONG Last;
+	double Start;
+	ULONG Oldest;
+	ULONG Block;
+	ULONG Offset;
+	ULONG Field;
+	ULONG Sample;
+	ULONG i;
+
+	RtlZeroMemory(Result, sizeof(*Result));
+	RtlZeroMemory(&Archive, sizeof(Archive));
+	Archive.Blocks = calloc(ASTON_BATTERY_ARCHIVE_BLOCKS, ASTON_BATTERY_ARCHIVE_BLOCK_SIZE);
+	Result->Samples = GenerateTrace(IntervalS, Samples);
+
+	Start = NowNs();
+	for (Sample = 0; Sample < Result->Samples; Sample++)
+	{
+		AstonBatteryArchiveSample(&Archive, Samples[Sample]);
+		if (Archive.Index[Archive.Head].Count == 1)
+		{
+			BlockStart[Archive.Head] = Sample;
+		}
+	}
+
+	Result->EncodeNs = (NowNs() - Start) / Result->Samples;
+
+	Oldest = (Archive.Head + ASTON_BATTERY_ARCHIVE_BLOCKS + 1 - Archive.BlockCount) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+	First = Archive.Index[Oldest].FirstTimestamp;
+	Last = Archive.Index[Archive.Head].LastTimestamp;
+	Result->Days = (Last - First) / 86400000.0;
+
+	Start = NowNs();
+	for (i = 0; i < Archive.BlockCount; i++)
+	{
+		Block = (Oldest + i) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+		Entry = &Archive.Index[Block];
+		RtlZeroMemory(Values, sizeof(Values));
+		Interval = 0;
+		Offset = 0;
+
+		for (Sample = 0; Sample < Entry->Count; Sample++)
+		{
+			CHECK(AstonBatteryDecodeSample(Archive.Blocks + (SIZE_T)Block * ASTON_BATTERY_ARCHIVE_BLOCK_SIZE,
+				Entry->Used,
+				&Offset,
+				Values,
+				&Interval));
+
+			for (Field = 0; Field < ASTON_BATTERY_HISTORY_FIELDS; Field++)
+			{
+				if (Values[Field] + (Field == 0 ? Entry->Bias : 0) != Samples[BlockStart[Block] + Sample][Field])
+				{
+					Result->Mismatches += 1;
+				}
+			}
+		}
+
+		CHECK_EQ(Offset, Entry->Used);
+		Result->Held += Entry->Count;
+		Result->Used += Entry->Used;
+	}
+
+	Result->DecodeNs = (NowNs() - Start) / Result->Held;
+	free(Archive.Blocks);
+}
+
+static
+VOID
+TestTimestampConversion(
+	VOID
+)
+{
+	CHECK_EQ(AstonBatteryTicksToMs(MAXLONGLONG, 10000000), 922337203685477LL);
+	CHECK_EQ(AstonBatteryTicksToMs(-MAXLONGLONG, 10000000), -922337203685477LL);
+	CHECK_EQ(AstonBatteryTicksToMs(19200000 * 3LL + 9600000, 19200000), 3500);
+	CHECK_EQ(AstonBatteryMsToTicks(922337203685477LL, 10000000), 9223372036854770000LL);
+	CHECK_EQ(AstonBatteryMsToTicks(-1500, 19200000), -28800000);
+}
+
+int
+main(
+	VOID
+)
+{
+	static const ULONG Intervals[] = { 1, 5, 15 };
+	BENCHMARK_RESULT Result;
+	double BytesPerSample;
+	ULONG i;
+
+	TestTimestampConversion();
+
+	printf("Interval  Archived  Held      Bytes/sample  Ratio  Days held  Encode ns  Decode ns\n");
+
+	for (i = 0; i < ARRAYSIZE(Intervals); i++)
+	{
+		Benchmark(Intervals[i], &Result);
+		BytesPerSample = (double)Result.Used / Result.Held;
+
+		printf("%6lus   %8lu  %8lu  %12.2f  %5.1f  %9.1f  %9.1f  %9.1f\n",
+			(unsigned long)Intervals[i],
+			(unsigned long)Result.Samples,
+			(unsigned long)Result.Held,
+			BytesPerSample,
+			RAW_SAMPLE_SIZE / BytesPerSample,
+			Result.Days,
+			Result.EncodeNs,
+			Result.DecodeNs);
+
+		CHECK_EQ(Result.Mismatches, 0);
+		CHECK(BytesPerSample < 14);
+	}
+
+	return TEST_RESULT();
+}
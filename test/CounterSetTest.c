@@ -0,0 +1,212 @@
+/*++
+
+Module Name:
+
+    CounterSetTest.c
+
+Abstract:
+
+    Checks the values AstonBatteryComputeCounterValues hands to the
+    performance counter set: the bus totals summed over the gauges, the
+    lock totals over the locks, the 32 bit cache counters wrapping, the
+    lock wait in 100 ns units and the snapshot age, at the ends of the
+    counter range.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "counterset.h"
+#include "Test.h"
+
+//------------------------------------------------------------------ Definitions
+
+#define QPC_FREQUENCY   19200000
+
+//-------------------------------------------------------------------- Functions
+
+static
+VOID
+InitializeSample(
+	PASTON_BATTERY_COUNTER_SAMPLE Sample
+)
+{
+	ULONG i;
+
+	RtlZeroMemory(Sample, sizeof(*Sample));
+
+	for (i = 0; i < RTL_NUMBER_OF(Sample->InformationQueries); i++)
+	{
+		Sample->InformationQueries[i] = 100 + i;
+	}
+
+	Sample->StatusQueries = 7000;
+	Sample->SafetyPolls = 40;
+	Sample->SafetyBusTransfers = 80;
+	Sample->CacheHits = 900;
+	Sample->CacheMisses = 100;
+
+	Sample->GaugeCount = 2;
+	Sample->Bus[0].Reads = 1000;
+	Sample->Bus[0].Writes = 10;
+	Sample->Bus[0].Failures = 3;
+	Sample->Bus[0].BytesRead = 2000;
+	Sample->Bus[0].BytesWritten = 30;
+	Sample->Bus[1].Reads = 500;
+	Sample->Bus[1].Writes = 5;
+	Sample->Bus[1].Failures = 1;
+	Sample->Bus[1].BytesRead = 1000;
+	Sample->Bus[1].BytesWritten = 15;
+
+	Sample->LockCount = 4;
+	for (i = 0; i < Sample->LockCount; i++)
+	{
+		Sample->Locks[i].Contentions = i + 1;
+		Sample->Locks[i].WaitTicks = QPC_FREQUENCY / 4;
+	}
+
+	Sample->QpcFrequency = QPC_FREQUENCY;
+}
+
+static
+VOID
+TestSums(
+	VOID
+)
+{
+	ASTON_BATTERY_COUNTER_SAMPLE Sample;
+	ASTON_BATTERY_COUNTER_VALUES Values;
+	ULONG i;
+
+	InitializeSample(&Sample);
+	AstonBatteryComputeCounterValues(&Sample, &Values);
+
+	for (i = 0; i < RTL_NUMBER_OF(Values.InformationQueries); i++)
+	{
+		CHECK_EQ(Values.InformationQueries[i], 100 + i);
+	}
+
+	CHECK_EQ(Values.StatusQueries, 7000);
+	CHECK_EQ(Values.SafetyPolls, 40);
+	CHECK_EQ(Values.SafetyBusTransfers, 80);
+	CHECK_EQ(Values.CacheHits, 900);
+	CHECK_EQ(Values.CacheLookups, 1000);
+	CHECK_EQ(Values.BusTransfers, 1515);
+	CHECK_EQ(Values.BusBytes, 3045);
+	CHECK_EQ(Values.BusErrors, 4);
+	CHECK_EQ(Values.LockContentions, 10);
+	CHECK_EQ(Values.LockWaitTime, 10000000);
+
+	//
+	// Only the gauges and locks the device has are summed.
+	//
+
+	Sample.GaugeCount = 1;
+	Sample.LockCount = 3;
+	AstonBatteryComputeCounterValues(&Sample, &Values);
+
+	CHECK_EQ(Values.BusTransfers, 1010);
+	CHECK_EQ(Values.BusBytes, 2030);
+	CHECK_EQ(Values.BusErrors, 3);
+	CHECK_EQ(Values.LockContentions, 6);
+	CHECK_EQ(Values.LockWaitTime, 7500000);
+}
+
+static
+VOID
+TestCacheWrap(
+	VOID
+)
+{
+	ASTON_BATTERY_COUNTER_SAMPLE Sample;
+	ASTON_BATTERY_COUNTER_VALUES Values;
+	ULONG Hits;
+	ULONG Lookups;
+
+	//
+	// The cache counters are 32 bits in the counter set, the deltas
+	// consumers take across the wrap stay right.
+	//
+
+	InitializeSample(&Sample);
+	Sample.CacheHits = 0xFFFFFFF0LL;
+	Sample.CacheMisses = 0x0000000CLL;
+	AstonBatteryComputeCounterValues(&Sample, &Values);
+
+	CHECK_EQ(Values.CacheHits, 0xFFFFFFF0);
+	CHECK_EQ(Values.CacheLookups, 0xFFFFFFFC);
+	Hits = Values.CacheHits;
+	Lookups = Values.CacheLookups;
+
+	Sample.CacheHits += 0x20;
+	Sample.CacheMisses += 0x10;
+	AstonBatteryComputeCounterValues(&Sample, &Values);
+
+	CHECK_EQ(Values.CacheHits, 0x00000010);
+	CHECK_EQ(Values.CacheLookups, 0x0000002C);
+	CHECK_EQ((ULONG)(Values.CacheHits - Hits), 0x20);
+	CHECK_EQ((ULONG)(Values.CacheLookups - Lookups), 0x30);
+}
+
+static
+VOID
+TestConversions(
+	VOID
+)
+{
+	ASTON_BATTERY_COUNTER_SAMPLE Sample;
+	ASTON_BATTERY_COUNTER_VALUES Values;
+
+	CHECK_EQ(AstonBatteryTicksToUnits(QPC_FREQUENCY * 3ULL + QPC_FREQUENCY / 2, QPC_FREQUENCY, 10000000), 35000000);
+	CHECK_EQ(AstonBatteryTicksToUnits(1, QPC_FREQUENCY, 10000000), 0);
+	CHECK_EQ(AstonBatteryTicksToUnits(2, QPC_FREQUENCY, 10000000), 1);
+	CHECK_EQ(AstonBatteryTicksToUnits(MAXLONGLONG, 10000000, 10000000), MAXLONGLONG);
+	CHECK_EQ(AstonBatteryTicksToUnits(MAXLONGLONG, QPC_FREQUENCY, 10000000), 4803839602528529066ULL);
+	CHECK_EQ(AstonBatteryTicksToUnits(100, 0, 10000000), 0);
+
+	//
+	// A lock wait far past the point where ticks * 10^7 overflows.
+	//
+
+	InitializeSample(&Sample);
+	Sample.LockCount = 2;
+	Sample.Locks[0].WaitTicks = MAXLONGLONG / 4;
+	Sample.Locks[1].WaitTicks = MAXLONGLONG / 4;
+	AstonBatteryComputeCounterValues(&Sample, &Values);
+
+	CHECK_EQ(Values.LockWaitTime, AstonBatteryTicksToUnits((MAXLONGLONG / 4) * 2, QPC_FREQUENCY, 10000000));
+	CHECK(Values.LockWaitTime > (ULONGLONG)MAXLONGLONG / 4);
+
+	//
+	// The snapshot age is only reported for a valid snapshot, and not for
+	// one stamped after the collection started.
+	//
+
+	InitializeSample(&Sample);
+	Sample.SnapshotTimestamp = 5LL * QPC_FREQUENCY;
+	Sample.Now = Sample.SnapshotTimestamp + QPC_FREQUENCY * 5LL / 2;
+	AstonBatteryComputeCounterValues(&Sample, &Values);
+	CHECK_EQ(Values.SnapshotAgeMs, 0);
+
+	Sample.SnapshotValid = TRUE;
+	AstonBatteryComputeCounterValues(&Sample, &Values);
+	CHECK_EQ(Values.SnapshotAgeMs, 2500);
+
+	Sample.Now = Sample.SnapshotTimestamp - 1;
+	AstonBatteryComputeCounterValues(&Sample, &Values);
+	CHECK_EQ(Values.SnapshotAgeMs, 0);
+}
+
+int
+main(
+	VOID
+)
+{
+	TestSums();
+	TestCacheWrap();
+	TestConversions();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,231 @@
+/*++
+
+Module Name:
+
+    EnergyIntegratorTest.c
+
+Abstract:
+
+    Feeds AstonBatteryIntegrateEnergy voltage and current traces whose
+    integral is known in closed form and checks the charged and discharged
+    energy, the mean discharge voltage and the remaining energy derived
+    from it, which the battery class is given as the capacity.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include <string.h>
+#include "GaugeSimulator.h"
+#include "Test.h"
+
+//-------------------------------------------------------------------- Functions
+
+static
+VOID
+Step(
+	PASTON_BATTERY_SNAPSHOT Snapshot,
+	LONG VoltageMv,
+	LONG CurrentMa,
+	ULONG RemainingMah,
+	ULONGLONG ElapsedUs
+)
+{
+	BQ28Z610_STANDARD_BLOCK Registers = { 0 };
+
+	Registers.Voltage = (UINT16)VoltageMv;
+	Registers.Current = (INT16)CurrentMa;
+	Registers.RemainingCapacity = (UINT16)RemainingMah;
+	Registers.FullChargeCapacity = 4000;
+
+	//
+	// The caller of the integrator stores the sample afterwards, as
+	// AstonBatteryRefreshSnapshot does.
+	//
+
+	AstonBatteryIntegrateEnergy(Snapshot, &Registers, ElapsedUs);
+	Snapshot->Registers = Registers;
+	Snapshot->Valid = TRUE;
+}
+
+static
+VOID
+TestFirstSample(
+	VOID
+)
+{
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+
+	memset(&Snapshot, 0, sizeof(Snapshot));
+
+	//
+	// Nothing is integrated from a single sample, the terminal voltage
+	// stands in for the mean: 2000 mAh at 3.9 V.
+	//
+
+	Step(&Snapshot, 3900, -1000, 2000, 0);
+
+	CHECK_EQ(Snapshot.Energy.DischargedUj, 0);
+	CHECK_EQ(Snapshot.Energy.ChargedUj, 0);
+	CHECK_EQ(Snapshot.Energy.IntervalUs, 0);
+	CHECK_EQ(Snapshot.Energy.MeanVoltage, 3900);
+	CHECK_EQ(Snapshot.Energy.RemainingEnergyMwh, 7800);
+	CHECK_EQ(AstonBatteryCapacityToEnergy(&Snapshot, 4000), 15600);
+}
+
+static
+VOID
+TestVoltageRamp(
+	VOID
+)
+{
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+	ULONG i;
+
+	memset(&Snapshot, 0, sizeof(Snapshot));
+
+	//
+	// 1.5 A for 10 s while the voltage falls linearly from 4.0 V to 3.8 V.
+	// V * I is linear, so the trapezoid rule is exact: 3.9 V * 1.5 A * 10 s
+	// is 58.5 J out of 15 C, a mean of 3.9 V.
+	//
+
+	for (i = 0; i <= 10; i++)
+	{
+		Step(&Snapshot, 4000 - 20 * (LONG)i, -1500, 2100 - i, i == 0 ? 0 : 1000000);
+	}
+
+	CHECK_EQ(Snapshot.Energy.DischargedUj, 58500000);
+	CHECK_EQ(Snapshot.Energy.DischargedUc, 15000000);
+	CHECK_EQ(Snapshot.Energy.ChargedUj, 0);
+	CHECK_EQ(Snapshot.Energy.IntervalUj, -5715000);
+	CHECK_EQ(Snapshot.Energy.IntervalUs, 1000000);
+	CHECK_EQ(Snapshot.Energy.MeanVoltage, 3900);
+
+	//
+	// The remaining energy follows the mean, not the last terminal voltage
+	// of 3.8 V: 2090 mAh at 3.9 V.
+	//
+
+	CHECK_EQ(Snapshot.Energy.RemainingEnergyMwh, 8151);
+	CHECK_EQ(AstonBatteryCapacityToEnergy(&Snapshot, 4000), 15600);
+}
+
+static
+VOID
+TestQuadraticPower(
+	VOID
+)
+{
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+	double Expected;
+	double Charge;
+	double T;
+	ULONG i;
+
+	memset(&Snapshot, 0, sizeof(Snapshot));
+
+	//
+	// V = 4100 - 20 t mV and I = -(500 + 100 t) mA over 20 s at 1 s steps.
+	// The power is quadratic in t, its integral is
+	//
+	//     a c T + (a d + b c) T^2 / 2 + b d T^3 / 3
+	//
+	// with a = 4100, b = -20, c = 500 and d = 100. mV * mA is uW, so with t
+	// in s the integral is in uJ.
+	//
+
+	for (i = 0; i <= 20; i++)
+	{
+		Step(&Snapshot, 4100 - 20 * (LONG)i, -(500 + 100 * (LONG)i), 3000, i == 0 ? 0 : 1000000);
+	}
+
+	T = 20.0;
+	Expected = 4100.0 * 500.0 * T +
+		(4100.0 * 100.0 - 20.0 * 500.0) * T * T / 2.0 -
+		20.0 * 100.0 * T * T * T / 3.0;
+
+	Charge = (500.0 * T + 100.0 * T * T / 2.0) * 1000.0;
+
+	//
+	// The trapezoid error is b d h^2 T / 6 for a step h of 1 s, a few parts
+	// in 10^5 here.
+	//
+
+	CHECK_NEAR(Snapshot.Energy.DischargedUj, Expected, Expected * 0.0001);
+	CHECK_NEAR(Snapshot.Energy.DischargedUc, Charge, 1);
+	CHECK_NEAR(Snapshot.Energy.MeanVoltage, Expected * 1000.0 / Charge, 1);
+	CHECK_NEAR(Snapshot.Energy.RemainingEnergyMwh, 3000.0 * Expected / Charge, 3);
+}
+
+static
+VOID
+TestChargeAndGaps(
+	VOID
+)
+{
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+	ULONGLONG Discharged;
+	ULONGLONG Charge;
+
+	memset(&Snapshot, 0, sizeof(Snapshot));
+
+	Step(&Snapshot, 3800, -2000, 1500, 0);
+	Step(&Snapshot, 3800, -2000, 1499, 2000000);
+
+	Discharged = Snapshot.Energy.DischargedUj;
+	Charge = Snapshot.Energy.DischargedUc;
+	CHECK_EQ(Discharged, 15200000);
+	CHECK_EQ(Charge, 4000000);
+
+	//
+	// 1 A into the pack at 4.1 V for 5 s: the interval averages the ends,
+	// (3.8 V * -2 A + 4.1 V * 1 A) / 2, and later ones are all charge.
+	//
+
+	Step(&Snapshot, 4100, 1000, 1500, 5000000);
+	CHECK_EQ(Snapshot.Energy.IntervalUj, -8750000);
+
+	Step(&Snapshot, 4100, 1000, 1501, 5000000);
+	CHECK_EQ(Snapshot.Energy.IntervalUj, 20500000);
+	CHECK_EQ(Snapshot.Energy.ChargedUj, 20500000);
+	CHECK_EQ(Snapshot.Energy.DischargedUj, Discharged + 8750000);
+	CHECK_EQ(Snapshot.Energy.DischargedUc, Charge + 2500000);
+
+	//
+	// An interval longer than ASTON_BATTERY_MAX_INTEGRATION_GAP_MS, a
+	// suspend say, is not integrated, and neither is one of zero length.
+	//
+
+	Discharged = Snapshot.Energy.DischargedUj;
+	Step(&Snapshot, 3700, -2000, 1400, (ULONGLONG)ASTON_BATTERY_MAX_INTEGRATION_GAP_MS * 1000 + 1);
+	CHECK_EQ(Snapshot.Energy.DischargedUj, Discharged);
+	CHECK_EQ(Snapshot.Energy.IntervalUj, 0);
+	CHECK_EQ(Snapshot.Energy.IntervalUs, 0);
+
+	Step(&Snapshot, 3700, -2000, 1400, 0);
+	CHECK_EQ(Snapshot.Energy.DischargedUj, Discharged);
+
+	//
+	// The mean stays that of the integrated discharge, not the 3.7 V the
+	// pack came back at.
+	//
+
+	CHECK_EQ(Snapshot.Energy.MeanVoltage, (Discharged * 1000) / Snapshot.Energy.DischargedUc);
+	CHECK_EQ(Snapshot.Energy.RemainingEnergyMwh, (1400 * Snapshot.Energy.MeanVoltage) / 1000);
+}
+
+int
+main(
+	VOID
+)
+{
+	TestFirstSample();
+	TestVoltageRamp();
+	TestQuadraticPower();
+	TestChargeAndGaps();
+
+	return TEST_RESULT();
+}
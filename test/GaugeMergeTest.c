@@ -0,0 +1,201 @@
+/*++
+
+Module Name:
+
+    GaugeMergeTest.c
+
+Abstract:
+
+    Checks AstonBatteryMergeGaugeRegisters and the capacity, rate and time
+    estimates of a battery made of two gauges wired in parallel.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "GaugeSimulator.h"
+#include "Test.h"
+
+//-------------------------------------------------------------------- Functions
+
+static
+VOID
+TestMergeSums(
+	VOID
+)
+{
+	BQ28Z610_STANDARD_BLOCK Gauges[2] = { 0 };
+	BQ28Z610_STANDARD_BLOCK Merged;
+
+	Gauges[0].Voltage = 3900;
+	Gauges[0].Current = -800;
+	Gauges[0].MaxLoadCurrent = -2000;
+	Gauges[0].RemainingCapacity = 2000;
+	Gauges[0].FullChargeCapacity = 4000;
+	Gauges[0].Temperature = 3000;
+	Gauges[0].BatteryStatus = 0x0040;
+
+	Gauges[1].Voltage = 3880;
+	Gauges[1].Current = -700;
+	Gauges[1].MaxLoadCurrent = -1800;
+	Gauges[1].RemainingCapacity = 1800;
+	Gauges[1].FullChargeCapacity = 3800;
+	Gauges[1].Temperature = 3050;
+	Gauges[1].BatteryStatus = 0x0840;
+
+	AstonBatteryMergeGaugeRegisters(Gauges, 2, &Merged);
+
+	CHECK_EQ(Merged.RemainingCapacity, 3800);
+	CHECK_EQ(Merged.FullChargeCapacity, 7800);
+	CHECK_EQ(Merged.Current, -1500);
+	CHECK_EQ(Merged.MaxLoadCurrent, -3800);
+	CHECK_EQ(Merged.Voltage, 3890);
+	CHECK_EQ(Merged.Temperature, 3050);
+	CHECK_EQ(Merged.BatteryStatus, 0x0840);
+
+	//
+	// 3800 mAh at 1500 mA is 152 minutes.
+	//
+
+	CHECK_EQ(Merged.AtRateTimeToEmpty, 152);
+}
+
+static
+VOID
+TestMergeSingleAndLimits(
+	VOID
+)
+{
+	BQ28Z610_STANDARD_BLOCK Gauges[2] = { 0 };
+	BQ28Z610_STANDARD_BLOCK Merged;
+
+	Gauges[0].Voltage = 4100;
+	Gauges[0].Current = 1200;
+	Gauges[0].RemainingCapacity = 3000;
+	Gauges[0].FullChargeCapacity = 4000;
+	Gauges[0].AtRateTimeToEmpty = 0xFFFF;
+
+	//
+	// A single gauge is passed through untouched.
+	//
+
+	AstonBatteryMergeGaugeRegisters(Gauges, 1, &Merged);
+	CHECK(memcmp(&Merged, &Gauges[0], sizeof(Merged)) == 0);
+
+	//
+	// Charging packs have no time to empty, sums saturate instead of
+	// wrapping.
+	//
+
+	Gauges[1] = Gauges[0];
+	AstonBatteryMergeGaugeRegisters(Gauges, 2, &Merged);
+	CHECK_EQ(Merged.Current, 2400);
+	CHECK_EQ(Merged.AtRateTimeToEmpty, 0xFFFF);
+
+	Gauges[0].Current = -30000;
+	Gauges[1].Current = -30000;
+	Gauges[0].RemainingCapacity = 40000;
+	Gauges[1].RemainingCapacity = 40000;
+	Gauges[0].FullChargeCapacity = 40000;
+	Gauges[1].FullChargeCapacity = 40000;
+	AstonBatteryMergeGaugeRegisters(Gauges, 2, &Merged);
+	CHECK_EQ(Merged.Current, MINSHORT);
+	CHECK_EQ(Merged.RemainingCapacity, MAXUSHORT);
+	CHECK_EQ(Merged.FullChargeCapacity, MAXUSHORT);
+	CHECK_EQ(Merged.AtRateTimeToEmpty, 80);
+}
+
+static
+VOID
+TestAggregatedDischarge(
+	VOID
+)
+
+/*++
+
+Routine Description:
+
+	Discharges two unequal packs for 20 minutes at the default sample
+	interval and checks that the battery reported to the class driver is
+	their sum: capacity, rate and the time to empty at both the filtered
+	current and an explicit power.
+
+--*/
+
+{
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+	SIM_GAUGE Gauges[2];
+	double Capacity;
+	double Current;
+	double Power;
+	ULONG Estimate;
+	ULONG i;
+
+	RtlZeroMemory(&Snapshot, sizeof(Snapshot));
+	SimInitializeGauge(&Gauges[0], 2700, 0.6, 90);
+	SimInitializeGauge(&Gauges[1], 2500, 0.6, 110);
+	Gauges[0].CurrentMa = -900;
+	Gauges[1].CurrentMa = -650;
+
+	for (i = 0; i <= 240; i++)
+	{
+		if (i != 0)
+		{
+			SimAdvanceGauge(&Gauges[0], 5000000);
+			SimAdvanceGauge(&Gauges[1], 5000000);
+		}
+
+		SimSample(&Snapshot, Gauges, 2, i == 0 ? 0 : 5000000);
+	}
+
+	Capacity = Gauges[0].RemainingMah + Gauges[1].RemainingMah;
+	Current = Gauges[0].CurrentMa + Gauges[1].CurrentMa;
+	Power = (SimOpenCircuitVoltage(&Gauges[0]) + Gauges[0].CurrentMa * 0.09) * Gauges[0].CurrentMa / 1000 +
+		(SimOpenCircuitVoltage(&Gauges[1]) + Gauges[1].CurrentMa * 0.11) * Gauges[1].CurrentMa / 1000;
+
+	CHECK_NEAR(Snapshot.Registers.RemainingCapacity, Capacity, 2);
+	CHECK_EQ(Snapshot.Registers.FullChargeCapacity, 5200);
+	CHECK_EQ(Snapshot.Registers.Current, -1550);
+	CHECK_NEAR(AstonBatteryFilterValue(Snapshot.RateFilter.CurrentLong), Current, 2);
+
+	//
+	// The rate is taken from the mean voltage of the packs, so it is within
+	// a percent of the sum of their powers.
+	//
+
+	CHECK_NEAR(AstonBatteryFilterValue(Snapshot.RateFilter.PowerShort), Power, fabs(Power) * 0.01);
+
+	//
+	// Time to empty at the filtered current, in seconds.
+	//
+
+	Estimate = AstonBatteryEstimateTime(&Snapshot, 0);
+	CHECK_NEAR(Estimate, Snapshot.Registers.RemainingCapacity * 3600.0 / -Current, 10);
+
+	//
+	// At the current power the load model has to land on the same current,
+	// and a heavier load must run out sooner than in proportion.
+	//
+
+	Estimate = AstonBatteryEstimateTime(&Snapshot, (LONG)Power);
+	CHECK_NEAR(Estimate, Snapshot.Registers.RemainingCapacity * 3600.0 / -Current,
+		Snapshot.Registers.RemainingCapacity * 3600.0 / -Current * 0.03);
+
+	CHECK(AstonBatteryEstimateTime(&Snapshot, (LONG)Power * 2) < Estimate / 2);
+	CHECK_EQ(Snapshot.GaugeCount, 2);
+	CHECK(Snapshot.Energy.DischargedUj > 0);
+}
+
+int
+main(
+	VOID
+)
+{
+	TestMergeSums();
+	TestMergeSingleAndLimits();
+	TestAggregatedDischarge();
+
+	return TEST_RESULT();
+}
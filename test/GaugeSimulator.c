@@ -0,0 +1,309 @@
+/*++
+
+Module Name:
+
+    GaugeSimulator.c
+
+Abstract:
+
+    Simulated BQ28Z610 gauges for the host tests, see GaugeSimulator.h.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include <math.h>
+#include "GaugeSimulator.h"
+
+//-------------------------------------------------------------------- Functions
+
+VOID
+SimInitializeGauge(
+	PSIM_GAUGE Gauge,
+	double FullChargeMah,
+	double StateOfCharge,
+	double ResistanceMohm
+)
+{
+	RtlZeroMemory(Gauge, sizeof(*Gauge));
+	Gauge->FullChargeMah = FullChargeMah;
+	Gauge->RemainingMah = FullChargeMah * StateOfCharge;
+	Gauge->ResistanceMohm = ResistanceMohm;
+	Gauge->TemperatureDk = 2981.5;
+}
+
+double
+SimOpenCircuitVoltage(
+	const SIM_GAUGE* Gauge
+)
+
+/*++
+
+Routine Description:
+
+	Open circuit voltage of a Li-ion cell in mV: a plateau rising by 700 mV
+	across the usable range, with a knee below 10 % state of charge.
+
+--*/
+
+{
+	double Soc;
+
+	Soc = Gauge->RemainingMah / Gauge->FullChargeMah;
+	Soc = fmin(fmax(Soc, 0.0), 1.0);
+
+	return 3500.0 + 700.0 * Soc - 250.0 * exp(-Soc / 0.03);
+}
+
+VOID
+SimAdvanceGauge(
+	PSIM_GAUGE Gauge,
+	ULONGLONG ElapsedUs
+)
+{
+	Gauge->RemainingMah += Gauge->CurrentMa * (double)ElapsedUs / 3600000000.0;
+	Gauge->RemainingMah = fmin(fmax(Gauge->RemainingMah, 0.0), Gauge->FullChargeMah);
+}
+
+VOID
+SimReadRegisters(
+	const SIM_GAUGE* Gauge,
+	PBQ28Z610_STANDARD_BLOCK Registers
+)
+{
+	double Voltage;
+
+	Voltage = SimOpenCircuitVoltage(Gauge) + Gauge->CurrentMa * Gauge->ResistanceMohm / 1000.0;
+
+	RtlZeroMemory(Registers, sizeof(*Registers));
+	Registers->Voltage = (UINT16)lround(Voltage);
+	Registers->Current = (INT16)lround(Gauge->CurrentMa);
+	Registers->MaxLoadCurrent = -3000;
+	Registers->RemainingCapacity = (UINT16)floor(Gauge->RemainingMah);
+	Registers->FullChargeCapacity = (UINT16)lround(Gauge->FullChargeMah);
+	Registers->Temperature = (UINT16)lround(Gauge->TemperatureDk);
+	Registers->BatteryStatus = Gauge->BatteryStatus;
+
+	if (Gauge->CurrentMa < 0)
+	{
+		Registers->BatteryStatus |= 1 << 6;
+		Registers->AtRateTimeToEmpty =
+			(UINT16)fmin(Gauge->RemainingMah * 60.0 / -Gauge->CurrentMa, 0xFFFE);
+	}
+	else
+	{
+		Registers->AtRateTimeToEmpty = 0xFFFF;
+	}
+}
+
+static
+ULONG
+SimRandom(
+	PULONG State
+)
+{
+	*State = *State * 1664525 + 1013904223;
+	return *State >> 8;
+}
+
+VOID
+SimGenerateLoad(
+	PLONG LoadMa,
+	ULONG Seconds,
+	ULONG Seed
+)
+
+/*++
+
+Routine Description:
+
+	Fills a per second load in mA: 600 mA with +-150 mA of noise, and on
+	average every 40 s a burst of 1500 to 2500 mA lasting 2 to 20 s.
+
+--*/
+
+{
+	ULONG State;
+	ULONG Burst;
+	LONG BurstMa;
+	ULONG i;
+
+	State = Seed;
+	Burst = 0;
+	BurstMa = 0;
+
+	for (i = 0; i < Seconds; i++)
+	{
+		if (Burst == 0 && SimRandom(&State) % 40 == 0)
+		{
+			Burst = 2 + SimRandom(&State) % 19;
+			BurstMa = 1500 + (LONG)(SimRandom(&State) % 1001);
+		}
+
+		LoadMa[i] = 450 + (LONG)(SimRandom(&State) % 301);
+		if (Burst != 0)
+		{
+			LoadMa[i] += BurstMa;
+			Burst -= 1;
+		}
+	}
+}
+
+VOID
+SimSample(
+	PASTON_BATTERY_SNAPSHOT Snapshot,
+	const SIM_GAUGE* Gauges,
+	ULONG GaugeCount,
+	ULONGLONG ElapsedUs
+)
+{
+	BQ28Z610_STANDARD_BLOCK GaugeRegisters[ASTON_BATTERY_MAX_GAUGES];
+	BQ28Z610_STANDARD_BLOCK Registers;
+	ULONG i;
+
+	for (i = 0; i < GaugeCount; i++)
+	{
+		SimReadRegisters(&Gauges[i], &GaugeRegisters[i]);
+	}
+
+	AstonBatteryMergeGaugeRegisters(GaugeRegisters, GaugeCount, &Registers);
+	AstonBatteryAdvanceSnapshot(Snapshot, &Registers, ElapsedUs);
+
+	Snapshot->Registers = Registers;
+	Snapshot->GaugeCount = GaugeCount;
+	RtlCopyMemory(Snapshot->GaugeRegisters, GaugeRegisters, GaugeCount * sizeof(GaugeRegisters[0]));
+	Snapshot->Timestamp.QuadPart += (LONGLONG)ElapsedUs;
+	Snapshot->Valid = TRUE;
+	Snapshot->Generation += 1;
+}
+
+VOID
+SimInitializeCycle(
+	PSIM_CYCLE Cycle,
+	ULONG Seed
+)
+{
+	RtlZeroMemory(Cycle, sizeof(*Cycle));
+	Cycle->State = SimCycleDischarging;
+	Cycle->Second = 8 * 3600;
+	Cycle->Random = Seed;
+}
+
+VOID
+SimAdvanceCycle(
+	PSIM_CYCLE Cycle,
+	PSIM_GAUGE Gauges,
+	ULONG GaugeCount
+)
+
+/*++
+
+Routine Description:
+
+	Advances the packs by one second of a day of use, starting at 8:00.
+	Between 7:00 and 23:00 they carry the load of SimGenerateLoad, at
+	night a standby draw of 15 to 25 mA. They go on the charger below
+	15 % state of charge and at 23:00 below 60 %, charge at 1500 mA per
+	pack up to 80 % and then taper down to 75 mA, and stay full on the
+	charger until 7:00. The temperature follows the current with a time
+	constant of ten minutes.
+
+--*/
+
+{
+	ULONG Hour;
+	double Soc;
+	double TotalMa;
+	double RiseDk;
+	ULONG i;
+
+	Hour = (Cycle->Second / 3600) % 24;
+	Soc = 0;
+	for (i = 0; i < GaugeCount; i++)
+	{
+		Soc += Gauges[i].RemainingMah / Gauges[i].FullChargeMah / GaugeCount;
+	}
+
+	switch (Cycle->State)
+	{
+	case SimCycleDischarging:
+		if (Soc < 0.15 || (Hour == 23 && Soc < 0.6))
+		{
+			Cycle->State = SimCycleCharging;
+		}
+
+		break;
+
+	case SimCycleCharging:
+		if (Soc >= 0.995)
+		{
+			Cycle->State = SimCycleFull;
+		}
+
+		break;
+
+	default:
+		if (Hour >= 7 && Hour < 23)
+		{
+			Cycle->State = SimCycleDischarging;
+		}
+
+		break;
+	}
+
+	if (Cycle->Burst == 0 && SimRandom(&Cycle->Random) % 40 == 0)
+	{
+		Cycle->Burst = 2 + SimRandom(&Cycle->Random) % 19;
+		Cycle->BurstMa = 1500 + (LONG)(SimRandom(&Cycle->Random) % 1001);
+	}
+
+	switch (Cycle->State)
+	{
+	case SimCycleDischarging:
+		if (Hour >= 7 && Hour < 23)
+		{
+			TotalMa = -(450.0 + SimRandom(&Cycle->Random) % 301);
+			if (Cycle->Burst != 0)
+			{
+				TotalMa -= Cycle->BurstMa;
+			}
+		}
+		else
+		{
+			TotalMa = -(15.0 + SimRandom(&Cycle->Random) % 11);
+		}
+
+		break;
+
+	case SimCycleCharging:
+		TotalMa = 1500.0 * GaugeCount;
+		if (Soc > 0.8)
+		{
+			TotalMa = fmax(TotalMa * (1.0 - Soc) / 0.2, 75.0 * GaugeCount);
+		}
+
+		break;
+
+	default:
+		TotalMa = 0;
+		break;
+	}
+
+	if (Cycle->Burst != 0)
+	{
+		Cycle->Burst -= 1;
+	}
+
+	for (i = 0; i < GaugeCount; i++)
+	{
+		Gauges[i].CurrentMa = TotalMa / GaugeCount;
+		Gauges[i].BatteryStatus = (Cycle->State == SimCycleFull) ? 0x0020 : 0;
+		RiseDk = fabs(Gauges[i].CurrentMa) / 50.0;
+		Gauges[i].TemperatureDk += (2981.5 + RiseDk - Gauges[i].TemperatureDk) / 600.0;
+		SimAdvanceGauge(&Gauges[i], 1000000);
+	}
+
+	Cycle->Second += 1;
+}
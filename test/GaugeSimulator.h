@@ -0,0 +1,115 @@
+/*++
+
+Module Name:
+
+    GaugeSimulator.h
+
+Abstract:
+
+    Simulated BQ28Z610 gauges for the host tests. A pack is an open circuit
+    voltage that follows its state of charge behind a series resistance,
+    and its charge is counted from the current. The registers are rounded
+    the way the gauge reports them.
+
+    SimGenerateLoad produces a reproducible per second load: a steady draw
+    with noise and bursts of heavy use, as a phone shows while in use.
+
+    SimAdvanceCycle drives a pack through days of use instead: the same
+    load during the day, a light standby draw at night, and a constant
+    current then tapering charge whenever the pack runs low or is put on
+    the charger in the evening.
+
+    SimSample plays the part of AstonBatteryRefreshSnapshot: it reads the
+    registers of every gauge, merges them and runs the models of model.c
+    over the result, in the same order as the driver.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+#pragma once
+
+#include "model.h"
+
+//------------------------------------------------------------------ Definitions
+
+typedef struct _SIM_GAUGE
+{
+    double RemainingMah;
+    double FullChargeMah;
+    double ResistanceMohm;
+    double CurrentMa;
+    double TemperatureDk;
+    USHORT BatteryStatus;
+} SIM_GAUGE, *PSIM_GAUGE;
+
+typedef enum _SIM_CYCLE_STATE
+{
+    SimCycleDischarging,
+    SimCycleCharging,
+    SimCycleFull
+} SIM_CYCLE_STATE;
+
+typedef struct _SIM_CYCLE
+{
+    SIM_CYCLE_STATE State;
+    ULONG Second;
+    ULONG Random;
+    ULONG Burst;
+    LONG BurstMa;
+} SIM_CYCLE, *PSIM_CYCLE;
+
+//------------------------------------------------------------------- Prototypes
+
+VOID
+SimInitializeGauge(
+    _Out_ PSIM_GAUGE Gauge,
+    _In_ double FullChargeMah,
+    _In_ double StateOfCharge,
+    _In_ double ResistanceMohm
+);
+
+double
+SimOpenCircuitVoltage(
+    _In_ const SIM_GAUGE* Gauge
+);
+
+VOID
+SimAdvanceGauge(
+    _Inout_ PSIM_GAUGE Gauge,
+    _In_ ULONGLONG ElapsedUs
+);
+
+VOID
+SimReadRegisters(
+    _In_ const SIM_GAUGE* Gauge,
+    _Out_ PBQ28Z610_STANDARD_BLOCK Registers
+);
+
+VOID
+SimGenerateLoad(
+    _Out_writes_(Seconds) PLONG LoadMa,
+    _In_ ULONG Seconds,
+    _In_ ULONG Seed
+);
+
+VOID
+SimSample(
+    _Inout_ PASTON_BATTERY_SNAPSHOT Snapshot,
+    _In_reads_(GaugeCount) const SIM_GAUGE* Gauges,
+    _In_ ULONG GaugeCount,
+    _In_ ULONGLONG ElapsedUs
+);
+
+VOID
+SimInitializeCycle(
+    _Out_ PSIM_CYCLE Cycle,
+    _In_ ULONG Seed
+);
+
+VOID
+SimAdvanceCycle(
+    _Inout_ PSIM_CYCLE Cycle,
+    _Inout_updates_(GaugeCount) PSIM_GAUGE Gauges,
+    _In_ ULONG GaugeCount
+);
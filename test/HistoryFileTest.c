@@ -0,0 +1,781 @@
+/*++
+
+Module Name:
+
+    HistoryFileTest.c
+
+Abstract:
+
+    Checkpoints the history ring and the archive of three days of simulated
+    use at a 5 s sampling interval to an in memory history file, at the
+    driver's checkpoint interval, and reports the bytes and the 4 KB pages
+    written per checkpoint and per day.
+
+    The file is then restored on a later boot and compared with what was
+    checkpointed, after checkpoints cut short after every possible number
+    of writes, with a corrupted block, a truncated file and an archive head
+    block that holds more bytes than the index says. Archive blocks are
+    decoded within their used bytes only.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include <stdlib.h>
+#include <string.h>
+#include "GaugeSimulator.h"
+#include "archive.h"
+#include "Test.h"
+
+//------------------------------------------------------------------ Definitions
+
+#define QPC_FREQUENCY       1000000
+#define SAMPLE_INTERVAL_S   5
+#define CHECKPOINT_S        (ASTON_BATTERY_HISTORY_CHECKPOINT_INTERVAL_MS / 1000)
+#define TRACE_DAYS          3
+#define SYSTEM_TIME_MS      13370000000000LL
+#define FILE_PAGES          ((ASTON_BATTERY_HISTORY_FILE_SIZE + 4095) / 4096)
+
+typedef struct _MEMORY_FILE
+{
+    UCHAR Data[ASTON_BATTERY_HISTORY_FILE_SIZE];
+    ULONG Size;
+    ULONG WritesLeft;
+    BOOLEAN FailHeader;
+    ULONG Writes;
+    ULONGLONG Bytes;
+    BOOLEAN Touched[FILE_PAGES];
+} MEMORY_FILE;
+
+typedef struct _SIM_DEVICE
+{
+    ASTON_BATTERY_HISTORY History;
+    ASTON_BATTERY_ARCHIVE Archive;
+    PUCHAR HistoryBuffer;
+    ASTON_BATTERY_SNAPSHOT Snapshot;
+    SIM_GAUGE Gauges[2];
+    SIM_CYCLE Cycle;
+    ULONG Seconds;
+} SIM_DEVICE;
+
+static UCHAR Buffer[ASTON_BATTERY_HISTORY_FILE_BUFFER_SIZE];
+
+//-------------------------------------------------------------------- Functions
+
+static
+NTSTATUS
+ReadMemoryFile(
+	PVOID Context,
+	ULONG Offset,
+	PVOID Data,
+	ULONG Length
+)
+{
+	MEMORY_FILE* File;
+
+	File = Context;
+	if ((ULONGLONG)Offset + Length > File->Size)
+	{
+		return STATUS_END_OF_FILE;
+	}
+
+	memcpy(Data, File->Data + Offset, Length);
+	return STATUS_SUCCESS;
+}
+
+static
+NTSTATUS
+WriteMemoryFile(
+	PVOID Context,
+	ULONG Offset,
+	PVOID Data,
+	ULONG Length
+)
+{
+	MEMORY_FILE* File;
+	ULONG Page;
+
+	File = Context;
+	CHECK((ULONGLONG)Offset + Length <= ASTON_BATTERY_HISTORY_FILE_SIZE);
+	if (File->WritesLeft == 0 ||
+		(File->FailHeader && Offset < ASTON_BATTERY_HISTORY_FILE_RECORDS_OFFSET))
+	{
+		return STATUS_DISK_FULL;
+	}
+
+	File->WritesLeft -= 1;
+	File->Writes += 1;
+	File->Bytes += Length;
+	for (Page = Offset / 4096; Page <= (Offset + Length - 1) / 4096; Page++)
+	{
+		File->Touched[Page] = TRUE;
+	}
+
+	memcpy(File->Data + Offset, Data, Length);
+	File->Size = max(File->Size, Offset + Length);
+	return STATUS_SUCCESS;
+}
+
+static
+VOID
+InitializeDevice(
+	SIM_DEVICE* Device
+)
+{
+	ASTON_BATTERY_HISTORY_HEADER Layout;
+
+	memset(Device, 0, sizeof(*Device));
+	AstonBatteryLayoutHistory(ASTON_BATTERY_HISTORY_CAPACITY, &Layout);
+	Device->HistoryBuffer = malloc(Layout.Size);
+	Device->Archive.Blocks = calloc(ASTON_BATTERY_ARCHIVE_BLOCKS, ASTON_BATTERY_ARCHIVE_BLOCK_SIZE);
+	AstonBatteryInitializeHistory(&Device->History, Device->HistoryBuffer);
+	SimInitializeGauge(&Device->Gauges[0], 4000, 0.9, 110);
+	SimInitializeGauge(&Device->Gauges[1], 4000, 0.9, 120);
+	SimInitializeCycle(&Device->Cycle, 42);
+}
+
+static
+VOID
+FreeDevice(
+	SIM_DEVICE* Device
+)
+{
+	free(Device->HistoryBuffer);
+	free(Device->Archive.Blocks);
+}
+
+static
+VOID
+RunDevice(
+	SIM_DEVICE* Device,
+	ULONG Seconds
+)
+
+/*++
+
+Routine Description:
+
+	Runs the day cycle and records a sample every SAMPLE_INTERVAL_S, the way
+	AstonBatteryAppendHistory takes it from the snapshot.
+
+--*/
+
+{
+	ASTON_BATTERY_HISTORY_RECORD Record;
+	ULONG t;
+
+	for (t = 0; t < Seconds; t++, Device->Seconds++)
+	{
+		SimAdvanceCycle(&Device->Cycle, Device->Gauges, 2);
+		if (Device->Seconds % SAMPLE_INTERVAL_S != 0)
+		{
+			continue;
+		}
+
+		SimSample(&Device->Snapshot,
+			Device->Gauges,
+			2,
+			Device->Seconds == 0 ? 0 : (ULONGLONG)SAMPLE_INTERVAL_S * 1000000);
+
+		Record.Timestamp = (LONGLONG)Device->Seconds * QPC_FREQUENCY;
+		Record.Rate = AstonBatteryFilterValue(Device->Snapshot.RateFilter.PowerShort);
+		Record.SafetyStatus = Device->Snapshot.Safety.SafetyStatus;
+		Record.Voltage = Device->Snapshot.Registers.Voltage;
+		Record.Current = Device->Snapshot.Registers.Current;
+		Record.Temperature = Device->Snapshot.Registers.Temperature;
+		Record.RemainingCapacity = Device->Snapshot.Registers.RemainingCapacity;
+		Record.FullChargeCapacity = Device->Snapshot.Registers.FullChargeCapacity;
+		Record.BatteryStatus = Device->Snapshot.Registers.BatteryStatus;
+		Record.Reserved = 0;
+		AstonBatteryRecordHistory(&Device->History, &Device->Archive, &Record, QPC_FREQUENCY);
+	}
+}
+
+static
+VOID
+OpenFile(
+	MEMORY_FILE* Memory,
+	LONGLONG SystemTimeMs,
+	LONGLONG TimestampMs,
+	ASTON_BATTERY_HISTORY_FILE* File
+)
+{
+	memset(File, 0, sizeof(*File));
+	memset(Memory->Touched, 0, sizeof(Memory->Touched));
+	Memory->WritesLeft = MAXULONG;
+	Memory->FailHeader = FALSE;
+	Memory->Writes = 0;
+	Memory->Bytes = 0;
+
+	File->Context = Memory;
+	File->Read = ReadMemoryFile;
+	File->Write = WriteMemoryFile;
+	File->Buffer = Buffer;
+	File->SystemTimeMs = SystemTimeMs;
+	File->TimestampMs = TimestampMs;
+	File->QpcFrequency = QPC_FREQUENCY;
+}
+
+static
+NTSTATUS
+Checkpoint(
+	SIM_DEVICE* Device,
+	MEMORY_FILE* Memory,
+	ULONG WritesLeft,
+	BOOLEAN FailHeader
+)
+
+/*++
+
+Routine Description:
+
+	Checkpoints with the clocks of the device, failing every write after
+	WritesLeft of them, or every write of the header if FailHeader is set.
+
+--*/
+
+{
+	ASTON_BATTERY_HISTORY_FILE File;
+
+	OpenFile(Memory, SYSTEM_TIME_MS + Device->Seconds * 1000LL, Device->Seconds * 1000LL, &File);
+	Memory->WritesLeft = WritesLeft;
+	Memory->FailHeader = FailHeader;
+
+	return AstonBatteryCheckpointHistoryFile(&Device->History, &Device->Archive, &File);
+}
+
+static
+NTSTATUS
+Restore(
+	SIM_DEVICE* Device,
+	MEMORY_FILE* Memory,
+	LONGLONG SystemTimeMs,
+	PULONG Dropped
+)
+
+/*++
+
+Routine Description:
+
+	Restores into a fresh device on a boot whose performance counter read
+	zero at SystemTimeMs.
+
+--*/
+
+{
+	ASTON_BATTERY_HISTORY_FILE File;
+
+	InitializeDevice(Device);
+	OpenFile(Memory, SystemTimeMs, 0, &File);
+	return AstonBatteryRestoreHistoryFile(&Device->History, &Device->Archive, &File, Dropped);
+}
+
+static
+ULONG
+CountTouched(
+	const MEMORY_FILE* Memory
+)
+{
+	ULONG Pages;
+	ULONG Page;
+
+	Pages = 0;
+	for (Page = 0; Page < FILE_PAGES; Page++)
+	{
+		Pages += Memory->Touched[Page];
+	}
+
+	return Pages;
+}
+
+static
+VOID
+CheckArchive(
+	const ASTON_BATTERY_ARCHIVE* Archive
+)
+
+/*++
+
+Routine Description:
+
+	Every held block has to match its index entry.
+
+--*/
+
+{
+	const ASTON_BATTERY_ARCHIVE_BLOCK* Entry;
+	LONGLONG Values[ASTON_BATTERY_HISTORY_FIELDS];
+	LONGLONG Interval;
+	ULONG Oldest;
+	ULONG Block;
+	ULONG i;
+
+	Oldest = (Archive->Head + ASTON_BATTERY_ARCHIVE_BLOCKS + 1 - Archive->BlockCount) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+	for (i = 0; i < Archive->BlockCount; i++)
+	{
+		Block = (Oldest + i) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+		Entry = &Archive->Index[Block];
+		CHECK(AstonBatteryReplayArchiveBlock(Archive->Blocks + (SIZE_T)Block * ASTON_BATTERY_ARCHIVE_BLOCK_SIZE,
+			Entry,
+			Values,
+			&Interval));
+	}
+}
+
+static
+VOID
+CheckRing(
+	const ASTON_BATTERY_HISTORY* History
+)
+
+/*++
+
+Routine Description:
+
+	The samples of the ring have to be in time order, one interval apart.
+
+--*/
+
+{
+	ULONG Slot;
+	ULONG Next;
+	ULONG i;
+
+	for (i = 1; i < History->Count; i++)
+	{
+		Slot = (History->Head + ASTON_BATTERY_HISTORY_CAPACITY - History->Count + i - 1) % ASTON_BATTERY_HISTORY_CAPACITY;
+		Next = (Slot + 1) % ASTON_BATTERY_HISTORY_CAPACITY;
+		CHECK_EQ(History->Timestamp[Next] - History->Timestamp[Slot], SAMPLE_INTERVAL_S * QPC_FREQUENCY);
+	}
+}
+
+static
+VOID
+TestBoundedDecode(
+	VOID
+)
+{
+	ASTON_BATTERY_ARCHIVE_BLOCK Entry;
+	LONGLONG Values[ASTON_BATTERY_HISTORY_FIELDS];
+	LONGLONG Interval;
+	SIM_DEVICE Device;
+	PUCHAR Block;
+	ULONG Offset;
+	ULONG Sample;
+
+	InitializeDevice(&Device);
+	RunDevice(&Device, 3600);
+	Entry = Device.Archive.Index[Device.Archive.Head];
+	Block = Device.Archive.Blocks + (SIZE_T)Device.Archive.Head * ASTON_BATTERY_ARCHIVE_BLOCK_SIZE;
+	CHECK(Entry.Count > 10);
+	CHECK(AstonBatteryReplayArchiveBlock(Block, &Entry, Values, &Interval));
+	CHECK_EQ(Values[0] + Entry.Bias, Entry.LastTimestamp);
+
+	//
+	// A count that does not fill the used bytes, or needs more of them, and
+	// a used length that cuts the last sample short.
+	//
+
+	Entry.Count -= 1;
+	CHECK(!AstonBatteryReplayArchiveBlock(Block, &Entry, Values, &Interval));
+	Entry.Count += 2;
+	CHECK(!AstonBatteryReplayArchiveBlock(Block, &Entry, Values, &Interval));
+	Entry.Count -= 1;
+	Entry.Used -= 1;
+	CHECK(!AstonBatteryReplayArchiveBlock(Block, &Entry, Values, &Interval));
+	Entry.Used = ASTON_BATTERY_ARCHIVE_BLOCK_SIZE + 1;
+	CHECK(!AstonBatteryReplayArchiveBlock(Block, &Entry, Values, &Interval));
+
+	//
+	// A varint that never ends stops at the used bytes.
+	//
+
+	memset(Block, 0xFF, ASTON_BATTERY_ARCHIVE_BLOCK_SIZE);
+	RtlZeroMemory(Values, sizeof(Values));
+	Interval = 0;
+	Offset = 0;
+	CHECK(!AstonBatteryDecodeSample(Block, 100, &Offset, Values, &Interval));
+	CHECK(Offset <= 100);
+
+	Offset = 0;
+	for (Sample = 0; Sample < 1000; Sample++)
+	{
+		if (!AstonBatteryDecodeSample(Block, ASTON_BATTERY_ARCHIVE_BLOCK_SIZE, &Offset, Values, &Interval))
+		{
+			break;
+		}
+	}
+
+	CHECK(Sample < 1000);
+	CHECK(Offset <= ASTON_BATTERY_ARCHIVE_BLOCK_SIZE);
+	FreeDevice(&Device);
+}
+
+static
+VOID
+TestWriteVolume(
+	MEMORY_FILE* Memory
+)
+{
+	SIM_DEVICE Device;
+	SIM_DEVICE Restored;
+	ULONGLONG Bytes;
+	ULONGLONG MaxBytes;
+	ULONG Checkpoints;
+	ULONG Pages;
+	ULONG MaxPages;
+	ULONG Dropped;
+	ULONG Slot;
+	ULONG Day;
+	ULONG i;
+	LONGLONG BootMs;
+	LONGLONG Offset;
+
+	InitializeDevice(&Device);
+	memset(Memory, 0, sizeof(*Memory));
+
+	//
+	// The first day fills the ring and is left out of the figures.
+	//
+
+	printf("Day  Checkpoints  KB written  Pages written  Max KB  Max pages\n");
+
+	for (Day = 0; Day < TRACE_DAYS; Day++)
+	{
+		Bytes = 0;
+		MaxBytes = 0;
+		Pages = 0;
+		MaxPages = 0;
+		Checkpoints = 0;
+
+		for (i = 0; i < 86400 / CHECKPOINT_S; i++)
+		{
+			RunDevice(&Device, CHECKPOINT_S);
+			CHECK(NT_SUCCESS(Checkpoint(&Device, Memory, MAXULONG, FALSE)));
+
+			Checkpoints += 1;
+			Bytes += Memory->Bytes;
+			Pages += CountTouched(Memory);
+			MaxBytes = max(MaxBytes, Memory->Bytes);
+			MaxPages = max(MaxPages, CountTouched(Memory));
+		}
+
+		printf("%3lu  %11lu  %10.1f  %13lu  %6.1f  %9lu\n",
+			(unsigned long)Day + 1,
+			(unsigned long)Checkpoints,
+			Bytes / 1024.0,
+			(unsigned long)Pages,
+			MaxBytes / 1024.0,
+			(unsigned long)MaxPages);
+
+		if (Day != 0)
+		{
+			CHECK(Bytes < 1024 * 1024);
+			CHECK(MaxBytes < 16 * 1024);
+			CHECK(MaxPages <= 6);
+		}
+	}
+
+	//
+	// Nothing new, nothing written.
+	//
+
+	CHECK(NT_SUCCESS(Checkpoint(&Device, Memory, MAXULONG, FALSE)));
+	CHECK_EQ(Memory->Bytes, 0);
+
+	//
+	// A later boot, an hour after the last checkpoint.
+	//
+
+	BootMs = SYSTEM_TIME_MS + Device.Seconds * 1000LL + 3600000;
+	CHECK(NT_SUCCESS(Restore(&Restored, Memory, BootMs, &Dropped)));
+	CHECK_EQ(Dropped, 0);
+	CHECK_EQ(Restored.History.Head, Device.History.Head);
+	CHECK_EQ(Restored.History.Count, ASTON_BATTERY_HISTORY_CAPACITY);
+	CHECK_EQ(Restored.History.TotalSamples, Device.History.TotalSamples);
+	CHECK_EQ(Restored.Archive.BlockCount, Device.Archive.BlockCount);
+	CHECK_EQ(Restored.Archive.TotalSamples, Device.Archive.TotalSamples);
+	CHECK_EQ(Restored.Archive.NextSequence, Device.Archive.NextSequence);
+
+	Offset = SYSTEM_TIME_MS - BootMs;
+	for (Slot = 0; Slot < ASTON_BATTERY_HISTORY_CAPACITY; Slot++)
+	{
+		CHECK_EQ(Restored.History.Timestamp[Slot], Device.History.Timestamp[Slot] + Offset * 1000);
+		CHECK_EQ(Restored.History.Voltage[Slot], Device.History.Voltage[Slot]);
+		CHECK_EQ(Restored.History.Rate[Slot], Device.History.Rate[Slot]);
+		CHECK_EQ(Restored.History.BatteryStatus[Slot], Device.History.BatteryStatus[Slot]);
+	}
+
+	for (i = 0; i < ASTON_BATTERY_ARCHIVE_BLOCKS; i++)
+	{
+		CHECK_EQ(Restored.Archive.Index[i].LastTimestamp, Device.Archive.Index[i].LastTimestamp + Offset);
+		CHECK_EQ(Restored.Archive.Index[i].Used, Device.Archive.Index[i].Used);
+		CHECK(memcmp(Restored.Archive.Blocks + (SIZE_T)i * ASTON_BATTERY_ARCHIVE_BLOCK_SIZE,
+			Device.Archive.Blocks + (SIZE_T)i * ASTON_BATTERY_ARCHIVE_BLOCK_SIZE,
+			Device.Archive.Index[i].Used) == 0);
+	}
+
+	CHECK(memcmp(Restored.Archive.Previous + 1, Device.Archive.Previous + 1,
+		sizeof(Device.Archive.Previous) - sizeof(LONGLONG)) == 0);
+	CHECK_EQ(Restored.Archive.PreviousInterval, Device.Archive.PreviousInterval);
+
+	//
+	// The restored state is already in the file, and samples appended to
+	// the head block on the new timeline decode within it.
+	//
+
+	Restored.Seconds = 0;
+	RunDevice(&Restored, 600);
+	CheckArchive(&Restored.Archive);
+
+	FreeDevice(&Restored);
+	FreeDevice(&Device);
+}
+
+static
+VOID
+TestInterruptedCheckpoint(
+	MEMORY_FILE* Memory,
+	MEMORY_FILE* Saved
+)
+{
+	SIM_DEVICE Device;
+	SIM_DEVICE Restored;
+	ULONGLONG TotalSamples;
+	LONGLONG Newest;
+	ULONG Seconds;
+	ULONG Head;
+	ULONG Writes;
+	ULONG Dropped;
+	ULONG k;
+
+	//
+	// A checkpoint of two hours of samples, with the ring wrapping and a new
+	// archive block started.
+	//
+
+	InitializeDevice(&Device);
+	memset(Memory, 0, sizeof(*Memory));
+	RunDevice(&Device, 30 * 3600);
+	while (Device.Archive.Index[Device.Archive.Head].Used < 3000)
+	{
+		RunDevice(&Device, 600);
+	}
+
+	Seconds = Device.Seconds;
+	Head = Device.Archive.Head;
+	TotalSamples = Device.History.TotalSamples;
+	Newest = Device.History.Timestamp[(Device.History.Head + ASTON_BATTERY_HISTORY_CAPACITY - 1) % ASTON_BATTERY_HISTORY_CAPACITY];
+	CHECK(NT_SUCCESS(Checkpoint(&Device, Memory, MAXULONG, FALSE)));
+	memcpy(Saved, Memory, sizeof(*Memory));
+
+	RunDevice(&Device, 2 * 3600);
+	CHECK(Device.Archive.Head != Head);
+	CHECK(NT_SUCCESS(Checkpoint(&Device, Memory, MAXULONG, FALSE)));
+	Writes = Memory->Writes;
+	CHECK(Writes > 3);
+	FreeDevice(&Device);
+
+	for (k = 0; k < Writes; k++)
+	{
+		InitializeDevice(&Device);
+		memcpy(Memory, Saved, sizeof(*Memory));
+		RunDevice(&Device, Seconds + 2 * 3600);
+		CHECK(!NT_SUCCESS(Checkpoint(&Device, Memory, k, FALSE)));
+		FreeDevice(&Device);
+
+		//
+		// The previous checkpoint is restored whole: the ring up to its
+		// newest sample, the archive up to its head block.
+		//
+
+		CHECK(NT_SUCCESS(Restore(&Restored, Memory, SYSTEM_TIME_MS + 40 * 3600000LL, &Dropped)));
+		CHECK_EQ(Dropped, 0);
+		CHECK_EQ(Restored.History.Count, ASTON_BATTERY_HISTORY_CAPACITY);
+		CHECK_EQ(Restored.History.TotalSamples, TotalSamples);
+		CHECK_EQ(Restored.History.Timestamp[(Restored.History.Head + ASTON_BATTERY_HISTORY_CAPACITY - 1) % ASTON_BATTERY_HISTORY_CAPACITY],
+			Newest - 40 * 3600 * (LONGLONG)QPC_FREQUENCY);
+
+		CHECK_EQ(Restored.Archive.Head, Head);
+		CheckRing(&Restored.History);
+		CheckArchive(&Restored.Archive);
+		FreeDevice(&Restored);
+	}
+}
+
+static
+VOID
+TestLongHead(
+	MEMORY_FILE* Memory
+)
+{
+	SIM_DEVICE Device;
+	SIM_DEVICE Restored;
+	ULONG Head;
+	ULONG Used;
+	ULONG Count;
+	ULONG Dropped;
+
+	//
+	// The records and the head block bytes make it to the file, the header
+	// does not.
+	//
+
+	InitializeDevice(&Device);
+	memset(Memory, 0, sizeof(*Memory));
+	RunDevice(&Device, 3600);
+	CHECK(NT_SUCCESS(Checkpoint(&Device, Memory, MAXULONG, FALSE)));
+	Head = Device.Archive.Head;
+	Used = Device.Archive.Index[Head].Used;
+	Count = Device.Archive.Index[Head].Count;
+
+	RunDevice(&Device, 1800);
+	CHECK_EQ(Device.Archive.Head, Head);
+	CHECK(!NT_SUCCESS(Checkpoint(&Device, Memory, MAXULONG, TRUE)));
+	CHECK(Memory->Bytes > 0);
+	CHECK(Device.Archive.Persisted[Head] > Used);
+
+	CHECK(NT_SUCCESS(Restore(&Restored, Memory, SYSTEM_TIME_MS + 7200000, &Dropped)));
+	CHECK_EQ(Dropped, 0);
+	CHECK_EQ(Restored.Archive.BlockCount, 1);
+	CHECK_EQ(Restored.Archive.Index[Head].Used, Used);
+	CHECK_EQ(Restored.Archive.Index[Head].Count, Count);
+	CHECK_EQ(Restored.History.Count, 3600 / SAMPLE_INTERVAL_S);
+	CheckRing(&Restored.History);
+
+	//
+	// The next checkpoint of the restored device writes over the bytes left
+	// past the head block.
+	//
+
+	RunDevice(&Restored, 600);
+	CHECK(NT_SUCCESS(Checkpoint(&Restored, Memory, MAXULONG, FALSE)));
+	FreeDevice(&Restored);
+
+	CHECK(NT_SUCCESS(Restore(&Restored, Memory, SYSTEM_TIME_MS + 10800000, &Dropped)));
+	CHECK_EQ(Dropped, 0);
+	CHECK_EQ(Restored.Archive.Index[Head].Count, Count + 600 / SAMPLE_INTERVAL_S / ASTON_BATTERY_ARCHIVE_SAMPLE_DIVIDER);
+	CheckArchive(&Restored.Archive);
+	FreeDevice(&Restored);
+	FreeDevice(&Device);
+}
+
+static
+VOID
+TestDamagedFile(
+	MEMORY_FILE* Memory,
+	MEMORY_FILE* Saved
+)
+{
+	SIM_DEVICE Device;
+	SIM_DEVICE Restored;
+	ASTON_BATTERY_ARCHIVE_BLOCK* Entry;
+	ULONG Oldest;
+	ULONG Block;
+	ULONG Blocks;
+	ULONG Dropped;
+
+	InitializeDevice(&Device);
+	memset(Memory, 0, sizeof(*Memory));
+	RunDevice(&Device, 2 * 86400);
+	CHECK(NT_SUCCESS(Checkpoint(&Device, Memory, MAXULONG, FALSE)));
+	memcpy(Saved, Memory, sizeof(*Memory));
+	Blocks = Device.Archive.BlockCount;
+	CHECK(Blocks > 10);
+	Oldest = (Device.Archive.Head + ASTON_BATTERY_ARCHIVE_BLOCKS + 1 - Blocks) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+
+	//
+	// The last byte of a block ends a varint, with its high bit set the
+	// block runs past its used bytes. It is dropped with every older one.
+	//
+
+	Block = (Oldest + 5) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+	Entry = &Device.Archive.Index[Block];
+	Memory->Data[ASTON_BATTERY_HISTORY_FILE_BLOCKS_OFFSET +
+		Block * sizeof(ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE) +
+		FIELD_OFFSET(ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE, Data) + Entry->Used - 1] |= 0x80;
+
+	CHECK(NT_SUCCESS(Restore(&Restored, Memory, SYSTEM_TIME_MS + 3 * 86400000LL, &Dropped)));
+	CHECK_EQ(Dropped, 1);
+	CHECK_EQ(Restored.Archive.BlockCount, Blocks);
+	CHECK_EQ(Restored.Archive.Index[Block].Used, 0);
+	CHECK(Restored.Archive.Index[(Block + 1) % ASTON_BATTERY_ARCHIVE_BLOCKS].Used != 0);
+	CHECK(Restored.Archive.Index[Oldest].Used != 0);
+	CheckArchive(&Restored.Archive);
+	FreeDevice(&Restored);
+
+	//
+	// A damaged head block is emptied too, new samples start it over.
+	//
+
+	memcpy(Memory, Saved, sizeof(*Memory));
+	Block = Device.Archive.Head;
+	Memory->Data[ASTON_BATTERY_HISTORY_FILE_BLOCKS_OFFSET + Block * sizeof(ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE)] ^= 1;
+
+	CHECK(NT_SUCCESS(Restore(&Restored, Memory, SYSTEM_TIME_MS + 3 * 86400000LL, &Dropped)));
+	CHECK_EQ(Dropped, 1);
+	CHECK_EQ(Restored.Archive.BlockCount, Blocks);
+	CHECK_EQ(Restored.Archive.Index[Block].Count, 0);
+	RunDevice(&Restored, 600);
+	CheckArchive(&Restored.Archive);
+	FreeDevice(&Restored);
+
+	//
+	// A file cut short in the middle of the archive keeps the blocks before
+	// the cut.
+	//
+
+	memcpy(Memory, Saved, sizeof(*Memory));
+	Block = (Oldest + 3) % ASTON_BATTERY_ARCHIVE_BLOCKS;
+	Memory->Size = ASTON_BATTERY_HISTORY_FILE_BLOCKS_OFFSET + Block * sizeof(ASTON_BATTERY_ARCHIVE_BLOCK_IMAGE) + 100;
+	CHECK(NT_SUCCESS(Restore(&Restored, Memory, SYSTEM_TIME_MS + 3 * 86400000LL, &Dropped)));
+	CHECK_EQ(Dropped, Blocks - 3);
+	CHECK_EQ(Restored.Archive.Index[(Oldest + 2) % ASTON_BATTERY_ARCHIVE_BLOCKS].Count,
+		Device.Archive.Index[(Oldest + 2) % ASTON_BATTERY_ARCHIVE_BLOCKS].Count);
+	CHECK_EQ(Restored.History.Count, ASTON_BATTERY_HISTORY_CAPACITY);
+	CheckRing(&Restored.History);
+	RunDevice(&Restored, 600);
+	CheckArchive(&Restored.Archive);
+	FreeDevice(&Restored);
+
+	//
+	// A file cut short in the records keeps no sample of the ring, a file
+	// cut short in the headers is not a history file, and neither is a
+	// header whose checksum does not match.
+	//
+
+	Memory->Size = ASTON_BATTERY_HISTORY_FILE_RECORDS_OFFSET + 1000;
+	CHECK(NT_SUCCESS(Restore(&Restored, Memory, SYSTEM_TIME_MS, &Dropped)));
+	CHECK_EQ(Restored.History.Count, 0);
+	CHECK_EQ(Dropped, Blocks);
+	FreeDevice(&Restored);
+
+	Memory->Size = 100;
+	CHECK_EQ(Restore(&Restored, Memory, SYSTEM_TIME_MS, &Dropped), STATUS_NOT_FOUND);
+	FreeDevice(&Restored);
+
+	memcpy(Memory, Saved, sizeof(*Memory));
+	Memory->Data[ASTON_BATTERY_HISTORY_FILE_HEADER_SIZE + 100] ^= 1;
+	CHECK_EQ(Restore(&Restored, Memory, SYSTEM_TIME_MS, &Dropped), STATUS_NOT_FOUND);
+	FreeDevice(&Restored);
+	FreeDevice(&Device);
+}
+
+int
+main(
+	VOID
+)
+{
+	static MEMORY_FILE Memory;
+	static MEMORY_FILE Saved;
+
+	TestBoundedDecode();
+	TestWriteVolume(&Memory);
+	TestInterruptedCheckpoint(&Memory, &Saved);
+	TestLongHead(&Memory);
+	TestDamagedFile(&Memory, &Saved);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,248 @@
+/*++
+
+Module Name:
+
+    PackSwapTest.c
+
+Abstract:
+
+    Swaps the packs behind the gauges under a learnt snapshot and checks
+    that AstonBatteryRecordPackSignature issues a new battery tag, clears
+    the cached registers and every learnt model and asks for the class
+    driver to be notified, and that it leaves everything alone while the
+    packs stay the same.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include <string.h>
+#include "GaugeSimulator.h"
+#include "Test.h"
+
+//------------------------------------------------------------------ Definitions
+
+static const ASTON_BATTERY_PACK_SIGNATURE PackA = { 0x8f3a11c5, 0x01780178, 8000, 112 };
+static const ASTON_BATTERY_PACK_SIGNATURE PackB = { 0x2b94e07d, 0x01780178, 9000, 3 };
+
+//-------------------------------------------------------------------- Functions
+
+static
+VOID
+LearnDischarge(
+	PASTON_BATTERY_SNAPSHOT Snapshot,
+	PSIM_GAUGE Gauges,
+	ULONG GaugeCount,
+	LONG CurrentMa
+)
+{
+	ULONG i;
+	ULONG t;
+
+	for (t = 0; t < 600; t += 5)
+	{
+		for (i = 0; i < GaugeCount; i++)
+		{
+			Gauges[i].CurrentMa = CurrentMa / (LONG)GaugeCount + (LONG)(t % 60) * 4;
+			SimAdvanceGauge(&Gauges[i], 5000000);
+		}
+
+		SimSample(Snapshot, Gauges, GaugeCount, t == 0 ? 0 : 5000000);
+	}
+}
+
+static
+VOID
+TestNextTag(
+	VOID
+)
+{
+	CHECK_EQ(AstonBatteryNextTag(BATTERY_TAG_INVALID), 1);
+	CHECK_EQ(AstonBatteryNextTag(41), 42);
+	CHECK_EQ(AstonBatteryNextTag(0xFFFFFFFF), 1);
+}
+
+static
+VOID
+TestSamePack(
+	VOID
+)
+{
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+	ASTON_BATTERY_SNAPSHOT Learnt;
+	ASTON_BATTERY_PACK_SIGNATURE Recorded;
+	ASTON_BATTERY_PACK_SIGNATURE Signature;
+	BOOLEAN RecordedValid;
+	SIM_GAUGE Gauges[2];
+	ULONG Tag;
+
+	RtlZeroMemory(&Snapshot, sizeof(Snapshot));
+	RtlZeroMemory(&Recorded, sizeof(Recorded));
+	SimInitializeGauge(&Gauges[0], 4000, 0.8, 110);
+	SimInitializeGauge(&Gauges[1], 4000, 0.8, 120);
+	LearnDischarge(&Snapshot, Gauges, 2, -1600);
+	Learnt = Snapshot;
+	RecordedValid = FALSE;
+	Tag = AstonBatteryNextTag(BATTERY_TAG_INVALID);
+
+	//
+	// The first signature has nothing to compare with.
+	//
+
+	CHECK(!AstonBatteryRecordPackSignature(&Recorded, &RecordedValid, &PackA, &Tag, &Snapshot));
+	CHECK(RecordedValid);
+	CHECK(memcmp(&Recorded, &PackA, sizeof(Recorded)) == 0);
+	CHECK_EQ(Tag, 1);
+	CHECK(memcmp(&Snapshot, &Learnt, sizeof(Snapshot)) == 0);
+
+	//
+	// The same packs a few cycles later.
+	//
+
+	Signature = PackA;
+	Signature.CycleCount += 2;
+	CHECK(!AstonBatteryRecordPackSignature(&Recorded, &RecordedValid, &Signature, &Tag, &Snapshot));
+	CHECK_EQ(Recorded.CycleCount, PackA.CycleCount + 2);
+	CHECK_EQ(Tag, 1);
+	CHECK(memcmp(&Snapshot, &Learnt, sizeof(Snapshot)) == 0);
+}
+
+static
+VOID
+TestSwap(
+	VOID
+)
+{
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+	ASTON_BATTERY_PACK_SIGNATURE Recorded;
+	BOOLEAN RecordedValid;
+	SIM_GAUGE Gauges[2];
+	SIM_GAUGE Swapped;
+	ULONG Generation;
+	ULONG Tag;
+
+	RtlZeroMemory(&Snapshot, sizeof(Snapshot));
+	SimInitializeGauge(&Gauges[0], 4000, 0.8, 110);
+	SimInitializeGauge(&Gauges[1], 4000, 0.8, 120);
+	LearnDischarge(&Snapshot, Gauges, 2, -1600);
+	Snapshot.HealthValid = TRUE;
+	Snapshot.Health.FullChargeCapacity = 7800;
+	Recorded = PackA;
+	RecordedValid = TRUE;
+	Tag = 7;
+
+	CHECK(Snapshot.Valid);
+	CHECK(Snapshot.LoadModel.FitCount > 0);
+	CHECK(Snapshot.RateFilter.Primed);
+	CHECK(Snapshot.Predictor.Samples > 0);
+	CHECK(Snapshot.Energy.DischargedUj > 0);
+
+	Generation = Snapshot.Generation;
+
+	//
+	// A different pack: new tag, nothing left of the old one in the cache
+	// or the models, and the class driver is to be told.
+	//
+
+	CHECK(AstonBatteryRecordPackSignature(&Recorded, &RecordedValid, &PackB, &Tag, &Snapshot));
+	CHECK(memcmp(&Recorded, &PackB, sizeof(Recorded)) == 0);
+	CHECK_EQ(Tag, 8);
+	CHECK_EQ(Snapshot.Generation, Generation + 1);
+	CHECK(!Snapshot.Valid);
+	CHECK_EQ(Snapshot.GaugeCount, 0);
+	CHECK_EQ(Snapshot.Registers.RemainingCapacity, 0);
+	CHECK_EQ(Snapshot.LoadModel.FitCount, 0);
+	CHECK_EQ(Snapshot.LoadModel.ResistanceMilliOhm, 0);
+	CHECK(!Snapshot.RateFilter.Primed);
+	CHECK_EQ(Snapshot.Predictor.Samples, 0);
+	CHECK_EQ(Snapshot.Energy.DischargedUj, 0);
+	CHECK(!Snapshot.HealthValid);
+	CHECK_EQ(Snapshot.Health.FullChargeCapacity, 0);
+
+	//
+	// The models start over on the new pack and only see its current.
+	//
+
+	SimInitializeGauge(&Swapped, 9000, 0.5, 60);
+	Swapped.CurrentMa = -400;
+	SimSample(&Snapshot, &Swapped, 1, 0);
+	SimAdvanceGauge(&Swapped, 5000000);
+	SimSample(&Snapshot, &Swapped, 1, 5000000);
+
+	CHECK_EQ(Snapshot.GaugeCount, 1);
+	CHECK_EQ(Snapshot.Registers.FullChargeCapacity, 9000);
+	CHECK_NEAR(AstonBatteryFilterValue(Snapshot.RateFilter.CurrentLong), -400, 2);
+	CHECK_NEAR(AstonBatteryEstimateTime(&Snapshot, 0), 4500 * 3600.0 / 400, 60);
+}
+
+static
+VOID
+TestEachField(
+	VOID
+)
+{
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+	ASTON_BATTERY_PACK_SIGNATURE Recorded;
+	ASTON_BATTERY_PACK_SIGNATURE Signature;
+	BOOLEAN RecordedValid;
+	ULONG Field;
+	ULONG Tag;
+
+	//
+	// Any one field is enough, and a cycle count going backwards means the
+	// gauge was reset or the pack replaced by an older one.
+	//
+
+	for (Field = 0; Field < 4; Field++)
+	{
+		RtlZeroMemory(&Snapshot, sizeof(Snapshot));
+		Snapshot.Valid = TRUE;
+		Snapshot.Generation = 30;
+		Recorded = PackA;
+		RecordedValid = TRUE;
+		Signature = PackA;
+		Tag = 3;
+
+		switch (Field)
+		{
+		case 0:
+			Signature.ManufacturerInfoHash ^= 1;
+			break;
+
+		case 1:
+			Signature.ChemId = 0x01780354;
+			break;
+
+		case 2:
+			Signature.DesignCapacity -= 1;
+			break;
+
+		default:
+			Signature.CycleCount -= 1;
+			break;
+		}
+
+		CHECK(!AstonBatteryIsSamePack(&PackA, &Signature));
+		CHECK(AstonBatteryRecordPackSignature(&Recorded, &RecordedValid, &Signature, &Tag, &Snapshot));
+		CHECK_EQ(Tag, 4);
+		CHECK(!Snapshot.Valid);
+		CHECK_EQ(Snapshot.Generation, 31);
+	}
+
+	CHECK(AstonBatteryIsSamePack(&PackA, &PackA));
+}
+
+int
+main(
+	VOID
+)
+{
+	TestNextTag();
+	TestSamePack();
+	TestSwap();
+	TestEachField();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,152 @@
+/*++
+
+Module Name:
+
+    PredictorSimulationTest.c
+
+Abstract:
+
+    Runs the predictor against a simulated three hour discharge with a
+    bursty load at sampling intervals from 5 s to 60 s and prints its error
+    statistics, to tune the sampling interval against accuracy.
+
+    Two errors are reported per interval. The predictor statistics of the
+    driver score the prediction made at one sample for the next one, the
+    worst case age. The query error scores the snapshot extrapolated to a
+    query halfway between samples against the gauge at that moment, next to
+    the error of answering the query with the last sample as is.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include <stdlib.h>
+#include "GaugeSimulator.h"
+#include "Test.h"
+
+//------------------------------------------------------------------ Definitions
+
+#define TRACE_SECONDS       (3 * 3600)
+
+typedef struct _SIMULATION_RESULT
+{
+    double MeanCapacityError;
+    double MeanVoltageError;
+    double MeanQueryCapacityError;
+    double MeanStaleCapacityError;
+    double MeanQueryVoltageError;
+    double MeanStaleVoltageError;
+    ULONG MaxCapacityErrorMah;
+    ULONG MaxVoltageErrorMv;
+} SIMULATION_RESULT;
+
+static LONG Load[TRACE_SECONDS];
+
+//-------------------------------------------------------------------- Functions
+
+static
+VOID
+Simulate(
+	ULONG IntervalS,
+	SIMULATION_RESULT* Result
+)
+{
+	ASTON_BATTERY_SNAPSHOT Snapshot;
+	BQ28Z610_STANDARD_BLOCK Registers;
+	SIM_GAUGE Gauge;
+	LONG Capacity;
+	LONG Voltage;
+	ULONG Queries;
+	ULONG t;
+
+	RtlZeroMemory(&Snapshot, sizeof(Snapshot));
+	RtlZeroMemory(Result, sizeof(*Result));
+	SimInitializeGauge(&Gauge, 12000, 0.95, 100);
+	Queries = 0;
+
+	for (t = 0; t < TRACE_SECONDS; t++)
+	{
+		Gauge.CurrentMa = -Load[t];
+		SimAdvanceGauge(&Gauge, 1000000);
+
+		if (t % IntervalS == 0)
+		{
+			SimSample(&Snapshot, &Gauge, 1, t == 0 ? 0 : (ULONGLONG)IntervalS * 1000000);
+			continue;
+		}
+
+		if (t % IntervalS != IntervalS / 2 || !Snapshot.RateFilter.Primed)
+		{
+			continue;
+		}
+
+		SimReadRegisters(&Gauge, &Registers);
+		AstonBatteryPredict(&Snapshot, (ULONGLONG)(t % IntervalS) * 1000000, &Capacity, &Voltage);
+
+		Result->MeanQueryCapacityError += abs(Capacity - (LONG)Registers.RemainingCapacity);
+		Result->MeanStaleCapacityError += abs((LONG)Snapshot.Registers.RemainingCapacity - (LONG)Registers.RemainingCapacity);
+		Result->MeanQueryVoltageError += abs(Voltage - (LONG)Registers.Voltage);
+		Result->MeanStaleVoltageError += abs((LONG)Snapshot.Registers.Voltage - (LONG)Registers.Voltage);
+		Queries += 1;
+	}
+
+	Result->MeanCapacityError = (double)Snapshot.Predictor.SumCapacityErrorMah / Snapshot.Predictor.Samples;
+	Result->MeanVoltageError = (double)Snapshot.Predictor.SumVoltageErrorMv / Snapshot.Predictor.Samples;
+	Result->MaxCapacityErrorMah = Snapshot.Predictor.MaxCapacityErrorMah;
+	Result->MaxVoltageErrorMv = Snapshot.Predictor.MaxVoltageErrorMv;
+	Result->MeanQueryCapacityError /= Queries;
+	Result->MeanStaleCapacityError /= Queries;
+	Result->MeanQueryVoltageError /= Queries;
+	Result->MeanStaleVoltageError /= Queries;
+
+	printf("%8u %8.2f %8u %8.1f %8u | %8.2f %8.2f %8.1f %8.1f\n",
+		IntervalS,
+		Result->MeanCapacityError,
+		Result->MaxCapacityErrorMah,
+		Result->MeanVoltageError,
+		Result->MaxVoltageErrorMv,
+		Result->MeanQueryCapacityError,
+		Result->MeanStaleCapacityError,
+		Result->MeanQueryVoltageError,
+		Result->MeanStaleVoltageError);
+}
+
+int
+main(
+	VOID
+)
+{
+	static const ULONG Intervals[] = { 5, 10, 15, 30, 60 };
+	SIMULATION_RESULT Result;
+	ULONG i;
+
+	SimGenerateLoad(Load, TRACE_SECONDS, 32);
+
+	printf("                next sample                         | query halfway\n");
+	printf("interval   cap mAh  max mAh    volt mV   max mV |  cap mAh stale mAh  volt mV stale mV\n");
+
+	for (i = 0; i < sizeof(Intervals) / sizeof(Intervals[0]); i++)
+	{
+		Simulate(Intervals[i], &Result);
+
+		//
+		// Extrapolated answers must beat the last sample once the capacity
+		// moves by more than its resolution between samples, and never be
+		// worse than it. The voltage error is dominated by the load steps
+		// the predictor cannot know about.
+		//
+
+		CHECK(Result.MeanQueryCapacityError <= Result.MeanStaleCapacityError + 0.05);
+		if (Intervals[i] >= 15)
+		{
+			CHECK(Result.MeanQueryCapacityError * 1.5 < Result.MeanStaleCapacityError);
+		}
+
+		CHECK(Result.MeanQueryVoltageError <= Result.MeanStaleVoltageError * 1.05);
+		CHECK(Result.MeanCapacityError < 2 + Intervals[i] / 10.0);
+	}
+
+	return TEST_RESULT();
+}
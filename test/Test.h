@@ -0,0 +1,53 @@
+/*++
+
+Module Name:
+
+    Test.h
+
+Abstract:
+
+    Minimal check macros shared by the host tests. A test program runs all
+    of its cases and returns nonzero if any check failed, which is what
+    CTest looks at.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+
+static int TestFailures;
+
+#define CHECK(Expression) \
+    do { \
+        if (!(Expression)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #Expression); \
+            TestFailures += 1; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(Actual, Expected) \
+    do { \
+        long long A_ = (long long)(Actual); \
+        long long E_ = (long long)(Expected); \
+        if (A_ != E_) { \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #Actual, A_, E_); \
+            TestFailures += 1; \
+        } \
+    } while (0)
+
+#define CHECK_NEAR(Actual, Expected, Tolerance) \
+    do { \
+        double A_ = (double)(Actual); \
+        double E_ = (double)(Expected); \
+        if (fabs(A_ - E_) > (double)(Tolerance)) { \
+            fprintf(stderr, "%s:%d: %s is %g, expected %g +- %g\n", __FILE__, __LINE__, #Actual, A_, E_, (double)(Tolerance)); \
+            TestFailures += 1; \
+        } \
+    } while (0)
+
+#define TEST_RESULT() \
+    (printf("%s\n", TestFailures == 0 ? "PASS" : "FAIL"), TestFailures == 0 ? 0 : 1)
@@ -0,0 +1,36 @@
+/*++
+
+Module Name:
+
+    batclass.h
+
+Abstract:
+
+    Stand-in for the battery class header when the portable parts of the
+    driver are built for the host by the tests.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+#pragma once
+
+#define BATTERY_UNKNOWN_CAPACITY    0xFFFFFFFF
+#define BATTERY_UNKNOWN_VOLTAGE     0xFFFFFFFF
+#define BATTERY_UNKNOWN_RATE        0x80000000
+#define BATTERY_UNKNOWN_TIME        0xFFFFFFFF
+
+#define BATTERY_TAG_INVALID         0
+
+typedef enum _BATTERY_QUERY_INFORMATION_LEVEL
+{
+    BatteryInformation,
+    BatteryGranularityInformation,
+    BatteryTemperature,
+    BatteryEstimatedTime,
+    BatteryDeviceName,
+    BatteryManufactureDate,
+    BatteryManufactureName,
+    BatteryUniqueID,
+    BatterySerialNumber
+} BATTERY_QUERY_INFORMATION_LEVEL;
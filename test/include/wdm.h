@@ -0,0 +1,120 @@
+/*++
+
+Module Name:
+
+    wdm.h
+
+Abstract:
+
+    Stand-in for the kernel header when the portable parts of the driver,
+    such as model.c, are built for the host by the tests. It only carries
+    the basic types, SAL annotations and runtime helpers those files use.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//------------------------------------------------------------------ Definitions
+
+#define VOID void
+#define TRUE 1
+#define FALSE 0
+
+typedef uint8_t UCHAR, *PUCHAR, BYTE, UINT8, BOOLEAN, *PBOOLEAN;
+typedef char CHAR, *PCHAR;
+typedef uint16_t USHORT, *PUSHORT, UINT16, WCHAR, *PWCHAR;
+typedef int16_t SHORT, *PSHORT, INT16;
+typedef uint32_t ULONG, *PULONG, UINT32;
+typedef int32_t LONG, *PLONG, INT32, NTSTATUS;
+typedef uint64_t ULONGLONG, *PULONGLONG, UINT64, ULONG64;
+typedef int64_t LONGLONG, *PLONGLONG, INT64, LONG64;
+typedef uintptr_t ULONG_PTR;
+typedef size_t SIZE_T;
+typedef void* PVOID;
+typedef void* HANDLE;
+
+typedef union _LARGE_INTEGER
+{
+    struct
+    {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _GUID
+{
+    ULONG Data1;
+    USHORT Data2;
+    USHORT Data3;
+    UCHAR Data4[8];
+} GUID;
+
+#define MAXSHORT    0x7FFF
+#define MINSHORT    (-MAXSHORT - 1)
+#define MAXUSHORT   0xFFFF
+#define MAXLONG     0x7FFFFFFF
+#define MAXULONG    0xFFFFFFFF
+#define MAXLONGLONG INT64_MAX
+
+#define STATUS_SUCCESS              ((NTSTATUS)0x00000000L)
+#define STATUS_END_OF_FILE          ((NTSTATUS)0xC0000011L)
+#define STATUS_NOT_FOUND            ((NTSTATUS)0xC0000225L)
+#define STATUS_DISK_FULL            ((NTSTATUS)0xC000007FL)
+#define NT_SUCCESS(Status)          (((NTSTATUS)(Status)) >= 0)
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define FORCEINLINE static inline
+#define C_ASSERT(e) _Static_assert(e, #e)
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+#define ARRAYSIZE(A) (sizeof(A) / sizeof((A)[0]))
+#define RTL_NUMBER_OF(A) ARRAYSIZE(A)
+#define FIELD_OFFSET(Type, Field) ((LONG)offsetof(Type, Field))
+
+#define RtlZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+#define RtlCopyMemory(Destination, Source, Length) memcpy((Destination), (Source), (Length))
+
+#define DEFINE_GUID(Name, l, w1, w2, b1, b2, b3, b4, b5, b6, b7, b8) \
+    static const GUID Name = { l, w1, w2, { b1, b2, b3, b4, b5, b6, b7, b8 } }
+
+#define FILE_DEVICE_BATTERY         0x00000029
+#define METHOD_BUFFERED             0
+#define METHOD_OUT_DIRECT           2
+#define FILE_READ_ACCESS            0x0001
+
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+//
+// SAL annotations
+//
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _Inout_updates_(s)
+#define _Inout_updates_bytes_(s)
+#define _In_reads_(s)
+#define _In_reads_bytes_(s)
+#define _Out_writes_(s)
+#define _Out_writes_bytes_(s)
+#define _Out_writes_bytes_to_(s, c)
+#define _Field_size_(s)
+#define _Use_decl_annotations_
+#define _IRQL_requires_max_(l)
+#define _IRQL_requires_same_
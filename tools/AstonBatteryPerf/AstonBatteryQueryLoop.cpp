@@ -0,0 +1,264 @@
+/*++
+
+Module Name:
+
+    AstonBatteryQueryLoop.cpp
+
+Abstract:
+
+    This module sends battery queries through the battery class driver at a
+    fixed rate of work, so that the CPU cost per query can be compared
+    between two builds of the driver. The battery is opened through its
+    GUID_DEVICE_BATTERY interface and its tag read with
+    IOCTL_BATTERY_QUERY_TAG, as the power manager and the shell do. Each of
+    the following is then sent the given number of times in a row:
+
+        IOCTL_BATTERY_QUERY_STATUS          AstonBatteryQueryStatus
+        IOCTL_BATTERY_QUERY_INFORMATION     AstonBatteryQueryInformation,
+          BatteryEstimatedTime              estimated time
+        IOCTL_BATTERY_QUERY_INFORMATION     AstonBatteryQueryInformation,
+          BatteryInformation                BATTERY_INFORMATION
+
+    The wall time and the CPU time of the calling thread are reported per
+    query. The thread time only covers the class and miniclass drivers
+    while they run in the caller's context; the CPU samples of a WPR trace
+    taken with AstonBatteryPerf.wprp are the reference:
+
+        wpr -start AstonBatteryPerf.wprp!AstonBatteryCpu -filemode
+        AstonBatteryQueryLoop 100000
+        wpr -stop Cpu.etl
+
+    AstonBatteryCpu records CPU samples with stacks and leaves the driver
+    providers disabled, the state of a release system; the WPP in-flight
+    recorder stays on as it does there. AstonBatteryTrace adds the query
+    and bus keywords of the Aston.Battery provider at verbose level, the
+    state of a system being diagnosed. In WPA, CPU Usage (Sampled) grouped
+    by Module and Function gives the samples in AstonBattery.sys per query
+    of this loop. Queries the class driver answers without calling the
+    miniclass show no samples in AstonBattery.sys. Run both profiles on a
+    Release build of the driver before and after a change, with the same
+    query count, and compare.
+
+    Results: none are recorded here yet. The before and after numbers per
+    query on a Release build are still owed and need a device running the
+    driver.
+
+        AstonBatteryQueryLoop [queries] [battery]
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#define NOMINMAX
+#include <windows.h>
+#include <winioctl.h>
+#include <setupapi.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <initguid.h>
+#include <batclass.h>
+
+//------------------------------------------------------------------ Definitions
+
+namespace
+{
+
+struct Query
+{
+    const char* Name;
+    DWORD IoControlCode;
+    const void* Input;
+    DWORD InputSize;
+    DWORD OutputSize;
+};
+
+//
+// Opens the battery with the given index among those of the battery class.
+//
+
+HANDLE OpenBattery(DWORD Index)
+{
+    HANDLE Battery = INVALID_HANDLE_VALUE;
+    const HDEVINFO DeviceInfo = SetupDiGetClassDevsW(&GUID_DEVICE_BATTERY,
+                                                     nullptr,
+                                                     nullptr,
+                                                     DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+
+    if (DeviceInfo == INVALID_HANDLE_VALUE)
+    {
+        return Battery;
+    }
+
+    SP_DEVICE_INTERFACE_DATA Interface = { sizeof(Interface) };
+    DWORD Size = 0;
+
+    if (SetupDiEnumDeviceInterfaces(DeviceInfo, nullptr, &GUID_DEVICE_BATTERY, Index, &Interface))
+    {
+        SetupDiGetDeviceInterfaceDetailW(DeviceInfo, &Interface, nullptr, 0, &Size, nullptr);
+
+        std::vector<BYTE> Buffer(std::max<DWORD>(Size, sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W)));
+        const auto Detail = reinterpret_cast<PSP_DEVICE_INTERFACE_DETAIL_DATA_W>(Buffer.data());
+
+        Detail->cbSize = sizeof(*Detail);
+        if (SetupDiGetDeviceInterfaceDetailW(DeviceInfo, &Interface, Detail, Size, nullptr, nullptr))
+        {
+            Battery = CreateFileW(Detail->DevicePath,
+                                  GENERIC_READ,
+                                  FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                  nullptr,
+                                  OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL,
+                                  nullptr);
+        }
+    }
+
+    SetupDiDestroyDeviceInfoList(DeviceInfo);
+    return Battery;
+}
+
+ULONGLONG ThreadCpuTime100ns()
+{
+    FILETIME Creation;
+    FILETIME Exit;
+    FILETIME Kernel;
+    FILETIME User;
+
+    GetThreadTimes(GetCurrentThread(), &Creation, &Exit, &Kernel, &User);
+    return (static_cast<ULONGLONG>(Kernel.dwHighDateTime) << 32 | Kernel.dwLowDateTime) +
+           (static_cast<ULONGLONG>(User.dwHighDateTime) << 32 | User.dwLowDateTime);
+}
+
+//
+// Sends one query the given number of times and prints its cost per call.
+// Returns the number of calls that failed.
+//
+
+ULONG RunQuery(HANDLE Battery, const Query& Entry, ULONG Calls)
+{
+    std::vector<BYTE> Output(Entry.OutputSize);
+    LARGE_INTEGER Frequency;
+    LARGE_INTEGER Start;
+    LARGE_INTEGER Stop;
+    DWORD Returned;
+    ULONG Failures = 0;
+
+    QueryPerformanceFrequency(&Frequency);
+    const ULONGLONG CpuStart = ThreadCpuTime100ns();
+    QueryPerformanceCounter(&Start);
+
+    for (ULONG i = 0; i < Calls; i++)
+    {
+        if (!DeviceIoControl(Battery,
+                             Entry.IoControlCode,
+                             const_cast<void*>(Entry.Input),
+                             Entry.InputSize,
+                             Output.data(),
+                             Entry.OutputSize,
+                             &Returned,
+                             nullptr))
+        {
+            Failures += 1;
+        }
+    }
+
+    QueryPerformanceCounter(&Stop);
+    const ULONGLONG CpuTime = ThreadCpuTime100ns() - CpuStart;
+    const double Seconds = static_cast<double>(Stop.QuadPart - Start.QuadPart) / Frequency.QuadPart;
+
+    std::printf("%-22s %lu calls, %lu failed, wall %.2f us/call, thread cpu %.2f us/call\n",
+                Entry.Name,
+                Calls,
+                Failures,
+                Seconds * 1e6 / Calls,
+                CpuTime / 10.0 / Calls);
+
+    return Failures;
+}
+
+} // namespace
+
+//-------------------------------------------------------------------- Functions
+
+int main(int argc, char** argv)
+{
+    const ULONG Calls = (argc > 1) ? std::strtoul(argv[1], nullptr, 0) : 100000;
+    const DWORD Index = (argc > 2) ? std::strtoul(argv[2], nullptr, 0) : 0;
+    ULONG Timeout = 0;
+    ULONG Tag = BATTERY_TAG_INVALID;
+    WCHAR Name[MAX_BATTERY_STRING_SIZE] = {};
+    DWORD Returned;
+    ULONG Failures = 0;
+
+    const HANDLE Battery = OpenBattery(Index);
+
+    if (Battery == INVALID_HANDLE_VALUE)
+    {
+        std::fprintf(stderr, "No battery %lu, error %lu\n", Index, GetLastError());
+        return 1;
+    }
+
+    if (!DeviceIoControl(Battery,
+                         IOCTL_BATTERY_QUERY_TAG,
+                         &Timeout,
+                         sizeof(Timeout),
+                         &Tag,
+                         sizeof(Tag),
+                         &Returned,
+                         nullptr) ||
+        Tag == BATTERY_TAG_INVALID)
+    {
+        std::fprintf(stderr, "No battery tag, error %lu\n", GetLastError());
+        CloseHandle(Battery);
+        return 1;
+    }
+
+    BATTERY_WAIT_STATUS WaitStatus = {};
+    WaitStatus.BatteryTag = Tag;
+
+    BATTERY_QUERY_INFORMATION DeviceName = {};
+    DeviceName.BatteryTag = Tag;
+    DeviceName.InformationLevel = BatteryDeviceName;
+
+    BATTERY_QUERY_INFORMATION EstimatedTime = {};
+    EstimatedTime.BatteryTag = Tag;
+    EstimatedTime.InformationLevel = BatteryEstimatedTime;
+
+    BATTERY_QUERY_INFORMATION Information = {};
+    Information.BatteryTag = Tag;
+    Information.InformationLevel = BatteryInformation;
+
+    DeviceIoControl(Battery,
+                    IOCTL_BATTERY_QUERY_INFORMATION,
+                    &DeviceName,
+                    sizeof(DeviceName),
+                    Name,
+                    sizeof(Name) - sizeof(WCHAR),
+                    &Returned,
+                    nullptr);
+
+    std::printf("battery %lu \"%ls\", tag %lu\n", Index, Name, Tag);
+
+    const Query Queries[] =
+    {
+        { "QUERY_STATUS", IOCTL_BATTERY_QUERY_STATUS,
+          &WaitStatus, sizeof(WaitStatus), sizeof(BATTERY_STATUS) },
+        { "BatteryEstimatedTime", IOCTL_BATTERY_QUERY_INFORMATION,
+          &EstimatedTime, sizeof(EstimatedTime), sizeof(ULONG) },
+        { "BatteryInformation", IOCTL_BATTERY_QUERY_INFORMATION,
+          &Information, sizeof(Information), sizeof(BATTERY_INFORMATION) },
+    };
+
+    for (const Query& Entry : Queries)
+    {
+        Failures += RunQuery(Battery, Entry, Calls);
+    }
+
+    CloseHandle(Battery);
+    return (Failures != 0) ? 1 : 0;
+}
@@ -0,0 +1,923 @@
+/*++
+
+Module Name:
+
+    AstonTelemetryAnalytics.h
+
+Abstract:
+
+    This module contains the column scanning kernels used to analyze battery
+    histories at fleet scale, over the columns handed out by
+    AstonTelemetryFile.h: power sums for interval energy, threshold counts
+    for discharge rate percentiles and temperature excursions, min/max, and
+    the moments behind the capacity fade regression.
+
+    Every kernel has a scalar reference and SSE4.1, AVX2 and NEON versions.
+    All kernels work in integers and wrap the same way, so the vector
+    versions return exactly what the reference returns. The x86 versions
+    are compiled with target attributes and picked at run time, no special
+    compiler flags are needed.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+#pragma once
+
+//--------------------------------------------------------------------- Includes
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define ASTON_TELEMETRY_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ASTON_TELEMETRY_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(ASTON_TELEMETRY_X86) && (defined(__GNUC__) || defined(__clang__))
+#define ASTON_TELEMETRY_TARGET(Isa) __attribute__((target(Isa)))
+#else
+#define ASTON_TELEMETRY_TARGET(Isa)
+#endif
+
+namespace AstonTelemetry
+{
+namespace Analytics
+{
+
+//------------------------------------------------------------------ Definitions
+
+struct MinMax16
+{
+    uint16_t Min;
+    uint16_t Max;
+};
+
+//
+// Sum, sum of squares and index weighted sum of a column, modulo 2^64
+//
+
+struct Moments16
+{
+    uint64_t Sum;
+    uint64_t SumSquares;
+    uint64_t SumIndex;
+};
+
+//
+// One implementation of every kernel.
+//
+// DotVoltageCurrent   sum of Voltage[i] * Current[i], in uW
+// CountLess           number of values below a threshold
+// CountGreater        number of values above a threshold
+// MinMax              min and max, UINT16_MAX and 0 for an empty column
+// Moments             see Moments16
+//
+
+struct Kernels
+{
+    const char* Name;
+    int64_t (*DotVoltageCurrent)(const uint16_t* Voltage, const int16_t* Current, size_t Count);
+    uint64_t (*CountLess)(const int32_t* Values, size_t Count, int32_t Threshold);
+    uint64_t (*CountGreater)(const uint16_t* Values, size_t Count, uint16_t Threshold);
+    MinMax16 (*MinMax)(const uint16_t* Values, size_t Count);
+    Moments16 (*Moments)(const uint16_t* Values, size_t Count);
+};
+
+//---------------------------------------------------------------------- Scalar
+
+namespace Scalar
+{
+
+//
+// The sum is kept unsigned so that it wraps like the 64 bit vector lanes
+// instead of overflowing, and is read back as two's complement.
+//
+
+inline int64_t DotVoltageCurrent(const uint16_t* Voltage, const int16_t* Current, size_t Count)
+{
+    uint64_t Sum = 0;
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        Sum += static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(Voltage[i]) * Current[i]));
+    }
+
+    return static_cast<int64_t>(Sum);
+}
+
+inline uint64_t CountLess(const int32_t* Values, size_t Count, int32_t Threshold)
+{
+    uint64_t Total = 0;
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        Total += (Values[i] < Threshold) ? 1 : 0;
+    }
+
+    return Total;
+}
+
+inline uint64_t CountGreater(const uint16_t* Values, size_t Count, uint16_t Threshold)
+{
+    uint64_t Total = 0;
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        Total += (Values[i] > Threshold) ? 1 : 0;
+    }
+
+    return Total;
+}
+
+inline MinMax16 MinMax(const uint16_t* Values, size_t Count)
+{
+    MinMax16 Result = { std::numeric_limits<uint16_t>::max(), 0 };
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        Result.Min = std::min(Result.Min, Values[i]);
+        Result.Max = std::max(Result.Max, Values[i]);
+    }
+
+    return Result;
+}
+
+//
+// Tail of the vector kernels, Base is the index of Values[0].
+//
+
+inline void AccumulateMoments(const uint16_t* Values, size_t Count, uint64_t Base, Moments16& Result)
+{
+    for (size_t i = 0; i < Count; i++)
+    {
+        const uint64_t Value = Values[i];
+
+        Result.Sum += Value;
+        Result.SumSquares += Value * Value;
+        Result.SumIndex += (Base + i) * Value;
+    }
+}
+
+inline Moments16 Moments(const uint16_t* Values, size_t Count)
+{
+    Moments16 Result = {};
+
+    AccumulateMoments(Values, Count, 0, Result);
+    return Result;
+}
+
+//
+// The vector versions of Moments keep, per lane, the running sum Y of the
+// lane and the sum Z of its running sums over the T iterations. The index
+// weighted sum of a lane is then L * (T * Y - Z) + Lane * Y, exactly as in
+// the reference, modulo 2^64.
+//
+
+inline void FoldMomentLanes(const uint64_t* Y, const uint64_t* Z, size_t Lanes, uint64_t Iterations, Moments16& Result)
+{
+    for (size_t Lane = 0; Lane < Lanes; Lane++)
+    {
+        Result.Sum += Y[Lane];
+        Result.SumIndex += Lanes * (Iterations * Y[Lane] - Z[Lane]) + Lane * Y[Lane];
+    }
+}
+
+} // namespace Scalar
+
+inline const Kernels& ScalarKernels()
+{
+    static const Kernels Table =
+    {
+        "scalar",
+        Scalar::DotVoltageCurrent,
+        Scalar::CountLess,
+        Scalar::CountGreater,
+        Scalar::MinMax,
+        Scalar::Moments,
+    };
+
+    return Table;
+}
+
+#if defined(ASTON_TELEMETRY_X86)
+
+//---------------------------------------------------------------------- SSE4.1
+
+namespace Sse41
+{
+
+ASTON_TELEMETRY_TARGET("sse4.1")
+inline int64_t DotVoltageCurrent(const uint16_t* Voltage, const int16_t* Current, size_t Count)
+{
+    __m128i Accumulator = _mm_setzero_si128();
+    alignas(16) uint64_t Lanes[2];
+    size_t i = 0;
+
+    for (; i + 4 <= Count; i += 4)
+    {
+        const __m128i V = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(Voltage + i)));
+        const __m128i C = _mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(Current + i)));
+        const __m128i Product = _mm_mullo_epi32(V, C);
+
+        Accumulator = _mm_add_epi64(Accumulator, _mm_cvtepi32_epi64(Product));
+        Accumulator = _mm_add_epi64(Accumulator, _mm_cvtepi32_epi64(_mm_srli_si128(Product, 8)));
+    }
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(Lanes), Accumulator);
+    return static_cast<int64_t>(Lanes[0] + Lanes[1] +
+        static_cast<uint64_t>(Scalar::DotVoltageCurrent(Voltage + i, Current + i, Count - i)));
+}
+
+ASTON_TELEMETRY_TARGET("sse4.1")
+inline uint64_t CountLess(const int32_t* Values, size_t Count, int32_t Threshold)
+{
+    const __m128i Limit = _mm_set1_epi32(Threshold);
+    alignas(16) uint32_t Lanes[4];
+    uint64_t Total = 0;
+    size_t i = 0;
+
+    while (Count - i >= 4)
+    {
+        const size_t End = i + std::min<size_t>((Count - i) & ~size_t(3), size_t(4) << 16);
+        __m128i Accumulator = _mm_setzero_si128();
+
+        for (; i < End; i += 4)
+        {
+            const __m128i X = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Values + i));
+
+            Accumulator = _mm_sub_epi32(Accumulator, _mm_cmpgt_epi32(Limit, X));
+        }
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(Lanes), Accumulator);
+        Total += uint64_t(Lanes[0]) + Lanes[1] + Lanes[2] + Lanes[3];
+    }
+
+    return Total + Scalar::CountLess(Values + i, Count - i, Threshold);
+}
+
+ASTON_TELEMETRY_TARGET("sse4.1")
+inline uint64_t CountGreater(const uint16_t* Values, size_t Count, uint16_t Threshold)
+{
+    alignas(16) int32_t Lanes[4];
+    uint64_t Total = 0;
+    size_t i = 0;
+
+    if (Threshold == std::numeric_limits<uint16_t>::max())
+    {
+        return 0;
+    }
+
+    //
+    // x > t is max(x, t + 1) == x; the 16 bit lane counters are flushed
+    // before they can reach 2^15.
+    //
+
+    const __m128i Limit = _mm_set1_epi16(static_cast<short>(Threshold + 1));
+    const __m128i Ones = _mm_set1_epi16(1);
+
+    while (Count - i >= 8)
+    {
+        const size_t End = i + std::min<size_t>((Count - i) & ~size_t(7), size_t(8) << 14);
+        __m128i Accumulator = _mm_setzero_si128();
+
+        for (; i < End; i += 8)
+        {
+            const __m128i X = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Values + i));
+
+            Accumulator = _mm_sub_epi16(Accumulator, _mm_cmpeq_epi16(_mm_max_epu16(X, Limit), X));
+        }
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(Lanes), _mm_madd_epi16(Accumulator, Ones));
+        Total += uint64_t(Lanes[0]) + Lanes[1] + Lanes[2] + Lanes[3];
+    }
+
+    return Total + Scalar::CountGreater(Values + i, Count - i, Threshold);
+}
+
+ASTON_TELEMETRY_TARGET("sse4.1")
+inline MinMax16 MinMax(const uint16_t* Values, size_t Count)
+{
+    __m128i Low = _mm_set1_epi16(-1);
+    __m128i High = _mm_setzero_si128();
+    alignas(16) uint16_t LowLanes[8];
+    alignas(16) uint16_t HighLanes[8];
+    MinMax16 Result;
+    size_t i = 0;
+
+    for (; i + 8 <= Count; i += 8)
+    {
+        const __m128i X = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Values + i));
+
+        Low = _mm_min_epu16(Low, X);
+        High = _mm_max_epu16(High, X);
+    }
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(LowLanes), Low);
+    _mm_store_si128(reinterpret_cast<__m128i*>(HighLanes), High);
+    Result = Scalar::MinMax(Values + i, Count - i);
+    for (size_t Lane = 0; Lane < 8; Lane++)
+    {
+        Result.Min = std::min(Result.Min, LowLanes[Lane]);
+        Result.Max = std::max(Result.Max, HighLanes[Lane]);
+    }
+
+    return Result;
+}
+
+ASTON_TELEMETRY_TARGET("sse4.1")
+inline Moments16 Moments(const uint16_t* Values, size_t Count)
+{
+    __m128i Y[2] = { _mm_setzero_si128(), _mm_setzero_si128() };
+    __m128i Z[2] = { _mm_setzero_si128(), _mm_setzero_si128() };
+    __m128i Squares = _mm_setzero_si128();
+    alignas(16) uint64_t YLanes[4];
+    alignas(16) uint64_t ZLanes[4];
+    alignas(16) uint64_t SquareLanes[2];
+    Moments16 Result = {};
+    uint64_t Iterations = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= Count; i += 4)
+    {
+        const __m128i X = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(Values + i)));
+        const __m128i Square = _mm_mullo_epi32(X, X);
+
+        Y[0] = _mm_add_epi64(Y[0], _mm_cvtepu32_epi64(X));
+        Y[1] = _mm_add_epi64(Y[1], _mm_cvtepu32_epi64(_mm_srli_si128(X, 8)));
+        Z[0] = _mm_add_epi64(Z[0], Y[0]);
+        Z[1] = _mm_add_epi64(Z[1], Y[1]);
+        Squares = _mm_add_epi64(Squares, _mm_cvtepu32_epi64(Square));
+        Squares = _mm_add_epi64(Squares, _mm_cvtepu32_epi64(_mm_srli_si128(Square, 8)));
+        Iterations += 1;
+    }
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(YLanes), Y[0]);
+    _mm_store_si128(reinterpret_cast<__m128i*>(YLanes + 2), Y[1]);
+    _mm_store_si128(reinterpret_cast<__m128i*>(ZLanes), Z[0]);
+    _mm_store_si128(reinterpret_cast<__m128i*>(ZLanes + 2), Z[1]);
+    _mm_store_si128(reinterpret_cast<__m128i*>(SquareLanes), Squares);
+
+    Result.SumSquares = SquareLanes[0] + SquareLanes[1];
+    Scalar::FoldMomentLanes(YLanes, ZLanes, 4, Iterations, Result);
+    Scalar::AccumulateMoments(Values + i, Count - i, i, Result);
+    return Result;
+}
+
+} // namespace Sse41
+
+//------------------------------------------------------------------------ AVX2
+
+namespace Avx2
+{
+
+ASTON_TELEMETRY_TARGET("avx2")
+inline int64_t DotVoltageCurrent(const uint16_t* Voltage, const int16_t* Current, size_t Count)
+{
+    __m256i Accumulator = _mm256_setzero_si256();
+    alignas(32) uint64_t Lanes[4];
+    size_t i = 0;
+
+    for (; i + 8 <= Count; i += 8)
+    {
+        const __m256i V = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Voltage + i)));
+        const __m256i C = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Current + i)));
+        const __m256i Product = _mm256_mullo_epi32(V, C);
+
+        Accumulator = _mm256_add_epi64(Accumulator, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(Product)));
+        Accumulator = _mm256_add_epi64(Accumulator, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(Product, 1)));
+    }
+
+    _mm256_store_si256(reinterpret_cast<__m256i*>(Lanes), Accumulator);
+    return static_cast<int64_t>(Lanes[0] + Lanes[1] + Lanes[2] + Lanes[3] +
+        static_cast<uint64_t>(Scalar::DotVoltageCurrent(Voltage + i, Current + i, Count - i)));
+}
+
+ASTON_TELEMETRY_TARGET("avx2")
+inline uint64_t CountLess(const int32_t* Values, size_t Count, int32_t Threshold)
+{
+    const __m256i Limit = _mm256_set1_epi32(Threshold);
+    alignas(32) uint32_t Lanes[8];
+    uint64_t Total = 0;
+    size_t i = 0;
+
+    while (Count - i >= 8)
+    {
+        const size_t End = i + std::min<size_t>((Count - i) & ~size_t(7), size_t(8) << 16);
+        __m256i Accumulator = _mm256_setzero_si256();
+
+        for (; i < End; i += 8)
+        {
+            const __m256i X = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Values + i));
+
+            Accumulator = _mm256_sub_epi32(Accumulator, _mm256_cmpgt_epi32(Limit, X));
+        }
+
+        _mm256_store_si256(reinterpret_cast<__m256i*>(Lanes), Accumulator);
+        for (uint32_t Lane : Lanes)
+        {
+            Total += Lane;
+        }
+    }
+
+    return Total + Scalar::CountLess(Values + i, Count - i, Threshold);
+}
+
+ASTON_TELEMETRY_TARGET("avx2")
+inline uint64_t CountGreater(const uint16_t* Values, size_t Count, uint16_t Threshold)
+{
+    alignas(32) int32_t Lanes[8];
+    uint64_t Total = 0;
+    size_t i = 0;
+
+    if (Threshold == std::numeric_limits<uint16_t>::max())
+    {
+        return 0;
+    }
+
+    const __m256i Limit = _mm256_set1_epi16(static_cast<short>(Threshold + 1));
+    const __m256i Ones = _mm256_set1_epi16(1);
+
+    while (Count - i >= 16)
+    {
+        const size_t End = i + std::min<size_t>((Count - i) & ~size_t(15), size_t(16) << 14);
+        __m256i Accumulator = _mm256_setzero_si256();
+
+        for (; i < End; i += 16)
+        {
+            const __m256i X = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Values + i));
+
+            Accumulator = _mm256_sub_epi16(Accumulator, _mm256_cmpeq_epi16(_mm256_max_epu16(X, Limit), X));
+        }
+
+        _mm256_store_si256(reinterpret_cast<__m256i*>(Lanes), _mm256_madd_epi16(Accumulator, Ones));
+        for (int32_t Lane : Lanes)
+        {
+            Total += static_cast<uint32_t>(Lane);
+        }
+    }
+
+    return Total + Scalar::CountGreater(Values + i, Count - i, Threshold);
+}
+
+ASTON_TELEMETRY_TARGET("avx2")
+inline MinMax16 MinMax(const uint16_t* Values, size_t Count)
+{
+    __m256i Low = _mm256_set1_epi16(-1);
+    __m256i High = _mm256_setzero_si256();
+    alignas(32) uint16_t LowLanes[16];
+    alignas(32) uint16_t HighLanes[16];
+    MinMax16 Result;
+    size_t i = 0;
+
+    for (; i + 16 <= Count; i += 16)
+    {
+        const __m256i X = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Values + i));
+
+        Low = _mm256_min_epu16(Low, X);
+        High = _mm256_max_epu16(High, X);
+    }
+
+    _mm256_store_si256(reinterpret_cast<__m256i*>(LowLanes), Low);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(HighLanes), High);
+    Result = Scalar::MinMax(Values + i, Count - i);
+    for (size_t Lane = 0; Lane < 16; Lane++)
+    {
+        Result.Min = std::min(Result.Min, LowLanes[Lane]);
+        Result.Max = std::max(Result.Max, HighLanes[Lane]);
+    }
+
+    return Result;
+}
+
+ASTON_TELEMETRY_TARGET("avx2")
+inline Moments16 Moments(const uint16_t* Values, size_t Count)
+{
+    __m256i Y[2] = { _mm256_setzero_si256(), _mm256_setzero_si256() };
+    __m256i Z[2] = { _mm256_setzero_si256(), _mm256_setzero_si256() };
+    __m256i Squares = _mm256_setzero_si256();
+    alignas(32) uint64_t YLanes[8];
+    alignas(32) uint64_t ZLanes[8];
+    alignas(32) uint64_t SquareLanes[4];
+    Moments16 Result = {};
+    uint64_t Iterations = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= Count; i += 8)
+    {
+        const __m256i X = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Values + i)));
+        const __m256i Square = _mm256_mullo_epi32(X, X);
+
+        Y[0] = _mm256_add_epi64(Y[0], _mm256_cvtepu32_epi64(_mm256_castsi256_si128(X)));
+        Y[1] = _mm256_add_epi64(Y[1], _mm256_cvtepu32_epi64(_mm256_extracti128_si256(X, 1)));
+        Z[0] = _mm256_add_epi64(Z[0], Y[0]);
+        Z[1] = _mm256_add_epi64(Z[1], Y[1]);
+        Squares = _mm256_add_epi64(Squares, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(Square)));
+        Squares = _mm256_add_epi64(Squares, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(Square, 1)));
+        Iterations += 1;
+    }
+
+    _mm256_store_si256(reinterpret_cast<__m256i*>(YLanes), Y[0]);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(YLanes + 4), Y[1]);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(ZLanes), Z[0]);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(ZLanes + 4), Z[1]);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(SquareLanes), Squares);
+
+    Result.SumSquares = SquareLanes[0] + SquareLanes[1] + SquareLanes[2] + SquareLanes[3];
+    Scalar::FoldMomentLanes(YLanes, ZLanes, 8, Iterations, Result);
+    Scalar::AccumulateMoments(Values + i, Count - i, i, Result);
+    return Result;
+}
+
+} // namespace Avx2
+
+inline const Kernels& Sse41Kernels()
+{
+    static const Kernels Table =
+    {
+        "sse4.1",
+        Sse41::DotVoltageCurrent,
+        Sse41::CountLess,
+        Sse41::CountGreater,
+        Sse41::MinMax,
+        Sse41::Moments,
+    };
+
+    return Table;
+}
+
+inline const Kernels& Avx2Kernels()
+{
+    static const Kernels Table =
+    {
+        "avx2",
+        Avx2::DotVoltageCurrent,
+        Avx2::CountLess,
+        Avx2::CountGreater,
+        Avx2::MinMax,
+        Avx2::Moments,
+    };
+
+    return Table;
+}
+
+namespace Detail
+{
+
+inline bool CpuSupports(int Leaf, int Register, int Bit)
+{
+#if defined(_MSC_VER)
+    int Info[4];
+
+    __cpuidex(Info, Leaf, 0);
+    return (Info[Register] & (1 << Bit)) != 0;
+#else
+    (void)Leaf;
+    (void)Register;
+    (void)Bit;
+    return false;
+#endif
+}
+
+inline bool HasSse41()
+{
+#if defined(_MSC_VER)
+    return CpuSupports(1, 2, 19);
+#else
+    return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+inline bool HasAvx2()
+{
+#if defined(_MSC_VER)
+    return CpuSupports(1, 2, 27) && (_xgetbv(0) & 6) == 6 && CpuSupports(7, 1, 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+} // namespace Detail
+
+#endif // ASTON_TELEMETRY_X86
+
+#if defined(ASTON_TELEMETRY_NEON)
+
+//------------------------------------------------------------------------ NEON
+
+namespace Neon
+{
+
+inline int64_t DotVoltageCurrent(const uint16_t* Voltage, const int16_t* Current, size_t Count)
+{
+    int64x2_t Accumulator = vdupq_n_s64(0);
+    size_t i = 0;
+
+    for (; i + 8 <= Count; i += 8)
+    {
+        const uint16x8_t V = vld1q_u16(Voltage + i);
+        const int16x8_t C = vld1q_s16(Current + i);
+        const int32x4_t Low = vmulq_s32(vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(V))), vmovl_s16(vget_low_s16(C)));
+        const int32x4_t High = vmulq_s32(vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(V))), vmovl_s16(vget_high_s16(C)));
+
+        Accumulator = vpadalq_s32(Accumulator, Low);
+        Accumulator = vpadalq_s32(Accumulator, High);
+    }
+
+    return static_cast<int64_t>(vaddvq_u64(vreinterpretq_u64_s64(Accumulator)) +
+        static_cast<uint64_t>(Scalar::DotVoltageCurrent(Voltage + i, Current + i, Count - i)));
+}
+
+inline uint64_t CountLess(const int32_t* Values, size_t Count, int32_t Threshold)
+{
+    const int32x4_t Limit = vdupq_n_s32(Threshold);
+    uint64_t Total = 0;
+    size_t i = 0;
+
+    while (Count - i >= 4)
+    {
+        const size_t End = i + std::min<size_t>((Count - i) & ~size_t(3), size_t(4) << 16);
+        uint32x4_t Accumulator = vdupq_n_u32(0);
+
+        for (; i < End; i += 4)
+        {
+            Accumulator = vsubq_u32(Accumulator, vcltq_s32(vld1q_s32(Values + i), Limit));
+        }
+
+        Total += vaddvq_u32(Accumulator);
+    }
+
+    return Total + Scalar::CountLess(Values + i, Count - i, Threshold);
+}
+
+inline uint64_t CountGreater(const uint16_t* Values, size_t Count, uint16_t Threshold)
+{
+    const uint16x8_t Limit = vdupq_n_u16(Threshold);
+    uint64_t Total = 0;
+    size_t i = 0;
+
+    while (Count - i >= 8)
+    {
+        const size_t End = i + std::min<size_t>((Count - i) & ~size_t(7), size_t(8) << 15);
+        uint16x8_t Accumulator = vdupq_n_u16(0);
+
+        for (; i < End; i += 8)
+        {
+            Accumulator = vsubq_u16(Accumulator, vcgtq_u16(vld1q_u16(Values + i), Limit));
+        }
+
+        Total += vaddlvq_u16(Accumulator);
+    }
+
+    return Total + Scalar::CountGreater(Values + i, Count - i, Threshold);
+}
+
+inline MinMax16 MinMax(const uint16_t* Values, size_t Count)
+{
+    uint16x8_t Low = vdupq_n_u16(std::numeric_limits<uint16_t>::max());
+    uint16x8_t High = vdupq_n_u16(0);
+    MinMax16 Result;
+    size_t i = 0;
+
+    for (; i + 8 <= Count; i += 8)
+    {
+        const uint16x8_t X = vld1q_u16(Values + i);
+
+        Low = vminq_u16(Low, X);
+        High = vmaxq_u16(High, X);
+    }
+
+    Result = Scalar::MinMax(Values + i, Count - i);
+    Result.Min = std::min(Result.Min, vminvq_u16(Low));
+    Result.Max = std::max(Result.Max, vmaxvq_u16(High));
+    return Result;
+}
+
+inline Moments16 Moments(const uint16_t* Values, size_t Count)
+{
+    uint64x2_t Y[4] = { vdupq_n_u64(0), vdupq_n_u64(0), vdupq_n_u64(0), vdupq_n_u64(0) };
+    uint64x2_t Z[4] = { vdupq_n_u64(0), vdupq_n_u64(0), vdupq_n_u64(0), vdupq_n_u64(0) };
+    uint64x2_t Squares = vdupq_n_u64(0);
+    uint64_t YLanes[8];
+    uint64_t ZLanes[8];
+    Moments16 Result = {};
+    uint64_t Iterations = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= Count; i += 8)
+    {
+        const uint16x8_t X = vld1q_u16(Values + i);
+        const uint32x4_t Low = vmovl_u16(vget_low_u16(X));
+        const uint32x4_t High = vmovl_u16(vget_high_u16(X));
+
+        Y[0] = vaddw_u32(Y[0], vget_low_u32(Low));
+        Y[1] = vaddw_u32(Y[1], vget_high_u32(Low));
+        Y[2] = vaddw_u32(Y[2], vget_low_u32(High));
+        Y[3] = vaddw_u32(Y[3], vget_high_u32(High));
+
+        for (size_t Part = 0; Part < 4; Part++)
+        {
+            Z[Part] = vaddq_u64(Z[Part], Y[Part]);
+        }
+
+        Squares = vpadalq_u32(Squares, vmull_u16(vget_low_u16(X), vget_low_u16(X)));
+        Squares = vpadalq_u32(Squares, vmull_u16(vget_high_u16(X), vget_high_u16(X)));
+        Iterations += 1;
+    }
+
+    for (size_t Part = 0; Part < 4; Part++)
+    {
+        vst1q_u64(YLanes + Part * 2, Y[Part]);
+        vst1q_u64(ZLanes + Part * 2, Z[Part]);
+    }
+
+    Result.SumSquares = vaddvq_u64(Squares);
+    Scalar::FoldMomentLanes(YLanes, ZLanes, 8, Iterations, Result);
+    Scalar::AccumulateMoments(Values + i, Count - i, i, Result);
+    return Result;
+}
+
+} // namespace Neon
+
+inline const Kernels& NeonKernels()
+{
+    static const Kernels Table =
+    {
+        "neon",
+        Neon::DotVoltageCurrent,
+        Neon::CountLess,
+        Neon::CountGreater,
+        Neon::MinMax,
+        Neon::Moments,
+    };
+
+    return Table;
+}
+
+#endif // ASTON_TELEMETRY_NEON
+
+//------------------------------------------------------------------- Dispatch
+
+//
+// Implementations the running processor supports, the reference first.
+//
+
+inline std::vector<const Kernels*> AvailableKernels()
+{
+    std::vector<const Kernels*> Result;
+
+    Result.push_back(&ScalarKernels());
+
+#if defined(ASTON_TELEMETRY_X86)
+    if (Detail::HasSse41())
+    {
+        Result.push_back(&Sse41Kernels());
+    }
+
+    if (Detail::HasAvx2())
+    {
+        Result.push_back(&Avx2Kernels());
+    }
+#elif defined(ASTON_TELEMETRY_NEON)
+    Result.push_back(&NeonKernels());
+#endif
+
+    return Result;
+}
+
+inline const Kernels& BestKernels()
+{
+    static const Kernels* Best = AvailableKernels().back();
+
+    return *Best;
+}
+
+//------------------------------------------------------------------ Analytics
+
+//
+// Energy of a run of evenly spaced samples, in nJ (mV * mA * ms).
+//
+
+inline int64_t Energy(const uint16_t* Voltage, const int16_t* Current, size_t Count, int64_t PeriodMs,
+                      const Kernels& Implementation = BestKernels())
+{
+    return static_cast<int64_t>(static_cast<uint64_t>(Implementation.DotVoltageCurrent(Voltage, Current, Count)) *
+                                static_cast<uint64_t>(PeriodMs));
+}
+
+//
+// Energy per interval of IntervalTicks, in nJ, over time ordered samples.
+// Element k covers [Timestamp[0] + k * IntervalTicks, + IntervalTicks).
+//
+
+inline std::vector<int64_t> IntervalEnergy(const int64_t* Timestamp, const uint16_t* Voltage, const int16_t* Current,
+                                           size_t Count, int64_t IntervalTicks, int64_t PeriodMs,
+                                           const Kernels& Implementation = BestKernels())
+{
+    std::vector<int64_t> Result;
+    size_t First = 0;
+
+    if (Count == 0 || IntervalTicks <= 0)
+    {
+        return Result;
+    }
+
+    for (int64_t Start = Timestamp[0]; First < Count; Start += IntervalTicks)
+    {
+        const size_t Last = static_cast<size_t>(
+            std::lower_bound(Timestamp + First, Timestamp + Count, Start + IntervalTicks) - Timestamp);
+
+        Result.push_back(Energy(Voltage + First, Current + First, Last - First, PeriodMs, Implementation));
+        First = Last;
+    }
+
+    return Result;
+}
+
+//
+// Smallest value v of the column such that at least Percent of the values
+// are <= v, found by bisection with CountLess.
+//
+
+inline int32_t Percentile(const int32_t* Values, size_t Count, double Percent,
+                          const Kernels& Implementation = BestKernels())
+{
+    const double Clamped = std::min(std::max(Percent, 0.0), 100.0);
+    const uint64_t Rank = std::max<uint64_t>(1, static_cast<uint64_t>(Clamped * Count / 100.0 + 0.999999));
+    int64_t Low = std::numeric_limits<int32_t>::min();
+    int64_t High = std::numeric_limits<int32_t>::max();
+
+    if (Count == 0)
+    {
+        return 0;
+    }
+
+    while (Low < High)
+    {
+        const int64_t Middle = Low + (High - Low) / 2;
+
+        if (Implementation.CountLess(Values, Count, static_cast<int32_t>(Middle + 1)) >= Rank)
+        {
+            High = Middle;
+        }
+        else
+        {
+            Low = Middle + 1;
+        }
+    }
+
+    return static_cast<int32_t>(Low);
+}
+
+//
+// Number of samples above a temperature, in 0.1 K.
+//
+
+inline uint64_t TemperatureExcursions(const uint16_t* Temperature, size_t Count, uint16_t Threshold,
+                                      const Kernels& Implementation = BestKernels())
+{
+    return Implementation.CountGreater(Temperature, Count, Threshold);
+}
+
+//
+// Least squares line through evenly spaced capacity samples, in mAh per
+// sample.
+//
+
+struct Regression
+{
+    double Slope;
+    double Intercept;
+};
+
+inline Regression CapacityFade(const uint16_t* Capacity, size_t Count,
+                               const Kernels& Implementation = BestKernels())
+{
+    const Moments16 Sums = Implementation.Moments(Capacity, Count);
+    const long double N = static_cast<long double>(Count);
+    const long double SumX = N * (N - 1) / 2;
+    const long double SumXX = (N - 1) * N * (2 * N - 1) / 6;
+    const long double Denominator = N * SumXX - SumX * SumX;
+    Regression Result = {};
+
+    if (Count < 2 || Denominator == 0)
+    {
+        return Result;
+    }
+
+    Result.Slope = static_cast<double>((N * Sums.SumIndex - SumX * Sums.Sum) / Denominator);
+    Result.Intercept = static_cast<double>((Sums.Sum - Result.Slope * SumX) / N);
+    return Result;
+}
+
+} // namespace Analytics
+} // namespace AstonTelemetry
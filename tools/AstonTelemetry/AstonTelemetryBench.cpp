@@ -0,0 +1,161 @@
+/*++
+
+Module Name:
+
+    AstonTelemetryBench.cpp
+
+Abstract:
+
+    This module benchmarks the kernels of AstonTelemetryAnalytics.h on
+    synthetic columns and checks every implementation the processor
+    supports against the scalar reference. Throughput is reported in GB/s of
+    column data read. Exits with 1 if any result differs.
+
+        cmake -S . -B build -DCMAKE_BUILD_TYPE=Release
+        cmake --build build --target AstonTelemetryBench
+        build/tools/AstonTelemetry/AstonTelemetryBench [rows]
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "AstonTelemetryAnalytics.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+using namespace AstonTelemetry::Analytics;
+
+//------------------------------------------------------------------ Definitions
+
+namespace
+{
+
+constexpr int Repetitions = 10;
+
+struct Columns
+{
+    std::vector<uint16_t> Voltage;
+    std::vector<int16_t> Current;
+    std::vector<int32_t> Rate;
+    std::vector<uint16_t> Temperature;
+    std::vector<uint16_t> Capacity;
+};
+
+//
+// A discharge with noise on every column, the exact values do not matter
+// but the thresholds below must split them.
+//
+
+Columns Generate(size_t Rows)
+{
+    std::mt19937 Random(0x41535421);
+    std::uniform_int_distribution<int> Noise(-64, 64);
+    Columns Result;
+
+    Result.Voltage.resize(Rows);
+    Result.Current.resize(Rows);
+    Result.Rate.resize(Rows);
+    Result.Temperature.resize(Rows);
+    Result.Capacity.resize(Rows);
+
+    for (size_t i = 0; i < Rows; i++)
+    {
+        Result.Voltage[i] = static_cast<uint16_t>(8400 - (i * 1600) / Rows + Noise(Random));
+        Result.Current[i] = static_cast<int16_t>(-1500 + Noise(Random) * 16);
+        Result.Rate[i] = static_cast<int32_t>(Result.Voltage[i]) * Result.Current[i] / 1000;
+        Result.Temperature[i] = static_cast<uint16_t>(3032 + Noise(Random) * 2);
+        Result.Capacity[i] = static_cast<uint16_t>(4500 - (i * 450) / Rows + Noise(Random) / 8);
+    }
+
+    return Result;
+}
+
+template <typename Function>
+double BestSeconds(Function&& Body)
+{
+    double Best = 1e30;
+
+    for (int Repetition = 0; Repetition < Repetitions; Repetition++)
+    {
+        const auto Start = std::chrono::steady_clock::now();
+
+        Body();
+
+        const std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+
+        Best = std::min(Best, Elapsed.count());
+    }
+
+    return Best;
+}
+
+bool g_Mismatch = false;
+
+template <typename Result, typename Function>
+void Run(const char* Kernel, const Kernels& Implementation, size_t Bytes, const Result& Reference, Function&& Body)
+{
+    Result Value = {};
+    const double Seconds = BestSeconds([&] { Value = Body(); });
+    const bool Match = std::memcmp(&Value, &Reference, sizeof(Result)) == 0;
+
+    std::printf("%-14s %-8s %8.2f GB/s  %s\n",
+                Kernel,
+                Implementation.Name,
+                Bytes / Seconds / 1e9,
+                Match ? "ok" : "MISMATCH");
+
+    g_Mismatch |= !Match;
+}
+
+} // namespace
+
+//-------------------------------------------------------------------- Functions
+
+int main(int argc, char** argv)
+{
+    const size_t Rows = (argc > 1) ? std::strtoull(argv[1], nullptr, 0) : (size_t(1) << 24);
+    const Columns Data = Generate(Rows);
+    const Kernels& Reference = ScalarKernels();
+    const uint16_t* Voltage = Data.Voltage.data();
+    const int16_t* Current = Data.Current.data();
+    const int32_t* Rate = Data.Rate.data();
+    const uint16_t* Temperature = Data.Temperature.data();
+    const uint16_t* Capacity = Data.Capacity.data();
+
+    const int64_t Dot = Reference.DotVoltageCurrent(Voltage, Current, Rows);
+    const uint64_t Less = Reference.CountLess(Rate, Rows, -12000);
+    const uint64_t Greater = Reference.CountGreater(Temperature, Rows, 3100);
+    const MinMax16 Extremes = Reference.MinMax(Temperature, Rows);
+    const Moments16 Sums = Reference.Moments(Capacity, Rows);
+
+    std::printf("%zu rows, best of %d\n\n", Rows, Repetitions);
+
+    for (const Kernels* Implementation : AvailableKernels())
+    {
+        const Kernels& K = *Implementation;
+
+        Run("energy", K, Rows * 4, Dot, [&] { return K.DotVoltageCurrent(Voltage, Current, Rows); });
+        Run("count-less", K, Rows * 4, Less, [&] { return K.CountLess(Rate, Rows, -12000); });
+        Run("count-greater", K, Rows * 2, Greater, [&] { return K.CountGreater(Temperature, Rows, 3100); });
+        Run("min-max", K, Rows * 2, Extremes, [&] { return K.MinMax(Temperature, Rows); });
+        Run("moments", K, Rows * 2, Sums, [&] { return K.Moments(Capacity, Rows); });
+        std::printf("\n");
+    }
+
+    const Regression Fade = CapacityFade(Capacity, Rows);
+
+    std::printf("energy %.3f J, rate p50 %d mW, p95 %d mW, %llu samples above 37 C, fade %.6g mAh/sample\n",
+                Energy(Voltage, Current, Rows, 1) / 1e9,
+                Percentile(Rate, Rows, 50.0),
+                Percentile(Rate, Rows, 95.0),
+                static_cast<unsigned long long>(TemperatureExcursions(Temperature, Rows, 3100)),
+                Fade.Slope);
+
+    return g_Mismatch ? 1 : 0;
+}
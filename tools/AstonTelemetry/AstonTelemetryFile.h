@@ -0,0 +1,775 @@
+/*++
+
+Module Name:
+
+    AstonTelemetryFile.h
+
+Abstract:
+
+    This module defines the columnar file format used for history dumps of
+    the Aston battery driver, along with a portable, header only C++17
+    writer and reader. The reader maps the file and hands out the columns
+    in place, without copying or decoding them.
+
+    Files are produced from the blob returned by
+    IOCTL_ASTON_BATTERY_QUERY_HISTORY or IOCTL_ASTON_BATTERY_QUERY_ARCHIVE,
+    see Public.h of the driver, and can be read on any little endian host.
+
+    Layout, all integers little endian, all offsets from the start of the
+    file:
+
+        FILE_HEADER                 64 bytes
+        COLUMN_DESCRIPTOR[]         ColumnCount entries
+        chunk 0:
+            column 0 values         RowCount values, 64 byte aligned
+            ...
+            column N values
+            CHUNK_FOOTER            RowCount and per column offset, min
+                                    and max, 64 byte aligned
+        ...
+        chunk directory             ChunkCount footer offsets, at
+                                    FILE_HEADER::DirectoryOffset
+
+    The min and max of every column of a chunk sit in its footer so that a
+    range scan can skip chunks without touching their values. Readers must
+    reject files with a SchemaVersion they do not know; new columns are
+    added with new column ids, which readers ignore.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+#pragma once
+
+//--------------------------------------------------------------------- Includes
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace AstonTelemetry
+{
+
+//------------------------------------------------------------------ Definitions
+
+constexpr char FileMagic[8] = { 'A', 'S', 'T', 'N', 'T', 'L', 'M', '\0' };
+constexpr uint32_t SchemaVersion = 1;
+constexpr uint32_t DefaultRowsPerChunk = 4096;
+constexpr uint64_t ChunkAlignment = 64;
+
+//
+// Columns of a history dump, in the order and with the units of the
+// history blob of the driver.
+//
+
+enum class ColumnId : uint32_t
+{
+    Timestamp = 0,          // int64, performance counter ticks
+    Rate = 1,               // int32, mW, positive while charging
+    SafetyStatus = 2,       // uint32
+    Voltage = 3,            // uint16, mV
+    Current = 4,            // int16, mA, positive while charging
+    Temperature = 5,        // uint16, 0.1 K
+    RemainingCapacity = 6,  // uint16, mAh
+    FullChargeCapacity = 7, // uint16, mAh
+    BatteryStatus = 8,      // uint16
+};
+
+constexpr uint32_t ColumnCount = 9;
+
+enum class ColumnType : uint32_t
+{
+    Int64 = 0,
+    Int32 = 1,
+    UInt32 = 2,
+    UInt16 = 3,
+    Int16 = 4,
+};
+
+#pragma pack(push, 1)
+
+struct FILE_HEADER
+{
+    char Magic[8];
+    uint32_t SchemaVersion;
+    uint32_t HeaderSize;
+    uint32_t ColumnCount;
+    uint32_t ChunkCount;
+    uint32_t RowsPerChunk;
+    uint32_t Flags;
+    uint64_t RowCount;
+    int64_t QpcFrequency;
+    uint64_t DirectoryOffset;
+    uint64_t Reserved;
+};
+
+struct COLUMN_DESCRIPTOR
+{
+    uint32_t Id;
+    uint32_t Type;
+};
+
+struct CHUNK_COLUMN
+{
+    uint64_t Offset;
+    int64_t Min;
+    int64_t Max;
+};
+
+struct CHUNK_FOOTER
+{
+    uint64_t FirstRow;
+    uint32_t RowCount;
+    uint32_t ColumnCount;
+    // CHUNK_COLUMN Columns[ColumnCount];
+};
+
+//
+// Mirror of ASTON_BATTERY_HISTORY_HEADER from Public.h of the driver
+//
+
+struct HISTORY_BLOB_HEADER
+{
+    uint32_t Version;
+    uint32_t Size;
+    uint32_t Capacity;
+    uint32_t Count;
+    uint64_t TotalSamples;
+    int64_t QpcFrequency;
+    uint32_t ColumnOffset[ColumnCount];
+    uint32_t Reserved;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(FILE_HEADER) == 64, "FILE_HEADER must stay 64 bytes");
+static_assert(sizeof(HISTORY_BLOB_HEADER) == 72, "HISTORY_BLOB_HEADER must match the driver");
+
+constexpr ColumnType ColumnTypes[ColumnCount] =
+{
+    ColumnType::Int64,
+    ColumnType::Int32,
+    ColumnType::UInt32,
+    ColumnType::UInt16,
+    ColumnType::Int16,
+    ColumnType::UInt16,
+    ColumnType::UInt16,
+    ColumnType::UInt16,
+    ColumnType::UInt16,
+};
+
+constexpr size_t ColumnTypeSize(ColumnType Type)
+{
+    switch (Type)
+    {
+    case ColumnType::Int64:
+        return sizeof(int64_t);
+    case ColumnType::Int32:
+    case ColumnType::UInt32:
+        return sizeof(uint32_t);
+    default:
+        return sizeof(uint16_t);
+    }
+}
+
+template <typename T>
+constexpr ColumnType ColumnTypeOf();
+
+template <> constexpr ColumnType ColumnTypeOf<int64_t>() { return ColumnType::Int64; }
+template <> constexpr ColumnType ColumnTypeOf<int32_t>() { return ColumnType::Int32; }
+template <> constexpr ColumnType ColumnTypeOf<uint32_t>() { return ColumnType::UInt32; }
+template <> constexpr ColumnType ColumnTypeOf<uint16_t>() { return ColumnType::UInt16; }
+template <> constexpr ColumnType ColumnTypeOf<int16_t>() { return ColumnType::Int16; }
+
+//
+// One sample of the history
+//
+
+struct Row
+{
+    int64_t Timestamp;
+    int32_t Rate;
+    uint32_t SafetyStatus;
+    uint16_t Voltage;
+    int16_t Current;
+    uint16_t Temperature;
+    uint16_t RemainingCapacity;
+    uint16_t FullChargeCapacity;
+    uint16_t BatteryStatus;
+};
+
+//
+// Read only view of the values of one column of one chunk
+//
+
+template <typename T>
+class ColumnView
+{
+public:
+    ColumnView() = default;
+    ColumnView(const T* Data, size_t Size) : m_Data(Data), m_Size(Size) {}
+
+    const T* data() const { return m_Data; }
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+    const T* begin() const { return m_Data; }
+    const T* end() const { return m_Data + m_Size; }
+    const T& operator[](size_t Index) const { return m_Data[Index]; }
+
+private:
+    const T* m_Data = nullptr;
+    size_t m_Size = 0;
+};
+
+//-------------------------------------------------------------------- Functions
+
+namespace Detail
+{
+
+inline bool IsLittleEndian()
+{
+    const uint16_t Probe = 1;
+    uint8_t First;
+
+    std::memcpy(&First, &Probe, sizeof(First));
+    return First == 1;
+}
+
+inline uint64_t AlignUp(uint64_t Value, uint64_t Alignment)
+{
+    return (Value + Alignment - 1) & ~(Alignment - 1);
+}
+
+template <typename T>
+inline void Append(std::vector<uint8_t>& Buffer, const T& Value)
+{
+    const uint8_t* Bytes = reinterpret_cast<const uint8_t*>(&Value);
+    Buffer.insert(Buffer.end(), Bytes, Bytes + sizeof(Value));
+}
+
+inline void Pad(std::vector<uint8_t>& Buffer, uint64_t Alignment)
+{
+    Buffer.resize(static_cast<size_t>(AlignUp(Buffer.size(), Alignment)), 0);
+}
+
+inline int64_t RowValue(const Row& Sample, uint32_t Column)
+{
+    switch (static_cast<ColumnId>(Column))
+    {
+    case ColumnId::Timestamp:
+        return Sample.Timestamp;
+    case ColumnId::Rate:
+        return Sample.Rate;
+    case ColumnId::SafetyStatus:
+        return Sample.SafetyStatus;
+    case ColumnId::Voltage:
+        return Sample.Voltage;
+    case ColumnId::Current:
+        return Sample.Current;
+    case ColumnId::Temperature:
+        return Sample.Temperature;
+    case ColumnId::RemainingCapacity:
+        return Sample.RemainingCapacity;
+    case ColumnId::FullChargeCapacity:
+        return Sample.FullChargeCapacity;
+    default:
+        return Sample.BatteryStatus;
+    }
+}
+
+inline void AppendValue(std::vector<uint8_t>& Buffer, ColumnType Type, int64_t Value)
+{
+    switch (Type)
+    {
+    case ColumnType::Int64:
+        Append(Buffer, static_cast<int64_t>(Value));
+        break;
+    case ColumnType::Int32:
+        Append(Buffer, static_cast<int32_t>(Value));
+        break;
+    case ColumnType::UInt32:
+        Append(Buffer, static_cast<uint32_t>(Value));
+        break;
+    case ColumnType::UInt16:
+        Append(Buffer, static_cast<uint16_t>(Value));
+        break;
+    case ColumnType::Int16:
+        Append(Buffer, static_cast<int16_t>(Value));
+        break;
+    }
+}
+
+template <typename T>
+inline T Load(const uint8_t* Base, uint64_t Offset)
+{
+    T Value;
+
+    std::memcpy(&Value, Base + Offset, sizeof(Value));
+    return Value;
+}
+
+} // namespace Detail
+
+//
+// Parses the blob returned by the history IOCTLs of the driver.
+//
+
+inline std::vector<Row> ParseHistoryBlob(const void* Blob, size_t Length, int64_t* QpcFrequency = nullptr)
+{
+    const uint8_t* Bytes = static_cast<const uint8_t*>(Blob);
+    HISTORY_BLOB_HEADER Header;
+    std::vector<Row> Rows;
+
+    if (Length < sizeof(Header))
+    {
+        throw std::runtime_error("history blob too short");
+    }
+
+    std::memcpy(&Header, Bytes, sizeof(Header));
+    if (Header.Version != 1 || Header.Size > Length)
+    {
+        throw std::runtime_error("unsupported history blob");
+    }
+
+    for (uint32_t Column = 0; Column < ColumnCount; Column++)
+    {
+        if (Header.ColumnOffset[Column] > Header.Size ||
+            static_cast<uint64_t>(Header.Count) * ColumnTypeSize(ColumnTypes[Column]) >
+                Header.Size - Header.ColumnOffset[Column])
+        {
+            throw std::runtime_error("history blob column out of bounds");
+        }
+    }
+
+    if (QpcFrequency != nullptr)
+    {
+        *QpcFrequency = Header.QpcFrequency;
+    }
+
+    Rows.resize(Header.Count);
+    for (uint32_t i = 0; i < Header.Count; i++)
+    {
+        Row& Sample = Rows[i];
+        const uint32_t* Offset = Header.ColumnOffset;
+
+        Sample.Timestamp = Detail::Load<int64_t>(Bytes, Offset[0] + i * sizeof(int64_t));
+        Sample.Rate = Detail::Load<int32_t>(Bytes, Offset[1] + i * sizeof(int32_t));
+        Sample.SafetyStatus = Detail::Load<uint32_t>(Bytes, Offset[2] + i * sizeof(uint32_t));
+        Sample.Voltage = Detail::Load<uint16_t>(Bytes, Offset[3] + i * sizeof(uint16_t));
+        Sample.Current = Detail::Load<int16_t>(Bytes, Offset[4] + i * sizeof(int16_t));
+        Sample.Temperature = Detail::Load<uint16_t>(Bytes, Offset[5] + i * sizeof(uint16_t));
+        Sample.RemainingCapacity = Detail::Load<uint16_t>(Bytes, Offset[6] + i * sizeof(uint16_t));
+        Sample.FullChargeCapacity = Detail::Load<uint16_t>(Bytes, Offset[7] + i * sizeof(uint16_t));
+        Sample.BatteryStatus = Detail::Load<uint16_t>(Bytes, Offset[8] + i * sizeof(uint16_t));
+    }
+
+    return Rows;
+}
+
+//
+// Serializes rows, in time order, into the file format.
+//
+
+inline std::vector<uint8_t> Serialize(const std::vector<Row>& Rows,
+                                      int64_t QpcFrequency,
+                                      uint32_t RowsPerChunk = DefaultRowsPerChunk)
+{
+    std::vector<uint8_t> Buffer;
+    std::vector<uint64_t> Footers;
+    FILE_HEADER Header = {};
+    CHUNK_COLUMN Columns[ColumnCount];
+
+    if (!Detail::IsLittleEndian())
+    {
+        throw std::runtime_error("big endian hosts are not supported");
+    }
+
+    if (RowsPerChunk == 0)
+    {
+        throw std::invalid_argument("RowsPerChunk must not be zero");
+    }
+
+    Buffer.resize(sizeof(Header));
+    for (uint32_t Column = 0; Column < ColumnCount; Column++)
+    {
+        Detail::Append(Buffer, COLUMN_DESCRIPTOR{ Column, static_cast<uint32_t>(ColumnTypes[Column]) });
+    }
+
+    for (size_t First = 0; First < Rows.size(); First += RowsPerChunk)
+    {
+        const size_t Count = std::min<size_t>(RowsPerChunk, Rows.size() - First);
+
+        for (uint32_t Column = 0; Column < ColumnCount; Column++)
+        {
+            Detail::Pad(Buffer, ChunkAlignment);
+            Columns[Column].Offset = Buffer.size();
+            Columns[Column].Min = std::numeric_limits<int64_t>::max();
+            Columns[Column].Max = std::numeric_limits<int64_t>::min();
+
+            for (size_t i = First; i < First + Count; i++)
+            {
+                const int64_t Value = Detail::RowValue(Rows[i], Column);
+
+                Columns[Column].Min = std::min(Columns[Column].Min, Value);
+                Columns[Column].Max = std::max(Columns[Column].Max, Value);
+                Detail::AppendValue(Buffer, ColumnTypes[Column], Value);
+            }
+        }
+
+        Detail::Pad(Buffer, ChunkAlignment);
+        Footers.push_back(Buffer.size());
+        Detail::Append(Buffer, CHUNK_FOOTER{ First, static_cast<uint32_t>(Count), ColumnCount });
+        for (const CHUNK_COLUMN& Entry : Columns)
+        {
+            Detail::Append(Buffer, Entry);
+        }
+    }
+
+    Detail::Pad(Buffer, sizeof(uint64_t));
+    std::memcpy(Header.Magic, FileMagic, sizeof(Header.Magic));
+    Header.SchemaVersion = SchemaVersion;
+    Header.HeaderSize = sizeof(Header);
+    Header.ColumnCount = ColumnCount;
+    Header.ChunkCount = static_cast<uint32_t>(Footers.size());
+    Header.RowsPerChunk = RowsPerChunk;
+    Header.RowCount = Rows.size();
+    Header.QpcFrequency = QpcFrequency;
+    Header.DirectoryOffset = Buffer.size();
+
+    for (uint64_t Footer : Footers)
+    {
+        Detail::Append(Buffer, Footer);
+    }
+
+    std::memcpy(Buffer.data(), &Header, sizeof(Header));
+    return Buffer;
+}
+
+//
+// Read only mapping of a whole file
+//
+
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string& Path)
+    {
+#if defined(_WIN32)
+        HANDLE File;
+        HANDLE Mapping;
+        LARGE_INTEGER FileSize;
+
+        File = CreateFileA(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (File == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("cannot open " + Path);
+        }
+
+        if (!GetFileSizeEx(File, &FileSize))
+        {
+            CloseHandle(File);
+            throw std::runtime_error("cannot size " + Path);
+        }
+
+        m_Size = static_cast<size_t>(FileSize.QuadPart);
+        if (m_Size != 0)
+        {
+            Mapping = CreateFileMappingA(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (Mapping != nullptr)
+            {
+                m_Data = static_cast<const uint8_t*>(MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(Mapping);
+            }
+        }
+
+        CloseHandle(File);
+#else
+        struct stat Status;
+        int File;
+        void* View;
+
+        File = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (File < 0)
+        {
+            throw std::runtime_error("cannot open " + Path);
+        }
+
+        if (fstat(File, &Status) != 0)
+        {
+            close(File);
+            throw std::runtime_error("cannot size " + Path);
+        }
+
+        m_Size = static_cast<size_t>(Status.st_size);
+        if (m_Size != 0)
+        {
+            View = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, File, 0);
+            if (View != MAP_FAILED)
+            {
+                m_Data = static_cast<const uint8_t*>(View);
+            }
+        }
+
+        close(File);
+#endif
+
+        if (m_Size != 0 && m_Data == nullptr)
+        {
+            throw std::runtime_error("cannot map " + Path);
+        }
+    }
+
+    ~MappedFile()
+    {
+        Unmap();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& Other) noexcept
+    {
+        *this = std::move(Other);
+    }
+
+    MappedFile& operator=(MappedFile&& Other) noexcept
+    {
+        if (this != &Other)
+        {
+            Unmap();
+            m_Data = std::exchange(Other.m_Data, nullptr);
+            m_Size = std::exchange(Other.m_Size, 0);
+        }
+
+        return *this;
+    }
+
+    const uint8_t* Data() const { return m_Data; }
+    size_t Size() const { return m_Size; }
+
+private:
+    void Unmap()
+    {
+        if (m_Data != nullptr)
+        {
+#if defined(_WIN32)
+            UnmapViewOfFile(m_Data);
+#else
+            munmap(const_cast<uint8_t*>(m_Data), m_Size);
+#endif
+            m_Data = nullptr;
+        }
+    }
+
+    const uint8_t* m_Data = nullptr;
+    size_t m_Size = 0;
+};
+
+//
+// Chunk of a file, as described by its footer
+//
+
+class Chunk
+{
+public:
+    Chunk(const uint8_t* Base, uint64_t FooterOffset)
+        : m_Base(Base), m_Footer(Detail::Load<CHUNK_FOOTER>(Base, FooterOffset)), m_Columns(FooterOffset + sizeof(CHUNK_FOOTER))
+    {
+    }
+
+    uint64_t FirstRow() const { return m_Footer.FirstRow; }
+    uint32_t RowCount() const { return m_Footer.RowCount; }
+
+    int64_t Min(ColumnId Column) const { return Entry(Column).Min; }
+    int64_t Max(ColumnId Column) const { return Entry(Column).Max; }
+
+    //
+    // True if the chunk may hold values of the column within [Low, High].
+    //
+
+    bool Overlaps(ColumnId Column, int64_t Low, int64_t High) const
+    {
+        const CHUNK_COLUMN Stats = Entry(Column);
+
+        return Stats.Max >= Low && Stats.Min <= High;
+    }
+
+    template <typename T>
+    ColumnView<T> Values(ColumnId Column) const
+    {
+        if (ColumnTypeOf<T>() != ColumnTypes[static_cast<uint32_t>(Column)])
+        {
+            throw std::invalid_argument("column type mismatch");
+        }
+
+        return ColumnView<T>(reinterpret_cast<const T*>(m_Base + Entry(Column).Offset), m_Footer.RowCount);
+    }
+
+private:
+    CHUNK_COLUMN Entry(ColumnId Column) const
+    {
+        return Detail::Load<CHUNK_COLUMN>(m_Base, m_Columns + static_cast<uint32_t>(Column) * sizeof(CHUNK_COLUMN));
+    }
+
+    const uint8_t* m_Base;
+    CHUNK_FOOTER m_Footer;
+    uint64_t m_Columns;
+};
+
+//
+// Reader of a mapped file. The constructor validates every offset of the
+// file once, the accessors then run without checks.
+//
+
+class Reader
+{
+public:
+    explicit Reader(const std::string& Path) : m_File(Path)
+    {
+        Validate();
+    }
+
+    uint64_t RowCount() const { return m_Header.RowCount; }
+    uint32_t ChunkCount() const { return m_Header.ChunkCount; }
+    int64_t QpcFrequency() const { return m_Header.QpcFrequency; }
+
+    Chunk GetChunk(uint32_t Index) const
+    {
+        return Chunk(m_File.Data(), FooterOffset(Index));
+    }
+
+    //
+    // Calls Callback for every chunk whose statistics overlap [Low, High]
+    // for the column, skipping the others without touching their values.
+    //
+
+    template <typename Callback>
+    void ForEachChunk(ColumnId Column, int64_t Low, int64_t High, Callback&& Function) const
+    {
+        for (uint32_t Index = 0; Index < m_Header.ChunkCount; Index++)
+        {
+            Chunk Current = GetChunk(Index);
+
+            if (Current.Overlaps(Column, Low, High))
+            {
+                Function(Current);
+            }
+        }
+    }
+
+private:
+    uint64_t FooterOffset(uint32_t Index) const
+    {
+        return Detail::Load<uint64_t>(m_File.Data(), m_Header.DirectoryOffset + Index * sizeof(uint64_t));
+    }
+
+    void Validate()
+    {
+        const uint64_t Size = m_File.Size();
+        const uint8_t* Base = m_File.Data();
+        uint64_t Rows = 0;
+
+        if (!Detail::IsLittleEndian())
+        {
+            throw std::runtime_error("big endian hosts are not supported");
+        }
+
+        if (Size < sizeof(m_Header))
+        {
+            throw std::runtime_error("file too short");
+        }
+
+        m_Header = Detail::Load<FILE_HEADER>(Base, 0);
+        if (std::memcmp(m_Header.Magic, FileMagic, sizeof(FileMagic)) != 0 ||
+            m_Header.SchemaVersion != SchemaVersion ||
+            m_Header.HeaderSize < sizeof(m_Header) ||
+            m_Header.ColumnCount < ColumnCount ||
+            m_Header.RowsPerChunk == 0)
+        {
+            throw std::runtime_error("not a telemetry file of a known version");
+        }
+
+        if (m_Header.DirectoryOffset > Size ||
+            static_cast<uint64_t>(m_Header.ChunkCount) * sizeof(uint64_t) > Size - m_Header.DirectoryOffset ||
+            m_Header.HeaderSize + static_cast<uint64_t>(m_Header.ColumnCount) * sizeof(COLUMN_DESCRIPTOR) > Size)
+        {
+            throw std::runtime_error("truncated file");
+        }
+
+        for (uint32_t Column = 0; Column < ColumnCount; Column++)
+        {
+            const COLUMN_DESCRIPTOR Descriptor =
+                Detail::Load<COLUMN_DESCRIPTOR>(Base, m_Header.HeaderSize + Column * sizeof(COLUMN_DESCRIPTOR));
+
+            if (Descriptor.Id != Column || Descriptor.Type != static_cast<uint32_t>(ColumnTypes[Column]))
+            {
+                throw std::runtime_error("unexpected column layout");
+            }
+        }
+
+        for (uint32_t Index = 0; Index < m_Header.ChunkCount; Index++)
+        {
+            const uint64_t Footer = FooterOffset(Index);
+            CHUNK_FOOTER Entry;
+
+            if (Footer > Size || sizeof(CHUNK_FOOTER) > Size - Footer)
+            {
+                throw std::runtime_error("chunk footer out of bounds");
+            }
+
+            Entry = Detail::Load<CHUNK_FOOTER>(Base, Footer);
+            if (Entry.ColumnCount != m_Header.ColumnCount ||
+                Entry.FirstRow != Rows ||
+                Entry.RowCount > m_Header.RowsPerChunk ||
+                static_cast<uint64_t>(Entry.ColumnCount) * sizeof(CHUNK_COLUMN) > Size - Footer - sizeof(CHUNK_FOOTER))
+            {
+                throw std::runtime_error("corrupt chunk footer");
+            }
+
+            for (uint32_t Column = 0; Column < ColumnCount; Column++)
+            {
+                const CHUNK_COLUMN Stats =
+                    Detail::Load<CHUNK_COLUMN>(Base, Footer + sizeof(CHUNK_FOOTER) + Column * sizeof(CHUNK_COLUMN));
+
+                const uint64_t Bytes = static_cast<uint64_t>(Entry.RowCount) * ColumnTypeSize(ColumnTypes[Column]);
+
+                if (Stats.Offset % ChunkAlignment != 0 || Stats.Offset > Size || Bytes > Size - Stats.Offset)
+                {
+                    throw std::runtime_error("chunk column out of bounds");
+                }
+            }
+
+            Rows += Entry.RowCount;
+        }
+
+        if (Rows != m_Header.RowCount)
+        {
+            throw std::runtime_error("row count mismatch");
+        }
+    }
+
+    MappedFile m_File;
+    FILE_HEADER m_Header = {};
+};
+
+} // namespace AstonTelemetry
@@ -0,0 +1,419 @@
+/*++
+
+Module Name:
+
+    AstonTelemetryFileTest.cpp
+
+Abstract:
+
+    This module checks AstonTelemetryFile.h: rows serialized and read back
+    through the mapped Reader come out unchanged, chunk by chunk, with
+    their min and max; range scans skip exactly the chunks whose statistics
+    fall outside the range; the Reader rejects every truncation of a file
+    and files with a corrupted header, descriptor or footer; and
+    ParseHistoryBlob rejects blobs whose columns do not fit.
+
+    N.B. This code is provided "AS IS" without any expressed or implied warranty.
+
+--*/
+
+//--------------------------------------------------------------------- Includes
+
+#include "AstonTelemetryFile.h"
+
+#include <cstdio>
+#include <functional>
+
+#include "Test.h"
+
+using namespace AstonTelemetry;
+
+//------------------------------------------------------------------ Definitions
+
+namespace
+{
+
+constexpr const char* FilePath = "AstonTelemetryFileTest.bin";
+constexpr int64_t QpcFrequency = 19200000;
+constexpr uint32_t RowsPerChunk = 1024;
+
+//
+// A slow discharge sampled every 5 s, with every column moving.
+//
+
+std::vector<Row> Generate(size_t Count)
+{
+    std::vector<Row> Rows(Count);
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        Row& Sample = Rows[i];
+
+        Sample.Timestamp = static_cast<int64_t>(i) * 5 * QpcFrequency + 12345;
+        Sample.Rate = -4000 - static_cast<int32_t>(i % 97) * 10;
+        Sample.SafetyStatus = (i % 500 == 0) ? 0x10 : 0;
+        Sample.Voltage = static_cast<uint16_t>(8400 - i / 8);
+        Sample.Current = static_cast<int16_t>(-500 - static_cast<int32_t>(i % 89));
+        Sample.Temperature = static_cast<uint16_t>(3000 + i % 61);
+        Sample.RemainingCapacity = static_cast<uint16_t>(9000 - i / 4);
+        Sample.FullChargeCapacity = 9000;
+        Sample.BatteryStatus = static_cast<uint16_t>(0x00C0 | (i % 3));
+    }
+
+    return Rows;
+}
+
+void WriteFile(const std::vector<uint8_t>& Bytes, size_t Length)
+{
+    FILE* File = std::fopen(FilePath, "wb");
+
+    CHECK(File != nullptr);
+    if (File != nullptr)
+    {
+        CHECK(std::fwrite(Bytes.data(), 1, Length, File) == Length);
+        std::fclose(File);
+    }
+}
+
+bool Rejected(const std::vector<uint8_t>& Bytes, size_t Length)
+{
+    WriteFile(Bytes, Length);
+
+    try
+    {
+        Reader File(FilePath);
+        return false;
+    }
+    catch (const std::runtime_error&)
+    {
+        return true;
+    }
+}
+
+bool Rejected(const std::vector<uint8_t>& Bytes, const std::function<void(std::vector<uint8_t>&)>& Corrupt)
+{
+    std::vector<uint8_t> Copy = Bytes;
+
+    Corrupt(Copy);
+    return Rejected(Copy, Copy.size());
+}
+
+template <typename T>
+void Store(std::vector<uint8_t>& Bytes, uint64_t Offset, T Value)
+{
+    std::memcpy(Bytes.data() + Offset, &Value, sizeof(Value));
+}
+
+FILE_HEADER LoadHeader(const std::vector<uint8_t>& Bytes)
+{
+    FILE_HEADER Header;
+
+    std::memcpy(&Header, Bytes.data(), sizeof(Header));
+    return Header;
+}
+
+uint64_t FooterOffset(const std::vector<uint8_t>& Bytes, uint32_t Index)
+{
+    uint64_t Offset;
+
+    std::memcpy(&Offset, Bytes.data() + LoadHeader(Bytes).DirectoryOffset + Index * sizeof(Offset), sizeof(Offset));
+    return Offset;
+}
+
+template <typename T>
+void CheckColumn(const Chunk& Current, ColumnId Column, const std::vector<Row>& Rows)
+{
+    const ColumnView<T> Values = Current.Values<T>(Column);
+    int64_t Min = std::numeric_limits<int64_t>::max();
+    int64_t Max = std::numeric_limits<int64_t>::min();
+    int64_t Expected;
+    uint32_t Mismatches = 0;
+
+    CHECK_EQ(Values.size(), Current.RowCount());
+    for (size_t i = 0; i < Values.size(); i++)
+    {
+        Expected = Detail::RowValue(Rows[Current.FirstRow() + i], static_cast<uint32_t>(Column));
+        Mismatches += (static_cast<int64_t>(Values[i]) != Expected);
+        Min = std::min(Min, Expected);
+        Max = std::max(Max, Expected);
+    }
+
+    CHECK_EQ(Mismatches, 0);
+    CHECK_EQ(Current.Min(Column), Min);
+    CHECK_EQ(Current.Max(Column), Max);
+}
+
+void TestRoundTrip()
+{
+    const std::vector<Row> Rows = Generate(10000);
+    const std::vector<uint8_t> Bytes = Serialize(Rows, QpcFrequency, RowsPerChunk);
+
+    WriteFile(Bytes, Bytes.size());
+
+    Reader File(FilePath);
+
+    CHECK_EQ(File.RowCount(), Rows.size());
+    CHECK_EQ(File.ChunkCount(), (Rows.size() + RowsPerChunk - 1) / RowsPerChunk);
+    CHECK_EQ(File.QpcFrequency(), QpcFrequency);
+
+    for (uint32_t Index = 0; Index < File.ChunkCount(); Index++)
+    {
+        const Chunk Current = File.GetChunk(Index);
+
+        CHECK_EQ(Current.FirstRow(), static_cast<uint64_t>(Index) * RowsPerChunk);
+        CHECK_EQ(Current.RowCount(), std::min<uint64_t>(RowsPerChunk, Rows.size() - Current.FirstRow()));
+        CHECK_EQ(reinterpret_cast<uintptr_t>(Current.Values<int64_t>(ColumnId::Timestamp).data()) % alignof(int64_t), 0);
+
+        CheckColumn<int64_t>(Current, ColumnId::Timestamp, Rows);
+        CheckColumn<int32_t>(Current, ColumnId::Rate, Rows);
+        CheckColumn<uint32_t>(Current, ColumnId::SafetyStatus, Rows);
+        CheckColumn<uint16_t>(Current, ColumnId::Voltage, Rows);
+        CheckColumn<int16_t>(Current, ColumnId::Current, Rows);
+        CheckColumn<uint16_t>(Current, ColumnId::Temperature, Rows);
+        CheckColumn<uint16_t>(Current, ColumnId::RemainingCapacity, Rows);
+        CheckColumn<uint16_t>(Current, ColumnId::FullChargeCapacity, Rows);
+        CheckColumn<uint16_t>(Current, ColumnId::BatteryStatus, Rows);
+    }
+
+    //
+    // The type of a column is part of the format.
+    //
+
+    bool Threw = false;
+
+    try
+    {
+        File.GetChunk(0).Values<int32_t>(ColumnId::Voltage);
+    }
+    catch (const std::invalid_argument&)
+    {
+        Threw = true;
+    }
+
+    CHECK(Threw);
+
+    //
+    // An empty history is a file without chunks.
+    //
+
+    const std::vector<uint8_t> Empty = Serialize({}, QpcFrequency, RowsPerChunk);
+
+    WriteFile(Empty, Empty.size());
+
+    Reader EmptyFile(FilePath);
+
+    CHECK_EQ(EmptyFile.RowCount(), 0);
+    CHECK_EQ(EmptyFile.ChunkCount(), 0);
+}
+
+void TestChunkSkipping()
+{
+    const std::vector<Row> Rows = Generate(10000);
+    const std::vector<uint8_t> Bytes = Serialize(Rows, QpcFrequency, RowsPerChunk);
+    std::vector<uint32_t> Visited;
+    int64_t Low;
+    int64_t High;
+
+    WriteFile(Bytes, Bytes.size());
+
+    Reader File(FilePath);
+
+    const auto Collect = [&](const Chunk& Current)
+    {
+        Visited.push_back(static_cast<uint32_t>(Current.FirstRow() / RowsPerChunk));
+    };
+
+    //
+    // A timestamp range from the middle of chunk 2 to the first row of
+    // chunk 4 visits chunks 2 to 4 only.
+    //
+
+    Low = Rows[2 * RowsPerChunk + 100].Timestamp;
+    High = Rows[4 * RowsPerChunk].Timestamp;
+    File.ForEachChunk(ColumnId::Timestamp, Low, High, Collect);
+    CHECK(Visited == (std::vector<uint32_t>{ 2, 3, 4 }));
+
+    //
+    // A range between the last row of a chunk and the first of the next
+    // touches neither, a range past every value touches none.
+    //
+
+    Visited.clear();
+    Low = Rows[RowsPerChunk - 1].Timestamp + 1;
+    High = Rows[RowsPerChunk].Timestamp - 1;
+    File.ForEachChunk(ColumnId::Timestamp, Low, High, Collect);
+    CHECK(Visited.empty());
+
+    File.ForEachChunk(ColumnId::Voltage, 8401, 65535, Collect);
+    CHECK(Visited.empty());
+
+    //
+    // The safety status is set in every chunk, the full charge capacity
+    // never moves.
+    //
+
+    File.ForEachChunk(ColumnId::SafetyStatus, 0x10, 0x10, Collect);
+    CHECK_EQ(Visited.size(), File.ChunkCount());
+
+    Visited.clear();
+    File.ForEachChunk(ColumnId::FullChargeCapacity, 9001, 9001, Collect);
+    CHECK(Visited.empty());
+}
+
+void TestRejected()
+{
+    constexpr uint32_t SmallChunk = 128;
+    const std::vector<Row> Rows = Generate(300);
+    const std::vector<uint8_t> Bytes = Serialize(Rows, QpcFrequency, SmallChunk);
+    const FILE_HEADER Header = LoadHeader(Bytes);
+    const uint64_t Footer = FooterOffset(Bytes, 1);
+    const uint64_t Columns = Footer + sizeof(CHUNK_FOOTER);
+    uint32_t Accepted = 0;
+
+    CHECK(!Rejected(Bytes, Bytes.size()));
+
+    //
+    // Every truncation, whether it cuts the header, the descriptors, the
+    // values, a footer or the directory.
+    //
+
+    for (size_t Length = 0; Length < Bytes.size(); Length++)
+    {
+        Accepted += !Rejected(Bytes, Length);
+    }
+
+    CHECK_EQ(Accepted, 0);
+
+    CHECK(Rejected(Bytes, [](std::vector<uint8_t>& File) { File[0] ^= 1; }));
+    CHECK(Rejected(Bytes, [](std::vector<uint8_t>& File) { Store<uint32_t>(File, offsetof(FILE_HEADER, SchemaVersion), SchemaVersion + 1); }));
+    CHECK(Rejected(Bytes, [](std::vector<uint8_t>& File) { Store<uint32_t>(File, offsetof(FILE_HEADER, HeaderSize), 16); }));
+    CHECK(Rejected(Bytes, [](std::vector<uint8_t>& File) { Store<uint32_t>(File, offsetof(FILE_HEADER, HeaderSize), 0xFFFFFFF0); }));
+    CHECK(Rejected(Bytes, [](std::vector<uint8_t>& File) { Store<uint32_t>(File, offsetof(FILE_HEADER, ColumnCount), ColumnCount - 1); }));
+    CHECK(Rejected(Bytes, [](std::vector<uint8_t>& File) { Store<uint32_t>(File, offsetof(FILE_HEADER, RowsPerChunk), 0); }));
+    CHECK(Rejected(Bytes, [](std::vector<uint8_t>& File) { Store<uint32_t>(File, offsetof(FILE_HEADER, RowsPerChunk), SmallChunk - 1); }));
+    CHECK(Rejected(Bytes, [](std::vector<uint8_t>& File) { Store<uint32_t>(File, offsetof(FILE_HEADER, ChunkCount), 0xFFFFFFFF); }));
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { Store<uint64_t>(File, offsetof(FILE_HEADER, RowCount), Rows.size() - 1); }));
+    CHECK(Rejected(Bytes, [](std::vector<uint8_t>& File) { Store<uint64_t>(File, offsetof(FILE_HEADER, DirectoryOffset), ~0ULL - 4); }));
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { Store<uint64_t>(File, offsetof(FILE_HEADER, DirectoryOffset), File.size() - 8); }));
+
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { File[Header.HeaderSize + 3 * sizeof(COLUMN_DESCRIPTOR)] ^= 1; }));
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { File[Header.HeaderSize + 3 * sizeof(COLUMN_DESCRIPTOR) + 4] ^= 1; }));
+
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { Store<uint64_t>(File, Header.DirectoryOffset + 8, File.size() - 4); }));
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { Store<uint64_t>(File, Header.DirectoryOffset + 8, ~0ULL - 8); }));
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { Store<uint64_t>(File, Footer + offsetof(CHUNK_FOOTER, FirstRow), SmallChunk + 1); }));
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { Store<uint32_t>(File, Footer + offsetof(CHUNK_FOOTER, RowCount), SmallChunk + 1); }));
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { Store<uint32_t>(File, Footer + offsetof(CHUNK_FOOTER, ColumnCount), ColumnCount + 1); }));
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { Store<uint64_t>(File, Columns + offsetof(CHUNK_COLUMN, Offset), 8); }));
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { Store<uint64_t>(File, Columns + offsetof(CHUNK_COLUMN, Offset), File.size() - ChunkAlignment); }));
+    CHECK(Rejected(Bytes, [&](std::vector<uint8_t>& File) { Store<uint64_t>(File, Columns + offsetof(CHUNK_COLUMN, Offset), ~0ULL - 63); }));
+
+    std::remove(FilePath);
+}
+
+std::vector<uint8_t> BuildBlob(const std::vector<Row>& Rows)
+{
+    HISTORY_BLOB_HEADER Header = {};
+    std::vector<uint8_t> Blob;
+    uint32_t Offset = sizeof(Header);
+
+    Header.Version = 1;
+    Header.Capacity = 4096;
+    Header.Count = static_cast<uint32_t>(Rows.size());
+    Header.TotalSamples = Rows.size() + 100;
+    Header.QpcFrequency = QpcFrequency;
+
+    for (uint32_t Column = 0; Column < ColumnCount; Column++)
+    {
+        Header.ColumnOffset[Column] = Offset;
+        Offset += Header.Count * static_cast<uint32_t>(ColumnTypeSize(ColumnTypes[Column]));
+    }
+
+    Header.Size = Offset;
+    Blob.resize(sizeof(Header));
+    std::memcpy(Blob.data(), &Header, sizeof(Header));
+
+    for (uint32_t Column = 0; Column < ColumnCount; Column++)
+    {
+        for (const Row& Sample : Rows)
+        {
+            Detail::AppendValue(Blob, ColumnTypes[Column], Detail::RowValue(Sample, Column));
+        }
+    }
+
+    return Blob;
+}
+
+bool BlobRejected(std::vector<uint8_t> Blob, size_t Length, const std::function<void(HISTORY_BLOB_HEADER&)>& Corrupt)
+{
+    HISTORY_BLOB_HEADER Header;
+
+    std::memcpy(&Header, Blob.data(), sizeof(Header));
+    Corrupt(Header);
+    std::memcpy(Blob.data(), &Header, sizeof(Header));
+
+    try
+    {
+        ParseHistoryBlob(Blob.data(), Length);
+        return false;
+    }
+    catch (const std::runtime_error&)
+    {
+        return true;
+    }
+}
+
+void TestHistoryBlob()
+{
+    const std::vector<Row> Rows = Generate(700);
+    const std::vector<uint8_t> Blob = BuildBlob(Rows);
+    const auto Keep = [](HISTORY_BLOB_HEADER&) {};
+    int64_t Frequency = 0;
+    uint32_t Mismatches = 0;
+
+    const std::vector<Row> Parsed = ParseHistoryBlob(Blob.data(), Blob.size(), &Frequency);
+
+    CHECK_EQ(Parsed.size(), Rows.size());
+    CHECK_EQ(Frequency, QpcFrequency);
+    for (size_t i = 0; i < std::min(Parsed.size(), Rows.size()); i++)
+    {
+        for (uint32_t Column = 0; Column < ColumnCount; Column++)
+        {
+            Mismatches += Detail::RowValue(Parsed[i], Column) != Detail::RowValue(Rows[i], Column);
+        }
+    }
+
+    CHECK_EQ(Mismatches, 0);
+
+    //
+    // A blob longer than Size is fine, the driver returns the header alone
+    // when the columns do not fit and the count may be zero.
+    //
+
+    CHECK(!BlobRejected(Blob, Blob.size(), Keep));
+    CHECK(!BlobRejected(Blob, Blob.size(), [](HISTORY_BLOB_HEADER& Header) { Header.Count = 0; }));
+    CHECK(ParseHistoryBlob(BuildBlob({}).data(), sizeof(HISTORY_BLOB_HEADER)).empty());
+
+    CHECK(BlobRejected(Blob, sizeof(HISTORY_BLOB_HEADER) - 1, Keep));
+    CHECK(BlobRejected(Blob, Blob.size() - 1, Keep));
+    CHECK(BlobRejected(Blob, Blob.size(), [](HISTORY_BLOB_HEADER& Header) { Header.Version = 2; }));
+    CHECK(BlobRejected(Blob, Blob.size(), [](HISTORY_BLOB_HEADER& Header) { Header.Count += 1; }));
+    CHECK(BlobRejected(Blob, Blob.size(), [](HISTORY_BLOB_HEADER& Header) { Header.Count = 0xFFFFFFFF; }));
+    CHECK(BlobRejected(Blob, Blob.size(), [](HISTORY_BLOB_HEADER& Header) { Header.ColumnOffset[8] += 2; }));
+    CHECK(BlobRejected(Blob, Blob.size(), [](HISTORY_BLOB_HEADER& Header) { Header.ColumnOffset[0] = Header.Size + 1; }));
+    CHECK(BlobRejected(Blob, Blob.size(), [](HISTORY_BLOB_HEADER& Header) { Header.ColumnOffset[0] = 0xFFFFFFF8; }));
+}
+
+} // namespace
+
+//-------------------------------------------------------------------- Functions
+
+int main()
+{
+    TestRoundTrip();
+    TestChunkSkipping();
+    TestRejected();
+    TestHistoryBlob();
+
+    return TEST_RESULT();
+}